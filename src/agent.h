@@ -50,6 +50,10 @@ void proxy_stats_dump_basic(ADD_STAT add_stats, conn *c,
                             const char *prefix);
 void proxy_stats_dump_proxy_main(ADD_STAT add_stats, conn *c,
                                  struct proxy_stats_cmd_info *pscip);
+void proxy_stats_dump_resolve(ADD_STAT add_stats, conn *c,
+                              const char *prefix);
+void proxy_stats_dump_breakers(ADD_STAT add_stats, conn *c,
+                               const char *prefix);
 void proxy_stats_dump_proxies(ADD_STAT add_stats, conn *c,
                               struct proxy_stats_cmd_info *pscip);
 void proxy_stats_dump_timings(ADD_STAT add_stats, conn *c);
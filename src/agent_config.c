@@ -1221,6 +1221,8 @@ void cproxy_on_config_pool(proxy_main *m,
                             p->port, p->name, p->config, n);
                 }
                 m->stat_proxy_starts++;
+
+                cproxy_prewarm(p);
             } else {
                 if (settings.verbose > 1) {
                     moxi_log_write("ERROR: cproxy_listen failed on %u to %s\n",
@@ -1251,6 +1253,7 @@ void cproxy_on_config_pool(proxy_main *m,
         mcache_stop(&p->front_cache);
         matcher_stop(&p->front_cache_matcher);
         matcher_stop(&p->front_cache_unmatcher);
+        matcher_stop(&p->front_cache_miss_matcher);
 
         matcher_stop(&p->optimize_set_matcher);
 
@@ -1274,6 +1277,21 @@ void cproxy_on_config_pool(proxy_main *m,
                                    &behavior_pool->base) == false) ||
             changed;
 
+        /* The front_cache is only sharded when the proxy's created, */
+        /* as the worker threads reach its shards without a lock, */
+        /* so a new front_cache_shards waits for a restart. */
+
+        if (p->behavior_pool.base.front_cache_shards !=
+            behavior_pool->base.front_cache_shards) {
+            moxi_log_write("front_cache_shards change from %u to %u"
+                           " on port %d needs a restart\n",
+                           p->behavior_pool.base.front_cache_shards,
+                           behavior_pool->base.front_cache_shards,
+                           p->port);
+            behavior_pool->base.front_cache_shards =
+                p->behavior_pool.base.front_cache_shards;
+        }
+
         p->behavior_pool.base = behavior_pool->base;
 
         changed =
@@ -1309,6 +1327,13 @@ void cproxy_on_config_pool(proxy_main *m,
         if (shutdown_flag == false) {
             if (behavior_pool->base.front_cache_max > 0 &&
                 behavior_pool->base.front_cache_lifespan > 0) {
+                mcache_max_bytes(&p->front_cache,
+                                 behavior_pool->base.front_cache_max_bytes,
+                                 behavior_pool->base.front_cache_max_item_bytes);
+                mcache_grace(&p->front_cache,
+                             behavior_pool->base.front_cache_grace);
+                mcache_admission(&p->front_cache,
+                                 behavior_pool->base.front_cache_admission > 0);
                 mcache_start(&p->front_cache,
                              behavior_pool->base.front_cache_max);
 
@@ -1321,6 +1346,11 @@ void cproxy_on_config_pool(proxy_main *m,
                     matcher_start(&p->front_cache_unmatcher,
                                   behavior_pool->base.front_cache_unspec);
                 }
+
+                if (strlen(behavior_pool->base.front_cache_miss_spec) > 0) {
+                    matcher_start(&p->front_cache_miss_matcher,
+                                  behavior_pool->base.front_cache_miss_spec);
+                }
             }
 
             if (strlen(behavior_pool->base.optimize_set) > 0) {
@@ -1345,6 +1375,14 @@ void cproxy_on_config_pool(proxy_main *m,
             }
         }
 
+        /* Queued after the update_ptd_config's, so the worker */
+        /* threads pre-warm against the new config. */
+
+        if (changed &&
+            shutdown_flag == false) {
+            cproxy_prewarm(p);
+        }
+
         cb_mutex_exit(&m->proxy_main_lock);
 
         if (settings.verbose > 2) {
@@ -32,6 +32,7 @@ static void add_stat_prefix_ase(const char *key, const uint16_t klen,
                                 const void *cookie);
 
 static void main_stats_collect(void *data0, void *data1);
+static bool main_stats_snapshots_on(proxy_main *m);
 static void work_stats_collect(void *data0, void *data1);
 
 static void main_stats_reset(void *data0, void *data1);
@@ -113,6 +114,9 @@ struct main_stats_collect_info {
     struct main_stats_proxy_info *proxies;
 };
 
+static void main_stats_collect_snapshots(struct main_stats_collect_info *msci);
+static void main_stats_collect_memcached(struct main_stats_collect_info *msci);
+
 static char *cmd_names[] = { /* Keep sync'ed with enum_stats_cmd. */
     "get",
     "get_key",
@@ -283,6 +287,19 @@ enum conflate_mgmt_cb_result on_conflate_get_stats(void *userdata,
                   (uint64_t) m->stat_proxy_existings);
         more_stat("%"PRIu64, "main_proxy_shutdowns",
                   (uint64_t) m->stat_proxy_shutdowns);
+
+        {
+            mcs_resolve_stats rs;
+            mcs_resolve_stats_get(&rs);
+
+            more_stat("%"PRIu64, "main_resolve_hits", rs.hits);
+            more_stat("%"PRIu64, "main_resolve_hits_stale", rs.hits_stale);
+            more_stat("%"PRIu64, "main_resolve_misses", rs.misses);
+            more_stat("%"PRIu64, "main_resolves", rs.resolves);
+            more_stat("%"PRIu64, "main_resolve_errors", rs.resolve_errors);
+            more_stat("%"PRIu64, "main_resolve_usec_tot", rs.resolve_usec_tot);
+            more_stat("%"PRIu64, "main_resolve_usec_max", rs.resolve_usec_max);
+        }
     }
 
 #undef more_stat
@@ -301,6 +318,16 @@ enum conflate_mgmt_cb_result on_conflate_get_stats(void *userdata,
         server_stats(add_stat_prefix_ase, &ase, NULL);
     }
 
+    /* When the workers publish stats snapshots, merge those here, */
+    /* instead of waiting on every worker thread. */
+
+    if (main_stats_snapshots_on(m)) {
+        main_stats_collect_snapshots(&msci);
+        main_stats_collect_memcached(&msci);
+
+        return RV_OK;
+    }
+
     /* Alloc here so the main listener thread has less work. */
 
     ca = calloc(m->nthreads, sizeof(work_collect));
@@ -377,13 +404,7 @@ enum conflate_mgmt_cb_result on_conflate_get_stats(void *userdata,
             }
         }
 
-        for (i = 0; i < msci.nproxy; i++) {
-            collect_memcached_stats_for_proxy(&msci,
-                                              msci.proxies[i].name,
-                                              msci.proxies[i].port);
-            free(msci.proxies[i].name);
-        }
-        free(msci.proxies);
+        main_stats_collect_memcached(&msci);
 
         for (i = 1; i < m->nthreads; i++) {
             genhash_t *map_key_stats;
@@ -411,6 +432,21 @@ enum conflate_mgmt_cb_result on_conflate_get_stats(void *userdata,
     return RV_OK;
 }
 
+static void main_stats_collect_memcached(struct main_stats_collect_info *msci) {
+    int i;
+
+    for (i = 0; i < msci->nproxy; i++) {
+        collect_memcached_stats_for_proxy(msci,
+                                          msci->proxies[i].name,
+                                          msci->proxies[i].port);
+        free(msci->proxies[i].name);
+    }
+    free(msci->proxies);
+
+    msci->proxies = NULL;
+    msci->nproxy = 0;
+}
+
 void map_pstd_foreach_merge(const void *key,
                             const void *value,
                             void *user_data) {
@@ -464,6 +500,30 @@ static void proxy_stats_dump_behavior(ADD_STAT add_stats,
     if (level >= 1) {
         APPEND_PREFIX_STAT("downstream_max", "%u", b->downstream_max);
         APPEND_PREFIX_STAT("downstream_conn_max", "%u", b->downstream_conn_max);
+        APPEND_PREFIX_STAT("downstream_conn_multiplex", "%u",
+                           b->downstream_conn_multiplex);
+        APPEND_PREFIX_STAT("downstream_conn_coalesce", "%u",
+                           b->downstream_conn_coalesce);
+        APPEND_PREFIX_STAT("downstream_conn_prewarm", "%u",
+                           b->downstream_conn_prewarm);
+        APPEND_PREFIX_STAT("downstream_conn_probe_interval", "%u",
+                           b->downstream_conn_probe_interval);
+        APPEND_PREFIX_STAT("downstream_conn_idle_max", "%u",
+                           b->downstream_conn_idle_max);
+        APPEND_PREFIX_STAT("hedge_get_percentile", "%u",
+                           b->hedge_get_percentile);
+        APPEND_PREFIX_STAT("coalesce_get", "%u",
+                           b->coalesce_get);
+        APPEND_PREFIX_STAT("stream_min_bytes", "%u",
+                           b->stream_min_bytes);
+        APPEND_PREFIX_STAT("stream_splice", "%u",
+                           b->stream_splice);
+        APPEND_PREFIX_STAT("pipeline_max", "%u",
+                           b->pipeline_max);
+        APPEND_PREFIX_STAT("listen_reuseport", "%u",
+                           b->listen_reuseport);
+        APPEND_PREFIX_STAT("stats_snapshot_interval", "%u",
+                           b->stats_snapshot_interval);
     }
 
     APPEND_PREFIX_STAT("downstream_weight",   "%u", b->downstream_weight);
@@ -490,10 +550,18 @@ static void proxy_stats_dump_behavior(ADD_STAT add_stats,
         APPEND_PREFIX_STAT("time_stats", "%d", b->time_stats);
         APPEND_PREFIX_STAT("connect_max_errors", "%d", b->connect_max_errors);
         APPEND_PREFIX_STAT("connect_retry_interval", "%d", b->connect_retry_interval);
+        APPEND_PREFIX_STAT("connect_retry_interval_max", "%d", b->connect_retry_interval_max);
         APPEND_PREFIX_STAT("front_cache_max", "%u", b->front_cache_max);
+        APPEND_PREFIX_STAT("front_cache_shards", "%u", b->front_cache_shards);
+        APPEND_PREFIX_STAT("front_cache_max_bytes", "%"PRIu64, b->front_cache_max_bytes);
+        APPEND_PREFIX_STAT("front_cache_max_item_bytes", "%u", b->front_cache_max_item_bytes);
+        APPEND_PREFIX_STAT("front_cache_admission", "%u", b->front_cache_admission);
         APPEND_PREFIX_STAT("front_cache_lifespan", "%u", b->front_cache_lifespan);
+        APPEND_PREFIX_STAT("front_cache_grace", "%u", b->front_cache_grace);
         APPEND_PREFIX_STAT("front_cache_spec", "%s", b->front_cache_spec);
         APPEND_PREFIX_STAT("front_cache_unspec", "%s", b->front_cache_unspec);
+        APPEND_PREFIX_STAT("front_cache_miss_lifespan", "%u", b->front_cache_miss_lifespan);
+        APPEND_PREFIX_STAT("front_cache_miss_spec", "%s", b->front_cache_miss_spec);
         APPEND_PREFIX_STAT("key_stats_max", "%u", b->key_stats_max);
         APPEND_PREFIX_STAT("key_stats_lifespan", "%u", b->key_stats_lifespan);
         APPEND_PREFIX_STAT("key_stats_spec", "%s", b->key_stats_spec);
@@ -512,38 +580,100 @@ static void proxy_stats_dump_behavior(ADD_STAT add_stats,
     }
 }
 
-static void proxy_stats_dump_frontcache(ADD_STAT add_stats, conn *c,
-                                        const char *prefix, proxy *p) {
-    cb_mutex_enter(p->front_cache.lock);
+/* The estimated change in hit ratio due to the admission filter, */
+/* from the hits on victims that a rejection kept, less the misses */
+/* on the items that were rejected. */
 
-    if (p->front_cache.map != NULL) {
-        APPEND_PREFIX_STAT("size", "%u", genhash_size(p->front_cache.map));
+static double mcache_stats_admit_hit_ratio_delta(mcache_stats *ms) {
+    uint64_t gets = ms->tot_get_hits + ms->tot_get_expires + ms->tot_get_misses;
+    if (gets == 0) {
+        return 0.0;
     }
 
-    APPEND_PREFIX_STAT("max", "%u", p->front_cache.max);
-    APPEND_PREFIX_STAT("oldest_live", "%u", p->front_cache.oldest_live);
+    return ((double) ms->tot_admit_protected_hits -
+            (double) ms->tot_admit_rejected_misses) / (double) gets;
+}
+
+static void proxy_stats_dump_mcache_stats(ADD_STAT add_stats, conn *c,
+                                          const char *prefix,
+                                          mcache_stats *ms,
+                                          bool started) {
+    if (started) {
+        APPEND_PREFIX_STAT("size", "%u", ms->size);
+        APPEND_PREFIX_STAT("curr_bytes", "%"PRIu64, ms->curr_bytes);
+    }
+
+    APPEND_PREFIX_STAT("max", "%u", ms->max);
+    APPEND_PREFIX_STAT("max_bytes", "%"PRIu64, ms->max_bytes);
+    APPEND_PREFIX_STAT("oldest_live", "%u", ms->oldest_live);
     APPEND_PREFIX_STAT("tot_get_hits",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_get_hits);
+           "%"PRIu64, (uint64_t) ms->tot_get_hits);
+    APPEND_PREFIX_STAT("tot_get_stale_hits",
+           "%"PRIu64, (uint64_t) ms->tot_get_stale_hits);
+    APPEND_PREFIX_STAT("tot_get_refreshes",
+           "%"PRIu64, (uint64_t) ms->tot_get_refreshes);
     APPEND_PREFIX_STAT("tot_get_expires",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_get_expires);
+           "%"PRIu64, (uint64_t) ms->tot_get_expires);
     APPEND_PREFIX_STAT("tot_get_misses",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_get_misses);
+           "%"PRIu64, (uint64_t) ms->tot_get_misses);
     APPEND_PREFIX_STAT("tot_get_bytes",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_get_bytes);
+           "%"PRIu64, (uint64_t) ms->tot_get_bytes);
     APPEND_PREFIX_STAT("tot_adds",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_adds);
+           "%"PRIu64, (uint64_t) ms->tot_adds);
     APPEND_PREFIX_STAT("tot_add_skips",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_add_skips);
+           "%"PRIu64, (uint64_t) ms->tot_add_skips);
     APPEND_PREFIX_STAT("tot_add_fails",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_add_fails);
+           "%"PRIu64, (uint64_t) ms->tot_add_fails);
     APPEND_PREFIX_STAT("tot_add_bytes",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_add_bytes);
+           "%"PRIu64, (uint64_t) ms->tot_add_bytes);
+    APPEND_PREFIX_STAT("tot_add_too_large",
+           "%"PRIu64, (uint64_t) ms->tot_add_too_large);
     APPEND_PREFIX_STAT("tot_deletes",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_deletes);
+           "%"PRIu64, (uint64_t) ms->tot_deletes);
     APPEND_PREFIX_STAT("tot_evictions",
-           "%"PRIu64, (uint64_t) p->front_cache.tot_evictions);
+           "%"PRIu64, (uint64_t) ms->tot_evictions);
+    APPEND_PREFIX_STAT("tot_admits",
+           "%"PRIu64, (uint64_t) ms->tot_admits);
+    APPEND_PREFIX_STAT("tot_admit_rejects",
+           "%"PRIu64, (uint64_t) ms->tot_admit_rejects);
+    APPEND_PREFIX_STAT("tot_admit_protected_hits",
+           "%"PRIu64, (uint64_t) ms->tot_admit_protected_hits);
+    APPEND_PREFIX_STAT("tot_admit_rejected_misses",
+           "%"PRIu64, (uint64_t) ms->tot_admit_rejected_misses);
+    APPEND_PREFIX_STAT("admit_hit_ratio_delta",
+           "%.4f", mcache_stats_admit_hit_ratio_delta(ms));
+}
+
+/* Emits the front cache stats merged across its shards, and then, */
+/* when there's more than one shard, each shard's own stats under a */
+/* "shard_N:" prefix, to help spot a hot shard. */
+
+static void proxy_stats_dump_frontcache(ADD_STAT add_stats, conn *c,
+                                        const char *prefix, proxy *p) {
+    uint32_t nshards = mcache_num_shards(&p->front_cache);
+    bool started = mcache_started(&p->front_cache);
+    mcache_stats ms;
+    uint32_t i;
+
+    mcache_get_stats(&p->front_cache, -1, &ms);
+
+    APPEND_PREFIX_STAT("shards", "%u", nshards);
+
+    proxy_stats_dump_mcache_stats(add_stats, c, prefix, &ms, started);
+
+    if (nshards > 1) {
+        char shard_prefix[220];
 
-    cb_mutex_exit(p->front_cache.lock);
+        for (i = 0; i < nshards; i++) {
+            snprintf(shard_prefix, sizeof(shard_prefix), "%sshard_%u:",
+                     prefix, i);
+
+            mcache_get_stats(&p->front_cache, (int) i, &ms);
+
+            proxy_stats_dump_mcache_stats(add_stats, c, shard_prefix,
+                                          &ms, started);
+        }
+    }
 }
 
 static void proxy_stats_dump_pstd_stats(ADD_STAT add_stats,
@@ -593,6 +723,8 @@ static void proxy_stats_dump_pstd_stats(ADD_STAT add_stats,
               "%"PRIu64, (uint64_t) pstats->tot_downstream_connect_interval);
     APPEND_PREFIX_STAT("tot_downstream_connect_max_reached",
               "%"PRIu64, (uint64_t) pstats->tot_downstream_connect_max_reached);
+    APPEND_PREFIX_STAT("tot_downstream_connect_unresolved",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_connect_unresolved);
     APPEND_PREFIX_STAT("tot_downstream_waiting_errors",
               "%"PRIu64, (uint64_t) pstats->tot_downstream_waiting_errors);
     APPEND_PREFIX_STAT("tot_downstream_auth",
@@ -613,6 +745,50 @@ static void proxy_stats_dump_pstd_stats(ADD_STAT add_stats,
               "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_queue_add);
     APPEND_PREFIX_STAT("tot_downstream_conn_queue_remove",
               "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_queue_remove);
+    APPEND_PREFIX_STAT("tot_downstream_mux_conn",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_mux_conn);
+    APPEND_PREFIX_STAT("tot_downstream_mux_request",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_mux_request);
+    APPEND_PREFIX_STAT("tot_downstream_mux_orphan",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_mux_orphan);
+    APPEND_PREFIX_STAT("tot_downstream_mux_batch",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_mux_batch);
+    APPEND_PREFIX_STAT("tot_downstream_mux_batch_requests",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_mux_batch_requests);
+    APPEND_PREFIX_STAT("avg_downstream_mux_batch",
+              "%.3f", pstats->tot_downstream_mux_batch > 0 ?
+              (double) pstats->tot_downstream_mux_batch_requests /
+              (double) pstats->tot_downstream_mux_batch : 0.0);
+    APPEND_PREFIX_STAT("num_downstream_conn_prewarm",
+              "%"PRIu64, (uint64_t) pstats->num_downstream_conn_prewarm);
+    APPEND_PREFIX_STAT("tot_downstream_conn_prewarm",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_prewarm);
+    APPEND_PREFIX_STAT("tot_downstream_conn_prewarm_failed",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_prewarm_failed);
+    APPEND_PREFIX_STAT("tot_downstream_conn_probe",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_probe);
+    APPEND_PREFIX_STAT("tot_downstream_conn_probe_failed",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_probe_failed);
+    APPEND_PREFIX_STAT("tot_downstream_conn_idle_closed",
+              "%"PRIu64, (uint64_t) pstats->tot_downstream_conn_idle_closed);
+    APPEND_PREFIX_STAT("tot_hedge_get",
+              "%"PRIu64, (uint64_t) pstats->tot_hedge_get);
+    APPEND_PREFIX_STAT("tot_hedge_get_win",
+              "%"PRIu64, (uint64_t) pstats->tot_hedge_get_win);
+    APPEND_PREFIX_STAT("tot_hedge_get_wasted",
+              "%"PRIu64, (uint64_t) pstats->tot_hedge_get_wasted);
+    APPEND_PREFIX_STAT("tot_hedge_get_skipped",
+              "%"PRIu64, (uint64_t) pstats->tot_hedge_get_skipped);
+    APPEND_PREFIX_STAT("tot_get_coalesced",
+              "%"PRIu64, (uint64_t) pstats->tot_get_coalesced);
+    APPEND_PREFIX_STAT("tot_stream_values",
+              "%"PRIu64, (uint64_t) pstats->tot_stream_values);
+    APPEND_PREFIX_STAT("tot_stream_bytes",
+              "%"PRIu64, (uint64_t) pstats->tot_stream_bytes);
+    APPEND_PREFIX_STAT("tot_stream_splice_bytes",
+              "%"PRIu64, (uint64_t) pstats->tot_stream_splice_bytes);
+    APPEND_PREFIX_STAT("tot_pipelined_gets",
+              "%"PRIu64, (uint64_t) pstats->tot_pipelined_gets);
     APPEND_PREFIX_STAT("tot_downstream_timeout",
               "%"PRIu64, (uint64_t) pstats->tot_downstream_timeout);
     APPEND_PREFIX_STAT("tot_wait_queue_timeout",
@@ -633,6 +809,10 @@ static void proxy_stats_dump_pstd_stats(ADD_STAT add_stats,
               "%"PRIu64, (uint64_t) pstats->tot_multiget_keys_dedupe);
     APPEND_PREFIX_STAT("tot_multiget_bytes_dedupe",
               "%"PRIu64, (uint64_t) pstats->tot_multiget_bytes_dedupe);
+    APPEND_PREFIX_STAT("tot_front_cache_miss_hits",
+              "%"PRIu64, (uint64_t) pstats->tot_front_cache_miss_hits);
+    APPEND_PREFIX_STAT("tot_front_cache_miss_adds",
+              "%"PRIu64, (uint64_t) pstats->tot_front_cache_miss_adds);
     APPEND_PREFIX_STAT("tot_optimize_sets",
               "%"PRIu64, (uint64_t) pstats->tot_optimize_sets);
     APPEND_PREFIX_STAT("tot_retry",
@@ -791,9 +971,97 @@ void proxy_stats_dump_proxy_main(ADD_STAT add_stats, conn *c,
                     "%"PRIu64, (uint64_t) pm->stat_proxy_existings);
         APPEND_PREFIX_STAT("stat_proxy_shutdowns",
                     "%"PRIu64, (uint64_t) pm->stat_proxy_shutdowns);
+
+        proxy_stats_dump_resolve(add_stats, c, prefix);
+        proxy_stats_dump_breakers(add_stats, c, "proxy_main:breaker:");
     }
 }
 
+void proxy_stats_dump_resolve(ADD_STAT add_stats, conn *c,
+                              const char *prefix) {
+    mcs_resolve_stats rs;
+
+    mcs_resolve_stats_get(&rs);
+
+    APPEND_PREFIX_STAT("stat_resolve_hits",
+                "%"PRIu64, rs.hits);
+    APPEND_PREFIX_STAT("stat_resolve_hits_stale",
+                "%"PRIu64, rs.hits_stale);
+    APPEND_PREFIX_STAT("stat_resolve_misses",
+                "%"PRIu64, rs.misses);
+    APPEND_PREFIX_STAT("stat_resolve_hit_rate",
+                "%.3f", (rs.hits + rs.misses) > 0 ?
+                (double) rs.hits / (double) (rs.hits + rs.misses) : 0.0);
+    APPEND_PREFIX_STAT("stat_resolves",
+                "%"PRIu64, rs.resolves);
+    APPEND_PREFIX_STAT("stat_resolve_errors",
+                "%"PRIu64, rs.resolve_errors);
+    APPEND_PREFIX_STAT("stat_resolve_usec_avg",
+                "%"PRIu64, rs.resolves > 0 ?
+                rs.resolve_usec_tot / rs.resolves : 0);
+    APPEND_PREFIX_STAT("stat_resolve_usec_max",
+                "%"PRIu64, rs.resolve_usec_max);
+}
+
+struct proxy_stats_dump_breaker_arg {
+    ADD_STAT    add_stats;
+    conn       *c;
+    const char *prefix;
+};
+
+static void proxy_stats_dump_breaker(const breaker_info *info,
+                                     void *userdata) {
+    struct proxy_stats_dump_breaker_arg *arg = userdata;
+    ADD_STAT add_stats = arg->add_stats;
+    conn *c = arg->c;
+    const char *state;
+    char prefix[200];
+    char *p;
+
+    /* Clip the host_ident to host:port:usr, to not show the pswd. */
+
+    snprintf(prefix, sizeof(prefix) - 1, "%s%s", arg->prefix, info->host_ident);
+    prefix[sizeof(prefix) - 1] = '\0';
+
+    p = prefix + strlen(arg->prefix);
+    p = strchr(p, ':');
+    if (p != NULL) {
+        p = strchr(p + 1, ':');
+    }
+    if (p != NULL) {
+        p = strchr(p + 1, ':');
+    }
+    if (p != NULL) {
+        p[1] = '\0';
+    } else {
+        strcat(prefix, ":");
+    }
+
+    switch (info->state) {
+    case BREAKER_OPEN:      state = "open";      break;
+    case BREAKER_HALF_OPEN: state = "half_open"; break;
+    default:                state = "closed";    break;
+    }
+
+    APPEND_PREFIX_STAT("state", "%s", state);
+    APPEND_PREFIX_STAT("errors", "%u", info->errors);
+    APPEND_PREFIX_STAT("trips", "%u", info->trips);
+    APPEND_PREFIX_STAT("open_msecs", "%"PRIu64, info->open_msecs);
+    APPEND_PREFIX_STAT("tot_trips", "%"PRIu64, info->tot_trips);
+    APPEND_PREFIX_STAT("tot_fast_fails", "%"PRIu64, info->tot_fast_fails);
+}
+
+void proxy_stats_dump_breakers(ADD_STAT add_stats, conn *c,
+                               const char *prefix) {
+    struct proxy_stats_dump_breaker_arg arg;
+
+    arg.add_stats = add_stats;
+    arg.c = c;
+    arg.prefix = prefix;
+
+    cproxy_breaker_visit(proxy_stats_dump_breaker, &arg);
+}
+
 void xpassword(char *p) {
     /* X out passwords in input string. */
     /* Example: ..."nodeLocator": "vbucket", "saslPassword": "test", "nodes":... */
@@ -925,7 +1193,17 @@ void proxy_stats_dump_proxies(ADD_STAT add_stats, conn *c,
                 cb_mutex_enter(&p->proxy_lock);
                 for (i = 1; i < pm->nthreads; i++) {
                     proxy_td *thread_ptd = &p->thread_data[i];
-                    if (thread_ptd != NULL) {
+                    if (thread_ptd == NULL) {
+                        continue;
+                    }
+                    if (p->behavior_pool.base.stats_snapshot_interval > 0) {
+                        cb_mutex_enter(&thread_ptd->snapshot_lock);
+                        if (thread_ptd->snapshot.version > 0) {
+                            add_proxy_stats_td(pstd,
+                                               &thread_ptd->snapshot.stats);
+                        }
+                        cb_mutex_exit(&thread_ptd->snapshot_lock);
+                    } else {
                         add_proxy_stats_td(pstd, &thread_ptd->stats);
                     }
                 }
@@ -977,34 +1255,18 @@ void proxy_stats_dump_proxies(ADD_STAT add_stats, conn *c,
     cb_mutex_exit(&pm->proxy_main_lock);
 }
 
-/* Must be invoked on the main listener thread.
- *
- * Puts stats gathering work on every worker thread's work_queue.
- */
-static void main_stats_collect(void *data0, void *data1) {
-    struct main_stats_collect_info *msci = data0;
-    proxy_main *m;
-    work_collect *ca;
+/* Emits each proxy's info, settings and front cache stats, */
+/* returning the number of proxies. */
+
+static int main_stats_collect_proxies(struct main_stats_collect_info *msci) {
+    proxy_main *m = msci->m;
     struct main_stats_collect_info ase;
-    int sent = 0;
     int nproxy = 0;
     char bufk[200];
     char bufv[4000];
     int i;
     proxy *p;
 
-    cb_assert(msci);
-    cb_assert(msci->result);
-
-    m = msci->m;
-    cb_assert(m);
-    cb_assert(m->nthreads > 1);
-
-    ca = data1;
-    cb_assert(ca);
-
-    cb_assert(is_listen_thread());
-
     ase = *msci;
     ase.prefix = "";
 
@@ -1059,54 +1321,148 @@ static void main_stats_collect(void *data0, void *data1) {
         /* Emit front_cache stats. */
 
         if (msci->do_stats) {
-            cb_mutex_enter(p->front_cache.lock);
+            mcache_stats ms;
+
+            mcache_get_stats(&p->front_cache, -1, &ms);
 
-            if (p->front_cache.map != NULL) {
-                emit_f("front_cache_size", "%u", genhash_size(p->front_cache.map));
+            if (mcache_started(&p->front_cache)) {
+                emit_f("front_cache_size", "%u", ms.size);
+                emit_f("front_cache_curr_bytes", "%"PRIu64, ms.curr_bytes);
             }
 
+            emit_f("front_cache_shards",
+                   "%u", mcache_num_shards(&p->front_cache));
+
             emit_f("front_cache_max",
-                   "%u", p->front_cache.max);
+                   "%u", ms.max);
+            emit_f("front_cache_max_bytes",
+                   "%"PRIu64, ms.max_bytes);
             emit_f("front_cache_oldest_live",
-                   "%u", p->front_cache.oldest_live);
+                   "%u", ms.oldest_live);
 
             emit_f("front_cache_tot_get_hits",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_get_hits);
+                   (uint64_t) ms.tot_get_hits);
+            emit_f("front_cache_tot_get_stale_hits",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_get_stale_hits);
+            emit_f("front_cache_tot_get_refreshes",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_get_refreshes);
             emit_f("front_cache_tot_get_expires",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_get_expires);
+                   (uint64_t) ms.tot_get_expires);
             emit_f("front_cache_tot_get_misses",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_get_misses);
+                   (uint64_t) ms.tot_get_misses);
             emit_f("front_cache_tot_get_bytes",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_get_bytes);
+                   (uint64_t) ms.tot_get_bytes);
             emit_f("front_cache_tot_adds",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_adds);
+                   (uint64_t) ms.tot_adds);
             emit_f("front_cache_tot_add_skips",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_add_skips);
+                   (uint64_t) ms.tot_add_skips);
             emit_f("front_cache_tot_add_fails",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_add_fails);
+                   (uint64_t) ms.tot_add_fails);
             emit_f("front_cache_tot_add_bytes",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_add_bytes);
+                   (uint64_t) ms.tot_add_bytes);
+            emit_f("front_cache_tot_add_too_large",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_add_too_large);
             emit_f("front_cache_tot_deletes",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_deletes);
+                   (uint64_t) ms.tot_deletes);
             emit_f("front_cache_tot_evictions",
                    "%"PRIu64,
-                   (uint64_t) p->front_cache.tot_evictions);
+                   (uint64_t) ms.tot_evictions);
+            emit_f("front_cache_tot_admits",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_admits);
+            emit_f("front_cache_tot_admit_rejects",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_admit_rejects);
+            emit_f("front_cache_tot_admit_protected_hits",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_admit_protected_hits);
+            emit_f("front_cache_tot_admit_rejected_misses",
+                   "%"PRIu64,
+                   (uint64_t) ms.tot_admit_rejected_misses);
+            emit_f("front_cache_admit_hit_ratio_delta",
+                   "%.4f", mcache_stats_admit_hit_ratio_delta(&ms));
+        }
+    }
+
+    cb_mutex_exit(&m->proxy_main_lock);
+
+    return nproxy;
+}
+
+/* Remembers the proxies' names and ports, for */
+/* collect_memcached_stats_for_proxy(). */
+
+static void main_stats_collect_infos(struct main_stats_collect_info *msci,
+                                     int nproxy) {
+    proxy_main *m = msci->m;
+    struct main_stats_proxy_info *infos;
+    int i;
+    proxy *p;
+
+    infos = calloc(nproxy, sizeof(struct main_stats_proxy_info));
+    if (infos == NULL) {
+        return;
+    }
+
+    cb_mutex_enter(&m->proxy_main_lock);
 
-            cb_mutex_exit(p->front_cache.lock);
+    p = m->proxy_head;
+    for (i = 0; i < nproxy; i++, p = p->next) {
+        if (p == NULL) {
+            break;
         }
+
+        cb_mutex_enter(&p->proxy_lock);
+        infos[i].name = p->name != NULL ? strdup(p->name) : NULL;
+        infos[i].port = p->port;
+        cb_mutex_exit(&p->proxy_lock);
     }
 
     cb_mutex_exit(&m->proxy_main_lock);
 
+    msci->proxies = infos;
+    msci->nproxy = nproxy;
+}
+
+/* Must be invoked on the main listener thread.
+ *
+ * Puts stats gathering work on every worker thread's work_queue.
+ */
+static void main_stats_collect(void *data0, void *data1) {
+    struct main_stats_collect_info *msci = data0;
+    proxy_main *m;
+    work_collect *ca;
+    int sent = 0;
+    int nproxy;
+    int i;
+    proxy *p;
+
+    cb_assert(msci);
+    cb_assert(msci->result);
+
+    m = msci->m;
+    cb_assert(m);
+    cb_assert(m->nthreads > 1);
+
+    ca = data1;
+    cb_assert(ca);
+
+    cb_assert(is_listen_thread());
+
+    nproxy = main_stats_collect_proxies(msci);
+
     /* Starting at 1 because 0 is the main listen thread. */
 
     for (i = 1; i < m->nthreads; i++) {
@@ -1133,29 +1489,7 @@ static void main_stats_collect(void *data0, void *data1) {
         }
     }
 
-    {
-        struct main_stats_proxy_info *infos =
-            calloc(nproxy, sizeof(struct main_stats_proxy_info));
-
-        cb_mutex_enter(&m->proxy_main_lock);
-
-        p = m->proxy_head;
-        for (i = 0; i < nproxy; i++, p = p->next) {
-            if (p == NULL) {
-                break;
-            }
-
-            cb_mutex_enter(&p->proxy_lock);
-            infos[i].name = p->name != NULL ? strdup(p->name) : NULL;
-            infos[i].port = p->port;
-            cb_mutex_exit(&p->proxy_lock);
-        }
-
-        cb_mutex_exit(&m->proxy_main_lock);
-
-        msci->proxies = infos;
-        msci->nproxy = nproxy;
-    }
+    main_stats_collect_infos(msci, nproxy);
 
     /* Normally, no need to wait for the worker threads to finish, */
     /* as the workers will signal using work_collect_one(). */
@@ -1171,6 +1505,146 @@ static void main_stats_collect(void *data0, void *data1) {
     /* we're ok.  New proxies that happen afterwards are fine, too. */
 }
 
+/* True when every proxy's worker threads publish stats snapshots. */
+
+static bool main_stats_snapshots_on(proxy_main *m) {
+    bool on = true;
+    proxy *p;
+
+    cb_mutex_enter(&m->proxy_main_lock);
+
+    for (p = m->proxy_head; p != NULL && on; p = p->next) {
+        cb_mutex_enter(&p->proxy_lock);
+        on = p->behavior_pool.base.stats_snapshot_interval > 0;
+        cb_mutex_exit(&p->proxy_lock);
+    }
+
+    cb_mutex_exit(&m->proxy_main_lock);
+
+    return on;
+}
+
+/* Adds a proxy's per-thread stats snapshots into new entries of */
+/* map_pstd and map_key_stats, keyed like work_stats_collect(). */
+
+static void main_stats_merge_snapshots(proxy *p,
+                                       genhash_t *map_pstd,
+                                       genhash_t *map_key_stats) {
+    proxy_stats_td *pstd;
+    genhash_t *key_stats_map;
+    char *key_pstd;
+    char *key_key_stats;
+    int key_len;
+    int i;
+
+    cb_mutex_enter(&p->proxy_lock);
+
+    if (p->name == NULL) {
+        cb_mutex_exit(&p->proxy_lock);
+        return;
+    }
+
+    key_len = (int)strlen(p->name) + 50;
+    key_pstd = malloc(key_len);
+    if (key_pstd != NULL) {
+        snprintf(key_pstd, key_len, "%d:%s", p->port, p->name);
+    }
+
+    cb_mutex_exit(&p->proxy_lock);
+
+    if (key_pstd == NULL) {
+        return;
+    }
+
+    key_key_stats = strdup(key_pstd);
+    pstd = calloc(1, sizeof(proxy_stats_td));
+    key_stats_map = genhash_init(16, strhash_ops);
+
+    if (key_key_stats == NULL ||
+        pstd == NULL ||
+        key_stats_map == NULL) {
+        free(key_pstd);
+        free(key_key_stats);
+        free(pstd);
+        if (key_stats_map != NULL) {
+            genhash_free(key_stats_map);
+        }
+        return;
+    }
+
+    genhash_update(map_pstd, key_pstd, pstd);
+    genhash_update(map_key_stats, key_key_stats, key_stats_map);
+
+    /* Starting at 1 because 0 is the main listen thread. */
+
+    for (i = 1; i < p->thread_data_num; i++) {
+        proxy_td *ptd = &p->thread_data[i];
+        proxy_stats_snapshot *snap = &ptd->snapshot;
+
+        cb_mutex_enter(&ptd->snapshot_lock);
+
+        if (snap->version > 0) {
+            add_proxy_stats_td(pstd, &snap->stats);
+
+            if (snap->key_stats != NULL) {
+                add_processed_key_stats(key_stats_map, snap->key_stats);
+            }
+        }
+
+        cb_mutex_exit(&ptd->snapshot_lock);
+    }
+}
+
+/* Can be invoked on any thread, as it only reads what the worker */
+/* threads have published, so it never sends them any work. */
+
+static void main_stats_collect_snapshots(struct main_stats_collect_info *msci) {
+    proxy_main *m;
+    genhash_t *map_pstd;
+    genhash_t *map_key_stats;
+    int nproxy;
+    proxy *p;
+
+    cb_assert(msci);
+    cb_assert(msci->result);
+
+    m = msci->m;
+    cb_assert(m);
+
+    nproxy = main_stats_collect_proxies(msci);
+
+    if (msci->do_stats) {
+        map_pstd = genhash_init(128, strhash_ops);
+        map_key_stats = genhash_init(128, strhash_ops);
+
+        if (map_pstd != NULL &&
+            map_key_stats != NULL) {
+            cb_mutex_enter(&m->proxy_main_lock);
+
+            for (p = m->proxy_head; p != NULL; p = p->next) {
+                main_stats_merge_snapshots(p, map_pstd, map_key_stats);
+            }
+
+            cb_mutex_exit(&m->proxy_main_lock);
+
+            genhash_iter(map_pstd, map_pstd_foreach_emit, msci);
+            genhash_iter(map_key_stats, map_key_stats_foreach_emit, msci);
+        }
+
+        if (map_pstd != NULL) {
+            genhash_iter(map_pstd, genhash_free_entry, NULL);
+            genhash_free(map_pstd);
+        }
+
+        if (map_key_stats != NULL) {
+            genhash_iter(map_key_stats, map_key_stats_foreach_free, NULL);
+            genhash_free(map_key_stats);
+        }
+    }
+
+    main_stats_collect_infos(msci, nproxy);
+}
+
 static void work_stats_collect(void *data0, void *data1) {
     proxy_td *ptd = data0;
     proxy *p;
@@ -1301,6 +1775,7 @@ static void add_proxy_stats(proxy_stats *agg, proxy_stats *x) {
     agg->tot_downstream_connect_timeout += x->tot_downstream_connect_timeout;
     agg->tot_downstream_connect_interval += x->tot_downstream_connect_interval;
     agg->tot_downstream_connect_max_reached += x->tot_downstream_connect_max_reached;
+    agg->tot_downstream_connect_unresolved += x->tot_downstream_connect_unresolved;
     agg->tot_downstream_waiting_errors += x->tot_downstream_waiting_errors;
     agg->tot_downstream_auth           += x->tot_downstream_auth;
     agg->tot_downstream_auth_failed    += x->tot_downstream_auth_failed;
@@ -1316,6 +1791,26 @@ static void add_proxy_stats(proxy_stats *agg, proxy_stats *x) {
         x->tot_downstream_conn_queue_add;
     agg->tot_downstream_conn_queue_remove +=
         x->tot_downstream_conn_queue_remove;
+    agg->tot_downstream_mux_conn += x->tot_downstream_mux_conn;
+    agg->tot_downstream_mux_request += x->tot_downstream_mux_request;
+    agg->tot_downstream_mux_orphan += x->tot_downstream_mux_orphan;
+    agg->tot_downstream_mux_batch += x->tot_downstream_mux_batch;
+    agg->tot_downstream_mux_batch_requests += x->tot_downstream_mux_batch_requests;
+    agg->num_downstream_conn_prewarm += x->num_downstream_conn_prewarm;
+    agg->tot_downstream_conn_prewarm += x->tot_downstream_conn_prewarm;
+    agg->tot_downstream_conn_prewarm_failed += x->tot_downstream_conn_prewarm_failed;
+    agg->tot_downstream_conn_probe += x->tot_downstream_conn_probe;
+    agg->tot_downstream_conn_probe_failed += x->tot_downstream_conn_probe_failed;
+    agg->tot_downstream_conn_idle_closed += x->tot_downstream_conn_idle_closed;
+    agg->tot_hedge_get += x->tot_hedge_get;
+    agg->tot_hedge_get_win += x->tot_hedge_get_win;
+    agg->tot_hedge_get_wasted += x->tot_hedge_get_wasted;
+    agg->tot_hedge_get_skipped += x->tot_hedge_get_skipped;
+    agg->tot_get_coalesced += x->tot_get_coalesced;
+    agg->tot_stream_values += x->tot_stream_values;
+    agg->tot_stream_bytes += x->tot_stream_bytes;
+    agg->tot_stream_splice_bytes += x->tot_stream_splice_bytes;
+    agg->tot_pipelined_gets += x->tot_pipelined_gets;
     agg->tot_downstream_timeout   += x->tot_downstream_timeout;
     agg->tot_wait_queue_timeout   += x->tot_wait_queue_timeout;
     agg->tot_auth_timeout         += x->tot_auth_timeout;
@@ -1326,6 +1821,8 @@ static void add_proxy_stats(proxy_stats *agg, proxy_stats *x) {
     agg->tot_multiget_keys        += x->tot_multiget_keys;
     agg->tot_multiget_keys_dedupe += x->tot_multiget_keys_dedupe;
     agg->tot_multiget_bytes_dedupe += x->tot_multiget_bytes_dedupe;
+    agg->tot_front_cache_miss_hits += x->tot_front_cache_miss_hits;
+    agg->tot_front_cache_miss_adds += x->tot_front_cache_miss_adds;
     agg->tot_optimize_sets        += x->tot_optimize_sets;
     agg->tot_retry                += x->tot_retry;
     agg->tot_retry_time           += x->tot_retry_time;
@@ -1567,6 +2064,8 @@ void map_pstd_foreach_emit(const void *k,
               pstd->stats.tot_downstream_connect_interval);
     more_stat("tot_downstream_connect_max_reached",
               pstd->stats.tot_downstream_connect_max_reached);
+    more_stat("tot_downstream_connect_unresolved",
+              pstd->stats.tot_downstream_connect_unresolved);
     more_stat("tot_downstream_waiting_errors",
               pstd->stats.tot_downstream_waiting_errors);
     more_stat("tot_downstream_auth",
@@ -1587,6 +2086,46 @@ void map_pstd_foreach_emit(const void *k,
               pstd->stats.tot_downstream_conn_queue_add);
     more_stat("tot_downstream_conn_queue_remove",
               pstd->stats.tot_downstream_conn_queue_remove);
+    more_stat("tot_downstream_mux_conn",
+              pstd->stats.tot_downstream_mux_conn);
+    more_stat("tot_downstream_mux_request",
+              pstd->stats.tot_downstream_mux_request);
+    more_stat("tot_downstream_mux_orphan",
+              pstd->stats.tot_downstream_mux_orphan);
+    more_stat("tot_downstream_mux_batch",
+              pstd->stats.tot_downstream_mux_batch);
+    more_stat("tot_downstream_mux_batch_requests",
+              pstd->stats.tot_downstream_mux_batch_requests);
+    more_stat("num_downstream_conn_prewarm",
+              pstd->stats.num_downstream_conn_prewarm);
+    more_stat("tot_downstream_conn_prewarm",
+              pstd->stats.tot_downstream_conn_prewarm);
+    more_stat("tot_downstream_conn_prewarm_failed",
+              pstd->stats.tot_downstream_conn_prewarm_failed);
+    more_stat("tot_downstream_conn_probe",
+              pstd->stats.tot_downstream_conn_probe);
+    more_stat("tot_downstream_conn_probe_failed",
+              pstd->stats.tot_downstream_conn_probe_failed);
+    more_stat("tot_downstream_conn_idle_closed",
+              pstd->stats.tot_downstream_conn_idle_closed);
+    more_stat("tot_hedge_get",
+              pstd->stats.tot_hedge_get);
+    more_stat("tot_hedge_get_win",
+              pstd->stats.tot_hedge_get_win);
+    more_stat("tot_hedge_get_wasted",
+              pstd->stats.tot_hedge_get_wasted);
+    more_stat("tot_hedge_get_skipped",
+              pstd->stats.tot_hedge_get_skipped);
+    more_stat("tot_get_coalesced",
+              pstd->stats.tot_get_coalesced);
+    more_stat("tot_stream_values",
+              pstd->stats.tot_stream_values);
+    more_stat("tot_stream_bytes",
+              pstd->stats.tot_stream_bytes);
+    more_stat("tot_stream_splice_bytes",
+              pstd->stats.tot_stream_splice_bytes);
+    more_stat("tot_pipelined_gets",
+              pstd->stats.tot_pipelined_gets);
     more_stat("tot_downstream_timeout",
               pstd->stats.tot_downstream_timeout);
     more_stat("tot_wait_queue_timeout",
@@ -1607,6 +2146,10 @@ void map_pstd_foreach_emit(const void *k,
               pstd->stats.tot_multiget_keys_dedupe);
     more_stat("tot_multiget_bytes_dedupe",
               pstd->stats.tot_multiget_bytes_dedupe);
+    more_stat("tot_front_cache_miss_hits",
+              pstd->stats.tot_front_cache_miss_hits);
+    more_stat("tot_front_cache_miss_adds",
+              pstd->stats.tot_front_cache_miss_adds);
     more_stat("tot_optimize_sets",
               pstd->stats.tot_optimize_sets);
     more_stat("tot_retry",
@@ -1750,6 +2293,9 @@ static void main_stats_reset(void *data0, void *data1) {
     m->stat_proxy_existings = 0;
     m->stat_proxy_shutdowns = 0;
 
+    mcs_resolve_stats_reset();
+    cproxy_breaker_reset_stats();
+
     cb_mutex_enter(&m->proxy_main_lock);
 
     for (p = m->proxy_head; p != NULL; p = p->next) {
@@ -1835,6 +2381,10 @@ static void work_stats_reset(void *data0, void *data1) {
         htgram_reset(ptd->stats.downstream_connect_time_htgram);
     }
 
+    /* So that the reset shows up without waiting an interval. */
+
+    cproxy_stats_publish(ptd);
+
     work_collect_one(c);
 }
 
@@ -1908,8 +2458,21 @@ void proxy_stats_dump_timings(ADD_STAT add_stats, conn *c) {
             cb_mutex_enter(&p->proxy_lock);
             for (i = 1; i < pm->nthreads; i++) {
                 proxy_td *thread_ptd = &p->thread_data[i];
-                if (thread_ptd != NULL &&
-                    thread_ptd->stats.downstream_reserved_time_htgram != NULL) {
+                if (thread_ptd == NULL) {
+                    continue;
+                }
+                if (p->behavior_pool.base.stats_snapshot_interval > 0) {
+                    proxy_stats_td *snap = &thread_ptd->snapshot.stats;
+
+                    cb_mutex_enter(&thread_ptd->snapshot_lock);
+                    if (snap->downstream_reserved_time_htgram != NULL) {
+                        htgram_add(hreserved, snap->downstream_reserved_time_htgram);
+                    }
+                    if (snap->downstream_connect_time_htgram != NULL) {
+                        htgram_add(hconnect, snap->downstream_connect_time_htgram);
+                    }
+                    cb_mutex_exit(&thread_ptd->snapshot_lock);
+                } else if (thread_ptd->stats.downstream_reserved_time_htgram != NULL) {
                     htgram_add(hreserved, thread_ptd->stats.downstream_reserved_time_htgram);
                     htgram_add(hconnect, thread_ptd->stats.downstream_connect_time_htgram);
                 }
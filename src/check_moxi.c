@@ -316,6 +316,245 @@ START_TEST(test_mcache) {
 }
 END_TEST
 
+/* Sets up n distinct key_stats items, "ks0", "ks1", ..., which */
+/* are held by the test so a cache eviction doesn't free them. */
+
+static void ks_init(key_stats *ks, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        memset(&ks[i], 0, sizeof(key_stats));
+        snprintf(ks[i].key, sizeof(ks[i].key), "ks%d", i);
+        ks[i].refcount = 1;
+    }
+}
+
+START_TEST(test_mcache_shards) {
+    mcache m;
+    mcache_stats ms;
+    key_stats ks[8];
+    uint32_t i, total;
+
+    mcache_init(&m, true, &mcache_key_stats_funcs, false);
+    fail_unless(mcache_shard(&m, 4), "sharded");
+    fail_unless(mcache_num_shards(&m) == 4, "num shards");
+    fail_if(mcache_started(&m), "started");
+
+    mcache_start(&m, 100);
+    fail_unless(mcache_started(&m), "started");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.max == 100, "max is divided across shards");
+
+    ks_init(ks, 8);
+
+    for (i = 0; i < 8; i++) {
+        mcache_set(&m, &ks[i], 0, false, false);
+    }
+
+    for (i = 0; i < 8; i++) {
+        fail_if(NULL == mcache_get(&m, s_len(ks[i].key), 0),
+                "hit after set");
+    }
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.size == 8, "merged size");
+    fail_unless(ms.tot_adds == 8, "merged adds");
+    fail_unless(ms.tot_get_hits == 8, "merged hits");
+
+    total = 0;
+    for (i = 0; i < 4; i++) {
+        mcache_get_stats(&m, (int) i, &ms);
+        fail_unless(ms.max == 25, "shard max");
+        total += ms.size;
+    }
+    fail_unless(total == 8, "shard sizes add up");
+
+    mcache_delete(&m, s_len("ks3"));
+    fail_unless(NULL == mcache_get(&m, s_len("ks3"), 0),
+                "miss after delete");
+
+    mcache_flush_all(&m, 0);
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.size == 0, "empty after flush");
+
+    mcache_reset_stats(&m);
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_get_hits == 0, "reset");
+
+    mcache_stop(&m);
+    fail_if(mcache_started(&m), "stopped");
+}
+END_TEST
+
+START_TEST(test_mcache_admission) {
+    mcache m;
+    mcache_stats ms;
+    key_stats ks[3];
+    int i;
+
+    mcache_init(&m, false, &mcache_key_stats_funcs, false);
+    mcache_admission(&m, true);
+    mcache_start(&m, 2);
+
+    ks_init(ks, 3);
+
+    /* Admitted without a contest while there's room. */
+
+    mcache_set(&m, &ks[0], 0, false, false);
+    mcache_set(&m, &ks[1], 0, false, false);
+
+    for (i = 0; i < 3; i++) {
+        fail_if(NULL == mcache_get(&m, s_len("ks0"), 0), "hot hit");
+        fail_if(NULL == mcache_get(&m, s_len("ks1"), 0), "hot hit");
+    }
+
+    /* A one-off key loses to the LRU victim. */
+
+    fail_unless(NULL == mcache_get(&m, s_len("ks2"), 0), "miss");
+    mcache_set(&m, &ks[2], 0, false, false);
+    fail_unless(NULL == mcache_get(&m, s_len("ks2"), 0), "rejected");
+    fail_if(NULL == mcache_get(&m, s_len("ks0"), 0), "kept");
+    fail_if(NULL == mcache_get(&m, s_len("ks1"), 0), "kept");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_admit_rejects == 1, "rejects");
+    fail_unless(ms.tot_admit_rejected_misses == 1, "rejected misses");
+    fail_unless(ms.tot_admits == 0, "admits");
+
+    /* Once it's read more often than the victim, it's admitted. */
+
+    for (i = 0; i < 6; i++) {
+        mcache_get(&m, s_len("ks2"), 0);
+    }
+    mcache_set(&m, &ks[2], 0, false, false);
+    fail_if(NULL == mcache_get(&m, s_len("ks2"), 0), "admitted");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_admits == 1, "admits");
+    fail_unless(ms.tot_evictions == 1, "evictions");
+
+    mcache_stop(&m);
+}
+END_TEST
+
+START_TEST(test_mcache_max_bytes) {
+    mcache m;
+    mcache_stats ms;
+    key_stats ks[4];
+
+    /* Each key_stats item is sizeof(key_stats) bytes long. */
+
+    mcache_init(&m, false, &mcache_key_stats_funcs, false);
+    mcache_max_bytes(&m, 2 * sizeof(key_stats), 0);
+    mcache_start(&m, 100);
+
+    ks_init(ks, 4);
+
+    mcache_set(&m, &ks[0], 0, false, false);
+    mcache_set(&m, &ks[1], 0, false, false);
+    fail_if(NULL == mcache_get(&m, s_len("ks0"), 0), "hit");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.curr_bytes == 2 * sizeof(key_stats), "curr_bytes");
+
+    /* Evicts ks1, as ks0 was used more recently. */
+
+    mcache_set(&m, &ks[2], 0, false, false);
+    fail_if(NULL == mcache_get(&m, s_len("ks2"), 0), "hit");
+    fail_if(NULL == mcache_get(&m, s_len("ks0"), 0), "hit");
+    fail_unless(NULL == mcache_get(&m, s_len("ks1"), 0), "evicted");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.size == 2, "size");
+    fail_unless(ms.curr_bytes == 2 * sizeof(key_stats), "curr_bytes");
+    fail_unless(ms.tot_evictions == 1, "evictions");
+
+    mcache_delete(&m, s_len("ks0"));
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.curr_bytes == sizeof(key_stats), "curr_bytes after delete");
+
+    mcache_stop(&m);
+
+    /* With a per-item limit, nothing fits. */
+
+    mcache_max_bytes(&m, 0, sizeof(key_stats) - 1);
+    mcache_start(&m, 100);
+
+    mcache_set(&m, &ks[3], 0, false, false);
+    fail_unless(NULL == mcache_get(&m, s_len("ks3"), 0), "too large");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_add_too_large == 1, "too large");
+    fail_unless(ms.curr_bytes == 0, "curr_bytes");
+
+    mcache_stop(&m);
+}
+END_TEST
+
+/* The key_stats funcs don't support a grace period, so the test */
+/* borrows the added_at field of a key_stats to mark refreshing. */
+
+static bool ks_get_refreshing(void *it) {
+    return ((key_stats *) it)->added_at != 0;
+}
+
+static void ks_set_refreshing(void *it, bool refreshing) {
+    ((key_stats *) it)->added_at = refreshing;
+}
+
+START_TEST(test_mcache_grace) {
+    mcache_funcs funcs = mcache_key_stats_funcs;
+    mcache m;
+    mcache_stats ms;
+    key_stats ks[2];
+
+    funcs.item_get_refreshing = ks_get_refreshing;
+    funcs.item_set_refreshing = ks_set_refreshing;
+
+    mcache_init(&m, false, &funcs, false);
+    mcache_grace(&m, 100);
+    mcache_start(&m, 10);
+
+    /* Two versions of the same key. */
+
+    ks_init(ks, 2);
+    strcpy(ks[1].key, ks[0].key);
+
+    mcache_set(&m, &ks[0], 1000, true, false);
+    fail_unless(&ks[0] == mcache_get(&m, s_len("ks0"), 1000), "fresh");
+
+    /* The first reader past the exptime refreshes, while the */
+    /* others are served the stale item. */
+
+    fail_unless(NULL == mcache_get(&m, s_len("ks0"), 1050), "refresher");
+    fail_unless(&ks[0] == mcache_get(&m, s_len("ks0"), 1060), "stale");
+    fail_unless(&ks[0] == mcache_get(&m, s_len("ks0"), 1070), "stale");
+
+    /* The refreshed item replaces the stale one, even for an add. */
+
+    mcache_set(&m, &ks[1], 2000, true, false);
+    fail_unless(&ks[1] == mcache_get(&m, s_len("ks0"), 1080), "refreshed");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_get_refreshes == 1, "refreshes");
+    fail_unless(ms.tot_get_stale_hits == 2, "stale hits");
+    fail_unless(ms.curr_bytes == sizeof(key_stats), "curr_bytes");
+
+    /* A refresh that never arrives misses after the grace period. */
+
+    fail_unless(NULL == mcache_get(&m, s_len("ks0"), 2010), "refresher");
+    fail_unless(&ks[1] == mcache_get(&m, s_len("ks0"), 2090), "stale");
+    fail_unless(NULL == mcache_get(&m, s_len("ks0"), 2110), "expired");
+
+    mcache_get_stats(&m, -1, &ms);
+    fail_unless(ms.tot_get_expires == 1, "expires");
+    fail_unless(ms.size == 0, "size");
+
+    mcache_stop(&m);
+}
+END_TEST
+
 START_TEST(test_matcher)
 {
     matcher m;
@@ -441,6 +680,1155 @@ START_TEST(test_matcher)
 }
 END_TEST
 
+/* Sets up just enough of a proxy and a proxy_td for the */
+/* front_cache, which caches "fc:" keys, and remembers misses */
+/* of "fc:" and "fm:" keys. */
+
+static void front_cache_init(proxy *p, proxy_td *ptd) {
+    memset(p, 0, sizeof(proxy));
+    memset(ptd, 0, sizeof(proxy_td));
+
+    ptd->proxy = p;
+    ptd->behavior_pool.base.front_cache_lifespan = 1000;
+    ptd->behavior_pool.base.front_cache_miss_lifespan = 100;
+
+    mcache_init(&p->front_cache, false, &mcache_item_funcs, true);
+    mcache_start(&p->front_cache, 100);
+
+    matcher_init(&p->front_cache_matcher, false);
+    matcher_init(&p->front_cache_unmatcher, false);
+    matcher_init(&p->front_cache_miss_matcher, false);
+
+    matcher_start(&p->front_cache_matcher, "fc:");
+    matcher_start(&p->front_cache_miss_matcher, "fc:|fm:");
+}
+
+static void front_cache_stop(proxy *p) {
+    mcache_stop(&p->front_cache);
+
+    matcher_stop(&p->front_cache_matcher);
+    matcher_stop(&p->front_cache_unmatcher);
+    matcher_stop(&p->front_cache_miss_matcher);
+}
+
+START_TEST(test_front_cache_miss)
+{
+    proxy p;
+    proxy_td ptd;
+    uint64_t gen;
+    uint64_t adds;
+    item *it;
+
+    front_cache_init(&p, &ptd);
+
+    fail_unless(cproxy_front_cache_miss_key(&ptd, s_len("fm:a")),
+                "miss key");
+    fail_if(cproxy_front_cache_miss_key(&ptd, s_len("xx:a")),
+            "not a miss key");
+
+    ptd.behavior_pool.base.front_cache_miss_lifespan = 0;
+    fail_if(cproxy_front_cache_miss_key(&ptd, s_len("fm:a")),
+            "misses off");
+    ptd.behavior_pool.base.front_cache_miss_lifespan = 100;
+
+    cproxy_front_cache_miss(&ptd, s_len("fm:a"),
+                            cproxy_front_cache_gen(&ptd));
+    fail_unless(ptd.stats.stats.tot_front_cache_miss_adds == 1, "adds");
+
+    it = mcache_get(&p.front_cache, s_len("fm:a"), msec_current_time);
+    fail_unless(it != NULL, "remembered miss");
+    fail_unless(it->it_flags & ITEM_MISS, "ITEM_MISS");
+    item_remove(it);
+
+    /* A change to the key forgets the miss. */
+
+    cproxy_front_cache_delete(&ptd, s_len("fm:a"));
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fm:a"),
+                                   msec_current_time),
+                "forgotten miss");
+
+    /* A miss doesn't replace a cached value, while a value */
+    /* does replace a remembered miss. */
+
+    it = item_alloc("fc:b", 4, 0, 0, 2);
+    memcpy(ITEM_data(it), "\r\n", 2);
+    mcache_set(&p.front_cache, it, msec_current_time + 1000, false, false);
+    item_remove(it);
+
+    cproxy_front_cache_miss(&ptd, s_len("fc:b"),
+                            cproxy_front_cache_gen(&ptd));
+    it = mcache_get(&p.front_cache, s_len("fc:b"), msec_current_time);
+    fail_unless(it != NULL, "value");
+    fail_if(it->it_flags & ITEM_MISS, "value not replaced by a miss");
+    item_remove(it);
+
+    cproxy_front_cache_delete(&ptd, s_len("fc:b"));
+    cproxy_front_cache_miss(&ptd, s_len("fc:b"),
+                            cproxy_front_cache_gen(&ptd));
+
+    it = item_alloc("fc:b", 4, 0, 0, 2);
+    memcpy(ITEM_data(it), "\r\n", 2);
+    mcache_set(&p.front_cache, it, msec_current_time + 1000, false, false);
+    item_remove(it);
+
+    it = mcache_get(&p.front_cache, s_len("fc:b"), msec_current_time);
+    fail_unless(it != NULL, "value");
+    fail_if(it->it_flags & ITEM_MISS, "miss replaced by a value");
+    item_remove(it);
+
+    /* A remembered miss expires after front_cache_miss_lifespan. */
+
+    cproxy_front_cache_miss(&ptd, s_len("fm:c"),
+                            cproxy_front_cache_gen(&ptd));
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fm:c"),
+                                   msec_current_time + 200),
+                "expired miss");
+
+    /* A change to the key while the get was in flight means that */
+    /* the get's miss might be older than the change, so it's not */
+    /* remembered, unlike a miss from a get sent after the change. */
+
+    gen = cproxy_front_cache_gen(&ptd);
+    cproxy_front_cache_delete(&ptd, s_len("fm:d"));
+    fail_unless(cproxy_front_cache_gen(&ptd) > gen, "gen");
+
+    adds = ptd.stats.stats.tot_front_cache_miss_adds;
+    cproxy_front_cache_miss(&ptd, s_len("fm:d"), gen);
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fm:d"),
+                                   msec_current_time),
+                "stale miss");
+    fail_unless(ptd.stats.stats.tot_front_cache_miss_adds == adds, "adds");
+
+    cproxy_front_cache_miss(&ptd, s_len("fm:e"), gen);
+    it = mcache_get(&p.front_cache, s_len("fm:e"), msec_current_time);
+    fail_unless(it != NULL, "unchanged key's miss");
+    item_remove(it);
+
+    cproxy_front_cache_miss(&ptd, s_len("fm:d"),
+                            cproxy_front_cache_gen(&ptd));
+    it = mcache_get(&p.front_cache, s_len("fm:d"), msec_current_time);
+    fail_unless(it != NULL, "miss after the change");
+    item_remove(it);
+
+    front_cache_stop(&p);
+}
+END_TEST
+
+/* Returns a binary request item, of just a header and a key. */
+
+static item *bin_request(uint8_t opcode, uint32_t opaque, char *key) {
+    protocol_binary_request_header *req;
+    int keylen = strlen(key);
+    item *it;
+
+    it = item_alloc("r", 1, 0, 0, sizeof(*req) + keylen);
+    fail_unless(it != NULL, "request item");
+
+    req = (protocol_binary_request_header *) ITEM_data(it);
+    memset(req, 0, sizeof(*req));
+    req->request.magic   = PROTOCOL_BINARY_REQ;
+    req->request.opcode  = opcode;
+    req->request.keylen  = htons(keylen);
+    req->request.bodylen = htonl(keylen);
+    req->request.opaque  = opaque;
+    memcpy(ITEM_data(it) + sizeof(*req), key, keylen);
+
+    return it;
+}
+
+START_TEST(test_b2b_front_cache_response)
+{
+    protocol_binary_response_get *rsp;
+    protocol_binary_request_header *req;
+    item *req_it;
+    item *it;
+    item *out;
+    item *copy;
+    char *body;
+
+    settings.use_cas = true;
+
+    it = item_alloc("fc:a", 4, 7, 0, 7);
+    fail_unless(it != NULL, "item");
+    memcpy(ITEM_data(it), "hello\r\n", 7);
+    ITEM_set_cas(it, 0x1234);
+
+    /* A GET hit has the flags and value, but no key. */
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GET, 0xdeadbeef, "fc:a");
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    out = b2b_front_cache_response(it, req);
+    fail_unless(out != NULL, "response");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(out);
+    fail_unless(rsp->message.header.response.magic ==
+                (uint8_t) PROTOCOL_BINARY_RES, "magic");
+    fail_unless(rsp->message.header.response.opcode ==
+                PROTOCOL_BINARY_CMD_GET, "opcode");
+    fail_unless(rsp->message.header.response.status == 0, "status");
+    fail_unless(rsp->message.header.response.keylen == 0, "keylen");
+    fail_unless(rsp->message.header.response.extlen == 4, "extlen");
+    fail_unless(ntohl(rsp->message.header.response.bodylen) == 4 + 5,
+                "bodylen");
+    fail_unless(rsp->message.header.response.opaque == 0xdeadbeef,
+                "opaque is echoed as-is");
+    fail_unless(mc_swap64(rsp->message.header.response.cas) == 0x1234,
+                "cas");
+    fail_unless(ntohl(rsp->message.body.flags) == 7, "flags");
+    fail_unless(out->nbytes == (int) sizeof(rsp->bytes) + 5, "nbytes");
+    fail_unless(memcmp(ITEM_data(out) + sizeof(rsp->bytes),
+                       "hello", 5) == 0, "value");
+    item_remove(out);
+    item_remove(req_it);
+
+    /* A GETKQ hit also has the key, before the value. */
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GETKQ, 42, "fc:a");
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    out = b2b_front_cache_response(it, req);
+    fail_unless(out != NULL, "response");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(out);
+    body = ITEM_data(out) + sizeof(rsp->bytes);
+    fail_unless(rsp->message.header.response.opcode ==
+                PROTOCOL_BINARY_CMD_GETKQ, "opcode");
+    fail_unless(ntohs(rsp->message.header.response.keylen) == 4, "keylen");
+    fail_unless(ntohl(rsp->message.header.response.bodylen) == 4 + 4 + 5,
+                "bodylen");
+    fail_unless(rsp->message.header.response.opaque == 42, "opaque");
+    fail_unless(memcmp(body, "fc:ahello", 9) == 0, "key and value");
+
+    /* A GETQ that was sent downstream as a GETKQ, for its key, */
+    /* has the key stripped again for the upstream. */
+
+    copy = b2b_response_copy(out, PROTOCOL_BINARY_CMD_GETQ, 43, true);
+    fail_unless(copy != NULL, "copy");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(copy);
+    fail_unless(rsp->message.header.response.opcode ==
+                PROTOCOL_BINARY_CMD_GETQ, "opcode");
+    fail_unless(rsp->message.header.response.keylen == 0, "keylen");
+    fail_unless(rsp->message.header.response.extlen == 4, "extlen");
+    fail_unless(ntohl(rsp->message.header.response.bodylen) == 4 + 5,
+                "bodylen");
+    fail_unless(rsp->message.header.response.opaque == 43, "opaque");
+    fail_unless(mc_swap64(rsp->message.header.response.cas) == 0x1234,
+                "cas");
+    fail_unless(ntohl(rsp->message.body.flags) == 7, "flags");
+    fail_unless(copy->nbytes == (int) sizeof(rsp->bytes) + 5, "nbytes");
+    fail_unless(memcmp(ITEM_data(copy) + sizeof(rsp->bytes),
+                       "hello", 5) == 0, "value");
+    item_remove(copy);
+    item_remove(out);
+    item_remove(req_it);
+    item_remove(it);
+
+    /* A remembered miss is a GET's "Not found", or a GETK's key. */
+
+    it = item_alloc("fc:m", 4, 0, 0, 2);
+    fail_unless(it != NULL, "item");
+    memcpy(ITEM_data(it), "\r\n", 2);
+    it->it_flags |= ITEM_MISS;
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GET, 44, "fc:m");
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    out = b2b_front_cache_response(it, req);
+    fail_unless(out != NULL, "response");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(out);
+    fail_unless(ntohs(rsp->message.header.response.status) ==
+                PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, "status");
+    fail_unless(rsp->message.header.response.extlen == 0, "extlen");
+    fail_unless(rsp->message.header.response.keylen == 0, "keylen");
+    fail_unless(ntohl(rsp->message.header.response.bodylen) == 9,
+                "bodylen");
+    fail_unless(rsp->message.header.response.opaque == 44, "opaque");
+    fail_unless(memcmp(ITEM_data(out) + sizeof(rsp->message.header),
+                       "Not found", 9) == 0, "message");
+    item_remove(out);
+    item_remove(req_it);
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GETK, 45, "fc:m");
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    out = b2b_front_cache_response(it, req);
+    fail_unless(out != NULL, "response");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(out);
+    fail_unless(ntohs(rsp->message.header.response.status) ==
+                PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, "status");
+    fail_unless(ntohs(rsp->message.header.response.keylen) == 4, "keylen");
+    fail_unless(ntohl(rsp->message.header.response.bodylen) == 4,
+                "bodylen");
+    fail_unless(memcmp(ITEM_data(out) + sizeof(rsp->message.header),
+                       "fc:m", 4) == 0, "key");
+    item_remove(out);
+    item_remove(req_it);
+    item_remove(it);
+}
+END_TEST
+
+/* Builds a downstream's successful GET response for a value. */
+
+static item *bin_get_response(uint64_t cas, uint32_t flags, char *val) {
+    protocol_binary_response_get *rsp;
+    int vlen = strlen(val);
+    item *it;
+
+    it = item_alloc("s", 1, 0, 0, sizeof(rsp->bytes) + vlen);
+    fail_unless(it != NULL, "response item");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(it);
+    memset(rsp, 0, sizeof(rsp->bytes));
+    rsp->message.header.response.magic   = (uint8_t) PROTOCOL_BINARY_RES;
+    rsp->message.header.response.opcode  = PROTOCOL_BINARY_CMD_GET;
+    rsp->message.header.response.extlen  = 4;
+    rsp->message.header.response.bodylen = htonl(4 + vlen);
+    rsp->message.header.response.cas     = mc_swap64(cas);
+    rsp->message.body.flags              = htonl(flags);
+    memcpy(ITEM_data(it) + sizeof(rsp->bytes), val, vlen);
+
+    return it;
+}
+
+/* Builds a downstream's response of just a header. */
+
+static item *bin_status_response(uint8_t opcode, uint16_t status) {
+    protocol_binary_response_header *res;
+    item *it;
+
+    it = item_alloc("s", 1, 0, 0, sizeof(*res));
+    fail_unless(it != NULL, "response item");
+
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    memset(res, 0, sizeof(*res));
+    res->response.magic  = (uint8_t) PROTOCOL_BINARY_RES;
+    res->response.opcode = opcode;
+    res->response.status = htons(status);
+
+    return it;
+}
+
+START_TEST(test_b2b_front_cache_update)
+{
+    proxy p;
+    proxy_td ptd;
+    uint64_t gen;
+    item *req_it;
+    item *res_it;
+    item *it;
+
+    settings.use_cas = true;
+
+    front_cache_init(&p, &ptd);
+
+    /* A GET miss is remembered, and its hit replaces it. */
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GET, 1, "fc:a");
+    res_it = bin_status_response(PROTOCOL_BINARY_CMD_GET,
+                                 PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+
+    b2b_front_cache_update(&ptd, req_it, res_it,
+                           cproxy_front_cache_gen(&ptd));
+    item_remove(res_it);
+
+    it = mcache_get(&p.front_cache, s_len("fc:a"), msec_current_time);
+    fail_unless(it != NULL, "remembered miss");
+    fail_unless(it->it_flags & ITEM_MISS, "ITEM_MISS");
+    item_remove(it);
+
+    res_it = bin_get_response(99, 3, "world");
+    b2b_front_cache_update(&ptd, req_it, res_it,
+                           cproxy_front_cache_gen(&ptd));
+    item_remove(res_it);
+    item_remove(req_it);
+
+    it = mcache_get(&p.front_cache, s_len("fc:a"), msec_current_time);
+    fail_unless(it != NULL, "cached value");
+    fail_if(it->it_flags & ITEM_MISS, "not a miss");
+    fail_unless(ITEM_get_cas(it) == 99, "cas");
+    fail_unless(strtoul(ITEM_suffix(it), NULL, 10) == 3, "flags");
+    fail_unless(it->nbytes == 7, "nbytes");
+    fail_unless(memcmp(ITEM_data(it), "world\r\n", 7) == 0, "value");
+    item_remove(it);
+
+    /* A quiet or non-quiet change to the key forgets it. */
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_SETQ, 2, "fc:a");
+    b2b_front_cache_forget(&ptd, req_it);
+    item_remove(req_it);
+
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fc:a"),
+                                   msec_current_time),
+                "forgotten");
+
+    /* A GET's miss isn't remembered when the key was changed */
+    /* while the GET was in flight. */
+
+    gen = cproxy_front_cache_gen(&ptd);
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_SETQ, 4, "fc:c");
+    b2b_front_cache_forget(&ptd, req_it);
+    item_remove(req_it);
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_GET, 5, "fc:c");
+    res_it = bin_status_response(PROTOCOL_BINARY_CMD_GET,
+                                 PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+    b2b_front_cache_update(&ptd, req_it, res_it, gen);
+    item_remove(res_it);
+    item_remove(req_it);
+
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fc:c"),
+                                   msec_current_time),
+                "stale miss");
+
+    cproxy_front_cache_miss(&ptd, s_len("fm:b"),
+                            cproxy_front_cache_gen(&ptd));
+
+    req_it = bin_request(PROTOCOL_BINARY_CMD_DELETE, 3, "fm:b");
+    res_it = bin_status_response(PROTOCOL_BINARY_CMD_DELETE,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    b2b_front_cache_update(&ptd, req_it, res_it,
+                           cproxy_front_cache_gen(&ptd));
+    item_remove(res_it);
+    item_remove(req_it);
+
+    fail_unless(NULL == mcache_get(&p.front_cache, s_len("fm:b"),
+                                   msec_current_time),
+                "forgotten miss");
+
+    front_cache_stop(&p);
+}
+END_TEST
+
+/* Builds a downstream's response to a GETKQ, with the key. */
+
+static item *bin_getkq_response(uint32_t opaque, char *key, char *val) {
+    protocol_binary_response_get *rsp;
+    int keylen = strlen(key);
+    int vlen = strlen(val);
+    item *it;
+
+    it = item_alloc("s", 1, 0, 0, sizeof(rsp->bytes) + keylen + vlen);
+    fail_unless(it != NULL, "response item");
+
+    rsp = (protocol_binary_response_get *) ITEM_data(it);
+    memset(rsp, 0, sizeof(rsp->bytes));
+    rsp->message.header.response.magic   = (uint8_t) PROTOCOL_BINARY_RES;
+    rsp->message.header.response.opcode  = PROTOCOL_BINARY_CMD_GETKQ;
+    rsp->message.header.response.extlen  = 4;
+    rsp->message.header.response.keylen  = htons(keylen);
+    rsp->message.header.response.bodylen = htonl(4 + keylen + vlen);
+    rsp->message.header.response.opaque  = opaque;
+    memcpy(ITEM_data(it) + sizeof(rsp->bytes), key, keylen);
+    memcpy(ITEM_data(it) + sizeof(rsp->bytes) + keylen, val, vlen);
+
+    return it;
+}
+
+/* Sets up just enough of an upstream conn to queue responses on. */
+
+static void quiet_conn_init(conn *uc) {
+    memset(uc, 0, sizeof(conn));
+    uc->transport = tcp_transport;
+
+    uc->isize = 2;
+    uc->ilist = calloc(uc->isize, sizeof(item *));
+    uc->icurr = uc->ilist;
+    uc->iovsize = 4;
+    uc->iov = calloc(uc->iovsize, sizeof(struct iovec));
+    uc->msgsize = 2;
+    uc->msglist = calloc(uc->msgsize, sizeof(struct msghdr));
+    fail_unless(uc->ilist && uc->iov && uc->msglist, "conn");
+
+    fail_unless(add_msghdr(uc) == 0, "msghdr");
+}
+
+static void quiet_conn_stop(conn *uc) {
+    int i;
+
+    for (i = 0; i < uc->ileft; i++) {
+        item_remove(uc->ilist[i]);
+    }
+
+    free(uc->ilist);
+    free(uc->iov);
+    free(uc->msglist);
+}
+
+START_TEST(test_b2b_quiet_response)
+{
+    protocol_binary_response_header *res;
+    bin_quiet quiet[3];
+    proxy p;
+    proxy_td ptd;
+    downstream d;
+    conn uc;
+    item *it;
+
+    front_cache_init(&p, &ptd);
+
+    memset(&d, 0, sizeof(d));
+    d.ptd = &ptd;
+    d.bin_quiet = quiet;
+
+    /* A response gets its upstream request's opaque back. */
+
+    quiet[0].opaque = htonl(0xabc);
+    quiet[0].opcode = PROTOCOL_BINARY_CMD_GETKQ;
+    quiet[0].dup    = -1;
+    d.bin_quiet_num = 1;
+
+    quiet_conn_init(&uc);
+
+    it = bin_getkq_response(htonl(1), "a", "hello");
+    b2b_quiet_response(&d, &uc, it);
+
+    fail_unless(uc.ileft == 1, "one response");
+    fail_unless(uc.ilist[0] == it, "sent as-is");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    fail_unless(res->response.opaque == htonl(0xabc), "opaque");
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GETKQ, "opcode");
+    fail_unless(ntohs(res->response.keylen) == 1, "keylen");
+    fail_unless(uc.iovused == 1, "iov");
+    fail_unless(uc.iov[0].iov_base == ITEM_data(it), "iov_base");
+    fail_unless(uc.iov[0].iov_len == (size_t) it->nbytes, "iov_len");
+    item_remove(it);
+    quiet_conn_stop(&uc);
+
+    /* A GETQ that was sent as a GETKQ, for its key, gets a copy */
+    /* of the response without the key. */
+
+    quiet[0].opaque = htonl(0xdef);
+    quiet[0].opcode = PROTOCOL_BINARY_CMD_GETQ;
+    quiet[0].dup    = -1;
+    d.bin_quiet_num = 1;
+
+    quiet_conn_init(&uc);
+
+    it = bin_getkq_response(htonl(1), "fc:a", "hello");
+    b2b_quiet_response(&d, &uc, it);
+
+    fail_unless(uc.ileft == 1, "one response");
+    fail_unless(uc.ilist[0] != it, "a copy");
+    res = (protocol_binary_response_header *) ITEM_data(uc.ilist[0]);
+    fail_unless(res->response.opaque == htonl(0xdef), "opaque");
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GETQ, "opcode");
+    fail_unless(res->response.keylen == 0, "keylen");
+    fail_unless(ntohl(res->response.bodylen) == 4 + 5, "bodylen");
+    fail_unless(memcmp(ITEM_data(uc.ilist[0]) + sizeof(*res) + 4,
+                       "hello", 5) == 0, "value");
+    item_remove(it);
+    quiet_conn_stop(&uc);
+
+    /* A response to a de-duplicated GET goes to every request of */
+    /* the key, each with its own opaque and opcode. */
+
+    quiet[0].opaque = htonl(10);
+    quiet[0].opcode = PROTOCOL_BINARY_CMD_GETKQ;
+    quiet[0].dup    = 2;
+    quiet[1].opaque = htonl(11);
+    quiet[1].opcode = PROTOCOL_BINARY_CMD_GETKQ;
+    quiet[1].dup    = -1;
+    quiet[2].opaque = htonl(12);
+    quiet[2].opcode = PROTOCOL_BINARY_CMD_GETQ;
+    quiet[2].dup    = -1;
+    d.bin_quiet_num = 3;
+
+    quiet_conn_init(&uc);
+
+    ptd.stats.stats.tot_multiget_bytes_dedupe = 0;
+
+    it = bin_getkq_response(htonl(1), "b", "world");
+    b2b_quiet_response(&d, &uc, it);
+
+    fail_unless(uc.ileft == 2, "two responses");
+    fail_unless(uc.ilist[0] == it, "first sent as-is");
+    res = (protocol_binary_response_header *) ITEM_data(uc.ilist[0]);
+    fail_unless(res->response.opaque == htonl(10), "first opaque");
+    fail_unless(ntohs(res->response.keylen) == 1, "first keylen");
+
+    res = (protocol_binary_response_header *) ITEM_data(uc.ilist[1]);
+    fail_unless(res->response.opaque == htonl(12), "dup opaque");
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GETQ,
+                "dup opcode");
+    fail_unless(res->response.keylen == 0, "dup keylen");
+    fail_unless(memcmp(ITEM_data(uc.ilist[1]) + sizeof(*res) + 4,
+                       "world", 5) == 0, "dup value");
+    fail_unless(ptd.stats.stats.tot_multiget_bytes_dedupe ==
+                (uint64_t) uc.ilist[1]->nbytes, "dedupe bytes");
+    item_remove(it);
+    quiet_conn_stop(&uc);
+
+    /* A response to another request, like the NOOP, passes through. */
+
+    quiet_conn_init(&uc);
+
+    it = bin_getkq_response(htonl(4), "c", "x");
+    b2b_quiet_response(&d, &uc, it);
+
+    fail_unless(uc.ileft == 1, "passed through");
+    fail_unless(uc.ilist[0] == it, "as-is");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    fail_unless(res->response.opaque == htonl(4), "opaque untouched");
+    item_remove(it);
+    quiet_conn_stop(&uc);
+
+    front_cache_stop(&p);
+}
+END_TEST
+
+START_TEST(test_mux_unshare)
+{
+    LIBEVENT_THREAD thread;
+    zstored_downstream_conns *conns;
+    proxy_behavior behavior;
+    proxy_td ptd;
+    downstream d1;
+    downstream d2;
+    conn uc;
+    conn dc;
+    item *it;
+
+    memset(&thread, 0, sizeof(thread));
+    thread.base = event_base_new();
+    thread.conn_hash = genhash_init(4, strhash_ops);
+    fail_unless(thread.base != NULL && thread.conn_hash != NULL, "thread");
+
+    memset(&behavior, 0, sizeof(behavior));
+    behavior.downstream_conn_max = 1;
+    behavior.downstream_conn_multiplex = 4;
+    behavior.downstream_conn_coalesce = 1;
+
+    memset(&ptd, 0, sizeof(ptd));
+
+    memset(&uc, 0, sizeof(uc));
+    memset(&d1, 0, sizeof(d1));
+    d1.ptd = &ptd;
+    d1.upstream_conn = &uc;
+    d2 = d1;
+
+    /* Just enough of a connected, idle downstream conn. */
+
+    memset(&dc, 0, sizeof(dc));
+    dc.sfd = -1;
+    dc.state = conn_pause;
+    dc.thread = &thread;
+    dc.host_ident = strdup("h:11211");
+
+    conns = zstored_get_downstream_conns(&thread, dc.host_ident);
+    fail_unless(conns != NULL, "conns");
+
+    zstored_park_downstream_conn(conns, &dc);
+
+    /* The only conn, per downstream_conn_max, becomes shared, */
+    /* so there's none left for a request that can't share it. */
+
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d1, conns,
+                                                       &behavior,
+                                                       true) == &dc,
+                "shared acquire");
+    fail_unless(dc.mux != NULL, "shared");
+    fail_unless(ptd.stats.stats.tot_downstream_mux_conn == 1, "mux conn");
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d2, conns,
+                                                       &behavior,
+                                                       false) == NULL,
+                "no exclusive conn while shared");
+
+    /* Once the shared request finishes, the conn goes back */
+    /* to the pool, for the exclusive request. */
+
+    conn_set_state(&dc, conn_new_cmd);
+    zstored_mux_release(&dc, &d1);
+
+    fail_unless(dc.mux == NULL, "unshared");
+    fail_unless(dc.state == conn_pause, "parked");
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d2, conns,
+                                                       &behavior,
+                                                       false) == &dc,
+                "exclusive acquire");
+    fail_unless(dc.extra == &d2, "exclusive");
+
+    /* A shared conn stays shared while any request is in flight, */
+    /* where coalescing keeps the requests queued in their slots. */
+
+    dc.extra = NULL;
+    zstored_park_downstream_conn(conns, &dc);
+
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d1, conns,
+                                                       &behavior,
+                                                       true) == &dc,
+                "shared acquire");
+    conn_set_state(&dc, conn_new_cmd);
+
+    it = bin_request(PROTOCOL_BINARY_CMD_GET, 1, "a");
+    fail_unless(cproxy_mux_send(&dc, &d1, it), "send");
+    item_remove(it);
+
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d2, conns,
+                                                       &behavior,
+                                                       true) == &dc,
+                "shared again");
+
+    it = bin_request(PROTOCOL_BINARY_CMD_GET, 2, "b");
+    fail_unless(cproxy_mux_send(&dc, &d2, it), "send");
+    item_remove(it);
+
+    zstored_mux_release(&dc, &d1);
+    fail_unless(dc.mux != NULL, "still shared");
+
+    zstored_mux_release(&dc, &d2);
+    fail_unless(dc.mux == NULL, "unshared");
+    fail_unless(zstored_acquire_pooled_downstream_conn(&d2, conns,
+                                                       &behavior,
+                                                       false) == &dc,
+                "exclusive acquire");
+
+    free(dc.host_ident);
+    genhash_free(thread.conn_hash);
+    event_base_free(thread.base);
+}
+END_TEST
+
+START_TEST(test_hedge_sample)
+{
+    proxy_td ptd;
+    int i;
+
+    memset(&ptd, 0, sizeof(ptd));
+    ptd.behavior_pool.base.hedge_get_percentile = 90;
+
+    /* The hedge_delay is only known after HEDGE_SAMPLES. */
+
+    for (i = HEDGE_SAMPLES - 1; i > 0; i--) {
+        cproxy_hedge_sample(&ptd, i * 10);
+    }
+    fail_unless(ptd.hedge_delay == 0, "not yet known");
+
+    cproxy_hedge_sample(&ptd, 0);
+    fail_unless(ptd.hedge_delay == (HEDGE_SAMPLES * 90 / 100) * 10,
+                "percentile");
+
+    /* Then it's recomputed from each next HEDGE_SAMPLES. */
+
+    for (i = 0; i < HEDGE_SAMPLES - 1; i++) {
+        cproxy_hedge_sample(&ptd, 5);
+    }
+    fail_unless(ptd.hedge_delay == (HEDGE_SAMPLES * 90 / 100) * 10,
+                "unchanged until the next samples");
+
+    cproxy_hedge_sample(&ptd, 1000000);
+    fail_unless(ptd.hedge_delay == 5, "recomputed");
+
+    /* A zero latency still hedges, after a usec. */
+
+    for (i = 0; i < HEDGE_SAMPLES; i++) {
+        cproxy_hedge_sample(&ptd, 0);
+    }
+    fail_unless(ptd.hedge_delay == 1, "at least a usec");
+
+    /* A latency too big for the samples is clamped. */
+
+    ptd.behavior_pool.base.hedge_get_percentile = 99;
+    for (i = 0; i < HEDGE_SAMPLES; i++) {
+        cproxy_hedge_sample(&ptd, 0x100000000ULL);
+    }
+    fail_unless(ptd.hedge_delay == UINT32_MAX, "clamped");
+
+    /* No percentile turns hedging off. */
+
+    ptd.behavior_pool.base.hedge_get_percentile = 0;
+    for (i = 0; i < HEDGE_SAMPLES; i++) {
+        cproxy_hedge_sample(&ptd, 5);
+    }
+    fail_unless(ptd.hedge_delay == 0, "off");
+}
+END_TEST
+
+START_TEST(test_b2b_hedge_reply_item)
+{
+    protocol_binary_response_header *res;
+    item *it;
+    item *out;
+
+    /* A replica's reply to the upstream's GETK keeps the key. */
+
+    it = bin_getkq_response(htonl(7), "key", "hello");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    res->response.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+
+    out = b2b_hedge_reply_item(it, PROTOCOL_BINARY_CMD_GETK);
+    fail_unless(out == it, "as-is");
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GETK, "opcode");
+    fail_unless(ntohs(res->response.keylen) == 3, "keylen");
+    fail_unless(ntohl(res->response.bodylen) == 4 + 3 + 5, "bodylen");
+    item_remove(out);
+
+    /* A replica's reply to the upstream's GET loses the key. */
+
+    it = bin_getkq_response(htonl(8), "key", "hello");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    res->response.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+    res->response.cas = mc_swap64(0x77);
+
+    out = b2b_hedge_reply_item(it, PROTOCOL_BINARY_CMD_GET);
+    fail_unless(out != it, "a copy");
+
+    res = (protocol_binary_response_header *) ITEM_data(out);
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GET, "opcode");
+    fail_unless(res->response.keylen == 0, "keylen");
+    fail_unless(res->response.extlen == 4, "extlen");
+    fail_unless(ntohl(res->response.bodylen) == 4 + 5, "bodylen");
+    fail_unless(res->response.opaque == htonl(8), "opaque");
+    fail_unless(mc_swap64(res->response.cas) == 0x77, "cas");
+    fail_unless(out->nbytes == (int) sizeof(*res) + 4 + 5, "nbytes");
+    fail_unless(memcmp(ITEM_data(out) + sizeof(*res) + 4,
+                       "hello", 5) == 0, "value");
+    item_remove(out);
+
+    /* A keyless reply, like an error, only gets its opcode. */
+
+    it = bin_get_response(0, 0, "");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    res->response.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+
+    out = b2b_hedge_reply_item(it, PROTOCOL_BINARY_CMD_GET);
+    fail_unless(out == it, "as-is");
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GET, "opcode");
+    item_remove(out);
+}
+END_TEST
+
+/* Sets up a downstream with a hedged GET, that's waiting on both */
+/* the master's conn, at index 0, and the replica's conn, at 1. */
+/* The conns are idle enough to be parked when they lose. */
+
+static void hedge_init(downstream *d, proxy_td *ptd, conn *uc,
+                       conn *dcs, conn **dconns,
+                       LIBEVENT_THREAD *thread) {
+    int i;
+
+    memset(d, 0, sizeof(*d));
+    memset(uc, 0, sizeof(*uc));
+
+    uc->cmd = PROTOCOL_BINARY_CMD_GET;
+
+    for (i = 0; i < 2; i++) {
+        memset(&dcs[i], 0, sizeof(conn));
+        dcs[i].sfd = -1;
+        dcs[i].state = conn_pause;
+        dcs[i].thread = thread;
+        dcs[i].host_ident = i == 0 ? "master:11210" : "replica:11210";
+        dcs[i].extra = d;
+        dconns[i] = &dcs[i];
+    }
+
+    d->ptd = ptd;
+    d->upstream_conn = uc;
+    d->mst.nservers = 2;
+    d->downstream_conns = dconns;
+    d->downstream_used = 2;
+    d->hedge_state = HEDGE_SENT;
+    d->hedge_master = 0;
+    d->hedge_replica = 1;
+    d->hedge_start = usec_now();
+}
+
+START_TEST(test_b2b_hedge_reply)
+{
+    protocol_binary_response_header *res;
+    LIBEVENT_THREAD thread;
+    proxy_td ptd;
+    downstream d;
+    conn uc;
+    conn dcs[2];
+    conn *dconns[2];
+    item *it;
+    item *orig;
+
+    memset(&thread, 0, sizeof(thread));
+    thread.base = event_base_new();
+    thread.conn_hash = genhash_init(4, strhash_ops);
+    fail_unless(thread.base != NULL && thread.conn_hash != NULL, "thread");
+
+    memset(&ptd, 0, sizeof(ptd));
+    ptd.behavior_pool.base.hedge_get_percentile = 90;
+
+    /* The master answers before any hedge was sent. */
+
+    hedge_init(&d, &ptd, &uc, dcs, dconns, &thread);
+    d.hedge_state = HEDGE_WATCH;
+    d.downstream_conns[1] = NULL;
+    d.downstream_used = 1;
+
+    it = bin_get_response(1, 0, "m");
+    fail_unless(b2b_hedge_reply(&d, &dcs[0], 0, &it), "master");
+    fail_unless(d.hedge_state == HEDGE_NONE, "done");
+    fail_unless(ptd.hedge_samples_num == 1, "sampled");
+    item_remove(it);
+
+    /* The master wins, so the replica's conn is let go. */
+
+    hedge_init(&d, &ptd, &uc, dcs, dconns, &thread);
+
+    it = bin_get_response(1, 0, "m");
+    orig = it;
+    fail_unless(b2b_hedge_reply(&d, &dcs[0], 0, &it), "master wins");
+    fail_unless(it == orig, "as-is");
+    fail_unless(d.hedge_state == HEDGE_NONE, "done");
+    fail_unless(ptd.hedge_samples_num == 2, "sampled");
+    fail_unless(ptd.stats.stats.tot_hedge_get_wasted == 1, "wasted");
+    fail_unless(d.downstream_conns[0] == &dcs[0], "master kept");
+    fail_unless(d.downstream_conns[1] == NULL, "replica let go");
+    fail_unless(d.downstream_used == 1, "used");
+    fail_unless(dcs[1].extra == NULL, "replica parked");
+    item_remove(it);
+
+    /* A not-my-vbucket from the master leaves the hedge going, */
+    /* as the replica might still win against the master's retry. */
+
+    hedge_init(&d, &ptd, &uc, dcs, dconns, &thread);
+
+    it = bin_get_response(0, 0, "");
+    fail_unless(b2b_hedge_reply(&d, &dcs[0],
+                                PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET,
+                                &it), "not-my-vbucket");
+    fail_unless(d.hedge_state == HEDGE_SENT, "still hedged");
+    fail_unless(d.downstream_conns[1] == &dcs[1], "replica kept");
+    fail_unless(d.downstream_used == 2, "used");
+    fail_unless(ptd.hedge_samples_num == 2, "not sampled");
+    item_remove(it);
+
+    /* A replica error is dropped while the master is still live. */
+
+    it = bin_get_response(0, 0, "");
+    fail_if(b2b_hedge_reply(&d, &dcs[1],
+                            PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
+                            &it), "replica error dropped");
+    fail_unless(d.hedge_state == HEDGE_WATCH, "back to the master");
+    fail_unless(d.downstream_conns[0] == &dcs[0], "master kept");
+    fail_unless(ptd.stats.stats.tot_hedge_get_wasted == 2, "wasted");
+    item_remove(it);
+
+    /* But goes upstream once the master went away. */
+
+    hedge_init(&d, &ptd, &uc, dcs, dconns, &thread);
+    d.downstream_conns[0] = NULL;
+    d.downstream_used = 1;
+
+    it = bin_get_response(0, 0, "");
+    fail_unless(b2b_hedge_reply(&d, &dcs[1],
+                                PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
+                                &it), "replica error");
+    fail_unless(d.hedge_state == HEDGE_NONE, "done");
+    fail_unless(ptd.stats.stats.tot_hedge_get_win == 0, "not a win");
+    item_remove(it);
+
+    /* The replica wins, so the master's conn is let go, and the */
+    /* reply looks like one to the upstream's GET. */
+
+    hedge_init(&d, &ptd, &uc, dcs, dconns, &thread);
+    d.upstream_retry = 1;
+
+    it = bin_getkq_response(htonl(9), "key", "hello");
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    res->response.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+
+    fail_unless(b2b_hedge_reply(&d, &dcs[1], 0, &it), "replica wins");
+    fail_unless(d.hedge_state == HEDGE_NONE, "done");
+    fail_unless(ptd.stats.stats.tot_hedge_get_win == 1, "win");
+    fail_unless(d.upstream_retry == 0, "no retry");
+    fail_unless(d.downstream_conns[0] == NULL, "master let go");
+    fail_unless(d.downstream_conns[1] == &dcs[1], "replica kept");
+    fail_unless(d.downstream_used == 1, "used");
+    fail_unless(dcs[0].extra == NULL, "master parked");
+
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    fail_unless(res->response.opcode == PROTOCOL_BINARY_CMD_GET, "opcode");
+    fail_unless(res->response.keylen == 0, "keylen");
+    fail_unless(ntohl(res->response.bodylen) == 4 + 5, "bodylen");
+    item_remove(it);
+
+    genhash_free(thread.conn_hash);
+    event_base_free(thread.base);
+}
+END_TEST
+
+static void breaker_find(const breaker_info *info, void *userdata) {
+    breaker_info *found = userdata;
+
+    if (strcmp(info->host_ident, found->host_ident) == 0) {
+        *found = *info;
+    }
+}
+
+static breaker_info breaker_get_info(const char *host_ident) {
+    breaker_info info;
+
+    memset(&info, 0, sizeof(info));
+    info.host_ident = host_ident;
+    info.state = BREAKER_CLOSED;
+
+    cproxy_breaker_visit(breaker_find, &info);
+
+    return info;
+}
+
+/* Reports errors until the breaker opens. */
+
+static void breaker_trip(const char *host_ident, proxy_behavior *b) {
+    uint32_t i;
+
+    fail_unless(cproxy_breaker_allow(host_ident, b), "allow");
+
+    for (i = 0; i < b->connect_max_errors; i++) {
+        fail_if(cproxy_breaker_report(host_ident, true), "not yet open");
+    }
+
+    fail_unless(cproxy_breaker_report(host_ident, true), "tripped");
+}
+
+START_TEST(test_breaker)
+{
+    proxy_behavior b;
+    breaker_info info;
+    const char *h = "breaker:1";
+
+    cproxy_breaker_init();
+
+    memset(&b, 0, sizeof(b));
+    b.cycle = 10;
+    b.connect_max_errors = 3;
+    b.connect_retry_interval = 1000;
+    b.connect_retry_interval_max = 0;
+
+    msec_current_time = 100000;
+
+    /* Closed, until more than connect_max_errors errors, where */
+    /* a success in between starts the count over. */
+
+    fail_unless(cproxy_breaker_allow(h, &b), "closed");
+    fail_if(cproxy_breaker_report(h, true), "1 error");
+    fail_if(cproxy_breaker_report(h, true), "2 errors");
+    fail_if(cproxy_breaker_report(h, false), "success");
+    fail_unless(breaker_get_info(h).errors == 0, "errors reset");
+
+    breaker_trip(h, &b);
+
+    info = breaker_get_info(h);
+    fail_unless(info.state == BREAKER_OPEN, "open");
+    fail_unless(info.trips == 1, "trips");
+    fail_unless(info.tot_trips == 1, "tot_trips");
+
+    /* Without a cap above the interval, there's no backoff and */
+    /* no jitter, like the old per-thread blacklist. */
+
+    fail_unless(info.open_msecs == 1000, "open for the interval");
+
+    /* Open fails fast, and late errors don't extend it. */
+
+    fail_if(cproxy_breaker_allow(h, &b), "fast fail");
+    msec_current_time += 999;
+    fail_if(cproxy_breaker_allow(h, &b), "fast fail");
+    fail_if(cproxy_breaker_report(h, true), "late error");
+    fail_unless(breaker_get_info(h).tot_fast_fails == 2, "tot_fast_fails");
+
+    /* Half-open allows one trial, until the trial reports back */
+    /* or a retry interval passes without it reporting back. */
+
+    msec_current_time += 1;
+    fail_unless(cproxy_breaker_allow(h, &b), "trial");
+    fail_unless(breaker_get_info(h).state == BREAKER_HALF_OPEN, "half-open");
+    fail_if(cproxy_breaker_allow(h, &b), "one trial only");
+    msec_current_time += 999;
+    fail_if(cproxy_breaker_allow(h, &b), "one trial only");
+    msec_current_time += 1;
+    fail_unless(cproxy_breaker_allow(h, &b), "trial re-armed");
+    fail_if(cproxy_breaker_allow(h, &b), "one trial only");
+
+    /* A failed trial re-opens, for the same interval again. */
+
+    fail_unless(cproxy_breaker_report(h, true), "re-opened");
+    info = breaker_get_info(h);
+    fail_unless(info.state == BREAKER_OPEN, "open");
+    fail_unless(info.trips == 2, "trips");
+    fail_unless(info.open_msecs == 1000, "no backoff");
+
+    /* A successful trial closes. */
+
+    msec_current_time += 1000;
+    fail_unless(cproxy_breaker_allow(h, &b), "trial");
+    fail_if(cproxy_breaker_report(h, false), "success");
+
+    info = breaker_get_info(h);
+    fail_unless(info.state == BREAKER_CLOSED, "closed");
+    fail_unless(info.trips == 0, "trips reset");
+    fail_unless(cproxy_breaker_allow(h, &b), "closed");
+    fail_unless(cproxy_breaker_allow(h, &b), "closed");
+
+    /* Off when there's no connect_max_errors. */
+
+    b.connect_max_errors = 0;
+    fail_unless(cproxy_breaker_allow("breaker:off", &b), "off");
+    fail_if(cproxy_breaker_report("breaker:off", true), "off");
+}
+END_TEST
+
+START_TEST(test_breaker_backoff)
+{
+    proxy_behavior b;
+    breaker_info info;
+    const char *h = "breaker:2";
+    uint64_t lo[] = { 50, 100, 200, 200, 200 };
+    uint64_t hi[] = { 100, 200, 400, 400, 400 };
+    int i;
+
+    cproxy_breaker_init();
+
+    memset(&b, 0, sizeof(b));
+    b.cycle = 10;
+    b.connect_max_errors = 1;
+    b.connect_retry_interval = 100;
+    b.connect_retry_interval_max = 400;
+
+    msec_current_time = 200000;
+
+    breaker_trip(h, &b);
+
+    /* Each failed trial doubles the open time, up to the cap, */
+    /* where the jitter takes it down by up to a half. */
+
+    for (i = 0; i < 5; i++) {
+        info = breaker_get_info(h);
+        fail_unless(info.state == BREAKER_OPEN, "open");
+        fail_unless(info.trips == (uint32_t) i + 1, "trips");
+        fail_unless(info.open_msecs >= lo[i] &&
+                    info.open_msecs <= hi[i], "backoff");
+
+        msec_current_time += info.open_msecs;
+        fail_unless(cproxy_breaker_allow(h, &b), "trial");
+        fail_unless(cproxy_breaker_report(h, true), "re-opened");
+    }
+
+    /* A successful trial ends the backoff. */
+
+    msec_current_time += breaker_get_info(h).open_msecs;
+    fail_unless(cproxy_breaker_allow(h, &b), "trial");
+    fail_if(cproxy_breaker_report(h, false), "success");
+
+    breaker_trip(h, &b);
+
+    info = breaker_get_info(h);
+    fail_unless(info.trips == 1, "trips");
+    fail_unless(info.open_msecs >= 50 && info.open_msecs <= 100,
+                "backoff starts over");
+}
+END_TEST
+
 static Suite* moxi_suite(void)
 {
     Suite *s = suite_create("moxi");
@@ -451,7 +1839,21 @@ static Suite* moxi_suite(void)
     tcase_add_test(tc_core, test_whitespace);
     tcase_add_test(tc_core, test_parse_behavior);
     tcase_add_test(tc_core, test_mcache);
+    tcase_add_test(tc_core, test_mcache_shards);
+    tcase_add_test(tc_core, test_mcache_admission);
+    tcase_add_test(tc_core, test_mcache_max_bytes);
+    tcase_add_test(tc_core, test_mcache_grace);
     tcase_add_test(tc_core, test_matcher);
+    tcase_add_test(tc_core, test_front_cache_miss);
+    tcase_add_test(tc_core, test_b2b_front_cache_response);
+    tcase_add_test(tc_core, test_b2b_front_cache_update);
+    tcase_add_test(tc_core, test_b2b_quiet_response);
+    tcase_add_test(tc_core, test_mux_unshare);
+    tcase_add_test(tc_core, test_breaker);
+    tcase_add_test(tc_core, test_breaker_backoff);
+    tcase_add_test(tc_core, test_hedge_sample);
+    tcase_add_test(tc_core, test_b2b_hedge_reply_item);
+    tcase_add_test(tc_core, test_b2b_hedge_reply);
     suite_add_tcase(s, tc_core);
 
     return s;
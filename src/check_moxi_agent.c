@@ -170,10 +170,32 @@ struct field_description proxy_stats_description[] = {
   describe_field(struct proxy_stats, tot_multiget_keys),
   describe_field(struct proxy_stats, tot_multiget_keys_dedupe),
   describe_field(struct proxy_stats, tot_multiget_bytes_dedupe),
+  describe_field(struct proxy_stats, tot_front_cache_miss_hits),
+  describe_field(struct proxy_stats, tot_front_cache_miss_adds),
   describe_field(struct proxy_stats, tot_optimize_sets),
   describe_field(struct proxy_stats, err_oom),
   describe_field(struct proxy_stats, err_upstream_write_prep),
   describe_field(struct proxy_stats, err_downstream_write_prep),
+  describe_field(struct proxy_stats, tot_downstream_mux_conn),
+  describe_field(struct proxy_stats, tot_downstream_mux_request),
+  describe_field(struct proxy_stats, tot_downstream_mux_orphan),
+  describe_field(struct proxy_stats, tot_downstream_mux_batch),
+  describe_field(struct proxy_stats, tot_downstream_mux_batch_requests),
+  describe_field(struct proxy_stats, tot_downstream_conn_prewarm),
+  describe_field(struct proxy_stats, tot_downstream_conn_prewarm_failed),
+  describe_field(struct proxy_stats, tot_downstream_conn_probe),
+  describe_field(struct proxy_stats, tot_downstream_conn_probe_failed),
+  describe_field(struct proxy_stats, tot_downstream_conn_idle_closed),
+  describe_field(struct proxy_stats, tot_hedge_get),
+  describe_field(struct proxy_stats, tot_hedge_get_win),
+  describe_field(struct proxy_stats, tot_hedge_get_wasted),
+  describe_field(struct proxy_stats, tot_hedge_get_skipped),
+  describe_field(struct proxy_stats, tot_get_coalesced),
+  describe_field(struct proxy_stats, tot_stream_values),
+  describe_field(struct proxy_stats, tot_stream_bytes),
+  describe_field(struct proxy_stats, tot_stream_splice_bytes),
+  describe_field(struct proxy_stats, tot_pipelined_gets),
+  describe_field(struct proxy_stats, tot_downstream_connect_unresolved),
   describe_field(struct proxy_stats, tot_cmd_time),
   describe_field(struct proxy_stats, tot_cmd_count),
   describe_field(struct proxy_stats, tot_local_cmd_time),
@@ -425,6 +447,105 @@ START_TEST(test_cmd_stats_gathering)
 }
 END_TEST
 
+START_TEST(test_cmd_stats_snapshot_gathering)
+{
+  char *ca[] = {
+    "pools",
+    "poolx",
+    NULL,
+    "behavior-poolx",
+    "port_listen=11411",
+    "stats_snapshot_interval=1000",
+    NULL,
+    "pool-poolx",
+    "svr1",
+    NULL,
+    "svr-svr1",
+    "host=localhost",
+    "port=11211",
+    NULL,
+    NULL
+  };
+
+  kvpair_t *c = mk_kvpairs(ca);
+  proxy_stats_td collected_stats;
+  int i,j,t;
+
+  on_conflate_new_config(pmain, c);
+
+  proxy *proxy = pmain->proxy_head;
+  ck_assert(proxy != NULL);
+  ck_assert(proxy->next == NULL);
+  ck_assert(proxy->behavior_pool.base.stats_snapshot_interval == 1000);
+
+  ck_assert(pmain->nthreads >= 2);
+
+  reset_random();
+  for (t = 1; t < 3; t++) {
+    randomize_uint64t_struct(&(proxy->thread_data[t].stats.stats),
+                             proxy_stats_description,
+                             sizeof(proxy_stats_description));
+    for (i = 0; i < STATS_CMD_TYPE_last; i++) {
+      for (j = 0; j < STATS_CMD_last; j++) {
+        randomize_uint64t_struct(&(proxy->thread_data[t].stats.stats_cmd[i][j]),
+                                 proxy_stats_cmd_description,
+                                 sizeof(proxy_stats_cmd_description));
+      }
+    }
+  }
+
+  redirected_conflate_add_field_target = gathering_conflate_add_field;
+  redirected_collect_memcached_stats_for_proxy_target =
+    cmd_stats_gathering_collect_memcached_stats_for_proxy;
+
+  /* First, collect from the workers, the old way. */
+
+  proxy->behavior_pool.base.stats_snapshot_interval = 0;
+
+  memset(&gathered_stats, 0, sizeof(gathered_stats));
+  on_conflate_get_stats(pmain, NULL, "get-stats", true, NULL,
+                        (conflate_form_result *)(intptr_t)gathering_conflate_add_field);
+
+  collected_stats = gathered_stats;
+
+  /* Then, merge what the workers published. */
+
+  proxy->behavior_pool.base.stats_snapshot_interval = 1000;
+
+  for (t = 1; t < 3; t++) {
+    ck_assert(cproxy_stats_publish(&proxy->thread_data[t]));
+  }
+
+  memset(&gathered_stats, 0, sizeof(gathered_stats));
+  on_conflate_get_stats(pmain, NULL, "get-stats", true, NULL,
+                        (conflate_form_result *)(intptr_t)gathering_conflate_add_field);
+
+  for (i = 0; i < STATS_CMD_TYPE_last; i++) {
+    for (j = 0; j < STATS_CMD_last; j++) {
+      for (t = 0; t < arsize(proxy_stats_cmd_description); t++) {
+    uint64_t old = field_read(&(collected_stats.stats_cmd[i][j]),
+                              proxy_stats_cmd_description + t);
+    uint64_t result = field_read(&(gathered_stats.stats_cmd[i][j]),
+                                 proxy_stats_cmd_description + t);
+    fail_unless(result == old,
+                "comparing snapshot command stats for %s(%d).%s: 0x%llx = 0x%llx\n",
+                cmd_names[j], i, proxy_stats_cmd_description[t].name, result, old);
+      }
+    }
+  }
+
+  for (t = 0; t < arsize(proxy_stats_description); t++) {
+    uint64_t old = field_read(&(collected_stats.stats),
+                              proxy_stats_description + t);
+    uint64_t result = field_read(&(gathered_stats.stats),
+                                 proxy_stats_description + t);
+    fail_unless(result == old,
+                "comparing snapshot stats field %s. 0x%llx = 0x%llx\n",
+                proxy_stats_description[t].name, result, old);
+  }
+}
+END_TEST
+
 START_TEST(test_easy_reconfig)
 {
   char *ca[] = {
@@ -570,6 +691,7 @@ static Suite* moxi_agent_suite(void)
     tcase_add_test(tc_core, test_first_config);
     tcase_add_test(tc_core, test_easy_reconfig);
     tcase_add_test(tc_core, test_cmd_stats_gathering);
+    tcase_add_test(tc_core, test_cmd_stats_snapshot_gathering);
     suite_add_tcase(s, tc_core);
 
     return s;
@@ -5,6 +5,10 @@
 #cmakedefine HAVE_UMEM_H ${HAVE_UMEM_H}
 #cmakedefine HAVE_SYSEXITS_H ${HAVE_SYSEXITS_H}
 
+#cmakedefine HAVE_SPLICE ${HAVE_SPLICE}
+#cmakedefine HAVE_EVENTFD ${HAVE_EVENTFD}
+#cmakedefine HAVE_IO_URING ${HAVE_IO_URING}
+
 #include <platform/platform.h>
 
 #ifdef WIN32
@@ -17,6 +17,10 @@
 #define MOXI_BLOCKING_CONNECT false
 #endif
 
+/* How often downstreams waiting on an unresolved address retry. */
+
+#define ZSTORED_RESOLVE_RETRY_MSECS 10
+
 /* Internal forward declarations. */
 
 downstream *downstream_list_remove(downstream *head, downstream *d);
@@ -51,12 +55,26 @@ int init_mcs_st(mcs_st *mst, char *config,
                 const char *opts);
 
 bool cproxy_on_connect_downstream_conn(conn *c);
+bool cproxy_on_auth_downstream_conn(conn *c);
+
+bool cproxy_auth_downstream_conn_start(downstream *d, mcs_server_st *msst,
+                                       proxy_behavior *behavior, conn *c);
+
+bool cproxy_connect_downstream_conn_ready(downstream *d, conn *c);
+bool cproxy_connect_downstream_conn_failed(downstream *d, conn *c);
+
+void cproxy_prewarm_server(downstream *d, LIBEVENT_THREAD *thread, int i);
+void cproxy_prewarm_skip(downstream *d, int i);
+void cproxy_prewarm_check_done(downstream *d);
+void cproxy_prewarm_conn_ready(downstream *d, conn *c);
+void cproxy_prewarm_conn_failed(downstream *d, int k);
 
 conn *zstored_acquire_downstream_conn(downstream *d,
                                       LIBEVENT_THREAD *thread,
                                       mcs_server_st *msst,
                                       proxy_behavior *behavior,
-                                      bool *downstream_conn_max_reached);
+                                      bool *downstream_conn_max_reached,
+                                      bool *downstream_unresolved);
 
 void zstored_release_downstream_conn(conn *dc, bool closing);
 
@@ -70,23 +88,120 @@ bool zstored_downstream_waiting_add(downstream *d, LIBEVENT_THREAD *thread,
 
 bool zstored_downstream_waiting_remove(downstream *d);
 
+/* The ports with per-worker SO_REUSEPORT listeners (see the */
+/* listen_reuseport behavior), which aren't on the listen_conn */
+/* list.  Only used by the main listen thread. */
+
+typedef struct reuseport_listener reuseport_listener;
+
+struct reuseport_listener {
+    int                 port;
+    conn_funcs         *funcs;
+    int                 listening;
+    reuseport_listener *next;
+};
+
+static reuseport_listener *reuseport_listeners = NULL;
+
+/* A shared, multiplexed downstream conn (see the */
+/* downstream_conn_multiplex behavior) tracks each in-flight */
+/* request in a slot, keyed by the opaque that we sent downstream. */
+
 typedef struct {
+    uint32_t    opaque;      /* Opaque sent downstream, 0 when slot is free. */
+    uint32_t    opaque_orig; /* Opaque of the upstream's request. */
+    downstream *d;           /* NULL when the downstream has gone away. */
+    item       *it;          /* Request not yet written, or NULL. */
+    protocol_binary_request_header hdr; /* Copy of request header, */
+                                        /* but with our opaque. */
+} zstored_mux_slot;
+
+typedef struct zstored_mux zstored_mux;
+
+struct zstored_mux {
+    conn             *dc;
+    uint32_t          opaque_next;
+    uint32_t          slots_max;
+    uint32_t          slots_used;
+    bool              coalesce; /* See downstream_conn_coalesce. */
+    zstored_mux_slot *slots; /* Array, size is slots_max. */
+    zstored_mux      *next;
+};
+
+struct zstored_downstream_conns {
     conn      *dc;          /* Linked-list of available downstream conns. */
     uint32_t   dc_acquired; /* Count of acquired (in-use) downstream conns. */
     char      *host_ident;
     uint32_t   error_count;
     uint64_t   error_time;
 
+    zstored_mux *mux; /* Linked-list of shared downstream conns, which */
+                      /* are also counted in dc_acquired. */
+
+    /* Health checking of the idle downstream conns, per the */
+    /* downstream_conn_probe_interval and downstream_conn_idle_max */
+    /* behaviors of the ptd that last released a conn here.  A conn */
+    /* being probed is off the dc list, but counted in dc_acquired. */
+
+    LIBEVENT_THREAD *thread;
+    proxy_td        *ptd;
+    struct event     probe_event;
+    bool             probe_armed;
+
+    /* Fires once per event loop iteration that queued requests onto */
+    /* the shared downstream conns, per downstream_conn_coalesce. */
+
+    struct event     flush_event;
+    bool             flush_armed;
+
+    /* Retries the waiting downstreams while the host's address */
+    /* is still being resolved, see zstored_resolve_arm(). */
+
+    struct event     resolve_event;
+    bool             resolve_armed;
+
     /* Head & tail of singly linked-list/queue, using */
     /* downstream->next_waiting pointers, where we've reached */
-    /* downstream_conn_max, so there are waiting downstreams. */
+    /* downstream_conn_max, or are waiting on the resolver, */
+    /* so there are waiting downstreams. */
 
     downstream *downstream_waiting_head;
     downstream *downstream_waiting_tail;
-} zstored_downstream_conns;
+};
 
-zstored_downstream_conns *zstored_get_downstream_conns(LIBEVENT_THREAD *thread,
-                                                       const char *host_ident);
+bool zstored_mux_eligible(downstream *d, proxy_behavior *behavior,
+                          enum protocol downstream_protocol);
+
+conn *zstored_mux_find(zstored_downstream_conns *conns);
+
+void zstored_mux_create(conn *dc, zstored_downstream_conns *conns,
+                        proxy_behavior *behavior, downstream *d);
+
+bool zstored_mux_flush(conn *dc);
+
+bool zstored_mux_flush_arm(zstored_downstream_conns *conns);
+
+void zstored_mux_wake(conn *dc);
+
+bool zstored_mux_unshare(conn *dc, zstored_downstream_conns *conns);
+
+void zstored_mux_close(conn *dc);
+
+void cproxy_mux_on_pause(conn *dc);
+
+void zstored_downstream_waiting_fail(zstored_downstream_conns *conns);
+
+void zstored_breaker_report(const char *host_ident, bool has_error);
+
+void zstored_probe_arm(zstored_downstream_conns *conns);
+void zstored_resolve_arm(zstored_downstream_conns *conns);
+
+bool zstored_probe_start(zstored_downstream_conns *conns, conn *dc);
+
+bool cproxy_on_probe_downstream_conn(conn *c);
+
+void cproxy_on_close_downstream_conn_ex(conn *c, downstream *d,
+                                        bool conn_closed);
 
 bool cproxy_forward_or_error(downstream *d);
 
@@ -100,6 +215,7 @@ conn_funcs cproxy_listen_funcs = {
     .conn_init                   = cproxy_init_upstream_conn,
     .conn_close                  = NULL,
     .conn_connect                = NULL,
+    .conn_auth                   = NULL,
     .conn_process_ascii_command  = NULL,
     .conn_process_binary_command = NULL,
     .conn_complete_nread_ascii   = NULL,
@@ -114,11 +230,12 @@ conn_funcs cproxy_upstream_funcs = {
     .conn_init                   = NULL,
     .conn_close                  = cproxy_on_close_upstream_conn,
     .conn_connect                = NULL,
+    .conn_auth                   = NULL,
     .conn_process_ascii_command  = cproxy_process_upstream_ascii,
     .conn_process_binary_command = cproxy_process_upstream_binary,
     .conn_complete_nread_ascii   = cproxy_process_upstream_ascii_nread,
     .conn_complete_nread_binary  = cproxy_process_upstream_binary_nread,
-    .conn_pause                  = NULL,
+    .conn_pause                  = cproxy_on_pause_upstream_conn,
     .conn_realtime               = cproxy_realtime,
     .conn_state_change           = cproxy_upstream_state_change,
     .conn_binary_command_magic   = PROTOCOL_BINARY_REQ
@@ -128,6 +245,7 @@ conn_funcs cproxy_downstream_funcs = {
     .conn_init                   = cproxy_init_downstream_conn,
     .conn_close                  = cproxy_on_close_downstream_conn,
     .conn_connect                = cproxy_on_connect_downstream_conn,
+    .conn_auth                   = cproxy_on_auth_downstream_conn,
     .conn_process_ascii_command  = cproxy_process_downstream_ascii,
     .conn_process_binary_command = cproxy_process_downstream_binary,
     .conn_complete_nread_ascii   = cproxy_process_downstream_ascii_nread,
@@ -180,13 +298,25 @@ proxy *cproxy_create(proxy_main *main,
         cb_mutex_initialize(&p->proxy_lock);
 
         mcache_init(&p->front_cache, true, &mcache_item_funcs, true);
+        if (!mcache_shard(&p->front_cache,
+                          behavior_pool->base.front_cache_shards)) {
+            moxi_log_write("could not shard front cache\n");
+        }
         matcher_init(&p->front_cache_matcher, true);
         matcher_init(&p->front_cache_unmatcher, true);
+        matcher_init(&p->front_cache_miss_matcher, true);
 
         matcher_init(&p->optimize_set_matcher, true);
 
         if (behavior_pool->base.front_cache_max > 0 &&
             behavior_pool->base.front_cache_lifespan > 0) {
+            mcache_max_bytes(&p->front_cache,
+                             behavior_pool->base.front_cache_max_bytes,
+                             behavior_pool->base.front_cache_max_item_bytes);
+            mcache_grace(&p->front_cache,
+                         behavior_pool->base.front_cache_grace);
+            mcache_admission(&p->front_cache,
+                             behavior_pool->base.front_cache_admission > 0);
             mcache_start(&p->front_cache,
                          behavior_pool->base.front_cache_max);
 
@@ -199,6 +329,11 @@ proxy *cproxy_create(proxy_main *main,
                 matcher_start(&p->front_cache_unmatcher,
                               behavior_pool->base.front_cache_unspec);
             }
+
+            if (strlen(behavior_pool->base.front_cache_miss_spec) > 0) {
+                matcher_start(&p->front_cache_miss_matcher,
+                              behavior_pool->base.front_cache_miss_spec);
+            }
         }
 
         if (strlen(behavior_pool->base.optimize_set) > 0) {
@@ -245,11 +380,18 @@ proxy *cproxy_create(proxy_main *main,
 
                 cproxy_reset_stats_td(&ptd->stats);
 
+                cb_mutex_initialize(&ptd->snapshot_lock);
+
                 mcache_init(&ptd->key_stats, true,
                             &mcache_key_stats_funcs, false);
                 matcher_init(&ptd->key_stats_matcher, false);
                 matcher_init(&ptd->key_stats_unmatcher, false);
 
+                ptd->inflight_gets = genhash_init(128, skeyhash_ops);
+
+                ptd->splice_pipe[0] = -1;
+                ptd->splice_pipe[1] = -1;
+
                 if (behavior_pool->base.key_stats_max > 0 &&
                     behavior_pool->base.key_stats_lifespan > 0) {
                     mcache_start(&ptd->key_stats,
@@ -306,6 +448,7 @@ int cproxy_listen(proxy *p) {
 
         listening = cproxy_listen_port(p->port, listen_protocol,
                                        tcp_transport,
+                                       p->behavior_pool.base.listen_reuseport > 0,
                                        p,
                                        &cproxy_listen_funcs);
         if (listening > 0) {
@@ -343,12 +486,14 @@ int cproxy_listen(proxy *p) {
 int cproxy_listen_port(int port,
                        enum protocol protocol,
                        enum network_transport transport,
+                       bool        reuseport,
                        void       *conn_extra,
                        conn_funcs *funcs) {
 
     int   listening;
     conn *listen_conn_orig;
     conn *x;
+    reuseport_listener *r;
 
     cb_assert(port > 0 || settings.socketpath != NULL);
     cb_assert(conn_extra);
@@ -382,6 +527,18 @@ int cproxy_listen_port(int port,
         x = x->next;
     }
 
+    for (r = reuseport_listeners; r != NULL; r = r->next) {
+        if (r->port == port && r->funcs == funcs) {
+            if (settings.verbose > 1) {
+                moxi_log_write(
+                        "cproxy listening reusing %d thread listeners on port %d\n",
+                        r->listening, port);
+            }
+
+            listening += r->listening;
+        }
+    }
+
     if (listening > 0) {
         /* If we're already listening on the required port, then */
         /* we don't need to start a new server_socket().  This happens */
@@ -394,6 +551,40 @@ int cproxy_listen_port(int port,
 
         return listening;
     }
+
+    if (reuseport &&
+        settings.socketpath == NULL &&
+        !IS_UDP(transport)) {
+        /* Each worker thread accepts on its own listener, so new */
+        /* conns skip the hand-off from the main thread. */
+
+        r = calloc(1, sizeof(reuseport_listener));
+        if (r != NULL) {
+            listening = server_socket_reuseport(port, protocol,
+                                                funcs, conn_extra);
+            if (listening > 0) {
+                if (settings.verbose > 1) {
+                    moxi_log_write(
+                            "cproxy listening on port %d with %d thread listeners\n",
+                            port, listening);
+                }
+
+                r->port      = port;
+                r->funcs     = funcs;
+                r->listening = listening;
+                r->next      = reuseport_listeners;
+
+                reuseport_listeners = r;
+
+                return listening;
+            }
+
+            free(r);
+        }
+
+        moxi_log_write("could not listen with SO_REUSEPORT on port %d, "
+                       "so only the main thread listens\n", port);
+    }
 #ifdef HAVE_SYS_UN_H
     if (settings.socketpath ?
         (server_socket_unix(settings.socketpath, settings.access) == 0) :
@@ -571,6 +762,8 @@ void cproxy_on_close_upstream_conn(conn *c) {
     }
     c->extra = NULL;
 
+    cproxy_pipeline_free(c);
+
     if (ptd->stats.stats.num_upstream > 0) {
         ptd->stats.stats.num_upstream--;
     }
@@ -604,6 +797,12 @@ void cproxy_on_close_upstream_conn(conn *c) {
                 genhash_iter(d->multiget, multiget_remove_upstream, c);
             }
 
+            /* A downstream conn that's parked mid-value, waiting on */
+            /* this upstream conn, now just reads and drops the rest. */
+
+            c->stream = NULL;
+            a2a_stream_resume(d);
+
             /* The downstream conn's might have iov's that */
             /* point to the upstream conn's buffers.  Also, the */
             /* downstream conn might be in all sorts of states */
@@ -612,7 +811,9 @@ void cproxy_on_close_upstream_conn(conn *c) {
             /* half written. */
 
             /* The safest, but inefficient, thing to do then is */
-            /* to close any conn_mwrite downstream conns. */
+            /* to close any conn_mwrite downstream conns.  Shared */
+            /* downstream conns only point at their own buffers, */
+            /* so they're left alone. */
 
             ptd->stats.stats.tot_downstream_close_on_upstream_close++;
 
@@ -622,6 +823,7 @@ void cproxy_on_close_upstream_conn(conn *c) {
                 conn *downstream_conn = d->downstream_conns[i];
                 if (downstream_conn != NULL &&
                     downstream_conn != NULL_CONN &&
+                    downstream_conn->mux == NULL &&
                     downstream_conn->state == conn_mwrite) {
                     downstream_conn->msgcurr = 0;
                     downstream_conn->msgused = 0;
@@ -679,10 +881,7 @@ int delink_from_downstream_conns(conn *c) {
 }
 
 void cproxy_on_close_downstream_conn(conn *c) {
-    conn *uc_retry = NULL;
     downstream *d;
-    int k;
-    proxy_td *ptd;
 
     cb_assert(c != NULL);
     cb_assert(c->sfd >= 0);
@@ -692,6 +891,11 @@ void cproxy_on_close_downstream_conn(conn *c) {
         moxi_log_write("<%d cproxy_on_close_downstream_conn\n", c->sfd);
     }
 
+    if (c->mux != NULL) {
+        zstored_mux_close(c);
+        return;
+    }
+
     d = c->extra;
 
     /* Might have been set to NULL during cproxy_free_downstream(). */
@@ -706,11 +910,26 @@ void cproxy_on_close_downstream_conn(conn *c) {
         return;
     }
 
+    cproxy_on_close_downstream_conn_ex(c, d, true);
+}
+
+/* The conn_closed flag is false for the 2nd and later downstreams */
+/* of a closing, shared downstream conn, so that the conn itself is */
+/* only accounted for once. */
+
+void cproxy_on_close_downstream_conn_ex(conn *c, downstream *d,
+                                        bool conn_closed) {
+    conn *uc_retry = NULL;
+    pipeline *p = NULL;
+    int k;
+    proxy_td *ptd;
+
     k = delink_from_downstream_conns(c);
 
     c->extra = NULL;
 
-    if (c->thread != NULL &&
+    if (conn_closed &&
+        c->thread != NULL &&
         c->host_ident != NULL) {
         zstored_error_count(c->thread, c->host_ident, true);
     }
@@ -718,7 +937,8 @@ void cproxy_on_close_downstream_conn(conn *c) {
     ptd = d->ptd;
     cb_assert(ptd);
 
-    if (ptd->stats.stats.num_downstream_conn > 0) {
+    if (conn_closed &&
+        ptd->stats.stats.num_downstream_conn > 0) {
         ptd->stats.stats.num_downstream_conn--;
     }
 
@@ -848,8 +1068,24 @@ void cproxy_on_close_downstream_conn(conn *c) {
     /* is closed concurrently.  We then move to conn_pause, */
     /* and same as Case 1. */
 
+    /* The retry forwards the upstream's pipelined get's again, so */
+    /* they must not be flushed by the release. */
+
+    if (uc_retry != NULL) {
+        p = uc_retry->pipeline;
+        uc_retry->pipeline = NULL;
+    }
+
     cproxy_release_downstream_conn(d, c);
 
+    if (uc_retry != NULL) {
+        uc_retry->pipeline = p;
+
+        if (uc_retry->state == conn_closing) {
+            cproxy_pipeline_free(uc_retry);
+        }
+    }
+
     /* Setup a retry after unwinding the call stack. */
     /* We use the work_queue, because our caller, conn_close(), */
     /* is likely to blow away our fd if we try to reconnect */
@@ -963,6 +1199,7 @@ downstream *cproxy_reserve_downstream(proxy_td *ptd) {
         d->timeout_tv.tv_sec = 0;
         d->timeout_tv.tv_usec = 0;
         d->next_waiting = NULL;
+        d->waiting_resolve = false;
 
         if (cproxy_check_downstream_config(d)) {
             bool found;
@@ -1001,14 +1238,171 @@ bool cproxy_clear_timeout(downstream *d) {
     return rv;
 }
 
+void cproxy_clear_hedge(downstream *d) {
+    if (d->hedge_timer) {
+        evtimer_del(&d->hedge_event);
+        d->hedge_timer = false;
+    }
+
+    d->hedge_state = HEDGE_NONE;
+}
+
+static int cproxy_hedge_sample_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Tracks a binary GET latency, recomputing the hedge_delay */
+/* as the percentile of the latest HEDGE_SAMPLES. */
+
+void cproxy_hedge_sample(proxy_td *ptd, uint64_t usecs) {
+    uint32_t pct = ptd->behavior_pool.base.hedge_get_percentile;
+
+    ptd->hedge_samples[ptd->hedge_samples_num % HEDGE_SAMPLES] =
+        usecs < UINT32_MAX ? (uint32_t) usecs : UINT32_MAX;
+    ptd->hedge_samples_num++;
+
+    if (ptd->hedge_samples_num % HEDGE_SAMPLES == 0) {
+        uint32_t sorted[HEDGE_SAMPLES];
+
+        if (pct == 0 || pct >= 100) {
+            ptd->hedge_delay = 0;
+            return;
+        }
+
+        memcpy(sorted, ptd->hedge_samples, sizeof(sorted));
+        qsort(sorted, HEDGE_SAMPLES, sizeof(uint32_t),
+              cproxy_hedge_sample_cmp);
+
+        ptd->hedge_delay = sorted[(HEDGE_SAMPLES * pct) / 100];
+        if (ptd->hedge_delay == 0) {
+            ptd->hedge_delay = 1;
+        }
+    }
+}
+
+/* A hedge never waits on a connect or on downstream_conn_max, */
+/* so it only uses an already connected downstream conn. */
+
+conn *cproxy_hedge_acquire_downstream_conn(downstream *d,
+                                           LIBEVENT_THREAD *thread,
+                                           int server_index) {
+    enum protocol downstream_protocol;
+    zstored_downstream_conns *conns;
+    proxy_behavior *behavior;
+    mcs_server_st *msst;
+    conn *dc;
+
+    cb_assert(d != NULL);
+    cb_assert(d->upstream_conn != NULL);
+    cb_assert(server_index >= 0);
+    cb_assert(server_index < (int) mcs_server_count(&d->mst));
+
+    if (d->downstream_conns[server_index] != NULL) {
+        return NULL;
+    }
+
+    msst = mcs_server_index(&d->mst, server_index);
+    behavior = &d->behaviors_arr[server_index];
+
+    downstream_protocol =
+        d->upstream_conn->peer_protocol ?
+        d->upstream_conn->peer_protocol :
+        behavior->downstream_protocol;
+    if (!IS_BINARY(downstream_protocol)) {
+        return NULL;
+    }
+
+    conns = zstored_get_downstream_conns(thread,
+                                         mcs_server_st_ident(msst, false));
+    if (conns == NULL) {
+        return NULL;
+    }
+
+    dc = zstored_acquire_pooled_downstream_conn(d, conns, behavior,
+        zstored_mux_eligible(d, behavior, downstream_protocol));
+    if (dc != NULL) {
+        d->ptd->stats.stats.tot_downstream_conn_acquired++;
+        d->downstream_conns[server_index] = dc;
+    }
+
+    return dc;
+}
+
+/* Takes the losing, still busy downstream conn of a hedge away from */
+/* the downstream.  Unless it's shared, where its reply will just be */
+/* dropped, the conn is closed, as its reply is still on the way. */
+
+void cproxy_hedge_detach_downstream_conn(downstream *d, conn *c) {
+    int k;
+
+    k = downstream_conn_index(d, c);
+    if (k < 0) {
+        return;
+    }
+
+    d->downstream_conns[k] = NULL;
+    d->downstream_used--;
+
+    if (c->mux != NULL) {
+        zstored_mux_release(c, d);
+        return;
+    }
+
+    if (c->state != conn_pause &&
+        d->ptd->stats.stats.num_downstream_conn > 0) {
+        d->ptd->stats.stats.num_downstream_conn--;
+    }
+
+    zstored_release_downstream_conn(c, true);
+}
+
+/* The upstream conn of a partly relayed value can't be sent an */
+/* error, so it's closed, as is the downstream conn, which still */
+/* has the rest of the value unread. */
+
+static void cproxy_stream_abort(downstream *d) {
+    conn *dc = d->stream_conn;
+    conn *uc = d->upstream_conn;
+
+    d->stream_conn = NULL;
+    d->stream_left = 0;
+    d->stream_splice = false;
+    d->upstream_retry = 0;
+
+    if (dc->state != conn_closing) {
+        conn_set_state(dc, conn_closing);
+    }
+
+    if (uc != NULL) {
+        uc->stream = NULL;
+        uc->write_and_go = conn_new_cmd;
+        cproxy_close_conn(uc);
+    }
+}
+
 bool cproxy_release_downstream(downstream *d, bool force) {
     int i;
     int n;
     bool found;
+    bool misses_known;
 
     cb_assert(d != NULL);
     cb_assert(d->ptd != NULL);
 
+    /* A multiget's misses are only real misses when every downstream */
+    /* conn ended its reply, with no retry pending and no dropped values. */
+
+    misses_known = (force == false &&
+                    d->multiget != NULL &&
+                    d->ptd->behavior_pool.base.front_cache_miss_lifespan > 0 &&
+                    d->upstream_retry == 0 &&
+                    d->multiget_lossy == false &&
+                    d->downstream_used_start > 0 &&
+                    d->multiget_ends >= d->downstream_used_start);
+
     if (settings.verbose > 2) {
         moxi_log_write("%d: release_downstream\n",
                        d->upstream_conn != NULL ?
@@ -1019,6 +1413,11 @@ bool cproxy_release_downstream(downstream *d, bool force) {
     /* to avoid pegging CPU with leaked timeout_events. */
 
     cproxy_clear_timeout(d);
+    cproxy_clear_hedge(d);
+
+    if (d->stream_conn != NULL) {
+        cproxy_stream_abort(d);
+    }
 
     /* If we need to retry the command, we do so here, */
     /* keeping the same downstream that would otherwise */
@@ -1062,6 +1461,8 @@ bool cproxy_release_downstream(downstream *d, bool force) {
         }
     }
 
+    cproxy_coalesce_end(d);
+
     /* Record reserved_time histogram timings. */
 
     if (d->usec_start > 0) {
@@ -1113,6 +1514,12 @@ bool cproxy_release_downstream(downstream *d, bool force) {
                            d->upstream_status);
         }
 
+        if (d->upstream_conn->pipeline != NULL) {
+            cproxy_pipeline_flush(d->upstream_conn,
+                                  d->upstream_suffix,
+                                  d->upstream_suffix_len);
+        }
+
         if (d->upstream_suffix != NULL) {
             /* Do a last write on the upstream.  For example, */
             /* the upstream_suffix might be "END\r\n" or other */
@@ -1161,11 +1568,25 @@ bool cproxy_release_downstream(downstream *d, bool force) {
     /* Free extra hash tables. */
 
     if (d->multiget != NULL) {
+        if (misses_known) {
+            genhash_iter(d->multiget, multiget_foreach_miss, d);
+        }
+
         genhash_iter(d->multiget, multiget_foreach_free, d);
         genhash_free(d->multiget);
         d->multiget = NULL;
     }
 
+    if (d->multiget_keys != NULL) {
+        multiget_keys_free(d);
+    }
+
+    if (d->bin_quiet != NULL) {
+        free(d->bin_quiet);
+        d->bin_quiet = NULL;
+        d->bin_quiet_num = 0;
+    }
+
     if (d->merger != NULL) {
         genhash_iter(d->merger, protocol_stats_foreach_free, NULL);
         genhash_free(d->merger);
@@ -1183,7 +1604,10 @@ bool cproxy_release_downstream(downstream *d, bool force) {
     d->downstream_used = 0;
     d->downstream_used_start = 0;
     d->multiget = NULL;
+    d->multiget_ends = 0;
+    d->multiget_lossy = false;
     d->merger = NULL;
+    d->waiting_resolve = false;
 
     /* TODO: Consider adding a downstream->prev backpointer */
     /*       or doubly-linked list to save on this scan. */
@@ -1201,7 +1625,9 @@ bool cproxy_release_downstream(downstream *d, bool force) {
     for (i = 0; i < n; i++) {
         conn *dc = d->downstream_conns[i];
         d->downstream_conns[i] = NULL;
-        if (dc != NULL) {
+        if (dc != NULL && dc != NULL_CONN && dc->mux != NULL) {
+            zstored_mux_release(dc, d);
+        } else if (dc != NULL) {
             zstored_release_downstream_conn(dc, false);
         }
     }
@@ -1234,6 +1660,9 @@ void cproxy_free_downstream(downstream *d) {
     cb_assert(d->ptd != NULL);
     cb_assert(d->upstream_conn == NULL);
     cb_assert(d->multiget == NULL);
+    cb_assert(d->multiget_keys == NULL);
+    cb_assert(d->bin_quiet == NULL);
+    cb_assert(d->stream_conn == NULL);
     cb_assert(d->merger == NULL);
     cb_assert(d->timeout_tv.tv_sec == 0);
     cb_assert(d->timeout_tv.tv_usec == 0);
@@ -1260,9 +1689,15 @@ void cproxy_free_downstream(downstream *d) {
     if (d->downstream_conns != NULL) {
         int i;
         for (i = 0; i < n; i++) {
-            if (d->downstream_conns[i] != NULL &&
-                d->downstream_conns[i] != NULL_CONN) {
-                d->downstream_conns[i]->extra = NULL;
+            conn *dc = d->downstream_conns[i];
+            if (dc != NULL &&
+                dc != NULL_CONN) {
+                if (dc->mux != NULL) {
+                    d->downstream_conns[i] = NULL;
+                    zstored_mux_release(dc, d);
+                } else {
+                    dc->extra = NULL;
+                }
             }
         }
     }
@@ -1274,11 +1709,17 @@ void cproxy_free_downstream(downstream *d) {
     mcs_free(&d->mst);
 
     cproxy_clear_timeout(d);
+    cproxy_clear_hedge(d);
+    cproxy_coalesce_end(d);
 
     if (d->downstream_conns != NULL) {
         free(d->downstream_conns);
     }
 
+    if (d->prewarm_left != NULL) {
+        free(d->prewarm_left);
+    }
+
     if (d->config != NULL) {
         free(d->config);
     }
@@ -1423,7 +1864,7 @@ bool cproxy_check_downstream_config(downstream *d) {
 
 /* Returns -1 if the connections aren't fully assigned and ready. */
 /* In that case, the downstream has to wait for a downstream connection */
-/* to get out of the conn_connecting state. */
+/* to get out of the conn_connecting (or conn_authing) state. */
 
 /* The downstream connection might leave the conn_connecting state */
 /* with an error (unable to connect).  That case is handled by */
@@ -1480,6 +1921,8 @@ int cproxy_connect_downstream(downstream *d, LIBEVENT_THREAD *thread,
 
         if (d->downstream_conns[i] == NULL) {
             bool downstream_conn_max_reached = false;
+            bool downstream_unresolved = false;
+            bool resolve_retry = d->waiting_resolve;
             conn *c = d->upstream_conn;
             /*
              * mcmux compatiblity mode, one downstream struct will be associated
@@ -1494,11 +1937,21 @@ int cproxy_connect_downstream(downstream *d, LIBEVENT_THREAD *thread,
                 msst_actual->ident_a[0] = msst_actual->ident_b[0] = 0;
             }
 
+            d->waiting_resolve = false;
+
             d->downstream_conns[i] =
                 zstored_acquire_downstream_conn(d, thread,
                                                 msst_actual,
                                                 &d->behaviors_arr[i],
-                                                &downstream_conn_max_reached);
+                                                &downstream_conn_max_reached,
+                                                &downstream_unresolved);
+            if (resolve_retry &&
+                d->downstream_conns[i] != NULL) {
+                /* Done waiting, like a downstream woken off the queue. */
+
+                cproxy_clear_timeout(d);
+            }
+
             if (c != NULL &&
                 i == server_index &&
                 d->downstream_conns[i] != NULL &&
@@ -1515,25 +1968,38 @@ int cproxy_connect_downstream(downstream *d, LIBEVENT_THREAD *thread,
 
             if (d->downstream_conns[i] != NULL &&
                 d->downstream_conns[i] != NULL_CONN &&
-                d->downstream_conns[i]->state == conn_connecting) {
+                (d->downstream_conns[i]->state == conn_connecting ||
+                 d->downstream_conns[i]->state == conn_authing)) {
                 return -1;
             }
 
             if (d->downstream_conns[i] == NULL &&
-                downstream_conn_max_reached == true) {
+                (downstream_conn_max_reached == true ||
+                 downstream_unresolved == true)) {
                 if (settings.verbose > 2) {
-                    moxi_log_write("%d: downstream_conn_max reached\n",
-                                   d->upstream_conn->sfd);
+                    moxi_log_write("%d: %s\n",
+                                   d->upstream_conn->sfd,
+                                   downstream_unresolved ?
+                                   "downstream address unresolved" :
+                                   "downstream_conn_max reached");
                 }
 
                 if (zstored_downstream_waiting_add(d, thread,
                                                    msst_actual,
                                                    &d->behaviors_arr[i]) == true) {
-                    /* Since we're waiting on the downstream conn queue, */
-                    /* start a downstream timer per configuration. */
+                    d->waiting_resolve = downstream_unresolved;
 
-                    cproxy_start_downstream_timeout_ex(d, c,
-                        d->behaviors_arr[i].downstream_conn_queue_timeout);
+                    /* Since we're waiting on the downstream conn queue, */
+                    /* start a downstream timer per configuration.  A */
+                    /* retry after waiting on the resolver keeps the */
+                    /* timer of its original wait. */
+
+                    if (resolve_retry == false ||
+                        (d->timeout_tv.tv_sec == 0 &&
+                         d->timeout_tv.tv_usec == 0)) {
+                        cproxy_start_downstream_timeout_ex(d, c,
+                            d->behaviors_arr[i].downstream_conn_queue_timeout);
+                    }
 
                     return -1;
                 }
@@ -1552,10 +2018,15 @@ int cproxy_connect_downstream(downstream *d, LIBEVENT_THREAD *thread,
     return s;
 }
 
+/* Returns NULL on failure, where *unresolved tells apart a server */
+/* whose address the resolver thread hasn't looked up yet, which */
+/* isn't a connect error. */
+
 conn *cproxy_connect_downstream_conn(downstream *d,
                                      LIBEVENT_THREAD *thread,
                                      mcs_server_st *msst,
-                                     proxy_behavior *behavior) {
+                                     proxy_behavior *behavior,
+                                     bool *unresolved) {
     uint64_t start = 0;
     int err = -1;
     SOCKET fd;
@@ -1570,6 +2041,9 @@ conn *cproxy_connect_downstream_conn(downstream *d,
     cb_assert(mcs_server_st_hostname(msst) != NULL);
     cb_assert(mcs_server_st_port(msst) > 0);
     cb_assert(mcs_server_st_fd(msst) == -1);
+    cb_assert(unresolved);
+
+    *unresolved = false;
 
     if (d->ptd->behavior_pool.base.time_stats) {
         start = usec_now();
@@ -1588,6 +2062,15 @@ conn *cproxy_connect_downstream_conn(downstream *d,
                        MOXI_BLOCKING_CONNECT, err);
     }
 
+    if (fd == -1 &&
+        err == MCS_UNRESOLVED) {
+        d->ptd->stats.stats.tot_downstream_connect_unresolved++;
+
+        *unresolved = true;
+
+        return NULL;
+    }
+
     if (fd != -1) {
         conn *c = conn_new(fd, conn_pause, 0,
                            DATA_BUFFER_SIZE,
@@ -1595,11 +2078,14 @@ conn *cproxy_connect_downstream_conn(downstream *d,
                            thread->base,
                            &cproxy_downstream_funcs, d);
         if (c != NULL ) {
-            c->protocol = (d->upstream_conn->peer_protocol ?
+            c->protocol = ((d->upstream_conn != NULL &&
+                            d->upstream_conn->peer_protocol) ?
                            d->upstream_conn->peer_protocol :
                            behavior->downstream_protocol);
             c->thread = thread;
             c->cmd_start_time = start;
+            c->rbuf_capped = behavior->stream_splice != 0 &&
+                             IS_ASCII(c->protocol);
 
 #ifdef WIN32
             if (err == WSAEINPROGRESS) {
@@ -1638,10 +2124,14 @@ conn *cproxy_connect_downstream_conn(downstream *d,
     return NULL;
 }
 
+/* Returns true when the downstream conn is either ready or has */
+/* started a non-blocking sasl auth/bucket handshake, in which case */
+/* the conn is in the conn_authing state, and the downstream is */
+/* woken up later by cproxy_on_auth_downstream_conn(). */
+
 bool downstream_connect_init(downstream *d, mcs_server_st *msst,
                              proxy_behavior *behavior, conn *c) {
     char *host_ident;
-    int rv;
 
     cb_assert(c->thread != NULL);
 
@@ -1656,29 +2146,20 @@ bool downstream_connect_init(downstream *d, mcs_server_st *msst,
                                        usec_now() - c->cmd_start_time);
     }
 
-    rv = cproxy_auth_downstream(msst, behavior, c->sfd);
-    if (rv == 0) {
-        d->ptd->stats.stats.tot_downstream_auth++;
-
-        rv = cproxy_bucket_downstream(msst, behavior, c->sfd);
-        if (rv == 0) {
-            d->ptd->stats.stats.tot_downstream_bucket++;
+    if (cproxy_auth_downstream_conn_start(d, msst, behavior, c)) {
+        if (c->state == conn_authing) {
+            return true;
+        }
 
-            zstored_error_count(c->thread, host_ident, false);
+        zstored_error_count(c->thread, host_ident, false);
 
-            d->ptd->stats.stats.tot_downstream_connect++;
+        d->ptd->stats.stats.tot_downstream_connect++;
 
-            return true;
-        } else {
-            d->ptd->stats.stats.tot_downstream_bucket_failed++;
-        }
-    } else {
-        d->ptd->stats.stats.tot_downstream_auth_failed++;
-        if (rv == 1) {
-            d->ptd->stats.stats.tot_auth_timeout++;
-        }
+        return true;
     }
 
+    d->ptd->stats.stats.tot_downstream_auth_failed++;
+
     /* Treat a auth/bucket error as a blacklistable error. */
 
     zstored_error_count(c->thread, host_ident, true);
@@ -1686,49 +2167,181 @@ bool downstream_connect_init(downstream *d, mcs_server_st *msst,
     return false;
 }
 
-conn *cproxy_find_downstream_conn(downstream *d,
-                                  char *key, int key_length,
-                                  bool *local) {
-    return cproxy_find_downstream_conn_ex(d, key, key_length, local, NULL);
-}
+/* Queues up the sasl auth and select bucket requests, pipelined, */
+/* and moves the downstream conn into the conn_authing state.  Returns */
+/* true without changing the conn's state when there's no handshake. */
 
-conn *cproxy_find_downstream_conn_ex(downstream *d,
-                                     char *key, int key_length,
-                                     bool *local,
-                                     int *vbucket) {
-    int v;
-    int s;
+bool cproxy_auth_downstream_conn_start(downstream *d, mcs_server_st *msst,
+                                       proxy_behavior *behavior, conn *c) {
+    protocol_binary_request_header *req;
+    struct timeval *timeout = NULL;
+    const char *usr;
+    const char *pwd;
+    int usr_len = 0;
+    int pwd_len = 0;
+    int bucket_len = 0;
+    int auth_len = 0;
+    char *buf;
+    char *p;
 
     cb_assert(d != NULL);
-    cb_assert(d->downstream_conns != NULL);
-    cb_assert(key != NULL);
-    cb_assert(key_length > 0);
+    cb_assert(msst != NULL);
+    cb_assert(behavior != NULL);
+    cb_assert(c != NULL);
 
-    if (local != NULL) {
-        *local = false;
+    usr = mcs_server_st_usr(msst) != NULL ?
+        mcs_server_st_usr(msst) : behavior->usr;
+    pwd = mcs_server_st_pwd(msst) != NULL ?
+        mcs_server_st_pwd(msst) : behavior->pwd;
+
+    if (IS_BINARY(behavior->downstream_protocol)) {
+        usr_len = (int)strlen(usr);
+        pwd_len = (int)strlen(pwd);
+        bucket_len = (int)strlen(behavior->bucket);
     }
 
-    v = -1;
-    s = cproxy_server_index(d, key, key_length, &v);
+    if (usr_len <= 0) {
+        d->ptd->stats.stats.tot_downstream_auth++;
 
-    if (settings.verbose > 2 && s >= 0) {
-        moxi_log_write("%d: server_index %d, vbucket %d, conn %d\n", s, v,
-                       (d->upstream_conn != NULL ?
-                        d->upstream_conn->sfd : 0),
-                       (d->downstream_conns[s] == NULL ?
-                        0 :
-                        (d->downstream_conns[s] == NULL_CONN ?
-                         -1 :
-                         d->downstream_conns[s]->sfd)));
-    }
+        if (bucket_len <= 0) {
+            d->ptd->stats.stats.tot_downstream_bucket++;
 
-    if (s >= 0 &&
-        s < (int) mcs_server_count(&d->mst) &&
-        d->downstream_conns[s] != NULL &&
-        d->downstream_conns[s] != NULL_CONN) {
+            return true;
+        }
+    } else {
+        if (usr_len + pwd_len + 50 > 3000) {
+            if (settings.verbose > 1) {
+                moxi_log_write("auth failure args\n");
+            }
 
-        if (local != NULL && s == 0) {
-            *local = true;
+            return false; /* Probably misconfigured. */
+        }
+
+        /* The body should look like "PLAIN\0usr\0pwd". */
+
+        auth_len = 7 + usr_len + pwd_len;
+    }
+
+    buf = calloc(1, 2 * sizeof(*req) + auth_len + bucket_len);
+    if (buf == NULL) {
+        d->ptd->stats.stats.err_oom++;
+        return false;
+    }
+
+    p = buf;
+
+    if (auth_len > 0) {
+        req = (protocol_binary_request_header *) p;
+        req->request.magic    = PROTOCOL_BINARY_REQ;
+        req->request.opcode   = PROTOCOL_BINARY_CMD_SASL_AUTH;
+        req->request.keylen   = htons((uint16_t) 5); /* 5 == strlen("PLAIN"). */
+        req->request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req->request.bodylen  = htonl(auth_len);
+        p += sizeof(*req);
+
+        memcpy(p, "PLAIN", 6);
+        memcpy(p + 6, usr, usr_len + 1);
+        memcpy(p + 7 + usr_len, pwd, pwd_len);
+        p += auth_len;
+    }
+
+    if (bucket_len > 0) {
+        req = (protocol_binary_request_header *) p;
+        req->request.magic    = PROTOCOL_BINARY_REQ;
+        req->request.opcode   = PROTOCOL_BINARY_CMD_BUCKET;
+        req->request.keylen   = htons((uint16_t) bucket_len);
+        req->request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        req->request.bodylen  = htonl(bucket_len);
+        p += sizeof(*req);
+
+        memcpy(p, behavior->bucket, bucket_len);
+        p += bucket_len;
+    }
+
+    if (settings.verbose > 2) {
+        moxi_log_write("%d: cproxy_auth_downstream_conn_start usr: %s"
+                       " pwd: (%d) bucket: %s\n",
+                       c->sfd, usr, pwd_len, behavior->bucket);
+    }
+
+    /* The handshake owns the conn's write buffer pointers until it */
+    /* completes, and write_and_free is freed by conn_cleanup() */
+    /* should the conn close early. */
+
+    c->write_and_free = buf;
+    c->wcurr  = buf;
+    c->wbytes = (int) (p - buf);
+    c->cmd    = (auth_len > 0 ?
+                 PROTOCOL_BINARY_CMD_SASL_AUTH :
+                 PROTOCOL_BINARY_CMD_BUCKET);
+    c->rcurr  = c->rbuf;
+    c->rbytes = 0;
+
+    if (behavior->auth_timeout.tv_sec != 0 ||
+        behavior->auth_timeout.tv_usec != 0) {
+        timeout = &behavior->auth_timeout;
+    }
+
+    conn_set_state(c, conn_authing);
+
+    if (update_event_timed(c, EV_WRITE | EV_PERSIST, timeout)) {
+        return true;
+    }
+
+    d->ptd->stats.stats.err_oom++;
+
+    free(c->write_and_free);
+    c->write_and_free = NULL;
+    c->wbytes = 0;
+
+    conn_set_state(c, conn_pause);
+
+    return false;
+}
+
+conn *cproxy_find_downstream_conn(downstream *d,
+                                  char *key, int key_length,
+                                  bool *local) {
+    return cproxy_find_downstream_conn_ex(d, key, key_length, local, NULL);
+}
+
+conn *cproxy_find_downstream_conn_ex(downstream *d,
+                                     char *key, int key_length,
+                                     bool *local,
+                                     int *vbucket) {
+    int v;
+    int s;
+
+    cb_assert(d != NULL);
+    cb_assert(d->downstream_conns != NULL);
+    cb_assert(key != NULL);
+    cb_assert(key_length > 0);
+
+    if (local != NULL) {
+        *local = false;
+    }
+
+    v = -1;
+    s = cproxy_server_index(d, key, key_length, &v);
+
+    if (settings.verbose > 2 && s >= 0) {
+        moxi_log_write("%d: server_index %d, vbucket %d, conn %d\n", s, v,
+                       (d->upstream_conn != NULL ?
+                        d->upstream_conn->sfd : 0),
+                       (d->downstream_conns[s] == NULL ?
+                        0 :
+                        (d->downstream_conns[s] == NULL_CONN ?
+                         -1 :
+                         d->downstream_conns[s]->sfd)));
+    }
+
+    if (s >= 0 &&
+        s < (int) mcs_server_count(&d->mst) &&
+        d->downstream_conns[s] != NULL &&
+        d->downstream_conns[s] != NULL_CONN) {
+
+        if (local != NULL && s == 0) {
+            *local = true;
         }
 
         if (vbucket != NULL) {
@@ -1980,6 +2593,8 @@ bool cproxy_forward(downstream *d) {
     cb_assert(d->ptd != NULL);
     cb_assert(d->upstream_conn != NULL);
 
+    d->front_cache_gen = cproxy_front_cache_gen(d->ptd);
+
     if (settings.verbose > 2) {
         moxi_log_write(
                 "%d: cproxy_forward prot %d to prot %d\n",
@@ -1995,12 +2610,19 @@ bool cproxy_forward(downstream *d) {
             d->upstream_conn->peer_protocol ?
             d->upstream_conn->peer_protocol :
             d->ptd->behavior_pool.base.downstream_protocol;
+        bool rv;
 
         if (IS_ASCII(peer_protocol)) {
-            return cproxy_forward_a2a_downstream(d);
+            rv = cproxy_forward_a2a_downstream(d);
         } else {
-            return cproxy_forward_a2b_downstream(d);
+            rv = cproxy_forward_a2b_downstream(d);
         }
+
+        if (rv) {
+            cproxy_coalesce_start(d);
+        }
+
+        return rv;
     } else {
         /* BINARY upstream. */
 
@@ -2065,6 +2687,10 @@ void upstream_error_msg(conn *uc, char *ascii_msg,
             moxi_log_write("%d: upstream_error: %s\n", uc->sfd, msg);
         }
 
+        /* Each pipelined get gets its own copy of the error. */
+
+        cproxy_pipeline_flush(uc, msg, 0);
+
         if (add_iov(uc, msg, (int)strlen(msg)) == 0 &&
             update_event(uc, EV_WRITE | EV_PERSIST)) {
             conn_set_state(uc, conn_mwrite);
@@ -2205,6 +2831,35 @@ void cproxy_release_downstream_conn(downstream *d, conn *c) {
     }
 }
 
+/* An upstream conn that's relaying a streamed value pauses after */
+/* writing each chunk, which is when the next chunk can be read. */
+
+void cproxy_on_pause_upstream_conn(conn *c) {
+    downstream *d;
+
+    cb_assert(c != NULL);
+
+    d = c->stream;
+    if (d == NULL) {
+        return;
+    }
+
+    c->stream = NULL;
+
+    if (d->upstream_conn == c &&
+        d->stream_conn != NULL) {
+        /* The written chunks were already freed, so start over. */
+
+        if (cproxy_prep_conn_for_write(c) == false) {
+            d->ptd->stats.stats.err_oom++;
+            cproxy_close_conn(c);
+            return;
+        }
+
+        a2a_stream_resume(d);
+    }
+}
+
 void cproxy_on_pause_downstream_conn(conn *c) {
     downstream *d;
     cb_assert(c != NULL);
@@ -2214,8 +2869,24 @@ void cproxy_on_pause_downstream_conn(conn *c) {
                 c->sfd);
     }
 
+    if (c->mux != NULL) {
+        cproxy_mux_on_pause(c);
+        return;
+    }
+
     d = c->extra;
 
+    if (d != NULL && d->stream_conn == c) {
+        /* Parked mid-value, see a2a_stream_chunk(), or else */
+        /* woken up because there's more of the value to splice. */
+
+        if (d->stream_splice) {
+            a2a_stream_splice(d, c);
+        }
+
+        return;
+    }
+
     if (!d || c->rbytes > 0) {
         zstored_downstream_conns *conns;
 
@@ -2265,6 +2936,12 @@ void cproxy_pause_upstream_for_downstream(proxy_td *ptd, conn *upstream) {
 
     conn_set_state(upstream, conn_pause);
 
+    cproxy_stats_snapshot_arm(ptd, upstream->thread->base);
+
+    if (cproxy_coalesce_get(ptd, upstream)) {
+        return;
+    }
+
     cproxy_wait_any_downstream(ptd, upstream);
 
     if (ptd->timeout_tv.tv_sec == 0 &&
@@ -2275,6 +2952,150 @@ void cproxy_pause_upstream_for_downstream(proxy_td *ptd, conn *upstream) {
     cproxy_assign_downstream(ptd);
 }
 
+/* Returns the space or '\0' terminated key of a single-key */
+/* ascii get (but not gets), or NULL. */
+
+static char *cproxy_coalesce_get_key(conn *uc) {
+    char *key;
+
+    if (uc == NULL ||
+        !IS_ASCII(uc->protocol) ||
+        uc->cmd != -1 ||
+        uc->cmd_curr != PROTOCOL_BINARY_CMD_GETK ||
+        uc->cmd_start == NULL ||
+        uc->cmd_retries > 0 ||
+        uc->noreply) {
+        return NULL;
+    }
+
+    key = uc->cmd_start;
+    while (*key == ' ') {
+        key++;
+    }
+
+    if (strncmp(key, "get ", 4) != 0) {
+        return NULL;
+    }
+
+    key += 4;
+    while (*key == ' ') {
+        key++;
+    }
+
+    if (*key == '\0') {
+        return NULL;
+    }
+
+    return key;
+}
+
+/* Single-flight handling of a hot key.  When an upstream conn asks */
+/* for a key that a downstream on the same worker thread is already */
+/* getting, the upstream conn is added to that downstream's list of */
+/* upstream conns instead of sending the same get again, so that */
+/* the one response goes to all of them. */
+
+bool cproxy_coalesce_get(proxy_td *ptd, conn *uc) {
+    downstream *d;
+    conn *tail;
+    char *key;
+
+    cb_assert(ptd != NULL);
+    cb_assert(uc != NULL);
+    cb_assert(uc->next == NULL);
+
+    if (ptd->inflight_gets == NULL ||
+        ptd->behavior_pool.base.coalesce_get == 0) {
+        return false;
+    }
+
+    key = cproxy_coalesce_get_key(uc);
+    if (key == NULL) {
+        return false;
+    }
+
+    d = genhash_find(ptd->inflight_gets, key);
+
+    /* A downstream that's retrying, or that has a multiget */
+    /* de-duplication table, has already sent its keys for the */
+    /* upstream conns that it knows about.  A streaming downstream */
+    /* relays its value to only the first upstream conn. */
+
+    if (d == NULL ||
+        d->upstream_conn == NULL ||
+        d->multiget != NULL ||
+        d->stream_conn != NULL ||
+        d->upstream_retry > 0 ||
+        d->upstream_retries > 0) {
+        return false;
+    }
+
+    for (tail = d->upstream_conn; tail->next != NULL; tail = tail->next) {
+        cb_assert(tail != uc);
+    }
+
+    tail->next = uc;
+
+    ptd->stats.stats.tot_assign_upstream++;
+    ptd->stats.stats.tot_get_coalesced++;
+
+    if (settings.verbose > 2) {
+        moxi_log_write("%d: coalesce_get, onto %d\n",
+                       uc->sfd, d->upstream_conn->sfd);
+    }
+
+    return true;
+}
+
+/* Called after a successful forward, so that later gets of */
+/* the same key can be coalesced onto the downstream. */
+
+void cproxy_coalesce_start(downstream *d) {
+    proxy_td *ptd = d->ptd;
+    char *key;
+    char *end;
+
+    if (d->coalesce_key != NULL ||
+        ptd->inflight_gets == NULL ||
+        ptd->behavior_pool.base.coalesce_get == 0 ||
+        d->upstream_conn == NULL ||
+        d->upstream_conn->next != NULL ||
+        d->upstream_retries > 0) {
+        return;
+    }
+
+    key = cproxy_coalesce_get_key(d->upstream_conn);
+    if (key == NULL ||
+        genhash_find(ptd->inflight_gets, key) != NULL) {
+        return;
+    }
+
+    end = key;
+    while (*end != ' ' && *end != '\0') {
+        end++;
+    }
+
+    d->coalesce_key = malloc(end - key + 1);
+    if (d->coalesce_key != NULL) {
+        memcpy(d->coalesce_key, key, end - key);
+        d->coalesce_key[end - key] = '\0';
+
+        genhash_store(ptd->inflight_gets, d->coalesce_key, d);
+    }
+}
+
+void cproxy_coalesce_end(downstream *d) {
+    if (d->coalesce_key != NULL) {
+        cb_assert(genhash_find(d->ptd->inflight_gets,
+                               d->coalesce_key) == d);
+
+        genhash_delete(d->ptd->inflight_gets, d->coalesce_key);
+
+        free(d->coalesce_key);
+        d->coalesce_key = NULL;
+    }
+}
+
 struct timeval cproxy_get_downstream_timeout(downstream *d, conn *c) {
 
     struct timeval rv;
@@ -2685,50 +3506,66 @@ downstream *downstream_list_waiting_remove(downstream *head,
  * save on network hops.
  */
 bool is_compatible_request(conn *existing, conn *candidate) {
-    (void)existing;
-    (void)candidate;
-
-    /* The not-my-vbucket error handling requires us to not */
-    /* squash ascii multi-GET requests, due to reusing the */
-    /* multiget-deduplication machinery during retries and */
-    /* to simplify the later codepaths. */
-    /*
+    char *a;
+    char *b;
+
     cb_assert(existing);
     cb_assert(existing->state == conn_pause);
     cb_assert(IS_PROXY(existing->protocol));
 
-    if (IS_BINARY(existing->protocol)) {
-        // TODO: Revisit multi-get squashing for binary another day.
-
+    if (candidate == NULL) {
         return false;
     }
 
-    cb_assert(IS_ASCII(existing->protocol));
+    cb_assert(IS_PROXY(candidate->protocol));
+    cb_assert(candidate->state == conn_pause);
+
+    /* TODO: Revisit multi-get squashing for binary another day. */
+
+    if (!IS_ASCII(existing->protocol) ||
+        !IS_ASCII(candidate->protocol)) {
+        return false;
+    }
 
-    if (candidate != NULL) {
-        cb_assert(IS_ASCII(candidate->protocol));
-        cb_assert(IS_PROXY(candidate->protocol));
-        cb_assert(candidate->state == conn_pause);
+    /* A not-my-vbucket retry of squashed requests reuses the */
+    /* multiget de-duplication map, where the keys are copied into */
+    /* the downstream's multiget_keys, as they're from more than */
+    /* one upstream conn. */
+
+    if (existing->cmd != -1 ||
+        candidate->cmd != -1 ||
+        existing->cmd_retries > 0 ||
+        candidate->cmd_retries > 0 ||
+        existing->noreply ||
+        candidate->noreply ||
+        existing->peer_protocol != candidate->peer_protocol ||
+        (existing->cmd_curr != PROTOCOL_BINARY_CMD_GETK &&
+         existing->cmd_curr != PROTOCOL_BINARY_CMD_GETKQ) ||
+        (candidate->cmd_curr != PROTOCOL_BINARY_CMD_GETK &&
+         candidate->cmd_curr != PROTOCOL_BINARY_CMD_GETKQ)) {
+        return false;
+    }
 
-        // TODO: Allow gets (CAS) for de-duplication.
+    cb_assert(existing->item == NULL);
+    cb_assert(candidate->item == NULL);
 
-        if (existing->cmd == -1 &&
-            candidate->cmd == -1 &&
-            existing->cmd_retries <= 0 &&
-            candidate->cmd_retries <= 0 &&
-            !existing->noreply &&
-            !candidate->noreply &&
-            strncmp(existing->cmd_start, "get ", 4) == 0 &&
-            strncmp(candidate->cmd_start, "get ", 4) == 0) {
-            cb_assert(existing->item == NULL);
-            cb_assert(candidate->item == NULL);
+    a = existing->cmd_start;
+    while (*a == ' ') {
+        a++;
+    }
 
-            return true;
-        }
+    b = candidate->cmd_start;
+    while (*b == ' ') {
+        b++;
     }
-    */
 
-    return false;
+    /* Only get's with get's and gets's with gets's, as a */
+    /* downstream ascii request line has just one command. */
+
+    return (strncmp(a, "get ", 4) == 0 &&
+            strncmp(b, "get ", 4) == 0) ||
+           (strncmp(a, "gets ", 5) == 0 &&
+            strncmp(b, "gets ", 5) == 0);
 }
 
 void downstream_timeout(evutil_socket_t fd,
@@ -2799,11 +3636,27 @@ void downstream_timeout(evutil_socket_t fd,
             conn *dc = d->downstream_conns[i];
             if (dc != NULL &&
                 dc != NULL_CONN) {
-                /* We have to de-link early, because we don't want */
-                /* to have cproxy_close_conn() release the downstream */
-                /* while we're in the middle of this loop. */
+                if (dc->mux != NULL) {
+                    /* A shared downstream conn is closed too, as its */
+                    /* server might have stopped answering, and the */
+                    /* slots of written requests are only freed by a */
+                    /* reply.  The downstream is detached first, so */
+                    /* the close just errors out the conn's other */
+                    /* downstreams.  Marking the conn as closing */
+                    /* keeps the detach from waking a waiting */
+                    /* downstream onto it. */
+
+                    conn_set_state(dc, conn_closing);
+
+                    d->downstream_conns[i] = NULL;
+                    zstored_mux_release(dc, d);
+                } else {
+                    /* We have to de-link early, because we don't want */
+                    /* to have cproxy_close_conn() release the downstream */
+                    /* while we're in the middle of this loop. */
 
-                delink_from_downstream_conns(dc);
+                    delink_from_downstream_conns(dc);
+                }
 
                 cproxy_close_conn(dc);
             }
@@ -3229,24 +4082,69 @@ bool cproxy_on_connect_downstream_conn(conn *c) {
     if (k >= 0) {
         if (downstream_connect_init(d, mcs_server_index(&d->mst, k),
                                     &d->behaviors_arr[k], c)) {
-            /* We are connected to the server now */
-            if (settings.verbose > 2) {
-                moxi_log_write("%d: connected to: %s\n",
-                               c->sfd, c->host_ident);
+            if (c->state == conn_authing) {
+                return true;
             }
 
-            conn_set_state(c, conn_pause);
-            update_event(c, 0);
-            cproxy_forward_or_error(d);
-
-            return true;
+            return cproxy_connect_downstream_conn_ready(d, c);
         }
     }
 
 cleanup:
+    return cproxy_connect_downstream_conn_failed(d, c);
+}
+
+bool cproxy_connect_downstream_conn_ready(downstream *d, conn *c) {
+    /* We are connected to the server now */
+    if (settings.verbose > 2) {
+        moxi_log_write("%d: connected to: %s\n",
+                       c->sfd, c->host_ident);
+    }
+
+    conn_set_state(c, conn_pause);
+    update_event(c, 0);
+
+    if (d->prewarm_left != NULL) {
+        cproxy_prewarm_conn_ready(d, c);
+        return true;
+    }
+
+    cproxy_forward_or_error(d);
+
+    return true;
+}
+
+bool cproxy_connect_downstream_conn_failed(downstream *d, conn *c) {
+    int k;
+
     d->ptd->stats.stats.tot_downstream_connect_failed++;
 
     k = delink_from_downstream_conns(c);
+
+    if (d->prewarm_left != NULL) {
+        /* Do the accounting of cproxy_on_close_downstream_conn() */
+        /* here, as the pre-warming downstream might be freed */
+        /* before the conn finishes closing. */
+
+        c->extra = NULL;
+
+        zstored_error_count(c->thread, c->host_ident, true);
+
+        if (d->ptd->stats.stats.num_downstream_conn > 0) {
+            d->ptd->stats.stats.num_downstream_conn--;
+        }
+
+        conn_set_state(c, conn_closing);
+        update_event(c, 0);
+
+        if (k >= 0) {
+            cproxy_prewarm_conn_failed(d, k);
+            cproxy_prewarm_check_done(d);
+        }
+
+        return false;
+    }
+
     if (k >= 0) {
         cb_assert(d->downstream_conns[k] == NULL);
 
@@ -3260,32 +4158,439 @@ cleanup:
     return false;
 }
 
-void downstream_reserved_time_sample(proxy_stats_td *pstd, uint64_t duration) {
-    if (pstd->downstream_reserved_time_htgram == NULL) {
-        pstd->downstream_reserved_time_htgram =
-            cproxy_create_timing_histogram();
-    }
+/* ------------------------------------------------- */
 
-    if (pstd->downstream_reserved_time_htgram != NULL) {
-        htgram_incr(pstd->downstream_reserved_time_htgram, duration, 1);
-    }
+/* Pre-warming, per the downstream_conn_prewarm behavior, opens and */
+/* authenticates downstream conns ahead of traffic, parking them in */
+/* the thread's zstored downstream conn pool.  Called on the main */
+/* thread after a config arrives, it asks each worker thread to */
+/* do the work, since the conn pools are per worker thread. */
+
+static void cproxy_prewarm_work(void *data0, void *data1) {
+    cproxy_prewarm_downstream_conns(data0, data1);
 }
 
-void downstream_connect_time_sample(proxy_stats_td *pstd, uint64_t duration) {
-    if (pstd->downstream_connect_time_htgram == NULL) {
-        pstd->downstream_connect_time_htgram =
-            cproxy_create_timing_histogram();
+void cproxy_prewarm(proxy *p) {
+    proxy_main *m;
+    int i;
+
+    cb_assert(p != NULL);
+
+    m = p->main;
+    cb_assert(m != NULL);
+
+    if (p->behavior_pool.base.downstream_conn_prewarm == 0) {
+        return;
     }
 
-    if (pstd->downstream_connect_time_htgram != NULL) {
-        htgram_incr(pstd->downstream_connect_time_htgram, duration, 1);
+    for (i = 1; i < m->nthreads; i++) {
+        LIBEVENT_THREAD *t = thread_by_index(i);
+        if (t != NULL &&
+            t->work_queue != NULL) {
+            work_send(t->work_queue, cproxy_prewarm_work,
+                      &p->thread_data[i], t);
+        }
     }
 }
 
-/* A histogram for tracking timings, such as for usec request timings. */
-
-HTGRAM_HANDLE cproxy_create_timing_histogram(void) {
-    /* TODO: Make histogram bins more configurable one day. */
+/* A pre-warming downstream is never reserved by an upstream conn. */
+/* It opens conns serially for each server, but in parallel across */
+/* servers, and frees itself when it's done. */
+
+void cproxy_prewarm_downstream_conns(proxy_td *ptd, LIBEVENT_THREAD *thread) {
+    downstream *d;
+    int n;
+    int i;
+
+    cb_assert(ptd != NULL);
+    cb_assert(thread != NULL);
+    cb_assert(is_listen_thread() == false); /* Expecting a worker thread. */
+
+    if (ptd->config == NULL ||
+        ptd->behavior_pool.arr == NULL ||
+        ptd->behavior_pool.base.downstream_conn_prewarm == 0) {
+        return;
+    }
+
+    cproxy_stats_snapshot_arm(ptd, thread->base);
+
+    d = cproxy_create_downstream(ptd->config,
+                                 ptd->config_ver,
+                                 &ptd->behavior_pool);
+    if (d == NULL) {
+        ptd->stats.stats.tot_downstream_create_failed++;
+        return;
+    }
+
+    d->ptd = ptd;
+    ptd->downstream_tot++;
+    ptd->downstream_num++;
+
+    n = mcs_server_count(&d->mst);
+    cb_assert(d->behaviors_num >= n);
+
+    d->prewarm_left = calloc(n, sizeof(int));
+    if (d->prewarm_left == NULL) {
+        ptd->stats.stats.err_oom++;
+        cproxy_free_downstream(d);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        d->prewarm_left[i] = d->behaviors_arr[i].downstream_conn_prewarm;
+        ptd->stats.stats.num_downstream_conn_prewarm += d->prewarm_left[i];
+    }
+
+    for (i = 0; i < n; i++) {
+        cproxy_prewarm_server(d, thread, i);
+    }
+
+    cproxy_prewarm_check_done(d);
+}
+
+void cproxy_prewarm_server(downstream *d, LIBEVENT_THREAD *thread, int i) {
+    cb_assert(d != NULL);
+    cb_assert(d->prewarm_left != NULL);
+
+    while (d->prewarm_left[i] > 0 &&
+           d->downstream_conns[i] == NULL) {
+        mcs_server_st *msst = mcs_server_index(&d->mst, i);
+        proxy_behavior *behavior = &d->behaviors_arr[i];
+        zstored_downstream_conns *conns;
+        char *host_ident;
+        uint32_t have = 0;
+        bool unresolved;
+        conn *dc;
+
+        host_ident = mcs_server_st_ident(msst,
+                                         IS_ASCII(behavior->downstream_protocol));
+        conns = zstored_get_downstream_conns(thread, host_ident);
+        if (conns == NULL) {
+            cproxy_prewarm_skip(d, i);
+            return;
+        }
+
+        for (dc = conns->dc; dc != NULL; dc = dc->next) {
+            have++;
+        }
+        have += conns->dc_acquired;
+
+        /* Stop when the pool is already warm enough, or at */
+        /* downstream_conn_max, or when the server is blacklisted. */
+
+        if (have >= behavior->downstream_conn_prewarm ||
+            (behavior->downstream_conn_max > 0 &&
+             have >= behavior->downstream_conn_max)) {
+            cproxy_prewarm_skip(d, i);
+            return;
+        }
+
+        if (!cproxy_breaker_allow(host_ident, behavior)) {
+            cproxy_prewarm_skip(d, i);
+            return;
+        }
+
+        d->prewarm_left[i]--;
+
+        dc = cproxy_connect_downstream_conn(d, thread, msst, behavior,
+                                            &unresolved);
+        if (dc == NULL && unresolved) {
+            /* The resolver thread now has the lookup queued up, */
+            /* and the first real request will connect. */
+
+            d->ptd->stats.stats.num_downstream_conn_prewarm--;
+
+            cproxy_prewarm_skip(d, i);
+            return;
+        }
+
+        if (dc == NULL) {
+            conns->error_count++;
+            conns->error_time = msec_current_time;
+
+            zstored_breaker_report(host_ident, true);
+
+            cproxy_prewarm_conn_failed(d, i);
+            return;
+        }
+
+        cb_assert(dc->host_ident == NULL);
+        dc->host_ident = strdup(host_ident);
+        if (dc->host_ident == NULL) {
+            d->ptd->stats.stats.err_oom++;
+            cproxy_close_conn(dc);
+            cproxy_prewarm_conn_failed(d, i);
+            return;
+        }
+
+        conns->dc_acquired++;
+
+        d->downstream_conns[i] = dc;
+
+        if (dc->state == conn_connecting ||
+            dc->state == conn_authing) {
+            return; /* Continued in cproxy_prewarm_conn_ready/failed. */
+        }
+
+        conns->error_count = 0;
+        conns->error_time = 0;
+
+        d->downstream_conns[i] = NULL;
+
+        d->ptd->stats.stats.tot_downstream_conn_prewarm++;
+        d->ptd->stats.stats.num_downstream_conn_prewarm--;
+
+        zstored_release_downstream_conn(dc, false);
+    }
+}
+
+void cproxy_prewarm_skip(downstream *d, int i) {
+    d->ptd->stats.stats.num_downstream_conn_prewarm -= d->prewarm_left[i];
+    d->prewarm_left[i] = 0;
+}
+
+void cproxy_prewarm_check_done(downstream *d) {
+    int n = mcs_server_count(&d->mst);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (d->downstream_conns[i] != NULL ||
+            d->prewarm_left[i] > 0) {
+            return;
+        }
+    }
+
+    cproxy_free_downstream(d);
+}
+
+void cproxy_prewarm_conn_ready(downstream *d, conn *c) {
+    LIBEVENT_THREAD *thread = c->thread;
+    int k;
+
+    k = downstream_conn_index(d, c);
+    cb_assert(k >= 0);
+
+    d->downstream_conns[k] = NULL;
+
+    d->ptd->stats.stats.tot_downstream_conn_prewarm++;
+    d->ptd->stats.stats.num_downstream_conn_prewarm--;
+
+    zstored_release_downstream_conn(c, false);
+
+    cproxy_prewarm_server(d, thread, k);
+    cproxy_prewarm_check_done(d);
+}
+
+/* A failed server isn't retried, leaving it to the usual */
+/* on-demand connect and blacklisting logic.  The caller is */
+/* responsible for the cproxy_prewarm_check_done(). */
+
+void cproxy_prewarm_conn_failed(downstream *d, int k) {
+    cb_assert(d->downstream_conns[k] == NULL);
+
+    d->ptd->stats.stats.tot_downstream_conn_prewarm_failed++;
+    d->ptd->stats.stats.num_downstream_conn_prewarm--;
+
+    cproxy_prewarm_skip(d, k);
+}
+
+/* Drives the non-blocking sasl auth/bucket handshake that was */
+/* started by cproxy_auth_downstream_conn_start(), first writing out */
+/* the pipelined requests and then reading the responses. */
+
+bool cproxy_on_auth_downstream_conn(conn *c) {
+    protocol_binary_response_header *res;
+    proxy_behavior *behavior;
+    struct timeval *timeout = NULL;
+    downstream *d;
+    int k;
+    int n;
+
+    cb_assert(c != NULL);
+    cb_assert(c->host_ident);
+
+    d = c->extra;
+    if (d == NULL) {
+        /* A pooled downstream conn that's being health checked. */
+
+        if (c->probing) {
+            return cproxy_on_probe_downstream_conn(c);
+        }
+
+        conn_set_state(c, conn_closing);
+        update_event(c, 0);
+
+        return false;
+    }
+
+    k = downstream_conn_index(d, c);
+    if (k < 0) {
+        goto failed;
+    }
+
+    behavior = &d->behaviors_arr[k];
+    if (behavior->auth_timeout.tv_sec != 0 ||
+        behavior->auth_timeout.tv_usec != 0) {
+        timeout = &behavior->auth_timeout;
+    }
+
+    if (c->which == EV_TIMEOUT) {
+        if (settings.verbose > 1) {
+            moxi_log_write("%d: auth_downstream timeout: %s\n",
+                           c->sfd, c->host_ident);
+        }
+
+        if (c->cmd == PROTOCOL_BINARY_CMD_SASL_AUTH) {
+            d->ptd->stats.stats.tot_auth_timeout++;
+        }
+
+        goto failed;
+    }
+
+    if (c->wbytes > 0) {
+        n = send(c->sfd, c->wcurr, c->wbytes, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+
+            goto failed;
+        }
+
+        c->wcurr  += n;
+        c->wbytes -= n;
+        if (c->wbytes > 0) {
+            return true;
+        }
+
+        free(c->write_and_free);
+        c->write_and_free = NULL;
+
+        if (!update_event_timed(c, EV_READ | EV_PERSIST, timeout)) {
+            d->ptd->stats.stats.err_oom++;
+            goto failed;
+        }
+
+        return true;
+    }
+
+    n = recv(c->sfd, c->rbuf + c->rbytes, c->rsize - c->rbytes, 0);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+
+        goto failed;
+    }
+
+    c->rbytes += n;
+
+    while (c->rbytes >= (int) sizeof(*res)) {
+        uint32_t len;
+        int status;
+        int opcode;
+
+        res = (protocol_binary_response_header *) c->rbuf;
+
+        /* Responses are tiny, so anything too large for the */
+        /* rbuf is treated as a broken server. */
+
+        len = sizeof(*res) + ntohl(res->response.bodylen);
+        if (res->response.magic != PROTOCOL_BINARY_RES ||
+            len > (uint32_t) c->rsize) {
+            goto failed;
+        }
+
+        if (len > (uint32_t) c->rbytes) {
+            return true;
+        }
+
+        status = ntohs(res->response.status);
+        opcode = res->response.opcode;
+
+        c->rbytes -= len;
+        memmove(c->rbuf, c->rbuf + len, c->rbytes);
+
+        /* The status should be either... */
+        /* - SUCCESS         - sasl/bucket aware server and good creds. */
+        /* - AUTH_ERROR      - wrong credentials or not allowed. */
+        /* - UNKNOWN_COMMAND - sasl/bucket unaware server. */
+
+        if (opcode != c->cmd ||
+            status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            if (settings.verbose > 1) {
+                moxi_log_write("%d: auth_downstream failure %x (%x) for %s\n",
+                               c->sfd, opcode, status, c->host_ident);
+            }
+
+            goto failed;
+        }
+
+        if (opcode == PROTOCOL_BINARY_CMD_SASL_AUTH) {
+            d->ptd->stats.stats.tot_downstream_auth++;
+
+            if (strlen(behavior->bucket) > 0) {
+                c->cmd = PROTOCOL_BINARY_CMD_BUCKET;
+                continue;
+            }
+        }
+
+        d->ptd->stats.stats.tot_downstream_bucket++;
+        d->ptd->stats.stats.tot_downstream_connect++;
+
+        zstored_error_count(c->thread, c->host_ident, false);
+
+        c->cmd    = -1;
+        c->rcurr  = c->rbuf;
+        c->rbytes = 0;
+
+        return cproxy_connect_downstream_conn_ready(d, c);
+    }
+
+    return true;
+
+ failed:
+    if (c->cmd == PROTOCOL_BINARY_CMD_SASL_AUTH) {
+        d->ptd->stats.stats.tot_downstream_auth_failed++;
+    } else {
+        d->ptd->stats.stats.tot_downstream_bucket_failed++;
+    }
+
+    /* Treat a auth/bucket error as a blacklistable error. */
+
+    zstored_error_count(c->thread, c->host_ident, true);
+
+    c->cmd = -1;
+
+    return cproxy_connect_downstream_conn_failed(d, c);
+}
+
+void downstream_reserved_time_sample(proxy_stats_td *pstd, uint64_t duration) {
+    if (pstd->downstream_reserved_time_htgram == NULL) {
+        pstd->downstream_reserved_time_htgram =
+            cproxy_create_timing_histogram();
+    }
+
+    if (pstd->downstream_reserved_time_htgram != NULL) {
+        htgram_incr(pstd->downstream_reserved_time_htgram, duration, 1);
+    }
+}
+
+void downstream_connect_time_sample(proxy_stats_td *pstd, uint64_t duration) {
+    if (pstd->downstream_connect_time_htgram == NULL) {
+        pstd->downstream_connect_time_htgram =
+            cproxy_create_timing_histogram();
+    }
+
+    if (pstd->downstream_connect_time_htgram != NULL) {
+        htgram_incr(pstd->downstream_connect_time_htgram, duration, 1);
+    }
+}
+
+/* A histogram for tracking timings, such as for usec request timings. */
+
+HTGRAM_HANDLE cproxy_create_timing_histogram(void) {
+    /* TODO: Make histogram bins more configurable one day. */
 
     HTGRAM_HANDLE h1 = htgram_mk(2000, 100, 2.0, 20, NULL);
     HTGRAM_HANDLE h0 = htgram_mk(0, 100, 1.0, 20, h1);
@@ -3309,6 +4614,7 @@ zstored_downstream_conns *zstored_get_downstream_conns(LIBEVENT_THREAD *thread,
     if (conns == NULL) {
         conns = calloc(1, sizeof(zstored_downstream_conns));
         if (conns != NULL) {
+            conns->thread = thread;
             conns->host_ident = strdup(host_ident);
             if (conns->host_ident != NULL) {
                 genhash_store(conn_hash, conns->host_ident, conns);
@@ -3360,306 +4666,1307 @@ void zstored_error_count(LIBEVENT_THREAD *thread,
                 conns->dc_acquired--;
             }
 
-            /* When zero downstream conns are available, wake up all */
-            /* waiting downstreams so they can proceed (possibly by */
-            /* just returning ERROR's to upstream clients). */
+            /* When zero downstream conns are available, wake up all */
+            /* waiting downstreams so they can proceed (possibly by */
+            /* just returning ERROR's to upstream clients). */
+
+            if (conns->dc_acquired <= 0 && conns->dc == NULL) {
+                zstored_downstream_waiting_fail(conns);
+            }
+        }
+    }
+
+    zstored_breaker_report(host_ident, has_error);
+}
+
+void zstored_downstream_waiting_fail(zstored_downstream_conns *conns) {
+    downstream *head = conns->downstream_waiting_head;
+
+    conns->downstream_waiting_head = NULL;
+    conns->downstream_waiting_tail = NULL;
+
+    while (head != NULL) {
+        downstream *prev;
+
+        head->ptd->stats.stats.tot_downstream_waiting_errors++;
+        head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+
+        prev = head;
+        head = head->next_waiting;
+        prev->next_waiting = NULL;
+
+        cproxy_forward_or_error(prev);
+    }
+}
+
+/* Reports a connect outcome to the host_ident's circuit breaker. */
+/* When that opens the breaker, every worker thread is told to fail */
+/* its waiting downstreams, as their retries will now fail fast. */
+
+static void zstored_breaker_tripped(void *data0, void *data1) {
+    char *host_ident = data0;
+    LIBEVENT_THREAD *thread = data1;
+    zstored_downstream_conns *conns;
+
+    cb_assert(host_ident != NULL);
+    cb_assert(thread != NULL);
+
+    conns = genhash_find(thread->conn_hash, host_ident);
+    if (conns != NULL) {
+        zstored_downstream_waiting_fail(conns);
+    }
+
+    free(host_ident);
+}
+
+void zstored_breaker_report(const char *host_ident, bool has_error) {
+    int i;
+
+    if (cproxy_breaker_report(host_ident, has_error) == false) {
+        return;
+    }
+
+    for (i = 1; i < settings.num_threads; i++) {
+        LIBEVENT_THREAD *t = thread_by_index(i);
+        if (t != NULL &&
+            t->work_queue != NULL) {
+            char *copy = strdup(host_ident);
+            if (copy != NULL &&
+                work_send(t->work_queue, zstored_breaker_tripped,
+                          copy, t) == false) {
+                free(copy);
+            }
+        }
+    }
+}
+
+conn *zstored_acquire_downstream_conn(downstream *d,
+                                      LIBEVENT_THREAD *thread,
+                                      mcs_server_st *msst,
+                                      proxy_behavior *behavior,
+                                      bool *downstream_conn_max_reached,
+                                      bool *downstream_unresolved) {
+    enum protocol downstream_protocol;
+    char *host_ident;
+    conn *dc;
+    zstored_downstream_conns *conns;
+    bool mux;
+
+    cb_assert(d);
+    cb_assert(d->ptd);
+    cb_assert(d->ptd->downstream_released != d); /* Should not be in free list. */
+    cb_assert(thread);
+    cb_assert(msst);
+    cb_assert(behavior);
+    cb_assert(mcs_server_st_hostname(msst) != NULL);
+    cb_assert(mcs_server_st_port(msst) > 0);
+    cb_assert(mcs_server_st_fd(msst) == -1);
+
+    *downstream_conn_max_reached = false;
+    *downstream_unresolved = false;
+
+    d->ptd->stats.stats.tot_downstream_conn_acquired++;
+
+    downstream_protocol =
+        d->upstream_conn->peer_protocol ?
+        d->upstream_conn->peer_protocol :
+        behavior->downstream_protocol;
+
+    mux = zstored_mux_eligible(d, behavior, downstream_protocol);
+
+    host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
+    conns = zstored_get_downstream_conns(thread, host_ident);
+    if (conns != NULL) {
+        dc = zstored_acquire_pooled_downstream_conn(d, conns, behavior, mux);
+        if (dc != NULL) {
+            cb_assert(dc->thread == thread);
+            cb_assert(strcmp(host_ident, dc->host_ident) == 0);
+
+            return dc;
+        }
+
+        if (!cproxy_breaker_allow(host_ident, behavior)) {
+            if (settings.verbose > 2) {
+                moxi_log_write("zacquire_dc, %s, breaker open\n",
+                               host_ident);
+            }
+
+            d->ptd->stats.stats.tot_downstream_connect_interval++;
+
+            return NULL;
+        }
+
+        if (behavior->downstream_conn_max > 0 &&
+            behavior->downstream_conn_max <= conns->dc_acquired) {
+            d->ptd->stats.stats.tot_downstream_connect_max_reached++;
+
+            *downstream_conn_max_reached = true;
+
+            return NULL;
+        }
+    }
+
+    dc = cproxy_connect_downstream_conn(d, thread, msst, behavior,
+                                        downstream_unresolved);
+    if (dc != NULL) {
+        cb_assert(dc->host_ident == NULL);
+        dc->host_ident = strdup(host_ident);
+        if (conns != NULL) {
+            conns->dc_acquired++;
+
+            if (dc->state != conn_connecting &&
+                dc->state != conn_authing) {
+                conns->error_count = 0;
+                conns->error_time = 0;
+            }
+
+            if (mux) {
+                zstored_mux_create(dc, conns, behavior, d);
+            }
+        }
+    } else if (*downstream_unresolved) {
+        /* Not an error, so the caller waits on the conns, */
+        /* to be retried once the resolver had time to run. */
+
+        if (conns != NULL) {
+            zstored_resolve_arm(conns);
+        }
+    } else {
+        if (conns != NULL) {
+            conns->error_count++;
+            conns->error_time = msec_current_time;
+        }
+
+        zstored_breaker_report(host_ident, true);
+    }
+
+    return dc;
+}
+
+/* Returns an already connected downstream conn from the pool, */
+/* either a shared one or an idle one, or NULL. */
+
+conn *zstored_acquire_pooled_downstream_conn(downstream *d,
+                                             zstored_downstream_conns *conns,
+                                             proxy_behavior *behavior,
+                                             bool mux) {
+    conn *dc;
+
+    if (mux) {
+        dc = zstored_mux_find(conns);
+        if (dc != NULL) {
+            return dc;
+        }
+    }
+
+    dc = conns->dc;
+    if (dc != NULL) {
+        conns->dc_acquired++;
+        conns->dc = dc->next;
+        dc->next = NULL;
+
+        cb_assert(dc->extra == NULL);
+        dc->extra = d;
+
+        if (mux) {
+            zstored_mux_create(dc, conns, behavior, d);
+        }
+    }
+
+    return dc;
+}
+
+/* new fn by jsh */
+void zstored_release_downstream_conn(conn *dc, bool closing) {
+    bool keep;
+    zstored_downstream_conns *conns;
+    downstream *d;
+
+    cb_assert(dc != NULL);
+    if (dc == NULL_CONN) {
+        return;
+    }
+
+    d = dc->extra;
+    cb_assert(d != NULL);
+
+    d->ptd->stats.stats.tot_downstream_conn_released++;
+
+    if (settings.verbose > 2) {
+        moxi_log_write("%d: release_downstream_conn, %s, (%d)"
+                       " upstream %d\n",
+                       dc->sfd, state_text(dc->state), closing,
+                       (d->upstream_conn != NULL ?
+                        d->upstream_conn->sfd : -1));
+    }
+
+    cb_assert(dc->next == NULL);
+    cb_assert(dc->thread != NULL);
+    cb_assert(dc->host_ident != NULL);
+
+    keep = dc->state == conn_pause;
+    dc->extra = NULL;
+    conns = zstored_get_downstream_conns(dc->thread, dc->host_ident);
+    if (conns != NULL) {
+        if (conns->dc_acquired > 0) {
+            conns->dc_acquired--;
+        }
+
+        if (keep) {
+            conns->ptd = d->ptd;
+
+            dc->idle_time = msec_current_time;
+
+            zstored_park_downstream_conn(conns, dc);
+
+            return;
+        }
+    }
+
+    cproxy_close_conn(dc);
+}
+
+/* Puts an idle downstream conn onto its thread's pool. */
+
+void zstored_park_downstream_conn(zstored_downstream_conns *conns, conn *dc) {
+    downstream *d_head;
+
+    cb_assert(dc->next == NULL);
+    cb_assert(dc->extra == NULL);
+
+    dc->next = conns->dc;
+    conns->dc = dc;
+
+    /* Since one downstream conn was released, process a single */
+    /* waiting downstream, if any. */
+
+    d_head = conns->downstream_waiting_head;
+    if (d_head != NULL) {
+        cb_assert(conns->downstream_waiting_tail != NULL);
+
+        conns->downstream_waiting_head =
+            conns->downstream_waiting_head->next_waiting;
+        if (conns->downstream_waiting_head == NULL) {
+            conns->downstream_waiting_tail = NULL;
+        }
+        d_head->next_waiting = NULL;
+
+        d_head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+
+        cproxy_clear_timeout(d_head);
+
+        cproxy_forward_or_error(d_head);
+    }
+
+    zstored_probe_arm(conns);
+}
+
+/* ------------------------------------------------- */
+
+/* Idle downstream conns are periodically health checked, so that */
+/* a half-dead conn is found by a NOOP (or by a version command, */
+/* for ascii) instead of by a real request that then has to wait */
+/* for its downstream_timeout.  The timer is per host_ident, per */
+/* thread, and only runs while there are idle conns to look at. */
+
+static void zstored_probe_timeout(evutil_socket_t fd,
+                                  const short which,
+                                  void *arg);
+
+static uint32_t zstored_probe_period(proxy_behavior *b) {
+    if (b->downstream_conn_probe_interval > 0 &&
+        (b->downstream_conn_idle_max == 0 ||
+         b->downstream_conn_probe_interval < b->downstream_conn_idle_max)) {
+        return b->downstream_conn_probe_interval;
+    }
+
+    return b->downstream_conn_idle_max;
+}
+
+void zstored_probe_arm(zstored_downstream_conns *conns) {
+    struct timeval tv;
+    uint32_t msecs;
+
+    if (conns->probe_armed ||
+        conns->ptd == NULL ||
+        conns->thread == NULL) {
+        return;
+    }
+
+    msecs = zstored_probe_period(&conns->ptd->behavior_pool.base);
+    if (msecs == 0) {
+        return;
+    }
+
+    tv.tv_sec  = msecs / 1000;
+    tv.tv_usec = (msecs % 1000) * 1000;
+
+    evtimer_set(&conns->probe_event, zstored_probe_timeout, conns);
+
+    event_base_set(conns->thread->base, &conns->probe_event);
+
+    conns->probe_armed = evtimer_add(&conns->probe_event, &tv) == 0;
+}
+
+static void zstored_probe_timeout(evutil_socket_t fd,
+                                  const short which,
+                                  void *arg) {
+    zstored_downstream_conns *conns = arg;
+    proxy_behavior *b;
+    conn *dc;
+    conn *next;
+    (void)fd;
+    (void)which;
+
+    cb_assert(conns != NULL);
+    cb_assert(conns->ptd != NULL);
+
+    conns->probe_armed = false;
+
+    b = &conns->ptd->behavior_pool.base;
+
+    for (dc = conns->dc; dc != NULL; dc = next) {
+        uint64_t idle = msec_current_time - dc->idle_time;
+        bool found = false;
+
+        next = dc->next;
+
+        if (b->downstream_conn_idle_max > 0 &&
+            b->downstream_conn_idle_max <= idle) {
+            conns->dc = conn_list_remove(conns->dc, NULL, dc, &found);
+            cb_assert(found);
+
+            conns->ptd->stats.stats.tot_downstream_conn_idle_closed++;
+
+            if (settings.verbose > 2) {
+                moxi_log_write("%d: closing idle downstream conn %s\n",
+                               dc->sfd, dc->host_ident);
+            }
+
+            cproxy_close_conn(dc);
+        } else if (b->downstream_conn_probe_interval > 0 &&
+                   b->downstream_conn_probe_interval <= idle) {
+            conns->dc = conn_list_remove(conns->dc, NULL, dc, &found);
+            cb_assert(found);
+
+            if (!zstored_probe_start(conns, dc)) {
+                conns->ptd->stats.stats.tot_downstream_conn_probe_failed++;
+
+                /* Counts the error, undoes the probe's dc_acquired, */
+                /* and fails any waiting downstreams if that was */
+                /* the last downstream conn. */
+
+                zstored_error_count(conns->thread, dc->host_ident, true);
+
+                cproxy_close_conn(dc);
+            }
+        }
+    }
+
+    if (conns->dc != NULL) {
+        zstored_probe_arm(conns);
+    }
+}
+
+/* Sends the probe request on an idle downstream conn, which has */
+/* already been taken off the conns->dc list, and moves it into the */
+/* conn_authing state to wait for the reply.  The conn is counted in */
+/* dc_acquired even on failure, for the caller's zstored_error_count(). */
+
+bool zstored_probe_start(zstored_downstream_conns *conns, conn *dc) {
+    protocol_binary_request_noop req;
+    struct timeval tv;
+    uint32_t msecs;
+    const char *buf;
+    int len;
+
+    cb_assert(dc->next == NULL);
+    cb_assert(dc->extra == NULL);
+    cb_assert(dc->state == conn_pause);
+
+    conns->ptd->stats.stats.tot_downstream_conn_probe++;
+    conns->dc_acquired++;
+
+    if (IS_BINARY(dc->protocol)) {
+        memset(&req, 0, sizeof(req));
+        req.message.header.request.magic  = PROTOCOL_BINARY_REQ;
+        req.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+
+        buf = (const char *) req.bytes;
+        len = sizeof(req.bytes);
+    } else {
+        buf = "version\r\n";
+        len = (int) strlen(buf);
+    }
+
+    /* The socket has been idle, so the tiny request should */
+    /* fit in its send buffer; anything else is a bad sign. */
+
+    if (send(dc->sfd, buf, len, 0) != len) {
+        return false;
+    }
+
+    msecs = conns->ptd->behavior_pool.base.downstream_conn_probe_interval;
+
+    tv.tv_sec  = msecs / 1000;
+    tv.tv_usec = (msecs % 1000) * 1000;
+
+    dc->probing = true;
+    dc->rcurr   = dc->rbuf;
+    dc->rbytes  = 0;
+
+    conn_set_state(dc, conn_authing);
+
+    if (!update_event_timed(dc, EV_READ | EV_PERSIST, &tv)) {
+        conns->ptd->stats.stats.err_oom++;
+        dc->probing = false;
+        return false;
+    }
+
+    return true;
+}
+
+/* Reads the probe reply, putting the downstream conn back onto */
+/* its pool when it's healthy, or else closing it. */
+
+bool cproxy_on_probe_downstream_conn(conn *c) {
+    zstored_downstream_conns *conns;
+    bool ok = false;
+    int n;
+
+    cb_assert(c->extra == NULL);
+    cb_assert(c->thread != NULL);
+
+    conns = zstored_get_downstream_conns(c->thread, c->host_ident);
+    if (conns == NULL) {
+        goto failed;
+    }
+
+    if (c->which == EV_TIMEOUT) {
+        goto failed;
+    }
+
+    n = recv(c->sfd, c->rbuf + c->rbytes, c->rsize - c->rbytes, 0);
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+
+        goto failed;
+    }
+
+    c->rbytes += n;
+
+    if (IS_BINARY(c->protocol)) {
+        protocol_binary_response_header *res =
+            (protocol_binary_response_header *) c->rbuf;
+
+        if (c->rbytes < (int) sizeof(*res)) {
+            return true;
+        }
+
+        ok = (c->rbytes == (int) sizeof(*res) &&
+              res->response.magic == PROTOCOL_BINARY_RES &&
+              res->response.opcode == PROTOCOL_BINARY_CMD_NOOP &&
+              res->response.bodylen == 0);
+    } else {
+        char *el = memchr(c->rbuf, '\n', c->rbytes);
+        if (el == NULL) {
+            if (c->rbytes < c->rsize) {
+                return true;
+            }
+        } else {
+            ok = (el + 1 == c->rbuf + c->rbytes &&
+                  strncmp(c->rbuf, "VERSION ", 8) == 0);
+        }
+    }
+
+    if (ok) {
+        if (conns->dc_acquired > 0) {
+            conns->dc_acquired--;
+        }
+
+        c->probing = false;
+        c->rcurr   = c->rbuf;
+        c->rbytes  = 0;
+
+        conn_set_state(c, conn_pause);
+
+        if (update_event(c, EV_READ | EV_PERSIST)) {
+            zstored_park_downstream_conn(conns, c);
+
+            return true;
+        }
+
+        if (conns->ptd != NULL) {
+            conns->ptd->stats.stats.err_oom++;
+        }
+
+        cproxy_close_conn(c);
+
+        return true;
+    }
+
+ failed:
+    if (settings.verbose > 1) {
+        moxi_log_write("%d: probe_downstream failed: %s\n",
+                       c->sfd, c->host_ident);
+    }
+
+    if (conns != NULL &&
+        conns->ptd != NULL) {
+        conns->ptd->stats.stats.tot_downstream_conn_probe_failed++;
+    }
+
+    c->probing = false;
+
+    conn_set_state(c, conn_closing);
+    update_event(c, 0);
+
+    /* Also undoes the probe's dc_acquired, and serves or fails */
+    /* any downstreams that are waiting for a downstream conn. */
+
+    zstored_error_count(c->thread, c->host_ident, true);
+
+    return false;
+}
+
+/* Returns true if the downstream was found on any */
+/* conns->downstream_waiting_head/tail queues and was removed. */
+
+bool zstored_downstream_waiting_remove(downstream *d) {
+    bool found = false;
+    int i;
+    int n;
+    LIBEVENT_THREAD *thread = thread_by_index(thread_index(cb_thread_self()));
+    cb_assert(thread != NULL);
+
+    n = mcs_server_count(&d->mst);
+    for (i = 0; i < n; i++) {
+        char *host_ident;
+        zstored_downstream_conns *conns;
+        mcs_server_st *msst = mcs_server_index(&d->mst, i);
+
+        enum protocol downstream_protocol =
+            d->upstream_conn && d->upstream_conn->peer_protocol ?
+            d->upstream_conn->peer_protocol :
+            d->behaviors_arr[i].downstream_protocol;
+
+        cb_assert(IS_PROXY(downstream_protocol));
+
+        host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
+        conns = zstored_get_downstream_conns(thread, host_ident);
+
+        if (conns != NULL) {
+            /* Linked-list removal, on the next_waiting pointer, */
+            /* and keep head and tail pointers updated. */
+
+            downstream *prev = NULL;
+            downstream *curr = conns->downstream_waiting_head;
+
+            while (curr != NULL) {
+                if (curr == d) {
+                    found = true;
+
+                    if (conns->downstream_waiting_head == curr) {
+                        cb_assert(conns->downstream_waiting_tail != NULL);
+                        conns->downstream_waiting_head = curr->next_waiting;
+                    }
+
+                    if (conns->downstream_waiting_tail == curr) {
+                        conns->downstream_waiting_tail = prev;
+                    }
+
+                    if (prev != NULL) {
+                        prev->next_waiting = curr->next_waiting;
+                    }
+
+                    curr->next_waiting = NULL;
+
+                    d->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+
+                    break;
+                }
+
+                prev = curr;
+                curr = curr->next_waiting;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool zstored_downstream_waiting_add(downstream *d, LIBEVENT_THREAD *thread,
+                                    mcs_server_st *msst,
+                                    proxy_behavior *behavior) {
+    enum protocol downstream_protocol;
+    char *host_ident;
+    zstored_downstream_conns *conns;
+
+    cb_assert(thread != NULL);
+    cb_assert(d != NULL);
+    cb_assert(d->upstream_conn != NULL);
+    cb_assert(d->next_waiting == NULL);
+
+    downstream_protocol = d->upstream_conn->peer_protocol ?
+        d->upstream_conn->peer_protocol :
+        behavior->downstream_protocol;
+
+    host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
+    conns = zstored_get_downstream_conns(thread, host_ident);
+    if (conns != NULL) {
+        cb_assert(conns->dc == NULL);
+
+        if (conns->downstream_waiting_head == NULL) {
+            cb_assert(conns->downstream_waiting_tail == NULL);
+            conns->downstream_waiting_head = d;
+        }
+        if (conns->downstream_waiting_tail != NULL) {
+            cb_assert(conns->downstream_waiting_tail->next_waiting == NULL);
+            conns->downstream_waiting_tail->next_waiting = d;
+        }
+        conns->downstream_waiting_tail = d;
+
+        d->ptd->stats.stats.tot_downstream_conn_queue_add++;
+
+        return true;
+    }
+
+    return false;
+}
+
+/* Downstreams that are waiting on the resolver thread to look */
+/* up a host_ident's address retry their connect after a short */
+/* while, as the resolver has no way to wake up a worker thread. */
+
+static void zstored_resolve_timeout(evutil_socket_t fd,
+                                    const short which,
+                                    void *arg);
+
+void zstored_resolve_arm(zstored_downstream_conns *conns) {
+    struct timeval tv;
+
+    if (conns->resolve_armed) {
+        return;
+    }
+
+    tv.tv_sec  = 0;
+    tv.tv_usec = ZSTORED_RESOLVE_RETRY_MSECS * 1000;
+
+    evtimer_set(&conns->resolve_event, zstored_resolve_timeout, conns);
+
+    event_base_set(conns->thread->base, &conns->resolve_event);
+
+    conns->resolve_armed = evtimer_add(&conns->resolve_event, &tv) == 0;
+}
+
+static void zstored_resolve_timeout(evutil_socket_t fd,
+                                    const short which,
+                                    void *arg) {
+    zstored_downstream_conns *conns = arg;
+    downstream *head;
+    downstream *tail;
+    downstream *curr;
+    (void)fd;
+    (void)which;
+
+    cb_assert(conns != NULL);
+
+    conns->resolve_armed = false;
+
+    /* Take the downstreams that are waiting on the resolver off */
+    /* the queue, leaving any that wait on downstream_conn_max. */
+
+    head = NULL;
+    tail = NULL;
+
+    curr = conns->downstream_waiting_head;
+
+    conns->downstream_waiting_head = NULL;
+    conns->downstream_waiting_tail = NULL;
+
+    while (curr != NULL) {
+        downstream *next = curr->next_waiting;
+
+        curr->next_waiting = NULL;
+
+        if (curr->waiting_resolve) {
+            if (tail != NULL) {
+                tail->next_waiting = curr;
+            } else {
+                head = curr;
+            }
+            tail = curr;
+        } else {
+            if (conns->downstream_waiting_tail != NULL) {
+                conns->downstream_waiting_tail->next_waiting = curr;
+            } else {
+                conns->downstream_waiting_head = curr;
+            }
+            conns->downstream_waiting_tail = curr;
+        }
+
+        curr = next;
+    }
+
+    /* A downstream that's still unresolved just waits again, */
+    /* but keeps its timeout. */
+
+    while (head != NULL) {
+        downstream *prev;
+
+        head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+
+        prev = head;
+        head = head->next_waiting;
+        prev->next_waiting = NULL;
+
+        cproxy_forward_or_error(prev);
+    }
+}
+
+/* A downstream is eligible to share a multiplexed downstream conn */
+/* when it's a simple, non-quiet binary request headed to a binary */
+/* downstream server, so that exactly one response comes back. */
+
+bool zstored_mux_eligible(downstream *d, proxy_behavior *behavior,
+                          enum protocol downstream_protocol) {
+    conn *uc = d->upstream_conn;
+
+    return (behavior->downstream_conn_multiplex > 0 &&
+            IS_BINARY(downstream_protocol) &&
+            uc != NULL &&
+            uc->next == NULL &&
+            IS_BINARY(uc->protocol) &&
+            uc->corked == NULL &&
+            uc->noreply == false &&
+            cproxy_is_broadcast_cmd(uc->cmd) == false);
+}
+
+/* Returns a shared downstream conn that has a free slot, or NULL. */
+
+conn *zstored_mux_find(zstored_downstream_conns *conns) {
+    zstored_mux *mux;
+
+    cb_assert(conns != NULL);
+
+    for (mux = conns->mux; mux != NULL; mux = mux->next) {
+        if (mux->slots_used < mux->slots_max &&
+            mux->dc->state != conn_connecting &&
+            mux->dc->state != conn_authing &&
+            mux->dc->state != conn_closing) {
+            return mux->dc;
+        }
+    }
+
+    return NULL;
+}
+
+/* Turns an acquired downstream conn into a shared one.  On failure, */
+/* the downstream conn just remains exclusive to the downstream. */
+
+void zstored_mux_create(conn *dc, zstored_downstream_conns *conns,
+                        proxy_behavior *behavior, downstream *d) {
+    zstored_mux *mux;
+
+    cb_assert(dc != NULL);
+    cb_assert(dc->mux == NULL);
+    cb_assert(conns != NULL);
+    cb_assert(behavior->downstream_conn_multiplex > 0);
+
+    mux = calloc(1, sizeof(zstored_mux));
+    if (mux != NULL) {
+        mux->slots = calloc(behavior->downstream_conn_multiplex,
+                            sizeof(zstored_mux_slot));
+        if (mux->slots != NULL) {
+            mux->dc        = dc;
+            mux->slots_max = behavior->downstream_conn_multiplex;
+            mux->coalesce  = behavior->downstream_conn_coalesce > 0;
+            mux->next      = conns->mux;
+            conns->mux     = mux;
+
+            dc->mux = mux;
+
+            d->ptd->stats.stats.tot_downstream_mux_conn++;
+
+            return;
+        }
+
+        free(mux);
+    }
+
+    d->ptd->stats.stats.err_oom++;
+}
+
+/* Queues a binary request item onto a shared downstream conn, */
+/* swapping in our own opaque so we can later match the response */
+/* back to the downstream.  The upstream's item is not modified. */
+
+bool cproxy_mux_send(conn *dc, downstream *d, item *it) {
+    zstored_mux *mux = dc->mux;
+    zstored_mux_slot *slot = NULL;
+    zstored_downstream_conns *conns;
+    uint32_t i;
+    int k;
+
+    cb_assert(mux != NULL);
+    cb_assert(d != NULL);
+    cb_assert(it != NULL);
+    cb_assert(it->nbytes >= (int) sizeof(protocol_binary_request_header));
+
+    for (i = 0; i < mux->slots_max; i++) {
+        if (mux->slots[i].opaque == 0) {
+            slot = &mux->slots[i];
+            break;
+        }
+    }
+
+    if (slot == NULL) {
+        return false;
+    }
+
+    do {
+        mux->opaque_next++;
+    } while (mux->opaque_next == 0 ||
+             mux->opaque_next == OPAQUE_IGNORE_REPLY);
+
+    memcpy(&slot->hdr, ITEM_data(it), sizeof(slot->hdr));
+
+    slot->opaque_orig = slot->hdr.request.opaque;
+    slot->opaque = htonl(mux->opaque_next);
+    slot->hdr.request.opaque = slot->opaque;
+    slot->d = d;
+    slot->it = it;
+
+    it->refcount++;
+
+    mux->slots_used++;
+
+    d->ptd->stats.stats.tot_downstream_mux_request++;
+
+    if (dc->extra == d) {
+        dc->extra = NULL; /* Was set by acquire or connect. */
+    }
+
+    /* When coalescing, the request waits in its slot for the */
+    /* end of the event loop iteration, to share one write with */
+    /* the other requests bound for the same server. */
+
+    if (mux->coalesce) {
+        conns = zstored_get_downstream_conns(dc->thread, dc->host_ident);
+        if (conns != NULL &&
+            zstored_mux_flush_arm(conns)) {
+            return true;
+        }
+    }
+
+    if (zstored_mux_flush(dc)) {
+        return true;
+    }
+
+    if (slot->it != NULL) {
+        item_remove(slot->it);
+    }
+    memset(slot, 0, sizeof(*slot));
+    mux->slots_used--;
+
+    k = downstream_conn_index(d, dc);
+    if (k >= 0) {
+        d->downstream_conns[k] = NULL_CONN;
+    }
+
+    cproxy_close_conn(dc);
+
+    return false;
+}
+
+/* Writes out any queued requests, but only when the shared */
+/* downstream conn is between response messages.  Otherwise, the */
+/* flush is deferred until the next cproxy_mux_on_pause(). */
+
+bool zstored_mux_flush(conn *dc) {
+    zstored_mux *mux = dc->mux;
+    proxy_stats *stats = NULL;
+    bool prepped = false;
+    uint32_t n = 0;
+    uint32_t i;
+
+    cb_assert(mux != NULL);
+
+    if (dc->state != conn_pause &&
+        dc->state != conn_new_cmd &&
+        dc->state != conn_waiting &&
+        dc->state != conn_read) {
+        return true;
+    }
+
+    for (i = 0; i < mux->slots_max; i++) {
+        zstored_mux_slot *slot = &mux->slots[i];
+        item *it = slot->it;
+
+        if (it == NULL) {
+            continue;
+        }
+
+        if (!prepped) {
+            if (cproxy_prep_conn_for_write(dc) == false) {
+                return false;
+            }
+            prepped = true;
+        }
+
+        /* The conn's ilist takes over the slot's item refcount. */
+
+        if (add_conn_item(dc, it) == false) {
+            return false;
+        }
+        slot->it = NULL;
+
+        if (add_iov(dc, &slot->hdr, sizeof(slot->hdr)) != 0 ||
+            add_iov(dc, ITEM_data(it) + sizeof(slot->hdr),
+                    it->nbytes - sizeof(slot->hdr)) != 0) {
+            return false;
+        }
+
+        if (stats == NULL && slot->d != NULL) {
+            stats = &slot->d->ptd->stats.stats;
+        }
+        n++;
+    }
+
+    if (prepped) {
+        if (stats != NULL) {
+            stats->tot_downstream_mux_batch++;
+            stats->tot_downstream_mux_batch_requests += n;
+        }
+
+        conn_set_state(dc, conn_mwrite);
+        dc->write_and_go = conn_new_cmd;
+
+        return update_event(dc, EV_WRITE | EV_PERSIST);
+    }
+
+    return true;
+}
+
+static void zstored_mux_flush_timeout(evutil_socket_t fd,
+                                      const short which,
+                                      void *arg);
+
+/* Schedules a flush of the shared downstream conns of a host_ident */
+/* for after the events of this event loop iteration are handled. */
+/* Returns false when the flush could not be scheduled. */
+
+bool zstored_mux_flush_arm(zstored_downstream_conns *conns) {
+    struct timeval tv;
+
+    if (conns->flush_armed) {
+        return true;
+    }
+
+    tv.tv_sec  = 0;
+    tv.tv_usec = 0;
+
+    evtimer_set(&conns->flush_event, zstored_mux_flush_timeout, conns);
 
-            if (conns->dc_acquired <= 0 && conns->dc == NULL) {
-                downstream *head = conns->downstream_waiting_head;
+    event_base_set(conns->thread->base, &conns->flush_event);
 
-                conns->downstream_waiting_head = NULL;
-                conns->downstream_waiting_tail = NULL;
+    conns->flush_armed = evtimer_add(&conns->flush_event, &tv) == 0;
 
-                while (head != NULL) {
-                    downstream *prev;
+    return conns->flush_armed;
+}
 
-                    head->ptd->stats.stats.tot_downstream_waiting_errors++;
-                    head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+static void zstored_mux_flush_timeout(evutil_socket_t fd,
+                                      const short which,
+                                      void *arg) {
+    zstored_downstream_conns *conns = arg;
+    zstored_mux *mux;
+    (void)fd;
+    (void)which;
 
-                    prev = head;
-                    head = head->next_waiting;
-                    prev->next_waiting = NULL;
+    cb_assert(conns != NULL);
 
-                    cproxy_forward_or_error(prev);
-                }
-            }
+    conns->flush_armed = false;
+
+    mux = conns->mux;
+    while (mux != NULL) {
+        if (zstored_mux_flush(mux->dc)) {
+            mux = mux->next;
+            continue;
         }
+
+        /* Closing errors out the downstreams of the shared conn, */
+        /* which might change the list, so start over. */
+
+        cproxy_close_conn(mux->dc);
+
+        mux = conns->mux;
     }
 }
 
-conn *zstored_acquire_downstream_conn(downstream *d,
-                                      LIBEVENT_THREAD *thread,
-                                      mcs_server_st *msst,
-                                      proxy_behavior *behavior,
-                                      bool *downstream_conn_max_reached) {
-    enum protocol downstream_protocol;
-    char *host_ident;
-    conn *dc;
-    zstored_downstream_conns *conns;
+/* Called with a response header at dc->rcurr, to find the */
+/* downstream that's waiting for it.  The dc->extra becomes NULL */
+/* when the downstream has already gone away. */
 
-    cb_assert(d);
-    cb_assert(d->ptd);
-    cb_assert(d->ptd->downstream_released != d); /* Should not be in free list. */
-    cb_assert(thread);
-    cb_assert(msst);
-    cb_assert(behavior);
-    cb_assert(mcs_server_st_hostname(msst) != NULL);
-    cb_assert(mcs_server_st_port(msst) > 0);
-    cb_assert(mcs_server_st_fd(msst) == -1);
+void cproxy_mux_route(conn *dc) {
+    zstored_mux *mux = dc->mux;
+    protocol_binary_response_header *header;
+    uint32_t i;
 
-    *downstream_conn_max_reached = false;
+    cb_assert(mux != NULL);
+    cb_assert(dc->rbytes >= (int) sizeof(*header));
 
-    d->ptd->stats.stats.tot_downstream_conn_acquired++;
+    header = (protocol_binary_response_header *) dc->rcurr;
 
-    downstream_protocol =
-        d->upstream_conn->peer_protocol ?
-        d->upstream_conn->peer_protocol :
-        behavior->downstream_protocol;
+    dc->extra = NULL;
 
-    host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
-    conns = zstored_get_downstream_conns(thread, host_ident);
-    if (conns != NULL) {
-        dc = conns->dc;
-        if (dc != NULL) {
-            cb_assert(dc->thread == thread);
-            cb_assert(strcmp(host_ident, dc->host_ident) == 0);
+    for (i = 0; i < mux->slots_max; i++) {
+        zstored_mux_slot *slot = &mux->slots[i];
 
-            conns->dc_acquired++;
-            conns->dc = dc->next;
-            dc->next = NULL;
+        if (slot->opaque == header->response.opaque &&
+            slot->opaque != 0 &&
+            slot->it == NULL) {
+            header->response.opaque = slot->opaque_orig;
+            dc->binary_header.request.opaque = slot->opaque_orig;
+            dc->opaque = slot->opaque_orig;
+            dc->extra = slot->d;
 
-            cb_assert(dc->extra == NULL);
-            dc->extra = d;
+            memset(slot, 0, sizeof(*slot));
+            mux->slots_used--;
 
-            return dc;
+            return;
         }
+    }
+}
 
-        if (behavior->connect_max_errors > 0 &&
-            behavior->connect_max_errors < conns->error_count) {
-            rel_time_t msecs_since_error =
-                (rel_time_t)(msec_current_time - conns->error_time);
+/* A shared downstream conn finished handling a response message. */
 
-            if (settings.verbose > 2) {
-                moxi_log_write("zacquire_dc, %s, %d, %"PRIu64", (%d)\n",
-                               host_ident,
-                               conns->error_count,
-                               (uint64_t)conns->error_time,
-                               msecs_since_error);
-            }
+void cproxy_mux_on_pause(conn *dc) {
+    downstream *d = dc->extra;
+    bool ok;
 
-            if ((behavior->cycle > 0) &&
-                (behavior->connect_retry_interval > msecs_since_error)) {
-                d->ptd->stats.stats.tot_downstream_connect_interval++;
+    dc->extra = NULL;
 
-                return NULL;
-            }
-        }
+    conn_set_state(dc, conn_new_cmd);
 
-        if (behavior->downstream_conn_max > 0 &&
-            behavior->downstream_conn_max <= conns->dc_acquired) {
-            d->ptd->stats.stats.tot_downstream_connect_max_reached++;
+    ok = zstored_mux_flush(dc);
+    if (ok && dc->state == conn_new_cmd) {
+        /* The rbuf might already hold more responses, which */
+        /* won't signal any more read events. */
 
-            *downstream_conn_max_reached = true;
+        ok = update_event(dc, dc->rbytes > 0 ?
+                          EV_WRITE | EV_PERSIST :
+                          EV_READ | EV_PERSIST);
+    }
 
-            return NULL;
+    if (!ok) {
+        if (d != NULL) {
+            d->ptd->stats.stats.err_oom++;
         }
-    }
 
-    dc = cproxy_connect_downstream_conn(d, thread, msst, behavior);
-    if (dc != NULL) {
-        cb_assert(dc->host_ident == NULL);
-        dc->host_ident = strdup(host_ident);
-        if (conns != NULL) {
-            conns->dc_acquired++;
+        dc->extra = d;
+        cproxy_close_conn(dc);
 
-            if (dc->state != conn_connecting) {
-                conns->error_count = 0;
-                conns->error_time = 0;
-            }
-        }
-    } else {
-        if (conns != NULL) {
-            conns->error_count++;
-            conns->error_time = msec_current_time;
-        }
+        return;
     }
 
-    return dc;
+    if (d != NULL) {
+        cproxy_release_downstream_conn(d, dc);
+    } else {
+        zstored_mux_wake(dc);
+    }
 }
 
-/* new fn by jsh */
-void zstored_release_downstream_conn(conn *dc, bool closing) {
-    bool keep;
-    zstored_downstream_conns *conns;
-    downstream *d;
+/* Detaches a downstream from a shared downstream conn, where any */
+/* in-flight responses for the downstream will just be dropped. */
 
-    cb_assert(dc != NULL);
-    if (dc == NULL_CONN) {
-        return;
-    }
+void zstored_mux_release(conn *dc, downstream *d) {
+    zstored_mux *mux = dc->mux;
+    uint32_t i;
 
-    d = dc->extra;
+    cb_assert(mux != NULL);
     cb_assert(d != NULL);
 
     d->ptd->stats.stats.tot_downstream_conn_released++;
 
-    if (settings.verbose > 2) {
-        moxi_log_write("%d: release_downstream_conn, %s, (%d)"
-                       " upstream %d\n",
-                       dc->sfd, state_text(dc->state), closing,
-                       (d->upstream_conn != NULL ?
-                        d->upstream_conn->sfd : -1));
+    if (dc->extra == d) {
+        dc->extra = NULL;
     }
 
-    cb_assert(dc->next == NULL);
-    cb_assert(dc->thread != NULL);
-    cb_assert(dc->host_ident != NULL);
-
-    keep = dc->state == conn_pause;
-    dc->extra = NULL;
-    conns = zstored_get_downstream_conns(dc->thread, dc->host_ident);
-    if (conns != NULL) {
-        if (conns->dc_acquired > 0) {
-            conns->dc_acquired--;
-        }
-
-        if (keep) {
-            downstream *d_head;
-            cb_assert(dc->next == NULL);
-            dc->next = conns->dc;
-            conns->dc = dc;
-
-            /* Since one downstream conn was released, process a single */
-            /* waiting downstream, if any. */
-
-            d_head = conns->downstream_waiting_head;
-            if (d_head != NULL) {
-                cb_assert(conns->downstream_waiting_tail != NULL);
-
-                conns->downstream_waiting_head =
-                    conns->downstream_waiting_head->next_waiting;
-                if (conns->downstream_waiting_head == NULL) {
-                    conns->downstream_waiting_tail = NULL;
-                }
-                d_head->next_waiting = NULL;
+    for (i = 0; i < mux->slots_max; i++) {
+        zstored_mux_slot *slot = &mux->slots[i];
 
-                d_head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+        if (slot->opaque != 0 && slot->d == d) {
+            d->ptd->stats.stats.tot_downstream_mux_orphan++;
 
-                cproxy_clear_timeout(d_head);
-
-                cproxy_forward_or_error(d_head);
+            if (slot->it != NULL) {
+                item_remove(slot->it);
+                memset(slot, 0, sizeof(*slot));
+                mux->slots_used--;
+            } else {
+                slot->d = NULL;
             }
-
-            return;
         }
     }
 
-    cproxy_close_conn(dc);
+    zstored_mux_wake(dc);
 }
 
-/* Returns true if the downstream was found on any */
-/* conns->downstream_waiting_head/tail queues and was removed. */
+/* Since a slot might have freed up, process a single waiting */
+/* downstream, if any.  A shared downstream conn that no longer */
+/* has any requests in flight goes back to the pool instead, so */
+/* that it's again available to requests that can't share it. */
 
-bool zstored_downstream_waiting_remove(downstream *d) {
-    bool found = false;
-    int i;
-    int n;
-    LIBEVENT_THREAD *thread = thread_by_index(thread_index(cb_thread_self()));
-    cb_assert(thread != NULL);
+void zstored_mux_wake(conn *dc) {
+    zstored_mux *mux = dc->mux;
+    zstored_downstream_conns *conns;
+    downstream *d_head;
 
-    n = mcs_server_count(&d->mst);
-    for (i = 0; i < n; i++) {
-        char *host_ident;
-        zstored_downstream_conns *conns;
-        mcs_server_st *msst = mcs_server_index(&d->mst, i);
+    if (mux == NULL ||
+        mux->slots_used >= mux->slots_max ||
+        dc->state == conn_closing) {
+        return;
+    }
 
-        enum protocol downstream_protocol =
-            d->upstream_conn && d->upstream_conn->peer_protocol ?
-            d->upstream_conn->peer_protocol :
-            d->behaviors_arr[i].downstream_protocol;
+    conns = zstored_get_downstream_conns(dc->thread, dc->host_ident);
+    if (conns == NULL) {
+        return;
+    }
 
-        cb_assert(IS_PROXY(downstream_protocol));
+    if (zstored_mux_unshare(dc, conns)) {
+        return;
+    }
 
-        host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
-        conns = zstored_get_downstream_conns(thread, host_ident);
+    d_head = conns->downstream_waiting_head;
+    if (d_head != NULL) {
+        cb_assert(conns->downstream_waiting_tail != NULL);
 
-        if (conns != NULL) {
-            /* Linked-list removal, on the next_waiting pointer, */
-            /* and keep head and tail pointers updated. */
+        conns->downstream_waiting_head = d_head->next_waiting;
+        if (conns->downstream_waiting_head == NULL) {
+            conns->downstream_waiting_tail = NULL;
+        }
+        d_head->next_waiting = NULL;
 
-            downstream *prev = NULL;
-            downstream *curr = conns->downstream_waiting_head;
+        d_head->ptd->stats.stats.tot_downstream_conn_queue_remove++;
 
-            while (curr != NULL) {
-                if (curr == d) {
-                    found = true;
+        cproxy_clear_timeout(d_head);
 
-                    if (conns->downstream_waiting_head == curr) {
-                        cb_assert(conns->downstream_waiting_tail != NULL);
-                        conns->downstream_waiting_head = curr->next_waiting;
-                    }
+        cproxy_forward_or_error(d_head);
+    }
+}
 
-                    if (conns->downstream_waiting_tail == curr) {
-                        conns->downstream_waiting_tail = prev;
-                    }
+/* Turns an idle shared downstream conn back into an exclusive one, */
+/* and parks it, which also gives up its dc_acquired count. */
+/* Returns false when the conn is still busy, so stays shared. */
 
-                    if (prev != NULL) {
-                        prev->next_waiting = curr->next_waiting;
-                    }
+bool zstored_mux_unshare(conn *dc, zstored_downstream_conns *conns) {
+    zstored_mux *mux = dc->mux;
+    zstored_mux **prev;
 
-                    curr->next_waiting = NULL;
+    cb_assert(mux != NULL);
 
-                    d->ptd->stats.stats.tot_downstream_conn_queue_remove++;
+    if (mux->slots_used > 0 ||
+        dc->extra != NULL ||
+        dc->rbytes > 0 ||
+        (dc->state != conn_new_cmd &&
+         dc->state != conn_waiting &&
+         dc->state != conn_read)) {
+        return false;
+    }
 
-                    break;
-                }
+    if (update_event(dc, 0) == false) {
+        return false;
+    }
 
-                prev = curr;
-                curr = curr->next_waiting;
-            }
+    for (prev = &conns->mux; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == mux) {
+            *prev = mux->next;
+            break;
         }
     }
 
-    return found;
+    dc->mux = NULL;
+
+    free(mux->slots);
+    free(mux);
+
+    conn_set_state(dc, conn_pause);
+
+    if (conns->dc_acquired > 0) {
+        conns->dc_acquired--;
+    }
+
+    dc->idle_time = msec_current_time;
+
+    zstored_park_downstream_conn(conns, dc);
+
+    return true;
 }
 
-bool zstored_downstream_waiting_add(downstream *d, LIBEVENT_THREAD *thread,
-                                    mcs_server_st *msst,
-                                    proxy_behavior *behavior) {
-    enum protocol downstream_protocol;
-    char *host_ident;
-    zstored_downstream_conns *conns;
+/* A shared downstream conn is closing, so error out every */
+/* downstream that's still using it. */
 
-    cb_assert(thread != NULL);
-    cb_assert(d != NULL);
-    cb_assert(d->upstream_conn != NULL);
-    cb_assert(d->next_waiting == NULL);
+void zstored_mux_close(conn *dc) {
+    zstored_mux *mux = dc->mux;
+    zstored_downstream_conns *conns;
+    downstream **ds;
+    int nds = 0;
+    int i;
+    uint32_t j;
 
-    downstream_protocol = d->upstream_conn->peer_protocol ?
-        d->upstream_conn->peer_protocol :
-        behavior->downstream_protocol;
+    cb_assert(mux != NULL);
 
-    host_ident = mcs_server_st_ident(msst, IS_ASCII(downstream_protocol));
-    conns = zstored_get_downstream_conns(thread, host_ident);
+    conns = zstored_get_downstream_conns(dc->thread, dc->host_ident);
     if (conns != NULL) {
-        cb_assert(conns->dc == NULL);
+        zstored_mux **prev = &conns->mux;
+        while (*prev != NULL) {
+            if (*prev == mux) {
+                *prev = mux->next;
+                break;
+            }
+            prev = &(*prev)->next;
+        }
+    }
 
-        if (conns->downstream_waiting_head == NULL) {
-            cb_assert(conns->downstream_waiting_tail == NULL);
-            conns->downstream_waiting_head = d;
+    dc->mux = NULL;
+
+    ds = calloc(mux->slots_max + 1, sizeof(downstream *));
+    if (ds != NULL && dc->extra != NULL) {
+        ds[nds++] = dc->extra;
+    }
+
+    for (j = 0; j < mux->slots_max; j++) {
+        zstored_mux_slot *slot = &mux->slots[j];
+
+        if (slot->it != NULL) {
+            item_remove(slot->it);
         }
-        if (conns->downstream_waiting_tail != NULL) {
-            cb_assert(conns->downstream_waiting_tail->next_waiting == NULL);
-            conns->downstream_waiting_tail->next_waiting = d;
+
+        if (ds != NULL && slot->opaque != 0 && slot->d != NULL) {
+            for (i = 0; i < nds && ds[i] != slot->d; i++) {
+            }
+            if (i >= nds) {
+                ds[nds++] = slot->d;
+            }
         }
-        conns->downstream_waiting_tail = d;
+    }
 
-        d->ptd->stats.stats.tot_downstream_conn_queue_add++;
+    free(mux->slots);
+    free(mux);
 
-        return true;
+    if (nds <= 0 && conns != NULL && conns->dc_acquired > 0) {
+        conns->dc_acquired--;
     }
 
-    return false;
+    for (i = 0; i < nds; i++) {
+        dc->extra = ds[i];
+        cproxy_on_close_downstream_conn_ex(dc, ds[i], i == 0);
+    }
+
+    dc->extra = NULL;
+
+    free(ds);
 }
 
 /* Find an appropriate proxy struct or NULL. */
@@ -3799,8 +6106,78 @@ bool cproxy_front_cache_key(proxy_td *ptd, char *key, int key_len) {
             matcher_check(&ptd->proxy->front_cache_unmatcher, key, key_len, false) == false);
 }
 
+/* Whether a get miss on the key should be remembered in the */
+/* front_cache, see the front_cache_miss_lifespan behavior. */
+
+bool cproxy_front_cache_miss_key(proxy_td *ptd, char *key, int key_len) {
+    return (key != NULL &&
+            key_len > 0 &&
+            ptd->behavior_pool.base.front_cache_lifespan > 0 &&
+            ptd->behavior_pool.base.front_cache_miss_lifespan > 0 &&
+            matcher_check(&ptd->proxy->front_cache_miss_matcher, key, key_len, false) == true &&
+            matcher_check(&ptd->proxy->front_cache_unmatcher, key, key_len, false) == false);
+}
+
+/* Returns the proxy's count of front_cache deletes, to be taken */
+/* before a get is sent, for cproxy_front_cache_miss(). */
+
+uint64_t cproxy_front_cache_gen(proxy_td *ptd) {
+    return work_atomic_load(&ptd->proxy->front_cache_gen);
+}
+
+static uint64_t *cproxy_front_cache_deleted(proxy *p,
+                                            char *key, int key_len) {
+    return &p->front_cache_deleted[hash(key, key_len, 0) %
+                                   FRONT_CACHE_DELETED_SLOTS];
+}
+
+/* Remembers a get miss on a key that cproxy_front_cache_miss_key() */
+/* accepted, as an ITEM_MISS item in the front_cache.  The gen is */
+/* the cproxy_front_cache_gen() from before the get was sent, where */
+/* a delete of the key since then means the miss might be stale. */
+
+void cproxy_front_cache_miss(proxy_td *ptd, char *key, int key_len,
+                             uint64_t gen) {
+    uint64_t *deleted = cproxy_front_cache_deleted(ptd->proxy, key, key_len);
+    item *it;
+
+    if (work_atomic_load(deleted) > gen) {
+        return;
+    }
+
+    it = item_alloc(key, key_len, 0, 0, 2);
+    if (it != NULL) {
+        memcpy(ITEM_data(it), "\r\n", 2);
+        it->it_flags |= ITEM_MISS;
+
+        mcache_set(&ptd->proxy->front_cache, it,
+                   ptd->behavior_pool.base.front_cache_miss_lifespan +
+                   msec_current_time,
+                   true, false);
+
+        item_remove(it);
+
+        ptd->stats.stats.tot_front_cache_miss_adds++;
+    }
+}
+
 void cproxy_front_cache_delete(proxy_td *ptd, char *key, int key_len) {
-    if (cproxy_front_cache_key(ptd, key, key_len) == true) {
+    if (cproxy_front_cache_key(ptd, key, key_len) == true ||
+        cproxy_front_cache_miss_key(ptd, key, key_len) == true) {
+        uint64_t *deleted =
+            cproxy_front_cache_deleted(ptd->proxy, key, key_len);
+        uint64_t gen =
+            work_atomic_add(&ptd->proxy->front_cache_gen, 1) + 1;
+        uint64_t prev = work_atomic_load(deleted);
+
+        /* Stamp before the delete, so that a racing miss either */
+        /* sees the stamp or gets deleted.  Another thread might */
+        /* have stamped a later gen into a colliding slot already. */
+
+        while (prev < gen &&
+               work_atomic_cas(deleted, &prev, gen) == false) {
+        }
+
         mcache_delete(&ptd->proxy->front_cache, key, key_len);
 
         if (settings.verbose > 1) {
@@ -54,12 +54,17 @@ typedef struct {
     void  (*item_set_prev)(void *it, void *prev);
     uint64_t (*item_get_exptime)(void *it);
     void     (*item_set_exptime)(void *it, uint64_t exptime);
+    bool     (*item_get_refreshing)(void *it); /* NULL-able, */
+    void     (*item_set_refreshing)(void *it,  /* for no grace. */
+                                    bool refreshing);
 } mcache_funcs;
 
 extern mcache_funcs mcache_item_funcs;
 extern mcache_funcs mcache_key_stats_funcs;
 
-typedef struct {
+typedef struct mcache mcache;
+
+struct mcache {
     mcache_funcs *funcs;
 
     cb_mutex_t *lock; /* NULL-able, for non-multithreaded. */
@@ -70,14 +75,30 @@ typedef struct {
 
     uint32_t max;          /* Maxiumum number of items to keep. */
 
+    uint64_t max_bytes;      /* Max sum of item_len()'s, 0 for unlimited. */
+    uint64_t max_item_bytes; /* Max item_len() to keep, 0 for unlimited. */
+    uint64_t curr_bytes;     /* Sum of item_len()'s of the kept items. */
+
+    uint32_t grace;        /* In millisecs, how long past its exptime an */
+                           /* item may still be served while one reader */
+                           /* refreshes it, 0 for none. */
+
     void *lru_head;        /* Most recently used. */
     void *lru_tail;        /* Least recently used. */
 
     uint32_t oldest_live;  /* In millisecs, relative to msec_current_time. */
 
+    bool admission;        /* True if a full mcache only admits a new */
+                           /* item when the sketch estimates that it's */
+                           /* more frequently accessed than the LRU victim. */
+
+    struct mcache_sketch *sketch; /* NULL-able, when admission is off. */
+
     /* Statistics. */
 
     uint64_t tot_get_hits;
+    uint64_t tot_get_stale_hits;  /* Hits, of items being refreshed. */
+    uint64_t tot_get_refreshes;   /* Misses, to refresh a stale item. */
     uint64_t tot_get_expires;
     uint64_t tot_get_misses;
     uint64_t tot_get_bytes;
@@ -85,9 +106,49 @@ typedef struct {
     uint64_t tot_add_skips;
     uint64_t tot_add_fails;
     uint64_t tot_add_bytes;
+    uint64_t tot_add_too_large;
     uint64_t tot_deletes;
     uint64_t tot_evictions;
-} mcache;
+    uint64_t tot_admits;                /* New items that beat the victim. */
+    uint64_t tot_admit_rejects;         /* New items that lost to the victim. */
+    uint64_t tot_admit_protected_hits;  /* Hits on victims that were kept. */
+    uint64_t tot_admit_rejected_misses; /* Misses on rejected items. */
+
+    /* When sharded, the items are instead spread by key hash */
+    /* across the shards, each with its own lock, map, LRU list */
+    /* and statistics, and the fields above go unused. */
+
+    mcache  *shards;       /* NULL-able, array of nshards mcache's. */
+    uint32_t nshards;
+};
+
+/* A copy of the statistics of one shard, or of all of them merged. */
+
+typedef struct {
+    uint32_t size;
+    uint32_t max;
+    uint32_t oldest_live;
+    uint64_t curr_bytes;
+    uint64_t max_bytes;
+
+    uint64_t tot_get_hits;
+    uint64_t tot_get_stale_hits;
+    uint64_t tot_get_refreshes;
+    uint64_t tot_get_expires;
+    uint64_t tot_get_misses;
+    uint64_t tot_get_bytes;
+    uint64_t tot_adds;
+    uint64_t tot_add_skips;
+    uint64_t tot_add_fails;
+    uint64_t tot_add_bytes;
+    uint64_t tot_add_too_large;
+    uint64_t tot_deletes;
+    uint64_t tot_evictions;
+    uint64_t tot_admits;
+    uint64_t tot_admit_rejects;
+    uint64_t tot_admit_protected_hits;
+    uint64_t tot_admit_rejected_misses;
+} mcache_stats;
 
 typedef struct proxy               proxy;
 typedef struct proxy_td            proxy_td;
@@ -96,8 +157,11 @@ typedef struct proxy_stats         proxy_stats;
 typedef struct proxy_behavior      proxy_behavior;
 typedef struct proxy_behavior_pool proxy_behavior_pool;
 typedef struct downstream          downstream;
+typedef struct bin_quiet           bin_quiet;
 typedef struct key_stats           key_stats;
 
+typedef struct zstored_downstream_conns zstored_downstream_conns;
+
 struct proxy_behavior {
     /* IL means startup, system initialization level behavior. */
     /* ML means proxy/pool manager-level behavior (proxy_main). */
@@ -108,6 +172,44 @@ struct proxy_behavior {
     uint32_t       downstream_max;      /* PL: Downstream concurrency. */
     uint32_t       downstream_conn_max; /* PL: Max # of conns per thread */
                                         /* and per host_ident. */
+    uint32_t       downstream_conn_multiplex; /* PL: Max # of in-flight */
+                                        /* requests per shared binary */
+                                        /* downstream conn, 0 to disable. */
+    uint32_t       downstream_conn_coalesce; /* PL: When 1, requests */
+                                        /* queued onto a shared downstream */
+                                        /* conn during one event loop */
+                                        /* iteration go out in one write. */
+    uint32_t       downstream_conn_prewarm; /* PL: # of downstream conns to */
+                                        /* open per thread and per */
+                                        /* host_ident ahead of traffic. */
+    uint32_t       downstream_conn_probe_interval; /* PL: In millisecs, how often */
+                                        /* idle pooled downstream conns */
+                                        /* are health checked, 0 to disable. */
+    uint32_t       downstream_conn_idle_max; /* PL: In millisecs, max time that a */
+                                        /* downstream conn may stay idle in */
+                                        /* the pool, 0 for unlimited. */
+    uint32_t       hedge_get_percentile; /* PL: Latency percentile after */
+                                        /* which a binary GET is also sent */
+                                        /* to the vbucket replica, 0 to disable. */
+    uint32_t       coalesce_get;        /* PL: When 1, concurrent ascii */
+                                        /* get's of a key that's already */
+                                        /* in flight share its response. */
+    uint32_t       stream_min_bytes;    /* PL: Ascii get values of at */
+                                        /* least this many bytes are */
+                                        /* relayed to a single upstream */
+                                        /* as they arrive, in chunks. */
+    uint32_t       stream_splice;       /* PL: When 1, the rest of a */
+                                        /* streamed value is moved with */
+                                        /* splice(), where available. */
+    uint32_t       pipeline_max;        /* PL: Max number of pipelined */
+                                        /* ascii get's of an upstream conn */
+                                        /* that are forwarded together. */
+    uint32_t       listen_reuseport;    /* IL: When 1, each worker */
+                                        /* thread accepts on its own */
+                                        /* SO_REUSEPORT listener. */
+    uint32_t       stats_snapshot_interval; /* IL: In millisecs, how often */
+                                        /* workers publish their proxy */
+                                        /* stats for stats requests. */
     uint32_t       downstream_weight;   /* SL: Server weight. */
     uint32_t       downstream_retry;    /* SL: How many times to retry a cmd. */
     enum protocol  downstream_protocol; /* SL: Favored downstream protocol. */
@@ -123,11 +225,34 @@ struct proxy_behavior {
     uint32_t connect_retry_interval;  /* IL: Time in millisecs before retrying */
                                       /* when too many connect() errors, to not */
                                       /* overwhelm the downstream servers. */
+    uint32_t connect_retry_interval_max; /* IL: Cap in millisecs of the */
+                                         /* exponential backoff between */
+                                         /* connect retries, which is */
+                                         /* off unless it's above the */
+                                         /* connect_retry_interval. */
 
     uint32_t front_cache_max;         /* PL: Max # of front cachable items. */
+    uint32_t front_cache_shards;      /* IL: # of independently locked */
+                                      /* segments of the front cache. */
+                                      /* Changes need a restart. */
+    uint64_t front_cache_max_bytes;   /* PL: Max bytes of front cached */
+                                      /* values, 0 for unlimited. */
+    uint32_t front_cache_max_item_bytes; /* PL: Don't front cache values */
+                                         /* larger than this, 0 for */
+                                         /* unlimited. */
+    uint32_t front_cache_admission;   /* PL: When 1, only admit items into */
+                                      /* a full front cache when they're */
+                                      /* hotter than the LRU victim. */
     uint32_t front_cache_lifespan;    /* PL: In millisecs. */
+    uint32_t front_cache_grace;       /* PL: In millisecs past the lifespan */
+                                      /* that an item is served stale while */
+                                      /* one request refreshes it. */
     char     front_cache_spec[300];   /* PL: Matcher prefixes for front caching. */
     char     front_cache_unspec[100]; /* PL: Don't front cache prefixes. */
+    uint32_t front_cache_miss_lifespan; /* PL: In millisecs, how long a */
+                                        /* miss is remembered, 0 for never. */
+    char     front_cache_miss_spec[100]; /* PL: Matcher prefixes for */
+                                         /* remembering misses. */
 
     uint32_t key_stats_max;         /* PL: Max # of key stats entries. */
     uint32_t key_stats_lifespan;    /* PL: In millisecs. */
@@ -214,6 +339,8 @@ struct proxy_main {
 
 /* Owned by main listener thread.
  */
+#define FRONT_CACHE_DELETED_SLOTS 1024
+
 struct proxy {
     proxy_main *main; /* Immutable, points to parent proxy_main. */
 
@@ -248,6 +375,14 @@ struct proxy {
     mcache  front_cache;
     matcher front_cache_matcher;
     matcher front_cache_unmatcher;
+    matcher front_cache_miss_matcher;
+
+    /* Every front_cache delete bumps the front_cache_gen, and stamps */
+    /* it into the key's slot, so that a get's miss isn't remembered */
+    /* when its key changed while the get was in flight. */
+
+    uint64_t front_cache_gen;
+    uint64_t front_cache_deleted[FRONT_CACHE_DELETED_SLOTS];
 
     matcher optimize_set_matcher;
 
@@ -292,6 +427,7 @@ struct proxy_stats {
     uint64_t tot_downstream_connect_timeout;
     uint64_t tot_downstream_connect_interval;
     uint64_t tot_downstream_connect_max_reached;
+    uint64_t tot_downstream_connect_unresolved;
 
     uint64_t tot_downstream_waiting_errors;
     uint64_t tot_downstream_auth;
@@ -303,6 +439,26 @@ struct proxy_stats {
     uint64_t tot_downstream_conn_queue_timeout;
     uint64_t tot_downstream_conn_queue_add;
     uint64_t tot_downstream_conn_queue_remove;
+    uint64_t tot_downstream_mux_conn;
+    uint64_t tot_downstream_mux_request;
+    uint64_t tot_downstream_mux_orphan;
+    uint64_t tot_downstream_mux_batch;
+    uint64_t tot_downstream_mux_batch_requests;
+    uint64_t num_downstream_conn_prewarm;
+    uint64_t tot_downstream_conn_prewarm;
+    uint64_t tot_downstream_conn_prewarm_failed;
+    uint64_t tot_downstream_conn_probe;
+    uint64_t tot_downstream_conn_probe_failed;
+    uint64_t tot_downstream_conn_idle_closed;
+    uint64_t tot_hedge_get;
+    uint64_t tot_hedge_get_win;
+    uint64_t tot_hedge_get_wasted;
+    uint64_t tot_hedge_get_skipped;
+    uint64_t tot_get_coalesced;
+    uint64_t tot_stream_values;
+    uint64_t tot_stream_bytes;
+    uint64_t tot_stream_splice_bytes;
+    uint64_t tot_pipelined_gets;
     uint64_t tot_downstream_timeout;
     uint64_t tot_wait_queue_timeout;
     uint64_t tot_auth_timeout;
@@ -319,6 +475,8 @@ struct proxy_stats {
     uint64_t tot_multiget_keys;
     uint64_t tot_multiget_keys_dedupe;
     uint64_t tot_multiget_bytes_dedupe;
+    uint64_t tot_front_cache_miss_hits;
+    uint64_t tot_front_cache_miss_adds;
     uint64_t tot_optimize_sets;
     uint64_t err_oom;
     uint64_t err_upstream_write_prep;
@@ -376,6 +534,17 @@ typedef struct {
     HTGRAM_HANDLE downstream_connect_time_htgram;
 } proxy_stats_td;
 
+/* A copy of a proxy_td's stats, which its worker thread publishes */
+/* every stats_snapshot_interval, so that stats requests can merge */
+/* them without waiting on, or waking up, the worker threads. */
+
+typedef struct {
+    uint64_t       version;   /* Bumped by each publish, 0 until the first. */
+    uint64_t       published; /* msec_current_time of the latest publish. */
+    proxy_stats_td stats;     /* Owns its own histograms. */
+    genhash_t     *key_stats; /* Key string to (struct key_stats *), or NULL. */
+} proxy_stats_snapshot;
+
 struct key_stats {
     char key[KEY_MAX_LENGTH + 1];
     int  refcount;
@@ -386,6 +555,12 @@ struct key_stats {
     proxy_stats_cmd stats_cmd[STATS_CMD_TYPE_last][STATS_CMD_last];
 };
 
+#define HEDGE_SAMPLES 128
+
+#define HEDGE_NONE    0 /* Not a hedgable request. */
+#define HEDGE_WATCH   1 /* Waiting on the master, maybe with a hedge timer. */
+#define HEDGE_SENT    2 /* Also sent to the replica, waiting on either. */
+
 /* We mirror memcached's threading model with a separate
  * proxy_td (td means "thread data") struct owned by each
  * worker thread.  The idea is to avoid extraneous locks.
@@ -426,7 +601,33 @@ struct proxy_td { /* Per proxy, per worker-thread data struct. */
     matcher key_stats_matcher;
     matcher key_stats_unmatcher;
 
+    /* Downstreams that have a single-key ascii get in flight, */
+    /* keyed by the key, for the coalesce_get behavior. */
+
+    genhash_t *inflight_gets;
+
+    /* Pipe that streamed values are splice()'d through, or -1's, */
+    /* for the stream_splice behavior.  It's always left empty. */
+
+    int splice_pipe[2];
+
+    /* Ring of recent binary GET latencies in usecs, for the */
+    /* hedge_get_percentile behavior.  The hedge_delay is */
+    /* recomputed each time the ring fills, and is 0 until then. */
+
+    uint32_t hedge_samples[HEDGE_SAMPLES];
+    uint32_t hedge_samples_num;
+    uint64_t hedge_delay;
+
     proxy_stats_td stats;
+
+    /* Published copy of the stats, guarded by the snapshot_lock, */
+    /* which the worker thread only ever try-locks. */
+
+    cb_mutex_t           snapshot_lock;
+    proxy_stats_snapshot snapshot;
+    struct event         snapshot_event;
+    bool                 snapshot_armed;
 };
 
 /* A 'downstream' struct represents a set of downstream connections.
@@ -452,6 +653,8 @@ struct downstream {
     downstream *next_waiting; /* To track lists when a downstream is reserved, */
                               /* but is waiting for a downstream connection, */
                               /* per zstored perf enhancement. */
+    bool waiting_resolve;     /* When it's waiting on the resolver thread, */
+                              /* see zstored_resolve_arm(). */
 
     conn **downstream_conns;  /* Wraps the fd's of mst with conns. */
     int    downstream_used;   /* Number of in-use downstream conns, might */
@@ -480,8 +683,44 @@ struct downstream {
     char *target_host_ident;
 
     genhash_t *multiget; /* Keyed by string. */
+
+    bin_quiet *bin_quiet;     /* Uncorked quiet binary commands, where a */
+    int        bin_quiet_num; /* command's downstream opaque is its index + 1. */
+
+    char **multiget_keys;     /* Key copies when more than one upstream */
+    int    multiget_keys_num; /* conn shares the downstream, where the */
+    int    multiget_keys_max; /* a2b opaque of a key is its index + 1. */
+
+    int    multiget_ends;     /* # of downstream conns that ended their */
+                              /* reply, see front_cache_miss_lifespan. */
+    bool   multiget_lossy;    /* When a reply value was dropped, so that */
+                              /* its key only looks like a miss. */
+    uint64_t front_cache_gen; /* cproxy_front_cache_gen() as of when */
+                              /* the request was last forwarded. */
     genhash_t *merger;   /* Keyed by string, for merging replies like STATS. */
 
+    char *coalesce_key;  /* Non-NULL while in the ptd->inflight_gets. */
+
+    conn    *stream_conn;   /* Downstream conn that's relaying a value */
+    uint32_t stream_left;   /* upstream, with this many bytes to go, */
+                            /* see the stream_min_bytes behavior. */
+    bool     stream_splice; /* Waiting to splice() more of the value. */
+
+    /* Hedging of a binary GET to the vbucket replica, */
+    /* see the hedge_get_percentile behavior. */
+
+    int            hedge_state;   /* One of the HEDGE_XXX values. */
+    int            hedge_master;  /* Server index of the vbucket master. */
+    int            hedge_replica; /* Server index of the vbucket replica. */
+    int            hedge_vbucket;
+    uint64_t       hedge_start;   /* Snapshot of usec_now(). */
+    bool           hedge_timer;   /* When hedge_event is pending. */
+    struct event   hedge_event;
+
+    int *prewarm_left; /* Non-NULL only for a downstream that's opening */
+                       /* conns ahead of traffic, where it's the per-server */
+                       /* # of downstream conns that are still to be opened. */
+
     /* Timeout is in use when timeout_tv fields are non-zero. */
 
     struct timeval timeout_tv;
@@ -505,9 +744,13 @@ proxy *cproxy_create(proxy_main *main,
                      int nthreads);
 
 int cproxy_listen(proxy *p);
+
+void cproxy_prewarm(proxy *p);
+void cproxy_prewarm_downstream_conns(proxy_td *ptd, LIBEVENT_THREAD *thread);
 int cproxy_listen_port(int port,
                        enum protocol protocol,
                        enum network_transport transport,
+                       bool        reuseport,
                        void       *conn_extra,
                        conn_funcs *conn_funcs);
 
@@ -515,6 +758,7 @@ proxy_td *cproxy_find_thread_data(proxy *p, cb_thread_t thread_id);
 bool      cproxy_init_upstream_conn(conn *c);
 bool      cproxy_init_downstream_conn(conn *c);
 void      cproxy_on_close_upstream_conn(conn *c);
+void      cproxy_on_pause_upstream_conn(conn *c);
 void      cproxy_on_close_downstream_conn(conn *c);
 void      cproxy_on_pause_downstream_conn(conn *c);
 
@@ -538,7 +782,8 @@ int   cproxy_connect_downstream(downstream *d,
 conn *cproxy_connect_downstream_conn(downstream *d,
                                      LIBEVENT_THREAD *thread,
                                      mcs_server_st *msst,
-                                     proxy_behavior *behavior);
+                                     proxy_behavior *behavior,
+                                     bool *unresolved);
 
 void  cproxy_wait_any_downstream(proxy_td *ptd, conn *c);
 void  cproxy_assign_downstream(proxy_td *ptd);
@@ -553,6 +798,10 @@ int cproxy_bucket_downstream(mcs_server_st *server,
                              proxy_behavior *behavior, SOCKET fd);
 
 void  cproxy_pause_upstream_for_downstream(proxy_td *ptd, conn *upstream);
+
+bool  cproxy_coalesce_get(proxy_td *ptd, conn *uc);
+void  cproxy_coalesce_start(downstream *d);
+void  cproxy_coalesce_end(downstream *d);
 conn *cproxy_find_downstream_conn(downstream *d, char *key, int key_length,
                                   bool *local);
 conn *cproxy_find_downstream_conn_ex(downstream *d, char *key, int key_length,
@@ -573,6 +822,31 @@ void upstream_retry(void *data0, void *data1);
 
 int downstream_conn_index(downstream *d, conn *c);
 
+/* Hedged binary GET's, see hedge_get_percentile. */
+
+void  cproxy_clear_hedge(downstream *d);
+void  cproxy_hedge_sample(proxy_td *ptd, uint64_t usecs);
+conn *cproxy_hedge_acquire_downstream_conn(downstream *d,
+                                           LIBEVENT_THREAD *thread,
+                                           int server_index);
+void  cproxy_hedge_detach_downstream_conn(downstream *d, conn *c);
+
+/* Shared binary downstream conns, see downstream_conn_multiplex. */
+
+bool cproxy_mux_send(conn *dc, downstream *d, item *it);
+void cproxy_mux_route(conn *dc);
+
+/* Per thread, per host_ident pool of downstream conns. */
+
+zstored_downstream_conns *zstored_get_downstream_conns(LIBEVENT_THREAD *thread,
+                                                       const char *host_ident);
+conn *zstored_acquire_pooled_downstream_conn(downstream *d,
+                                             zstored_downstream_conns *conns,
+                                             proxy_behavior *behavior,
+                                             bool mux);
+void  zstored_park_downstream_conn(zstored_downstream_conns *conns, conn *dc);
+void  zstored_mux_release(conn *dc, downstream *d);
+
 void cproxy_dump_header(SOCKET prefix, char *bb);
 
 int cproxy_max_retries(downstream *d);
@@ -598,6 +872,9 @@ void cproxy_init_a2a(void);
 void cproxy_process_a2a_downstream(conn *c, char *line);
 void cproxy_process_a2a_downstream_nread(conn *c);
 
+void a2a_stream_resume(downstream *d);
+bool a2a_stream_splice(downstream *d, conn *c);
+
 bool cproxy_forward_a2a_downstream(downstream *d);
 
 bool cproxy_forward_a2a_multiget_downstream(downstream *d, conn *uc);
@@ -649,6 +926,23 @@ bool b2b_forward_item(conn *uc, downstream *d, item *it);
 bool b2b_forward_item_vbucket(conn *uc, downstream *d, item *it,
                               conn *c, int vbucket);
 
+conn *b2b_queue_item(conn *uc, downstream *d, item *it);
+void  b2b_flush_queued(downstream *d);
+
+item *b2b_response_copy(item *it, uint8_t opcode, uint32_t opaque,
+                        bool strip_key);
+void  b2b_quiet_response(downstream *d, conn *uc, item *it);
+
+item *b2b_hedge_reply_item(item *it, uint8_t opcode);
+bool  b2b_hedge_reply(downstream *d, conn *c, int status, item **itp);
+
+item *b2b_front_cache_response(item *it,
+                               protocol_binary_request_header *req);
+bool b2b_front_cache_get(proxy_td *ptd, conn *uc, item *req_it);
+void b2b_front_cache_update(proxy_td *ptd, item *req_it, item *res_it,
+                            uint64_t gen);
+void b2b_front_cache_forget(proxy_td *ptd, item *req_it);
+
 /* --------------------------------------------------------------- */
 
 /* Magic opaque value that tells us to eat a binary quiet command */
@@ -699,6 +993,11 @@ bool cproxy_is_broadcast_cmd(int cmd);
 
 void cproxy_ascii_broadcast_suffix(downstream *d);
 
+void cproxy_upstream_ascii_item_pipelined(item *it, conn *uc,
+                                          int cas_emit, int index);
+void cproxy_pipeline_flush(conn *uc, char *suffix, int suffix_len);
+void cproxy_pipeline_free(conn *c);
+
 void cproxy_upstream_ascii_item_response(item *it, conn *uc,
                                          int cas_emit);
 
@@ -719,18 +1018,31 @@ void cproxy_reset_stats_td(proxy_stats_td *pstd);
 void cproxy_reset_stats(proxy_stats *ps);
 void cproxy_reset_stats_cmd(proxy_stats_cmd *sc);
 
+bool cproxy_stats_publish(proxy_td *ptd);
+void cproxy_stats_snapshot_arm(proxy_td *ptd, struct event_base *base);
+
 bool cproxy_binary_cork_cmd(conn *uc);
 void cproxy_binary_uncork_cmds(downstream *d, conn *uc);
 
 bool ascii_scan_key(char *line, char **key, int *key_len);
 
+/* A quiet binary command that was uncorked onto a downstream. */
+
+struct bin_quiet {
+    uint32_t opaque; /* The upstream's opaque, in network byte order. */
+    uint8_t  opcode; /* The upstream's opcode. */
+    int      dup;    /* Index of the next quiet GET of the same key, */
+                     /* which is answered by the same response, or -1. */
+};
+
 /* Multiget key de-duplication. */
 
 typedef struct multiget_entry multiget_entry;
 
 struct multiget_entry {
     conn           *upstream_conn;
-    uint32_t        opaque; /* For binary protocol. */
+    uint32_t        opaque; /* For binary protocol, or else the index */
+                            /* of the upstream conn's pipelined get. */
     uint64_t        hits;
     multiget_entry *next;
 };
@@ -748,10 +1060,17 @@ void multiget_foreach_free(const void *key,
                            const void *value,
                            void *user_data);
 
+void multiget_foreach_miss(const void *key,
+                           const void *value,
+                           void *user_data);
+
 void multiget_remove_upstream(const void *key,
                               const void *value,
                               void *user_data);
 
+char *multiget_key(downstream *d, conn *uc, int key_index);
+void  multiget_keys_free(downstream *d);
+
 /* Space or null terminated key funcs. */
 
 size_t skey_len(const char *key);
@@ -797,6 +1116,13 @@ void cproxy_front_cache_delete(proxy_td *ptd, char *key, int key_len);
 
 bool cproxy_front_cache_key(proxy_td *ptd, char *key, int key_len);
 
+bool cproxy_front_cache_miss_key(proxy_td *ptd, char *key, int key_len);
+
+uint64_t cproxy_front_cache_gen(proxy_td *ptd);
+
+void cproxy_front_cache_miss(proxy_td *ptd, char *key, int key_len,
+                             uint64_t gen);
+
 HTGRAM_HANDLE cproxy_create_timing_histogram(void);
 
 typedef void (*mcache_traversal_func)(const void *it, void *userdata);
@@ -805,6 +1131,13 @@ typedef void (*mcache_traversal_func)(const void *it, void *userdata);
 
 void  mcache_init(mcache *m, bool multithreaded,
                   mcache_funcs *funcs, bool key_alloc);
+bool  mcache_shard(mcache *m, uint32_t nshards);
+void  mcache_admission(mcache *m, bool admission);
+void  mcache_max_bytes(mcache *m, uint64_t max_bytes,
+                       uint64_t max_item_bytes);
+void  mcache_grace(mcache *m, uint32_t grace);
+uint32_t mcache_num_shards(mcache *m);
+void  mcache_get_stats(mcache *m, int shard, mcache_stats *out);
 void  mcache_start(mcache *m, uint32_t max);
 bool  mcache_started(mcache *m);
 void  mcache_stop(mcache *m);
@@ -819,6 +1152,33 @@ void  mcache_delete(mcache *m, char *key, int key_len);
 void  mcache_flush_all(mcache *m, uint32_t msec_exp);
 void  mcache_foreach(mcache *m, mcache_traversal_func f, void *userdata);
 
+/* Circuit breaker per host_ident, shared across worker threads, */
+/* which replaces the per-thread connect_max_errors blacklisting. */
+
+typedef enum {
+    BREAKER_CLOSED = 0, /* Connects are allowed. */
+    BREAKER_OPEN,       /* Connects fail fast until the backoff ends. */
+    BREAKER_HALF_OPEN   /* A single trial connect is allowed. */
+} breaker_state;
+
+typedef struct {
+    const char   *host_ident;
+    breaker_state state;
+    uint32_t      errors;         /* Consecutive errors while closed. */
+    uint32_t      trips;          /* Consecutive trips, for the backoff. */
+    uint64_t      open_msecs;     /* Remaining millisecs while open. */
+    uint64_t      tot_trips;
+    uint64_t      tot_fast_fails;
+} breaker_info;
+
+typedef void (*breaker_visit_func)(const breaker_info *info, void *userdata);
+
+void cproxy_breaker_init(void);
+bool cproxy_breaker_allow(const char *host_ident, proxy_behavior *behavior);
+bool cproxy_breaker_report(const char *host_ident, bool has_error);
+void cproxy_breaker_visit(breaker_visit_func f, void *userdata);
+void cproxy_breaker_reset_stats(void);
+
 /* Functions for key stats. */
 
 key_stats *find_key_stats(proxy_td *ptd, char *key, int key_len,
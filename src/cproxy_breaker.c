@@ -0,0 +1,289 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "src/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <platform/cbassert.h>
+#include "memcached.h"
+#include "cproxy.h"
+#include "log.h"
+
+/* A circuit breaker per host_ident, shared by all the worker threads, */
+/* so that once one thread sees that a server is dead, every thread */
+/* stops connecting to it.  The breaker is closed while connects are */
+/* working.  After more than connect_max_errors consecutive errors it */
+/* opens, failing connects fast for connect_retry_interval.  It then */
+/* goes half-open, allowing a single trial connect, whose outcome */
+/* either closes the breaker or re-opens it.  When the */
+/* connect_retry_interval_max is above the connect_retry_interval, */
+/* each re-open doubles the open time, up to that cap, with jitter. */
+
+typedef struct {
+    char         *host_ident;
+    breaker_state state;
+    uint32_t      errors;
+    uint32_t      trips;
+    uint64_t      open_until; /* msec_current_time of when open ends. */
+    uint64_t      trial_time; /* msec_current_time of the half-open trial. */
+
+    /* Behaviors, as of the latest cproxy_breaker_allow(). */
+
+    uint32_t      max_errors;
+    uint32_t      retry_interval;
+    uint32_t      retry_interval_max;
+
+    uint64_t      tot_trips;
+    uint64_t      tot_fast_fails;
+} breaker;
+
+static bool       breaker_initted = false;
+static cb_mutex_t breaker_lock;
+static genhash_t *breaker_map; /* Entries are never removed. */
+static uint32_t   breaker_seed = 1;
+
+void cproxy_breaker_init(void) {
+    if (breaker_initted) {
+        return;
+    }
+
+    cb_mutex_initialize(&breaker_lock);
+
+    breaker_map = genhash_init(128, strhash_ops);
+    if (breaker_map == NULL) {
+        moxi_log_write("could not alloc breaker map\n");
+        return;
+    }
+
+    breaker_initted = true;
+}
+
+/* Must be called while holding the breaker_lock. */
+
+static breaker *breaker_get(const char *host_ident, bool create) {
+    breaker *b = genhash_find(breaker_map, host_ident);
+    if (b == NULL && create) {
+        b = calloc(1, sizeof(breaker));
+        if (b != NULL) {
+            b->host_ident = strdup(host_ident);
+            if (b->host_ident != NULL) {
+                genhash_store(breaker_map, b->host_ident, b);
+            } else {
+                free(b);
+                b = NULL;
+            }
+        }
+    }
+
+    return b;
+}
+
+/* Must be called while holding the breaker_lock.  Uses "equal jitter", */
+/* so that threads and moxi's don't all retry a server in lockstep. */
+
+static uint64_t breaker_backoff(breaker *b) {
+    uint64_t msecs = b->retry_interval;
+    uint64_t half;
+    uint32_t i;
+
+    /* Without a cap above the interval, there's no backoff, and the */
+    /* breaker stays open for exactly the interval, like the old */
+    /* per-thread blacklist. */
+
+    if (b->retry_interval_max <= b->retry_interval) {
+        return msecs;
+    }
+
+    for (i = 1; i < b->trips && msecs < b->retry_interval_max; i++) {
+        msecs = msecs * 2;
+    }
+
+    if (msecs > b->retry_interval_max) {
+        msecs = b->retry_interval_max;
+    }
+
+    breaker_seed = breaker_seed * 1103515245 + 12345;
+
+    half = msecs / 2;
+
+    return half + ((breaker_seed >> 16) % (msecs - half + 1));
+}
+
+/* Returns false when a connect to the host_ident should fail fast. */
+
+bool cproxy_breaker_allow(const char *host_ident, proxy_behavior *behavior) {
+    breaker *b;
+    bool rv = true;
+
+    cb_assert(host_ident != NULL);
+    cb_assert(behavior != NULL);
+
+    if (breaker_initted == false ||
+        behavior->connect_max_errors == 0 ||
+        behavior->connect_retry_interval == 0 ||
+        behavior->cycle == 0) {
+        return true;
+    }
+
+    cb_mutex_enter(&breaker_lock);
+
+    b = breaker_get(host_ident, true);
+    if (b != NULL) {
+        b->max_errors         = behavior->connect_max_errors;
+        b->retry_interval     = behavior->connect_retry_interval;
+        b->retry_interval_max = behavior->connect_retry_interval_max;
+
+        switch (b->state) {
+        case BREAKER_CLOSED:
+            break;
+
+        case BREAKER_OPEN:
+            if (msec_current_time < b->open_until) {
+                rv = false;
+                break;
+            }
+
+            b->state      = BREAKER_HALF_OPEN;
+            b->trial_time = msec_current_time;
+            break;
+
+        case BREAKER_HALF_OPEN:
+            /* Only one trial at a time, unless the trial */
+            /* never reported back. */
+
+            if (msec_current_time - b->trial_time < b->retry_interval) {
+                rv = false;
+                break;
+            }
+
+            b->trial_time = msec_current_time;
+            break;
+        }
+
+        if (rv == false) {
+            b->tot_fast_fails++;
+        }
+    }
+
+    cb_mutex_exit(&breaker_lock);
+
+    return rv;
+}
+
+/* Returns true when the error opened the breaker, so that the caller */
+/* can fail fast any downstreams that are waiting on the host_ident. */
+
+bool cproxy_breaker_report(const char *host_ident, bool has_error) {
+    breaker *b;
+    bool tripped = false;
+
+    cb_assert(host_ident != NULL);
+
+    if (breaker_initted == false) {
+        return false;
+    }
+
+    cb_mutex_enter(&breaker_lock);
+
+    b = breaker_get(host_ident, false);
+    if (b != NULL) {
+        if (has_error == false) {
+            b->state  = BREAKER_CLOSED;
+            b->errors = 0;
+            b->trips  = 0;
+        } else if (b->max_errors > 0) {
+            switch (b->state) {
+            case BREAKER_CLOSED:
+                b->errors++;
+                tripped = b->errors > b->max_errors;
+                break;
+
+            case BREAKER_HALF_OPEN:
+                tripped = true;
+                break;
+
+            case BREAKER_OPEN:
+                /* Late errors, from conns opened before the trip. */
+                break;
+            }
+
+            if (tripped) {
+                b->state  = BREAKER_OPEN;
+                b->errors = 0;
+                b->trips++;
+                b->tot_trips++;
+                b->open_until = msec_current_time + breaker_backoff(b);
+
+                if (settings.verbose > 1) {
+                    moxi_log_write("breaker open, %u, %"PRIu64"\n",
+                                   b->trips,
+                                   b->open_until - msec_current_time);
+                }
+            }
+        }
+    }
+
+    cb_mutex_exit(&breaker_lock);
+
+    return tripped;
+}
+
+struct breaker_visit_arg {
+    breaker_visit_func f;
+    void *userdata;
+};
+
+static void breaker_visit_one(const void *key, const void *val, void *arg) {
+    const breaker *b = val;
+    struct breaker_visit_arg *va = arg;
+    breaker_info info;
+    (void)key;
+
+    info.host_ident     = b->host_ident;
+    info.state          = b->state;
+    info.errors         = b->errors;
+    info.trips          = b->trips;
+    info.open_msecs     = (b->state == BREAKER_OPEN &&
+                           b->open_until > msec_current_time) ?
+                          b->open_until - msec_current_time : 0;
+    info.tot_trips      = b->tot_trips;
+    info.tot_fast_fails = b->tot_fast_fails;
+
+    va->f(&info, va->userdata);
+}
+
+/* The visitor is called while holding the breaker_lock, so it */
+/* should not block or call other breaker functions. */
+
+void cproxy_breaker_visit(breaker_visit_func f, void *userdata) {
+    struct breaker_visit_arg va;
+
+    if (breaker_initted == false) {
+        return;
+    }
+
+    va.f = f;
+    va.userdata = userdata;
+
+    cb_mutex_enter(&breaker_lock);
+    genhash_iter(breaker_map, breaker_visit_one, &va);
+    cb_mutex_exit(&breaker_lock);
+}
+
+static void breaker_reset_one(const void *key, const void *val, void *arg) {
+    breaker *b = (breaker *) val;
+    (void)key;
+    (void)arg;
+
+    b->tot_trips = 0;
+    b->tot_fast_fails = 0;
+}
+
+void cproxy_breaker_reset_stats(void) {
+    if (breaker_initted == false) {
+        return;
+    }
+
+    cb_mutex_enter(&breaker_lock);
+    genhash_iter(breaker_map, breaker_reset_one, NULL);
+    cb_mutex_exit(&breaker_lock);
+}
@@ -43,6 +43,18 @@ proxy_behavior behavior_default_g = {
     .cycle = 200, /* Clock cycle or quantum, in milliseconds. */
     .downstream_max = 1024,
     .downstream_conn_max = 4, /* Use 0 for unlimited. */
+    .downstream_conn_multiplex = 0, /* Use 0 for exclusive downstream conns. */
+    .downstream_conn_coalesce = 0, /* Use 1 to batch shared conn writes per loop. */
+    .downstream_conn_prewarm = 0, /* Use 0 to only connect on demand. */
+    .downstream_conn_probe_interval = 0, /* In millisecs, 0 to not probe. */
+    .downstream_conn_idle_max = 0, /* In millisecs, 0 for unlimited. */
+    .hedge_get_percentile = 0, /* Use 0 to never hedge. */
+    .coalesce_get = 0, /* Use 1 to share in-flight single key gets. */
+    .stream_min_bytes = 0, /* Use 0 to always store-and-forward values. */
+    .stream_splice = 0, /* Use 1 to splice() streamed values, where available. */
+    .pipeline_max = 1, /* Use > 1 to forward pipelined ascii gets together. */
+    .listen_reuseport = 0, /* Use 1 for a SO_REUSEPORT listener per thread. */
+    .stats_snapshot_interval = 0, /* In millisecs, use > 0 to merge published worker stats. */
     .downstream_weight = 0,
     .downstream_retry = 1,
     .downstream_protocol = proxy_downstream_ascii_prot,
@@ -70,10 +82,18 @@ proxy_behavior behavior_default_g = {
     .mcs_opts = {0},
     .connect_max_errors = 5,         /* In zstored, 10. */
     .connect_retry_interval = 30000, /* In zstored, 30000. */
+    .connect_retry_interval_max = 30000, /* Use > connect_retry_interval for backoff. */
     .front_cache_max = 200,
+    .front_cache_shards = 1,
+    .front_cache_max_bytes = 0,
+    .front_cache_max_item_bytes = 0,
+    .front_cache_admission = 0,
     .front_cache_lifespan = 0,
+    .front_cache_grace = 0,
     .front_cache_spec = {0},
     .front_cache_unspec = {0},
+    .front_cache_miss_lifespan = 0,
+    .front_cache_miss_spec = {0},
     .key_stats_max = 4000,
     .key_stats_lifespan = 0,
     .key_stats_spec = {0},
@@ -269,6 +289,9 @@ int cproxy_init(char *cfg_str,
 
         gethostname(cproxy_hostname, sizeof(cproxy_hostname));
 
+        mcs_resolve_init();
+        cproxy_breaker_init();
+
         cproxy_init_a2a();
         cproxy_init_a2b();
         cproxy_init_b2b();
@@ -533,6 +556,8 @@ int cproxy_init_string(char *cfg_str,
                         moxi_log_write("moxi listening on %d with %d conns\n",
                                 proxy_port, n);
                     }
+
+                    cproxy_prewarm(p);
                 } else {
                     moxi_log_write("moxi error -- port %d unavailable?\n",
                             proxy_port);
@@ -647,6 +672,30 @@ void cproxy_parse_behavior_key_val(char *key,
             ok = safe_strtoul(val, &behavior->downstream_max);
         } else if (wordeq(key, "downstream_conn_max")) {
             ok = safe_strtoul(val, &behavior->downstream_conn_max);
+        } else if (wordeq(key, "downstream_conn_multiplex")) {
+            ok = safe_strtoul(val, &behavior->downstream_conn_multiplex);
+        } else if (wordeq(key, "downstream_conn_coalesce")) {
+            ok = safe_strtoul(val, &behavior->downstream_conn_coalesce);
+        } else if (wordeq(key, "downstream_conn_prewarm")) {
+            ok = safe_strtoul(val, &behavior->downstream_conn_prewarm);
+        } else if (wordeq(key, "downstream_conn_probe_interval")) {
+            ok = safe_strtoul(val, &behavior->downstream_conn_probe_interval);
+        } else if (wordeq(key, "downstream_conn_idle_max")) {
+            ok = safe_strtoul(val, &behavior->downstream_conn_idle_max);
+        } else if (wordeq(key, "hedge_get_percentile")) {
+            ok = safe_strtoul(val, &behavior->hedge_get_percentile);
+        } else if (wordeq(key, "coalesce_get")) {
+            ok = safe_strtoul(val, &behavior->coalesce_get);
+        } else if (wordeq(key, "stream_min_bytes")) {
+            ok = safe_strtoul(val, &behavior->stream_min_bytes);
+        } else if (wordeq(key, "stream_splice")) {
+            ok = safe_strtoul(val, &behavior->stream_splice);
+        } else if (wordeq(key, "pipeline_max")) {
+            ok = safe_strtoul(val, &behavior->pipeline_max);
+        } else if (wordeq(key, "listen_reuseport")) {
+            ok = safe_strtoul(val, &behavior->listen_reuseport);
+        } else if (wordeq(key, "stats_snapshot_interval")) {
+            ok = safe_strtoul(val, &behavior->stats_snapshot_interval);
         } else if (wordeq(key, "weight") ||
                    wordeq(key, "downstream_weight")) {
             ok = safe_strtoul(val, &behavior->downstream_weight);
@@ -706,10 +755,22 @@ void cproxy_parse_behavior_key_val(char *key,
             ok = safe_strtoul(val, &behavior->connect_max_errors);
         } else if (wordeq(key, "connect_retry_interval")) {
             ok = safe_strtoul(val, &behavior->connect_retry_interval);
+        } else if (wordeq(key, "connect_retry_interval_max")) {
+            ok = safe_strtoul(val, &behavior->connect_retry_interval_max);
         } else if (wordeq(key, "front_cache_max")) {
             ok = safe_strtoul(val, &behavior->front_cache_max);
+        } else if (wordeq(key, "front_cache_shards")) {
+            ok = safe_strtoul(val, &behavior->front_cache_shards);
+        } else if (wordeq(key, "front_cache_max_bytes")) {
+            ok = safe_strtoull(val, &behavior->front_cache_max_bytes);
+        } else if (wordeq(key, "front_cache_max_item_bytes")) {
+            ok = safe_strtoul(val, &behavior->front_cache_max_item_bytes);
+        } else if (wordeq(key, "front_cache_admission")) {
+            ok = safe_strtoul(val, &behavior->front_cache_admission);
         } else if (wordeq(key, "front_cache_lifespan")) {
             ok = safe_strtoul(val, &behavior->front_cache_lifespan);
+        } else if (wordeq(key, "front_cache_grace")) {
+            ok = safe_strtoul(val, &behavior->front_cache_grace);
         } else if (wordeq(key, "front_cache_spec")) {
             if (strlen(val) < sizeof(behavior->front_cache_spec)) {
                 strcpy(behavior->front_cache_spec, val);
@@ -720,6 +781,13 @@ void cproxy_parse_behavior_key_val(char *key,
                 strcpy(behavior->front_cache_unspec, val);
                 ok = true;
             }
+        } else if (wordeq(key, "front_cache_miss_lifespan")) {
+            ok = safe_strtoul(val, &behavior->front_cache_miss_lifespan);
+        } else if (wordeq(key, "front_cache_miss_spec")) {
+            if (strlen(val) < sizeof(behavior->front_cache_miss_spec)) {
+                strcpy(behavior->front_cache_miss_spec, val);
+                ok = true;
+            }
         } else if (wordeq(key, "key_stats_max")) {
             ok = safe_strtoul(val, &behavior->key_stats_max);
         } else if (wordeq(key, "key_stats_lifespan")) {
@@ -868,6 +936,18 @@ void cproxy_dump_behavior_ex(proxy_behavior *b, char *prefix, int level,
     if (level >= 1) {
         vdump("downstream_max", "%u", b->downstream_max);
         vdump("downstream_conn_max", "%u", b->downstream_conn_max);
+        vdump("downstream_conn_multiplex", "%u", b->downstream_conn_multiplex);
+        vdump("downstream_conn_coalesce", "%u", b->downstream_conn_coalesce);
+        vdump("downstream_conn_prewarm", "%u", b->downstream_conn_prewarm);
+        vdump("downstream_conn_probe_interval", "%u", b->downstream_conn_probe_interval);
+        vdump("downstream_conn_idle_max", "%u", b->downstream_conn_idle_max);
+        vdump("hedge_get_percentile", "%u", b->hedge_get_percentile);
+        vdump("coalesce_get", "%u", b->coalesce_get);
+        vdump("stream_min_bytes", "%u", b->stream_min_bytes);
+        vdump("stream_splice", "%u", b->stream_splice);
+        vdump("pipeline_max", "%u", b->pipeline_max);
+        vdump("listen_reuseport", "%u", b->listen_reuseport);
+        vdump("stats_snapshot_interval", "%u", b->stats_snapshot_interval);
     }
 
     vdump("downstream_weight",   "%u", b->downstream_weight);
@@ -894,10 +974,18 @@ void cproxy_dump_behavior_ex(proxy_behavior *b, char *prefix, int level,
         vdump("mcs_opts", "%s", b->mcs_opts);
         vdump("connect_max_errors", "%u", b->connect_max_errors);
         vdump("connect_retry_interval", "%u", b->connect_retry_interval);
+        vdump("connect_retry_interval_max", "%u", b->connect_retry_interval_max);
         vdump("front_cache_max", "%u", b->front_cache_max);
+        vdump("front_cache_shards", "%u", b->front_cache_shards);
+        vdump("front_cache_max_bytes", "%"PRIu64, b->front_cache_max_bytes);
+        vdump("front_cache_max_item_bytes", "%u", b->front_cache_max_item_bytes);
+        vdump("front_cache_admission", "%u", b->front_cache_admission);
         vdump("front_cache_lifespan", "%u", b->front_cache_lifespan);
+        vdump("front_cache_grace", "%u", b->front_cache_grace);
         vdump("front_cache_spec", "%s", b->front_cache_spec);
         vdump("front_cache_unspec", "%s", b->front_cache_unspec);
+        vdump("front_cache_miss_lifespan", "%u", b->front_cache_miss_lifespan);
+        vdump("front_cache_miss_spec", "%s", b->front_cache_miss_spec);
         vdump("key_stats_max", "%u", b->key_stats_max);
         vdump("key_stats_lifespan", "%u", b->key_stats_lifespan);
         vdump("key_stats_spec", "%s", b->key_stats_spec);
@@ -21,10 +21,46 @@ static void *item_get_prev(void *it);
 static void item_set_prev(void *it, void *prev);
 static uint64_t item_get_exptime(void *it);
 static void item_set_exptime(void *it, uint64_t exptime);
+static bool item_get_refreshing(void *it);
+static void item_set_refreshing(void *it, bool refreshing);
 
 void mcache_item_unlink(mcache *m, void *it);
 void mcache_item_touch(mcache *m, void *it);
 
+/* A count-min sketch of recent key accesses, TinyLFU style, which */
+/* lets a full mcache turn away a new item that's less frequently */
+/* accessed than the LRU victim that it would replace, so that a scan */
+/* of one-off keys doesn't flush out the hot keys.  The counters are */
+/* 4-bit saturating and are halved every samples_max accesses, so */
+/* the frequencies follow recent history. */
+/* */
+/* The two bitsets remember which keys were recently rejected and */
+/* which victims were kept by a rejection, so that later misses and */
+/* hits on those keys estimate what the admission filter cost and */
+/* saved, i.e., its net effect on the hit ratio. */
+
+#define MCACHE_SKETCH_DEPTH     4
+#define MCACHE_SKETCH_COUNT_MAX 15
+
+struct mcache_sketch {
+    uint32_t mask;        /* Width of each row, minus 1. */
+    uint32_t samples;
+    uint32_t samples_max;
+    uint8_t *counts;      /* MCACHE_SKETCH_DEPTH rows of counters. */
+    uint8_t *rejected;    /* Bitset of recently rejected keys. */
+    uint8_t *kept;        /* Bitset of victims kept by a rejection. */
+};
+
+static struct mcache_sketch *mcache_sketch_create(uint32_t max);
+static uint32_t mcache_sketch_freq(struct mcache_sketch *s,
+                                   const char *key, int key_len);
+static void mcache_sketch_add(struct mcache_sketch *s,
+                              const char *key, int key_len);
+static bool mcache_sketch_bit(uint8_t *bits, struct mcache_sketch *s,
+                              const char *key, int key_len, bool set);
+static bool mcache_admit(mcache *m, void *it);
+static bool mcache_full(mcache *m, uint64_t len);
+
 mcache_funcs mcache_item_funcs = {
     .item_key         = item_key,
     .item_key_len     = item_key_len,
@@ -36,7 +72,9 @@ mcache_funcs mcache_item_funcs = {
     .item_get_prev    = item_get_prev,
     .item_set_prev    = item_set_prev,
     .item_get_exptime = item_get_exptime,
-    .item_set_exptime = item_set_exptime
+    .item_set_exptime = item_set_exptime,
+    .item_get_refreshing = item_get_refreshing,
+    .item_set_refreshing = item_set_refreshing
 };
 
 void mcache_init(mcache *m, bool multithreaded,
@@ -51,6 +89,15 @@ void mcache_init(mcache *m, bool multithreaded,
     m->lru_head    = NULL;
     m->lru_tail    = NULL;
     m->oldest_live = 0;
+    m->admission   = false;
+    m->sketch      = NULL;
+    m->grace       = 0;
+    m->shards      = NULL;
+    m->nshards     = 0;
+
+    m->max_bytes      = 0;
+    m->max_item_bytes = 0;
+    m->curr_bytes     = 0;
 
     if (multithreaded) {
         m->lock = malloc(sizeof(cb_mutex_t));
@@ -64,14 +111,147 @@ void mcache_init(mcache *m, bool multithreaded,
     mcache_reset_stats(m);
 }
 
+/* Splits the mcache into nshards independently locked segments, */
+/* chosen by key hash.  Must be called after mcache_init() and before */
+/* the first mcache_start(), as the shards are kept until exit. */
+
+bool mcache_shard(mcache *m, uint32_t nshards) {
+    uint32_t i;
+
+    cb_assert(m);
+    cb_assert(m->funcs);
+    cb_assert(m->map == NULL);
+    cb_assert(m->shards == NULL);
+
+    if (nshards <= 1) {
+        return true;
+    }
+
+    m->shards = calloc(nshards, sizeof(mcache));
+    if (m->shards == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < nshards; i++) {
+        mcache_init(&m->shards[i], m->lock != NULL,
+                    m->funcs, m->key_alloc);
+    }
+
+    m->nshards = nshards;
+
+    return true;
+}
+
+/* Whether the next mcache_start() should turn on the admission filter. */
+
+void mcache_admission(mcache *m, bool admission) {
+    cb_assert(m);
+
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_admission(&m->shards[i], admission);
+        }
+        return;
+    }
+
+    if (m->lock) {
+        cb_mutex_enter(m->lock);
+    }
+
+    m->admission = admission;
+
+    if (m->lock) {
+        cb_mutex_exit(m->lock);
+    }
+}
+
+/* The byte limits for the next mcache_start(), where the max_bytes */
+/* of a sharded mcache is divided across its shards. */
+
+void mcache_max_bytes(mcache *m, uint64_t max_bytes,
+                      uint64_t max_item_bytes) {
+    cb_assert(m);
+
+    if (m->shards != NULL) {
+        uint64_t shard_max_bytes =
+            (max_bytes + m->nshards - 1) / m->nshards;
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_max_bytes(&m->shards[i], shard_max_bytes, max_item_bytes);
+        }
+        return;
+    }
+
+    if (m->lock) {
+        cb_mutex_enter(m->lock);
+    }
+
+    m->max_bytes      = max_bytes;
+    m->max_item_bytes = max_item_bytes;
+
+    if (m->lock) {
+        cb_mutex_exit(m->lock);
+    }
+}
+
+/* The grace period for the next mcache_start(), which only applies */
+/* when the funcs can mark an item as refreshing. */
+
+void mcache_grace(mcache *m, uint32_t grace) {
+    cb_assert(m);
+
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_grace(&m->shards[i], grace);
+        }
+        return;
+    }
+
+    if (m->lock) {
+        cb_mutex_enter(m->lock);
+    }
+
+    m->grace = (m->funcs->item_set_refreshing != NULL) ? grace : 0;
+
+    if (m->lock) {
+        cb_mutex_exit(m->lock);
+    }
+}
+
+uint32_t mcache_num_shards(mcache *m) {
+    cb_assert(m);
+
+    return m->shards != NULL ? m->nshards : 1;
+}
+
+static mcache *mcache_shard_for(mcache *m, const char *key, int key_len) {
+    if (m->shards == NULL) {
+        return m;
+    }
+
+    return &m->shards[hash(key, key_len, 0) % m->nshards];
+}
+
 void mcache_reset_stats(mcache *m) {
     cb_assert(m);
 
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_reset_stats(&m->shards[i]);
+        }
+        return;
+    }
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
 
     m->tot_get_hits    = 0;
+    m->tot_get_stale_hits = 0;
+    m->tot_get_refreshes  = 0;
     m->tot_get_expires = 0;
     m->tot_get_misses  = 0;
     m->tot_get_bytes   = 0;
@@ -79,9 +259,15 @@ void mcache_reset_stats(mcache *m) {
     m->tot_add_skips   = 0;
     m->tot_add_fails   = 0;
     m->tot_add_bytes   = 0;
+    m->tot_add_too_large = 0;
     m->tot_deletes     = 0;
     m->tot_evictions   = 0;
 
+    m->tot_admits                = 0;
+    m->tot_admit_rejects         = 0;
+    m->tot_admit_protected_hits  = 0;
+    m->tot_admit_rejected_misses = 0;
+
     if (m->lock) {
         cb_mutex_exit(m->lock);
     }
@@ -90,6 +276,17 @@ void mcache_reset_stats(mcache *m) {
 void mcache_start(mcache *m, uint32_t max) {
     cb_assert(m);
 
+    if (m->shards != NULL) {
+        /* Round up, so that a small max still caches in every shard. */
+
+        uint32_t shard_max = (max + m->nshards - 1) / m->nshards;
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_start(&m->shards[i], shard_max);
+        }
+        return;
+    }
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
@@ -111,6 +308,8 @@ void mcache_start(mcache *m, uint32_t max) {
         m->lru_head    = NULL;
         m->lru_tail    = NULL;
         m->oldest_live = 0;
+        m->curr_bytes  = 0;
+        m->sketch      = m->admission ? mcache_sketch_create(max) : NULL;
     }
 
     if (m->lock) {
@@ -121,6 +320,10 @@ void mcache_start(mcache *m, uint32_t max) {
 bool mcache_started(mcache *m) {
     cb_assert(m);
 
+    if (m->shards != NULL) {
+        return mcache_started(&m->shards[0]);
+    }
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
@@ -137,17 +340,28 @@ bool mcache_started(mcache *m) {
 void mcache_stop(mcache *m) {
     cb_assert(m);
 
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_stop(&m->shards[i]);
+        }
+        return;
+    }
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
 
     genhash_t *x = m->map;
+    struct mcache_sketch *s = m->sketch;
 
     m->map         = NULL;
     m->max         = 0;
     m->lru_head    = NULL;
     m->lru_tail    = NULL;
     m->oldest_live = 0;
+    m->curr_bytes  = 0;
+    m->sketch      = NULL;
 
     if (m->lock) {
         cb_mutex_exit(m->lock);
@@ -158,17 +372,20 @@ void mcache_stop(mcache *m) {
     if (x != NULL) {
         genhash_free(x);
     }
+
+    free(s);
 }
 
 void *mcache_get(mcache *m, char *key, int key_len,
                  uint64_t curr_time) {
-    (void)key_len;
     cb_assert(key);
 
     if (m == NULL) {
         return NULL;
     }
 
+    m = mcache_shard_for(m, key, key_len);
+
     cb_assert(m->funcs);
 
     if (m->lock) {
@@ -176,11 +393,19 @@ void *mcache_get(mcache *m, char *key, int key_len,
     }
 
     if (m->map != NULL) {
-        void *it = genhash_find(m->map, key);
+        void *it;
+
+        if (m->sketch != NULL) {
+            mcache_sketch_add(m->sketch, key, key_len);
+        }
+
+        it = genhash_find(m->map, key);
         if (it != NULL) {
             mcache_item_unlink(m, it);
 
             uint64_t exptime = m->funcs->item_get_exptime(it);
+            bool refreshing = m->funcs->item_get_refreshing != NULL &&
+                              m->funcs->item_get_refreshing(it);
             if ((exptime <= 0) ||
                 (exptime >= curr_time &&
                  exptime >= m->oldest_live)) {
@@ -191,6 +416,16 @@ void *mcache_get(mcache *m, char *key, int key_len,
                 m->tot_get_hits++;
                 m->tot_get_bytes += m->funcs->item_len(it);
 
+                if (refreshing) {
+                    m->tot_get_stale_hits++;
+                }
+
+                if (m->sketch != NULL &&
+                    mcache_sketch_bit(m->sketch->kept, m->sketch,
+                                      key, key_len, false)) {
+                    m->tot_admit_protected_hits++;
+                }
+
                 if (m->lock) {
                     cb_mutex_exit(m->lock);
                 }
@@ -202,6 +437,33 @@ void *mcache_get(mcache *m, char *key, int key_len,
                 return it;
             }
 
+            /* The first reader of an item that's within its grace */
+            /* period misses, so that it fetches a fresh item, while */
+            /* the stale item is served to others until the fresh */
+            /* item replaces it or the grace period ends. */
+
+            if (refreshing == false &&
+                m->grace > 0 &&
+                exptime >= m->oldest_live &&
+                exptime + m->grace >= curr_time) {
+                m->funcs->item_set_refreshing(it, true);
+                m->funcs->item_set_exptime(it, exptime + m->grace);
+
+                mcache_item_touch(m, it);
+
+                m->tot_get_refreshes++;
+
+                if (m->lock) {
+                    cb_mutex_exit(m->lock);
+                }
+
+                if (settings.verbose > 1) {
+                    moxi_log_write("mcache refresh: %s\n", key);
+                }
+
+                return NULL;
+            }
+
             /* Handle item expiration. */
 
             m->tot_get_expires++;
@@ -210,10 +472,18 @@ void *mcache_get(mcache *m, char *key, int key_len,
                 moxi_log_write("mcache expire: %s\n", key);
             }
 
+            m->curr_bytes -= m->funcs->item_len(it);
+
             genhash_delete(m->map, key);
         } else {
             m->tot_get_misses++;
 
+            if (m->sketch != NULL &&
+                mcache_sketch_bit(m->sketch->rejected, m->sketch,
+                                  key, key_len, false)) {
+                m->tot_admit_rejected_misses++;
+            }
+
             if (settings.verbose > 1) {
                 moxi_log_write("mcache miss: %s\n", key);
             }
@@ -231,6 +501,8 @@ void mcache_set(mcache *m, void *it,
                 uint64_t exptime,
                 bool add_only,
                 bool mod_exptime_if_exists) {
+    uint64_t len;
+
     cb_assert(it);
     cb_assert(m->funcs);
     cb_assert(m->funcs->item_get_next(it) == NULL);
@@ -240,18 +512,38 @@ void mcache_set(mcache *m, void *it,
         return;
     }
 
+    m = mcache_shard_for(m, m->funcs->item_key(it),
+                         m->funcs->item_key_len(it));
+
+    len = m->funcs->item_len(it);
+
+    if ((m->max_item_bytes > 0 && len > m->max_item_bytes) ||
+        (m->max_bytes > 0 && len > m->max_bytes)) {
+        if (m->lock) {
+            cb_mutex_enter(m->lock);
+        }
+
+        m->tot_add_too_large++;
+
+        if (m->lock) {
+            cb_mutex_exit(m->lock);
+        }
+
+        return;
+    }
+
     /* TODO: Our lock areas are possibly too wide. */
 
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
 
-    if (m->map != NULL) {
+    if (m->map != NULL && mcache_admit(m, it)) {
         /* Evict some items if necessary. */
         int i;
         for (i = 0; m->lru_tail != NULL && i < 20; i++) {
             void *last_it;
-            if ((uint32_t)genhash_size(m->map) < m->max) {
+            if (!mcache_full(m, len)) {
                 break;
             }
 
@@ -259,6 +551,8 @@ void mcache_set(mcache *m, void *it,
 
             mcache_item_unlink(m, last_it);
 
+            m->curr_bytes -= m->funcs->item_len(last_it);
+
             if (m->key_alloc) {
                 int  len = m->funcs->item_key_len(last_it);
                 char buf[KEY_MAX_LENGTH + 10];
@@ -273,7 +567,7 @@ void mcache_set(mcache *m, void *it,
             m->tot_evictions++;
         }
 
-        if ((uint32_t)genhash_size(m->map) < m->max) {
+        if (!mcache_full(m, len)) {
             char *key     = m->funcs->item_key(it);
             int   key_len = m->funcs->item_key_len(it);
             char *key_buf = NULL;
@@ -295,8 +589,13 @@ void mcache_set(mcache *m, void *it,
             }
 
             if (key != NULL) {
-                void *existing = add_only ? genhash_find(m->map, key) : NULL;
-                if (existing != NULL) {
+                /* An add still replaces an item that's being */
+                /* refreshed, as that's how the refresh arrives. */
+
+                void *existing = genhash_find(m->map, key);
+                if (existing != NULL && add_only &&
+                    (m->funcs->item_get_refreshing == NULL ||
+                     m->funcs->item_get_refreshing(existing) == false)) {
                     mcache_item_unlink(m, existing);
                     mcache_item_touch(m, existing);
 
@@ -314,13 +613,34 @@ void mcache_set(mcache *m, void *it,
                         free(key_buf);
                     }
                 } else {
+                    if (existing != NULL) {
+                        /* Replacing, where genhash_update() will */
+                        /* dec-ref the existing item. */
+
+                        mcache_item_unlink(m, existing);
+
+                        m->curr_bytes -= m->funcs->item_len(existing);
+                    }
+
                     m->funcs->item_set_exptime(it, exptime);
                     m->funcs->item_add_ref(it);
 
+                    if (m->funcs->item_set_refreshing != NULL) {
+                        m->funcs->item_set_refreshing(it, false);
+                    }
+
                     genhash_update(m->map, key, it);
 
+                    /* Onto the LRU list now, not just on the first */
+                    /* hit, so that items which are never read can */
+                    /* still be evicted to stay within the limits. */
+
+                    mcache_item_touch(m, it);
+
+                    m->curr_bytes += len;
+
                     m->tot_adds++;
-                    m->tot_add_bytes += m->funcs->item_len(it);
+                    m->tot_add_bytes += len;
 
                     if (settings.verbose > 1) {
                         moxi_log_write("mcache add: %s\n", key);
@@ -340,8 +660,6 @@ void mcache_set(mcache *m, void *it,
 }
 
 void mcache_delete(mcache *m, char *key, int key_len) {
-    (void)key_len;
-    (void)key;
     cb_assert(key);
     cb_assert(key_len > 0);
     cb_assert(key[key_len] == '\0' ||
@@ -351,6 +669,8 @@ void mcache_delete(mcache *m, char *key, int key_len) {
         return;
     }
 
+    m = mcache_shard_for(m, key, key_len);
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
@@ -360,6 +680,8 @@ void mcache_delete(mcache *m, char *key, int key_len) {
         if (existing != NULL) {
             mcache_item_unlink(m, existing);
 
+            m->curr_bytes -= m->funcs->item_len(existing);
+
             genhash_delete(m->map, key);
 
             m->tot_deletes++;
@@ -380,6 +702,14 @@ void mcache_flush_all(mcache *m, uint32_t msec_exp) {
         return;
     }
 
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_flush_all(&m->shards[i], msec_exp);
+        }
+        return;
+    }
+
     if (m->lock) {
         cb_mutex_enter(m->lock);
     }
@@ -390,6 +720,7 @@ void mcache_flush_all(mcache *m, uint32_t msec_exp) {
         m->lru_head = NULL;
         m->lru_tail = NULL;
 
+        m->curr_bytes  = 0;
         m->oldest_live = msec_exp;
     }
 
@@ -459,6 +790,13 @@ void mcache_foreach_trampoline(const void *key, const void *value, void *_data)
 
 void mcache_foreach(mcache *m, mcache_traversal_func f, void *userdata) {
     cb_assert(m);
+    if (m->shards != NULL) {
+        uint32_t i;
+        for (i = 0; i < m->nshards; i++) {
+            mcache_foreach(&m->shards[i], f, userdata);
+        }
+        return;
+    }
     if (!m->map) {
         return;
     }
@@ -466,6 +804,263 @@ void mcache_foreach(mcache *m, mcache_traversal_func f, void *userdata) {
     genhash_iter(m->map, mcache_foreach_trampoline, &data);
 }
 
+/* Copies the statistics of one shard, or of all the shards merged */
+/* when shard is negative.  The max of a merged copy is the sum of */
+/* the shard max's, and its oldest_live is the latest of them. */
+
+void mcache_get_stats(mcache *m, int shard, mcache_stats *out) {
+    cb_assert(m);
+    cb_assert(out);
+
+    if (m->shards != NULL) {
+        if (shard >= 0) {
+            cb_assert((uint32_t) shard < m->nshards);
+            mcache_get_stats(&m->shards[shard], -1, out);
+        } else {
+            mcache_stats s;
+            uint32_t i;
+
+            memset(out, 0, sizeof(mcache_stats));
+
+            for (i = 0; i < m->nshards; i++) {
+                mcache_get_stats(&m->shards[i], -1, &s);
+
+                out->size += s.size;
+                out->max  += s.max;
+                out->curr_bytes += s.curr_bytes;
+                out->max_bytes  += s.max_bytes;
+                if (out->oldest_live < s.oldest_live) {
+                    out->oldest_live = s.oldest_live;
+                }
+
+                out->tot_get_hits    += s.tot_get_hits;
+                out->tot_get_stale_hits += s.tot_get_stale_hits;
+                out->tot_get_refreshes  += s.tot_get_refreshes;
+                out->tot_get_expires += s.tot_get_expires;
+                out->tot_get_misses  += s.tot_get_misses;
+                out->tot_get_bytes   += s.tot_get_bytes;
+                out->tot_adds        += s.tot_adds;
+                out->tot_add_skips   += s.tot_add_skips;
+                out->tot_add_fails   += s.tot_add_fails;
+                out->tot_add_bytes   += s.tot_add_bytes;
+                out->tot_add_too_large += s.tot_add_too_large;
+                out->tot_deletes     += s.tot_deletes;
+                out->tot_evictions   += s.tot_evictions;
+
+                out->tot_admits                += s.tot_admits;
+                out->tot_admit_rejects         += s.tot_admit_rejects;
+                out->tot_admit_protected_hits  += s.tot_admit_protected_hits;
+                out->tot_admit_rejected_misses += s.tot_admit_rejected_misses;
+            }
+        }
+        return;
+    }
+
+    if (m->lock) {
+        cb_mutex_enter(m->lock);
+    }
+
+    out->size        = m->map != NULL ? genhash_size(m->map) : 0;
+    out->max         = m->max;
+    out->oldest_live = m->oldest_live;
+    out->curr_bytes  = m->curr_bytes;
+    out->max_bytes   = m->max_bytes;
+
+    out->tot_get_hits    = m->tot_get_hits;
+    out->tot_get_stale_hits = m->tot_get_stale_hits;
+    out->tot_get_refreshes  = m->tot_get_refreshes;
+    out->tot_get_expires = m->tot_get_expires;
+    out->tot_get_misses  = m->tot_get_misses;
+    out->tot_get_bytes   = m->tot_get_bytes;
+    out->tot_adds        = m->tot_adds;
+    out->tot_add_skips   = m->tot_add_skips;
+    out->tot_add_fails   = m->tot_add_fails;
+    out->tot_add_bytes   = m->tot_add_bytes;
+    out->tot_add_too_large = m->tot_add_too_large;
+    out->tot_deletes     = m->tot_deletes;
+    out->tot_evictions   = m->tot_evictions;
+
+    out->tot_admits                = m->tot_admits;
+    out->tot_admit_rejects         = m->tot_admit_rejects;
+    out->tot_admit_protected_hits  = m->tot_admit_protected_hits;
+    out->tot_admit_rejected_misses = m->tot_admit_rejected_misses;
+
+    if (m->lock) {
+        cb_mutex_exit(m->lock);
+    }
+}
+
+/* ------------------------------------------------- */
+
+static struct mcache_sketch *mcache_sketch_create(uint32_t max) {
+    struct mcache_sketch *s;
+    uint32_t width = 64;
+
+    /* About 4 counters per item, in rows a power of 2 wide. */
+
+    while (width < max * 4 && width < (1u << 24)) {
+        width = width << 1;
+    }
+
+    s = calloc(1, sizeof(struct mcache_sketch) +
+               (MCACHE_SKETCH_DEPTH * width) + (2 * width / 8));
+    if (s != NULL) {
+        s->mask        = width - 1;
+        s->samples     = 0;
+        s->samples_max = (max > 0 ? max : 1) * 10;
+        s->counts      = (uint8_t *) (s + 1);
+        s->rejected    = s->counts + (MCACHE_SKETCH_DEPTH * width);
+        s->kept        = s->rejected + (width / 8);
+    }
+
+    return s;
+}
+
+/* The seed differs from the one mcache_shard_for() uses, as the */
+/* keys of a shard would otherwise share their low hash bits. */
+
+static void mcache_sketch_hash(const char *key, int key_len,
+                               uint32_t *h1, uint32_t *h2) {
+    *h1 = hash(key, key_len, 0x6b43a9b5);
+    *h2 = hash(key, key_len, *h1) | 1;
+}
+
+static uint32_t mcache_sketch_freq(struct mcache_sketch *s,
+                                   const char *key, int key_len) {
+    uint32_t h1, h2, i;
+    uint32_t rv = MCACHE_SKETCH_COUNT_MAX;
+
+    mcache_sketch_hash(key, key_len, &h1, &h2);
+
+    for (i = 0; i < MCACHE_SKETCH_DEPTH; i++) {
+        uint8_t c = s->counts[(i * (s->mask + 1)) + ((h1 + i * h2) & s->mask)];
+        if (rv > c) {
+            rv = c;
+        }
+    }
+
+    return rv;
+}
+
+/* Conservative update: only the counters at the minimum are */
+/* incremented, which keeps the over-estimates of colliding keys down. */
+
+static void mcache_sketch_add(struct mcache_sketch *s,
+                              const char *key, int key_len) {
+    uint32_t freq = mcache_sketch_freq(s, key, key_len);
+    uint32_t h1, h2, i;
+
+    if (freq < MCACHE_SKETCH_COUNT_MAX) {
+        mcache_sketch_hash(key, key_len, &h1, &h2);
+
+        for (i = 0; i < MCACHE_SKETCH_DEPTH; i++) {
+            uint8_t *c =
+                &s->counts[(i * (s->mask + 1)) + ((h1 + i * h2) & s->mask)];
+            if (*c == freq) {
+                (*c)++;
+            }
+        }
+    }
+
+    if (++s->samples >= s->samples_max) {
+        uint32_t n = MCACHE_SKETCH_DEPTH * (s->mask + 1);
+
+        for (i = 0; i < n; i++) {
+            s->counts[i] = s->counts[i] >> 1;
+        }
+
+        memset(s->rejected, 0, (s->mask + 1) / 8);
+        memset(s->kept, 0, (s->mask + 1) / 8);
+
+        s->samples = s->samples / 2;
+    }
+}
+
+/* Tests, or sets, the key's bit in one of the sketch's bitsets. */
+
+static bool mcache_sketch_bit(uint8_t *bits, struct mcache_sketch *s,
+                              const char *key, int key_len, bool set) {
+    uint32_t h1, h2;
+    uint32_t b;
+
+    mcache_sketch_hash(key, key_len, &h1, &h2);
+
+    b = h1 & s->mask;
+
+    if (set) {
+        bits[b >> 3] |= (uint8_t) (1 << (b & 7));
+        return true;
+    }
+
+    return (bits[b >> 3] & (1 << (b & 7))) != 0;
+}
+
+/* Must be called while holding the mcache lock.  Returns true when */
+/* adding an item of len bytes would go over the item count or byte */
+/* limits. */
+
+static bool mcache_full(mcache *m, uint64_t len) {
+    return (uint32_t)genhash_size(m->map) >= m->max ||
+           (m->max_bytes > 0 && m->curr_bytes + len > m->max_bytes);
+}
+
+/* Must be called while holding the mcache lock.  Returns false when */
+/* the admission filter turns away the new item, which happens only */
+/* when the mcache is full and the new item is not replacing an */
+/* existing one, as otherwise the stale one would remain. */
+
+static bool mcache_admit(mcache *m, void *it) {
+    struct mcache_sketch *s = m->sketch;
+    void *victim = m->lru_tail;
+    char *key;
+    int   key_len;
+    char *victim_key;
+    int   victim_key_len;
+    char  buf[KEY_MAX_LENGTH + 10];
+
+    if (s == NULL || victim == NULL ||
+        !mcache_full(m, m->funcs->item_len(it))) {
+        return true;
+    }
+
+    key     = m->funcs->item_key(it);
+    key_len = m->funcs->item_key_len(it);
+
+    if (m->key_alloc) {
+        if (key_len > KEY_MAX_LENGTH) {
+            return true;
+        }
+
+        memcpy(buf, key, key_len);
+        buf[key_len] = '\0';
+        key = buf;
+    }
+
+    if (genhash_find(m->map, key) != NULL) {
+        return true;
+    }
+
+    victim_key     = m->funcs->item_key(victim);
+    victim_key_len = m->funcs->item_key_len(victim);
+
+    if (mcache_sketch_freq(s, key, key_len) >
+        mcache_sketch_freq(s, victim_key, victim_key_len)) {
+        m->tot_admits++;
+        return true;
+    }
+
+    mcache_sketch_bit(s->rejected, s, key, key_len, true);
+    mcache_sketch_bit(s->kept, s, victim_key, victim_key_len, true);
+
+    m->tot_admit_rejects++;
+
+    if (settings.verbose > 1) {
+        moxi_log_write("mcache admit-reject: %s\n", key);
+    }
+
+    return false;
+}
+
 /* ------------------------------------------------- */
 
 static char *item_key(void *it) {
@@ -536,3 +1131,18 @@ static void item_set_exptime(void *it, uint64_t exptime) {
     i->exptime = exptime;
 }
 
+static bool item_get_refreshing(void *it) {
+    item *i = it;
+    cb_assert(i);
+    return (i->it_flags & ITEM_REFRESHING) != 0;
+}
+
+static void item_set_refreshing(void *it, bool refreshing) {
+    item *i = it;
+    cb_assert(i);
+    if (refreshing) {
+        i->it_flags |= ITEM_REFRESHING;
+    } else {
+        i->it_flags &= ~ITEM_REFRESHING;
+    }
+}
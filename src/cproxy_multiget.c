@@ -49,6 +49,44 @@ void multiget_foreach_free(const void *key,
     /* TODO: Track key-level multiget squashes (length > 1). */
 }
 
+/* Callback to genhash_iter that remembers the missed keys in the */
+/* front_cache, when cproxy_release_downstream() knows that every */
+/* downstream conn replied in full, so that the misses are real.
+ */
+void multiget_foreach_miss(const void *key,
+                           const void *value,
+                           void *user_data) {
+    downstream *d;
+    proxy_td *ptd;
+    multiget_entry *entry;
+    char *skey;
+    int key_len;
+
+    d = user_data;
+    cb_assert(d);
+
+    ptd = d->ptd;
+    cb_assert(ptd);
+
+    entry = (multiget_entry *) value;
+    cb_assert(entry != NULL);
+
+    /* The key might be in the cmd_start of a closed upstream conn. */
+
+    if (entry->hits > 0 ||
+        entry->upstream_conn == NULL) {
+        return;
+    }
+
+    skey = (char *) key;
+    key_len = skey_len(skey);
+
+    if (key_len <= KEY_MAX_LENGTH &&
+        cproxy_front_cache_miss_key(ptd, skey, key_len) == true) {
+        cproxy_front_cache_miss(ptd, skey, key_len, d->front_cache_gen);
+    }
+}
+
 /* Callback to g_hash_table_foreach that clears out multiget_entries
  * which have the given upstream conn (passed as user_data).
  */
@@ -78,6 +116,77 @@ void multiget_remove_upstream(const void *key,
     }
 }
 
+/* When upstream conns are squashed onto one downstream, the keys */
+/* are copied, as the key_index of a key can't then be its offset in */
+/* just one upstream conn's cmd_start, and as an upstream conn might */
+/* close before the downstream is released.  Returns the key_index, */
+/* or 0 when out of memory. */
+
+static int multiget_key_add(downstream *d, char *key, int key_len) {
+    char *copy;
+
+    if (d->multiget_keys_num >= d->multiget_keys_max) {
+        int max = d->multiget_keys_max * 2;
+        char **keys = realloc(d->multiget_keys, max * sizeof(char *));
+        if (keys == NULL) {
+            return 0;
+        }
+
+        d->multiget_keys = keys;
+        d->multiget_keys_max = max;
+    }
+
+    copy = malloc(key_len + 1);
+    if (copy == NULL) {
+        return 0;
+    }
+
+    memcpy(copy, key, key_len);
+    copy[key_len] = '\0';
+
+    d->multiget_keys[d->multiget_keys_num++] = copy;
+
+    return d->multiget_keys_num;
+}
+
+/* Returns the space or null terminated key of a key_index, */
+/* or NULL if unknown. */
+
+char *multiget_key(downstream *d, conn *uc, int key_index) {
+    if (key_index <= 0) {
+        return NULL;
+    }
+
+    if (d->multiget_keys != NULL) {
+        if (key_index > d->multiget_keys_num) {
+            return NULL;
+        }
+
+        return d->multiget_keys[key_index - 1];
+    }
+
+    if (uc == NULL ||
+        uc->cmd_start == NULL) {
+        return NULL;
+    }
+
+    return uc->cmd_start + key_index;
+}
+
+void multiget_keys_free(downstream *d) {
+    int i;
+
+    for (i = 0; i < d->multiget_keys_num; i++) {
+        free(d->multiget_keys[i]);
+    }
+
+    free(d->multiget_keys);
+
+    d->multiget_keys = NULL;
+    d->multiget_keys_num = 0;
+    d->multiget_keys_max = 0;
+}
+
 bool multiget_ascii_downstream(downstream *d, conn *uc,
                                int (*emit_start)(conn *c, char *cmd, int cmd_len),
                                int (*emit_skey)(conn *c, char *skey, int skey_len, int vbucket, int key_index),
@@ -105,6 +214,17 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
     psc_get_key = &ptd->stats.stats_cmd[STATS_CMD_TYPE_REGULAR][STATS_CMD_GET_KEY];
     nconns = mcs_server_count(&d->mst);
 
+    if ((uc->next != NULL || uc->pipeline != NULL) &&
+        d->multiget_keys == NULL) {
+        d->multiget_keys = calloc(16, sizeof(char *));
+        if (d->multiget_keys == NULL) {
+            d->ptd->stats.stats.err_oom++;
+            return false;
+        }
+
+        d->multiget_keys_max = 16;
+    }
+
     for (i = 0; i < nconns; i++) {
         if (d->downstream_conns[i] != NULL &&
             d->downstream_conns[i] != NULL_CONN &&
@@ -124,6 +244,7 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
         char *space;
         int cmd_len;
         int cas_emit;
+        int cmd_index = 0;
 
         cb_assert(uc_cur->cmd == -1);
         cb_assert(uc_cur->item == NULL);
@@ -134,6 +255,8 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
         command = uc_cur->cmd_start;
         cb_assert(command != NULL);
 
+    next_command:
+
         while (*command != '\0' && *command == ' ') {
             command++;
         }
@@ -173,6 +296,7 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
 
             if (key_len > 0) {
                 int vbucket = -1;
+                int key_index;
                 conn *c;
                 bool do_key_stats;
 
@@ -206,16 +330,30 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
                     item *it = NULL;
 
                     if (front_cache != NULL &&
-                        cproxy_front_cache_key(ptd, key, key_len) == true) {
+                        (cproxy_front_cache_key(ptd, key, key_len) == true ||
+                         cproxy_front_cache_miss_key(ptd, key, key_len) == true)) {
                         it = mcache_get(front_cache, key, key_len,
                                         msec_current_time_snapshot);
                     }
 
+                    /* A remembered miss is answered by emitting nothing. */
+
+                    if (it != NULL &&
+                        (it->it_flags & ITEM_MISS) != 0) {
+                        psc_get_key->misses++;
+                        ptd->stats.stats.tot_front_cache_miss_hits++;
+
+                        item_remove(it);
+
+                        goto loop_next;
+                    }
+
                     if (it != NULL) {
                         cb_assert(it->nkey == key_len);
                         cb_assert(strncmp(ITEM_key(it), key, it->nkey) == 0);
 
-                        cproxy_upstream_ascii_item_response(it, uc_cur, 0);
+                        cproxy_upstream_ascii_item_pipelined(it, uc_cur, 0,
+                                                             cmd_index);
 
                         psc_get_key->hits++;
                         psc_get_key->write_bytes += it->nbytes;
@@ -242,15 +380,29 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
                 if (c != NULL) {
                     bool first_request = true;
 
+                    key_index = (d->multiget_keys == NULL) ?
+                        (int) (key - command) : 0;
+
                     /* If there's more than one key, create a de-duplication map. */
                     /* This is used to handle not-my-vbucket errors */
                     /* where any later retry attempts should avoid */
                     /* retrying already successfully attempted keys. */
 
                     /* Previously, we used to only have a map when there was more than */
-                    /* one upstream conn. */
-
-                    if (key_last == false &&
+                    /* one upstream conn.  That's still needed for */
+                    /* upstream conns that were coalesced onto a */
+                    /* single-key get while it was in flight, as */
+                    /* they're then forwarded together on a retry. */
+
+                    /* It's also how a miss is noticed, for a key */
+                    /* whose misses are remembered in the front_cache. */
+
+                    if ((key_last == false ||
+                         uc->next != NULL ||
+                         uc->pipeline != NULL ||
+                         (front_cache != NULL &&
+                          cproxy_front_cache_miss_key(ptd, key,
+                                                      key_len) == true)) &&
                         d->multiget == NULL) {
                         d->multiget = genhash_init(128, skeyhash_ops);
                         if (settings.verbose > 1) {
@@ -264,6 +416,7 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
 
                     if (d->multiget != NULL) {
                         multiget_entry *entry;
+                        multiget_entry *head;
                         if (settings.verbose > 2) {
                             char key_buf[KEY_MAX_LENGTH + 10];
                             cb_assert(key_len <= KEY_MAX_LENGTH);
@@ -279,14 +432,32 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
                         entry = calloc(1, sizeof(multiget_entry));
                         if (entry != NULL) {
                             entry->upstream_conn = uc_cur;
-                            entry->opaque = 0;
+                            entry->opaque = cmd_index;
                             entry->hits = 0;
-                            entry->next = genhash_find(d->multiget, key);
+                            entry->next = NULL;
 
-                            genhash_update(d->multiget, key, entry);
+                            head = genhash_find(d->multiget, key);
+                            if (head != NULL) {
+                                /* Keep the head entry, so that the */
+                                /* map's key stays the first request's. */
+
+                                entry->next = head->next;
+                                head->next = entry;
 
-                            if (entry->next != NULL) {
                                 first_request = false;
+                            } else {
+                                char *map_key = key;
+
+                                if (d->multiget_keys != NULL) {
+                                    key_index = multiget_key_add(d, key,
+                                                                 key_len);
+                                    if (key_index > 0) {
+                                        map_key =
+                                            d->multiget_keys[key_index - 1];
+                                    }
+                                }
+
+                                genhash_update(d->multiget, map_key, entry);
                             }
                         } else {
                             /* TODO: Handle out of multiget entry memory. */
@@ -308,7 +479,7 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
                         /* Provide the preceding space as optimization */
                         /* for ascii-to-ascii configuration. */
 
-                        emit_skey(c, key - 1, key_len + 1, vbucket, key - command);
+                        emit_skey(c, key - 1, key_len + 1, vbucket, key_index);
                     } else {
                         ptd->stats.stats.tot_multiget_keys_dedupe++;
 
@@ -330,6 +501,14 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
             space = next_space;
         }
 
+        /* Next are any get's that the upstream conn pipelined. */
+
+        if (uc_cur->pipeline != NULL &&
+            ++cmd_index < uc_cur->pipeline->num) {
+            command = uc_cur->pipeline->cmds[cmd_index].command;
+            goto next_command;
+        }
+
         uc_num++;
         uc_cur = uc_cur->next;
     }
@@ -369,6 +548,7 @@ bool multiget_ascii_downstream(downstream *d, conn *uc,
 
     d->downstream_used_start = nwrite;
     d->downstream_used       = nwrite;
+    d->multiget_ends         = 0;
 
     if (cproxy_dettach_if_noreply(d, uc) == false) {
         d->upstream_suffix = "END\r\n";
@@ -405,9 +585,15 @@ void multiget_ascii_downstream_response(downstream *d, item *it) {
         uint32_t front_cache_lifespan =
             ptd->behavior_pool.base.front_cache_lifespan;
 
+        /* Replace rather than add when the key might have a */
+        /* remembered miss, which the value makes stale. */
+
+        bool add_only =
+            cproxy_front_cache_miss_key(ptd, ITEM_key(it), it->nkey) == false;
+
         mcache_set(&p->front_cache, it,
                    front_cache_lifespan + msec_current_time,
-                   true, false);
+                   add_only, false);
     }
 
     if (d->multiget != NULL) {
@@ -431,7 +617,8 @@ void multiget_ascii_downstream_response(downstream *d, item *it) {
 
                 conn *uc = entry->upstream_conn;
                 if (uc != NULL) {
-                    cproxy_upstream_ascii_item_response(it, uc, -1);
+                    cproxy_upstream_ascii_item_pipelined(it, uc, -1,
+                                                         entry->opaque);
 
                     psc_get_key->hits++;
                     psc_get_key->write_bytes += it->nbytes;
@@ -17,6 +17,8 @@
 #define MAX_HOSTNAME_LEN 200
 #define MAX_PORT_LEN     8
 
+static void cproxy_pipeline_ascii_gets(proxy_td *ptd, conn *c, char *cmd);
+
 void cproxy_process_upstream_ascii(conn *c, char *line) {
     cb_assert(c != NULL);
     cb_assert(c->next == NULL);
@@ -138,6 +140,11 @@ void cproxy_process_upstream_ascii(conn *c, char *line) {
             c->cmd_curr = PROTOCOL_BINARY_CMD_GETKQ;
         }
 
+        if (c->cmd_curr != PROTOCOL_BINARY_CMD_GETL &&
+            mcmux_command == false) {
+            cproxy_pipeline_ascii_gets(ptd, c, cmd);
+        }
+
         /* Handles get and gets. */
 
         cproxy_pause_upstream_for_downstream(ptd, c);
@@ -421,6 +428,209 @@ void cproxy_upstream_ascii_item_response(item *it, conn *uc,
     }
 }
 
+/* Parses ahead the complete get's (or gets's) that the client has */
+/* pipelined right after the current one, up to the pipeline_max */
+/* behavior, so that they're all forwarded together, in a single */
+/* multiget.  The conn's rcont is moved past them, so that */
+/* try_read_command() skips over them. */
+
+static void cproxy_pipeline_ascii_gets(proxy_td *ptd, conn *c, char *cmd) {
+    uint32_t max = ptd->behavior_pool.base.pipeline_max;
+    int      cmd_len = (cmd[3] == 's') ? 4 : 3;
+    char    *end = c->rcurr + c->rbytes;
+    char    *curr = c->rcont;
+    pipeline *p;
+
+    cb_assert(c->pipeline == NULL);
+
+    if (max <= 1) {
+        return;
+    }
+
+    p = calloc(1, sizeof(pipeline) + max * sizeof(pipeline_cmd));
+    if (p == NULL) {
+        ptd->stats.stats.err_oom++;
+        return;
+    }
+
+    p->num = 1;
+    p->max = max;
+    p->cmds[0].command = c->cmd_start;
+
+    while (p->num < p->max && curr < end) {
+        char *line = curr;
+        char *el = memchr(curr, '\n', end - curr);
+        char *s;
+        int   key_len = 0;
+        bool  ok = false;
+
+        if (el == NULL ||
+            el - line <= cmd_len + 1 ||
+            strncmp(line, cmd, cmd_len) != 0 ||
+            line[cmd_len] != ' ') {
+            break;
+        }
+
+        /* Only lines with keys of sane lengths, which a downstream */
+        /* won't reject, since all the get's share its response. */
+
+        for (s = line + cmd_len; s <= el; s++) {
+            if (*s == ' ' || *s == '\r' || *s == '\n') {
+                if (key_len > KEY_MAX_LENGTH) {
+                    ok = false;
+                    break;
+                }
+                if (key_len > 0) {
+                    ok = true;
+                }
+                key_len = 0;
+            } else {
+                key_len++;
+            }
+        }
+
+        if (ok == false) {
+            break;
+        }
+
+        curr = el + 1;
+        if (*(el - 1) == '\r') {
+            el--;
+        }
+        *el = '\0';
+
+        p->cmds[p->num++].command = line;
+
+        ptd->stats.stats_cmd[STATS_CMD_TYPE_REGULAR][STATS_CMD_GET].seen++;
+        if (cmd_len == 4) {
+            ptd->stats.stats_cmd[STATS_CMD_TYPE_REGULAR][STATS_CMD_GET].cas++;
+        }
+    }
+
+    if (p->num <= 1) {
+        free(p);
+        return;
+    }
+
+    ptd->stats.stats.tot_pipelined_gets += p->num - 1;
+
+    c->pipeline = p;
+    c->rcont = curr;
+    c->cmd_curr = PROTOCOL_BINARY_CMD_GETKQ;
+}
+
+/* Handles an item response for the index'th get of an upstream conn. */
+/* Only the first get's responses can be written right away, while */
+/* the later get's responses are held back, in order, until the */
+/* downstream is done, see cproxy_pipeline_flush(). */
+
+void cproxy_upstream_ascii_item_pipelined(item *it, conn *uc,
+                                          int cas_emit, int index) {
+    pipeline_cmd *pc;
+
+    cb_assert(it != NULL);
+    cb_assert(uc != NULL);
+
+    if (index <= 0 ||
+        uc->pipeline == NULL ||
+        index >= uc->pipeline->num) {
+        cproxy_upstream_ascii_item_response(it, uc, cas_emit);
+        return;
+    }
+
+    pc = &uc->pipeline->cmds[index];
+
+    if (pc->items_num >= pc->items_max) {
+        int    max = pc->items_max > 0 ? pc->items_max * 2 : 4;
+        item **items = realloc(pc->items, max * sizeof(item *));
+        int   *cas_emits;
+
+        if (items != NULL) {
+            pc->items = items;
+        }
+
+        cas_emits = realloc(pc->cas_emits, max * sizeof(int));
+        if (cas_emits != NULL) {
+            pc->cas_emits = cas_emits;
+        }
+
+        if (items == NULL || cas_emits == NULL) {
+            /* The client sees a miss. */
+
+            proxy_td *ptd = uc->extra;
+            if (ptd != NULL) {
+                ptd->stats.stats.err_oom++;
+            }
+
+            return;
+        }
+
+        pc->items_max = max;
+    }
+
+    it->refcount++;
+
+    pc->items[pc->items_num] = it;
+    pc->cas_emits[pc->items_num] = cas_emit;
+    pc->items_num++;
+}
+
+/* Writes the held back responses of an upstream conn's pipelined */
+/* get's, in order, where each get before the last one is ended with */
+/* the given suffix.  The caller then writes the last get's suffix. */
+
+void cproxy_pipeline_flush(conn *uc, char *suffix, int suffix_len) {
+    pipeline *p = uc->pipeline;
+    int i, j;
+
+    if (p == NULL) {
+        return;
+    }
+
+    if (suffix != NULL && suffix_len == 0) {
+        suffix_len = (int) strlen(suffix);
+    }
+
+    for (i = 1; i < p->num; i++) {
+        pipeline_cmd *pc = &p->cmds[i];
+
+        if (suffix != NULL) {
+            add_iov(uc, suffix, suffix_len);
+        }
+
+        for (j = 0; j < pc->items_num; j++) {
+            cproxy_upstream_ascii_item_response(pc->items[j], uc,
+                                                pc->cas_emits[j]);
+        }
+    }
+
+    cproxy_pipeline_free(uc);
+}
+
+void cproxy_pipeline_free(conn *c) {
+    pipeline *p = c->pipeline;
+    int i, j;
+
+    if (p == NULL) {
+        return;
+    }
+
+    c->pipeline = NULL;
+
+    for (i = 0; i < p->num; i++) {
+        pipeline_cmd *pc = &p->cmds[i];
+
+        for (j = 0; j < pc->items_num; j++) {
+            item_remove(pc->items[j]);
+        }
+
+        free(pc->items);
+        free(pc->cas_emits);
+    }
+
+    free(p);
+}
+
 /**
  * When we're sending an ascii response line back upstream to
  * an ascii protocol client, keep the front_cache sync'ed.
@@ -521,9 +731,12 @@ bool cproxy_optimize_set_ascii(downstream *d, conn *uc,
 void cproxy_process_downstream_ascii(conn *c, char *line) {
     downstream *d = c->extra;
     cb_assert(d != NULL);
-    cb_assert(d->upstream_conn != NULL);
 
-    if (IS_ASCII(d->upstream_conn->protocol)) {
+    /* The upstream conn might have closed while a value was being */
+    /* streamed to it, and the rest of the response is then dropped. */
+
+    if (d->upstream_conn == NULL ||
+        IS_ASCII(d->upstream_conn->protocol)) {
         cproxy_process_a2a_downstream(c, line);
     } else {
         cb_assert(false); /* TODO: b2a. */
@@ -533,9 +746,9 @@ void cproxy_process_downstream_ascii(conn *c, char *line) {
 void cproxy_process_downstream_ascii_nread(conn *c) {
     downstream *d = c->extra;
     cb_assert(d != NULL);
-    cb_assert(d->upstream_conn != NULL);
 
-    if (IS_ASCII(d->upstream_conn->protocol)) {
+    if (d->upstream_conn == NULL ||
+        IS_ASCII(d->upstream_conn->protocol)) {
         cproxy_process_a2a_downstream_nread(c);
     } else {
         cb_assert(false); /* TODO: b2a. */
@@ -1,8 +1,15 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* splice() is a GNU extension. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
 #include "src/config.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#endif
 #include <platform/cbassert.h>
 #include "memcached.h"
 #include "cproxy.h"
@@ -14,10 +21,22 @@
 #define KEY_TOKEN  1
 #define MAX_TOKENS 8
 
+/* Size of the buffers that a streamed value is relayed through. */
+
+#define STREAM_CHUNK_SIZE 65536
+
 int a2a_multiget_start(conn *c, char *cmd, int cmd_len);
 int a2a_multiget_skey(conn *c, char *skey, int skey_len, int vbucket, int key_index);
 int a2a_multiget_end(conn *c);
 
+static bool a2a_stream_start(downstream *d, conn *c,
+                             char *key, int nkey,
+                             unsigned int flags, int vlen, char *cas);
+static bool a2a_stream_next(downstream *d, conn *c);
+static void a2a_stream_chunk(downstream *d, conn *c, item *it);
+static bool a2a_stream_park(downstream *d, conn *c, conn *uc);
+static void a2a_stream_kick(downstream *d, conn *c);
+
 void cproxy_init_a2a() {
     /* Nothing right now. */
 }
@@ -44,6 +63,12 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
     cb_assert(d->ptd != NULL);
     cb_assert(d->ptd->proxy != NULL);
 
+    /* Once any of the response has been seen, an upstream conn */
+    /* coalesced onto the downstream would miss that part, */
+    /* such as a VALUE followed by a late END. */
+
+    cproxy_coalesce_end(d);
+
     if (strncmp(line, "VALUE ", 6) == 0) {
         token_t      tokens[MAX_TOKENS];
         size_t       ntokens;
@@ -61,6 +86,11 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
             char  *key  = tokens[KEY_TOKEN].value;
             size_t nkey = tokens[KEY_TOKEN].length;
 
+            if (a2a_stream_start(d, c, key, nkey, flags, vlen,
+                                 ntokens == 6 ? tokens[4].value : NULL)) {
+                return; /* Success, with the value relayed in chunks. */
+            }
+
             item *it = item_alloc(key, nkey, flags, 0, vlen + 2);
             if (it != NULL) {
                 if (ntokens == 5 ||
@@ -97,6 +127,10 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
 
             conn_set_state(c, conn_swallow);
 
+            /* The swallowed value's key must not look like a miss. */
+
+            d->multiget_lossy = true;
+
             /* Note, eventually, we'll see an END later. */
         } else {
             /* We don't know how much to swallow, so close the downstream. */
@@ -107,6 +141,10 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
         }
     } else if (strncmp(line, "END", 3) == 0) {
         conn_set_state(c, conn_pause);
+
+        if (d->multiget != NULL) {
+            d->multiget_ends++;
+        }
     } else if (strncmp(line, "OK", 2) == 0) {
         conn_set_state(c, conn_pause);
 
@@ -174,11 +212,12 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
         conn_set_state(c, conn_pause);
 
         /* The upstream conn might be NULL when closed already */
-        /* or while handling a noreply. */
+        /* or while handling a noreply.  There might also be more */
+        /* than one upstream conn, for a coalesced get. */
 
         conn *uc = d->upstream_conn;
-        if (uc != NULL) {
-            cb_assert(uc->next == NULL);
+        while (uc != NULL) {
+            conn *uc_next = uc->next;
 
             out_string(uc, line);
 
@@ -193,6 +232,8 @@ void cproxy_process_a2a_downstream(conn *c, char *line) {
 
             cproxy_del_front_cache_key_ascii_response(d, line,
                                                       uc->cmd_start);
+
+            uc = uc_next;
         }
     }
 }
@@ -219,6 +260,11 @@ void cproxy_process_a2a_downstream_nread(conn *c) {
 
     c->item = NULL;
 
+    if (d->stream_conn == c) {
+        a2a_stream_chunk(d, c, it);
+        return;
+    }
+
     conn_set_state(c, conn_new_cmd);
 
     /* pthread_mutex_lock(&c->thread->stats.mutex); */
@@ -630,3 +676,385 @@ bool cproxy_forward_a2a_item_downstream(downstream *d, short cmd,
     return false;
 }
 
+
+/* A large get value, for a downstream that has just a single upstream */
+/* and no front_cache or multiget de-duplication interest in the item, */
+/* is relayed upstream a chunk at a time, instead of being read in */
+/* whole first.  The next chunk isn't read until the upstream has */
+/* written out the previous chunk, so only one chunk is buffered. */
+
+static bool a2a_stream_start(downstream *d, conn *c,
+                             char *key, int nkey,
+                             unsigned int flags, int vlen, char *cas) {
+    proxy_td *ptd = d->ptd;
+    proxy_stats_cmd *psc_get_key;
+    conn *uc = d->upstream_conn;
+    uint32_t min_bytes = ptd->behavior_pool.base.stream_min_bytes;
+    item *hdr;
+    int nhdr;
+
+    if (min_bytes == 0 ||
+        vlen < 0 ||
+        (uint32_t) vlen < min_bytes ||
+        uc == NULL ||
+        uc->next != NULL ||
+        d->multiget != NULL ||
+        d->stream_conn != NULL ||
+        cproxy_front_cache_key(ptd, key, nkey) == true) {
+        return false;
+    }
+
+    hdr = item_alloc("s", 1, 0, 0, nkey + 64);
+    if (hdr == NULL) {
+        return false;
+    }
+
+    nhdr = snprintf(ITEM_data(hdr), hdr->nbytes, "VALUE %.*s %u %d%s%s\r\n",
+                    nkey, key, flags, vlen,
+                    cas != NULL ? " " : "",
+                    cas != NULL ? cas : "");
+
+    if (nhdr <= 0 ||
+        nhdr >= hdr->nbytes ||
+        add_conn_item(uc, hdr) == false) {
+        item_remove(hdr);
+        return false;
+    }
+
+    if (add_iov(uc, ITEM_data(hdr), nhdr) != 0) {
+        return false; /* The hdr is freed along with the uc's items. */
+    }
+
+    if (settings.verbose > 2) {
+        moxi_log_write("<%d a2a_stream_start %d to %d\n",
+                       c->sfd, vlen, uc->sfd);
+    }
+
+    psc_get_key = &ptd->stats.stats_cmd[STATS_CMD_TYPE_REGULAR][STATS_CMD_GET_KEY];
+    psc_get_key->hits++;
+    psc_get_key->write_bytes += vlen + 2;
+
+    if (matcher_check(&ptd->key_stats_matcher, key, nkey, false) == true &&
+        matcher_check(&ptd->key_stats_unmatcher, key, nkey, false) == false) {
+        touch_key_stats(ptd, key, nkey,
+                        msec_current_time,
+                        STATS_CMD_TYPE_REGULAR,
+                        STATS_CMD_GET_KEY,
+                        0, 1, 0,
+                        0, vlen + 2);
+    }
+
+    ptd->stats.stats.tot_stream_values++;
+
+    d->stream_conn = c;
+    d->stream_left = vlen + 2; /* Including the value's "\r\n". */
+
+    /* With nothing of the value read yet, the header can go out */
+    /* first and the whole value gets spliced, see a2a_stream_resume(). */
+    /* A value that fits in one chunk isn't worth the extra trips */
+    /* through the event loop, so it's always read in whole. */
+
+    if (ptd->behavior_pool.base.stream_splice &&
+        d->stream_left > STREAM_CHUNK_SIZE &&
+        c->rbytes == 0 &&
+        a2a_stream_park(d, c, uc) == true) {
+        return true;
+    }
+
+    if (a2a_stream_next(d, c) == false) {
+        /* Closing the downstream conn also closes the upstream, */
+        /* which would otherwise see a partial value. */
+
+        conn_set_state(c, conn_closing);
+    }
+
+    return true;
+}
+
+/* Sets up the downstream conn to read the next chunk of the value. */
+
+static bool a2a_stream_next(downstream *d, conn *c) {
+    uint32_t n = d->stream_left;
+    item *it;
+
+    if (n > STREAM_CHUNK_SIZE) {
+        n = STREAM_CHUNK_SIZE;
+    }
+
+    /* When splicing, only what's already buffered is read, */
+    /* and the rest is spliced once that's been written. */
+
+    if (d->ptd->behavior_pool.base.stream_splice &&
+        d->stream_left > STREAM_CHUNK_SIZE &&
+        d->upstream_conn != NULL &&
+        c->rbytes > 0 &&
+        n > (uint32_t) c->rbytes) {
+        n = c->rbytes;
+    }
+
+    it = item_alloc("s", 1, 0, 0, n);
+    if (it == NULL) {
+        d->ptd->stats.stats.err_oom++;
+        return false;
+    }
+
+    c->item = it;
+    c->ritem = ITEM_data(it);
+    c->rlbytes = it->nbytes;
+    c->cmd = -1;
+
+    conn_set_state(c, conn_nread);
+
+    return true;
+}
+
+/* Hands a chunk that's been read to the upstream conn. */
+
+static void a2a_stream_chunk(downstream *d, conn *c, item *it) {
+    conn *uc = d->upstream_conn;
+
+    cb_assert(d->stream_left >= (uint32_t) it->nbytes);
+
+    d->stream_left -= it->nbytes;
+    d->ptd->stats.stats.tot_stream_bytes += it->nbytes;
+
+    /* The upstream conn might have been closed mid-value. */
+
+    if (uc != NULL) {
+        bool ok = false;
+
+        if (add_conn_item(uc, it) == true) {
+            ok = add_iov(uc, ITEM_data(it), it->nbytes) == 0;
+            it = NULL; /* The uc owns the item now. */
+        }
+
+        if (ok == false) {
+            d->ptd->stats.stats.err_oom++;
+            cproxy_close_conn(uc);
+            uc = NULL;
+        }
+    }
+
+    if (it != NULL) {
+        item_remove(it);
+    }
+
+    if (d->stream_left == 0) {
+        /* The last chunk goes out along with the rest of the */
+        /* response, when the downstream is released, after which */
+        /* the upstream conn reads its next command again. */
+
+        d->stream_conn = NULL;
+
+        if (uc != NULL) {
+            uc->write_and_go = conn_new_cmd;
+        }
+
+        conn_set_state(c, conn_new_cmd);
+        return;
+    }
+
+    if (uc != NULL &&
+        a2a_stream_park(d, c, uc) == true) {
+        return;
+    }
+
+    /* Without an upstream conn, read and drop the rest of the value. */
+
+    if (a2a_stream_next(d, c) == false) {
+        conn_set_state(c, conn_closing);
+    }
+}
+
+/* Parks the downstream conn until the upstream conn has written */
+/* what it has, see cproxy_on_pause_upstream_conn().  On failure, */
+/* the upstream conn is closed and false is returned. */
+
+static bool a2a_stream_park(downstream *d, conn *c, conn *uc) {
+    uc->stream = d;
+    uc->write_and_go = conn_pause;
+
+    if (update_event(uc, EV_WRITE | EV_PERSIST)) {
+        conn_set_state(uc, conn_mwrite);
+        conn_set_state(c, conn_pause);
+        return true;
+    }
+
+    d->ptd->stats.stats.err_oom++;
+    uc->stream = NULL;
+    cproxy_close_conn(uc);
+
+    return false;
+}
+
+/* Unparks a downstream conn that's relaying a value, so that it */
+/* reads the next chunk. */
+
+void a2a_stream_resume(downstream *d) {
+    conn *c = d->stream_conn;
+
+    if (c == NULL ||
+        c->state != conn_pause) {
+        return;
+    }
+
+    d->stream_splice = false;
+
+    if (d->ptd->behavior_pool.base.stream_splice &&
+        a2a_stream_splice(d, c) == true) {
+        return;
+    }
+
+    if (a2a_stream_next(d, c) == false) {
+        conn_set_state(c, conn_closing);
+    }
+
+    a2a_stream_kick(d, c);
+}
+
+/* Gets the drive_machine going again for a downstream conn that */
+/* was parked, from outside of its own event. */
+
+static void a2a_stream_kick(downstream *d, conn *c) {
+    /* The rest of the value might already be in the conn's rbuf, */
+    /* which a read event won't announce, but a write event will. */
+
+    if (update_event(c, ((c->rbytes > 0 || c->state == conn_closing) ?
+                         EV_WRITE : EV_READ) | EV_PERSIST) == false) {
+        d->ptd->stats.stats.err_oom++;
+        cproxy_close_conn(c);
+    }
+}
+
+/* Moves the rest of a streamed value from the downstream socket */
+/* to the upstream socket through the ptd's pipe, so the value never */
+/* gets copied into moxi.  Called when the upstream conn has nothing */
+/* else to write, and returns false when it can't splice.  See */
+/* tests/moxi/splice_bench.c for its cost against copying. */
+
+bool a2a_stream_splice(downstream *d, conn *c) {
+#ifdef HAVE_SPLICE
+    proxy_td *ptd = d->ptd;
+    conn *uc = d->upstream_conn;
+    int *fds = ptd->splice_pipe;
+
+    d->stream_splice = false;
+
+    if (uc == NULL ||
+        c->rbytes > 0 ||
+        d->stream_conn != c) {
+        return false;
+    }
+
+    if (fds[0] < 0) {
+        if (pipe(fds) != 0) {
+            fds[0] = fds[1] = -1;
+            return false;
+        }
+
+        if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+            fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            fds[0] = fds[1] = -1;
+            return false;
+        }
+    }
+
+    while (d->stream_left > 0) {
+        ssize_t n;
+        ssize_t m = 0;
+        item *it;
+
+        n = splice(c->sfd, NULL, fds[1], NULL,
+                   d->stream_left < STREAM_CHUNK_SIZE ?
+                   d->stream_left : STREAM_CHUNK_SIZE,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /* Wait for more of the value, which wakes up the parked */
+            /* conn, see cproxy_on_pause_downstream_conn(). */
+
+            d->stream_splice = true;
+
+            if (update_event(c, EV_READ | EV_PERSIST)) {
+                return true;
+            }
+
+            d->stream_splice = false;
+            ptd->stats.stats.err_oom++;
+        }
+
+        if (n <= 0) {
+            /* The downstream conn closed or failed mid-value, and */
+            /* its release also closes the upstream conn. */
+
+            conn_set_state(c, conn_closing);
+            a2a_stream_kick(d, c);
+            return true;
+        }
+
+        while (m < n) {
+            ssize_t k = splice(fds[0], NULL, uc->sfd, NULL, n - m,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (k <= 0) {
+                break;
+            }
+
+            m += k;
+        }
+
+        d->stream_left -= m;
+        ptd->stats.stats.tot_stream_bytes += m;
+        ptd->stats.stats.tot_stream_splice_bytes += m;
+
+        if (m < n) {
+            /* The upstream socket is full, and the pipe is shared, */
+            /* so the bytes left in the pipe become a regular chunk. */
+
+            it = item_alloc("s", 1, 0, 0, n - m);
+            if (it == NULL ||
+                read(fds[0], ITEM_data(it), n - m) != n - m) {
+                /* Lose the pipe, as it can't be left with data. */
+
+                close(fds[0]);
+                close(fds[1]);
+                fds[0] = fds[1] = -1;
+
+                if (it != NULL) {
+                    item_remove(it);
+                }
+
+                ptd->stats.stats.err_oom++;
+
+                conn_set_state(c, conn_closing);
+                a2a_stream_kick(d, c);
+                return true;
+            }
+
+            a2a_stream_chunk(d, c, it);
+
+            if (c->state != conn_pause) {
+                a2a_stream_kick(d, c);
+            }
+
+            return true;
+        }
+    }
+
+    /* The whole value was spliced, so the downstream conn can go */
+    /* on to read the END. */
+
+    d->stream_conn = NULL;
+    uc->write_and_go = conn_new_cmd;
+
+    conn_set_state(c, conn_new_cmd);
+    a2a_stream_kick(d, c);
+
+    return true;
+#else
+    (void) d;
+    (void) c;
+
+    return false;
+#endif
+}
@@ -438,6 +438,13 @@ void cproxy_process_a2b_downstream(conn *c) {
     cb_assert(IS_BINARY(c->protocol));
     cb_assert(IS_PROXY(c->protocol));
 
+    /* See cproxy_process_a2a_downstream(), as later upstream */
+    /* conns can't share a response that's already underway. */
+
+    if (c->extra != NULL) {
+        cproxy_coalesce_end(c->extra);
+    }
+
     /* Snapshot rcurr, because the caller, try_read_command(), changes it. */
 
     c->cmd_start = c->rcurr;
@@ -902,6 +909,10 @@ void a2b_process_downstream_response(conn *c) {
 
     case PROTOCOL_BINARY_CMD_NOOP:
         conn_set_state(c, conn_pause);
+
+        if (d->multiget != NULL) {
+            d->multiget_ends++;
+        }
         break;
 
     case PROTOCOL_BINARY_CMD_SET: /* FALLTHROUGH */
@@ -1182,9 +1193,11 @@ bool cproxy_forward_a2b_simple_downstream(downstream *d,
     cb_assert(uc->cmd_curr != (protocol_binary_command) -1);
     cb_assert(d->merger == NULL);
 
-    /* Handles multi-key get and gets. */
+    /* Handles multi-key get and gets, and single-key gets from */
+    /* more than one upstream conn, after a coalesce_get. */
 
-    if (uc->cmd_curr == PROTOCOL_BINARY_CMD_GETKQ) {
+    if (uc->cmd_curr == PROTOCOL_BINARY_CMD_GETKQ ||
+        (uc->cmd_curr == PROTOCOL_BINARY_CMD_GETK && uc->next != NULL)) {
         /* Only use front_cache for 'get', not for 'gets'. */
         mcache *front_cache =
             (command[3] == ' ') ? &d->ptd->proxy->front_cache : NULL;
@@ -1868,6 +1881,7 @@ bool a2b_not_my_vbucket(conn *uc, conn *c,
         char key_buf[KEY_MAX_LENGTH + 10];
         int vbucket = -1;
         int sindex;
+        int max_retries;
 
         /* Handle ascii multi-GET commands by awaiting all NOOP's from */
         /* downstream servers, eating the NOOP's, and retrying with */
@@ -1882,11 +1896,15 @@ bool a2b_not_my_vbucket(conn *uc, conn *c,
             return true;
         }
 
-        cb_assert(uc->cmd_start != NULL);
-        cb_assert(header->response.opaque != 0);
-
         key_index = ntohl(header->response.opaque);
-        key = uc->cmd_start + key_index;
+        key = multiget_key(d, uc, key_index);
+        if (key == NULL) {
+            /* Without the key, it can't be retried, so it's a miss. */
+
+            conn_set_state(c, conn_new_cmd);
+            return true;
+        }
+
         key_len = skey_len(key);
 
         /* The key is not NULL or space terminated. */
@@ -1908,6 +1926,36 @@ bool a2b_not_my_vbucket(conn *uc, conn *c,
 
         mcs_server_invalid_vbucket(&d->mst, sindex, vbucket);
 
+        /* Retries are counted on each upstream conn that's waiting */
+        /* for the key, as the upstream conns of squashed requests */
+        /* might each have already seen different retries. */
+
+        max_retries = cproxy_max_retries(d);
+
+        if (d->multiget != NULL) {
+            multiget_entry *entry = genhash_find(d->multiget, key_buf);
+            multiget_entry *curr;
+            bool retry = false;
+
+            for (curr = entry; curr != NULL; curr = curr->next) {
+                if (curr->upstream_conn != NULL &&
+                    curr->upstream_conn->cmd_retries < max_retries) {
+                    curr->upstream_conn->cmd_retries++;
+                    retry = true;
+                }
+            }
+
+            if (entry != NULL && retry == false) {
+                /* Leave the key in the de-duplication map, so */
+                /* that it's not retried, and is seen as a miss. */
+
+                conn_set_state(c, conn_new_cmd);
+                return true;
+            }
+        } else {
+            uc->cmd_retries++;
+        }
+
         /* Update the de-duplication map, removing the key, so that */
         /* we'll reattempt another request for the key during the */
         /* retry. */
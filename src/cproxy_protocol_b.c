@@ -188,29 +188,38 @@ void cproxy_process_upstream_binary_nread(conn *c) {
 
     cb_assert(c->item == NULL || ((item *) c->item)->refcount == 1);
 
+    /* A GET with no quiet commands ahead of it, whose responses */
+    /* would have to come first, might be a front_cache hit. */
+
+    if (c->item != NULL &&
+        c->corked == NULL &&
+        b2b_front_cache_get(ptd, c, c->item)) {
+        item_remove(c->item);
+        c->item = NULL;
+
+        conn_set_state(c, conn_mwrite);
+        c->write_and_go = conn_new_cmd;
+        return;
+    }
+
     cproxy_pause_upstream_for_downstream(ptd, c);
 }
 
-static int bin_cmd_append(bin_cmd **head, bin_cmd *bc) {
-    cb_assert(head != NULL);
+static int bin_cmd_append(conn *c, bin_cmd *bc) {
+    cb_assert(c != NULL);
     cb_assert(bc != NULL);
+    cb_assert(bc->next == NULL);
 
-    bin_cmd *tail = *head;
-
-    int n = 1;
-
-    while (tail != NULL) {
-        n++;
-        if (tail->next == NULL) {
-            tail->next = bc;
-            return n;
-        }
-        tail = tail->next;
+    if (c->corked_tail != NULL) {
+        c->corked_tail->next = bc;
+    } else {
+        c->corked = bc;
     }
 
-    *head = bc;
+    c->corked_tail = bc;
+    c->corked_num++;
 
-    return n; /* Returns number of items in list. */
+    return c->corked_num; /* Returns number of items in list. */
 }
 
 bool cproxy_binary_cork_cmd(conn *c) {
@@ -226,7 +235,7 @@ bool cproxy_binary_cork_cmd(conn *c) {
         bc->request_item = c->item;
         c->item = NULL;
 
-        int ncorked = bin_cmd_append(&c->corked, bc);
+        int ncorked = bin_cmd_append(c, bc);
 
         if (settings.verbose > 2) {
             moxi_log_write("%d: cproxy_binary_cork_cmd, ncorked %d %d\n",
@@ -244,6 +253,122 @@ bool cproxy_binary_cork_cmd(conn *c) {
     return false;
 }
 
+/* Remembers a quiet command before queuing it to its downstream */
+/* conn, with its index + 1 as its opaque.  A quiet GET of a key */
+/* that's already being asked for isn't sent, but is answered by */
+/* the earlier request's response. */
+
+static bool uncork_quiet_cmd(downstream *d, conn *uc, item *it,
+                             int *slots, int nslots, item **gets) {
+    protocol_binary_request_header *req;
+    bin_quiet *q;
+    conn *c;
+    char *key;
+    int keylen;
+    int i;
+    int k;
+    int s = -1;
+    uint32_t h;
+
+    req = (protocol_binary_request_header *) ITEM_data(it);
+    key = ((char *) req) + sizeof(*req) + req->request.extlen;
+    keylen = ntohs(req->request.keylen);
+
+    if (keylen <= 0) {
+        return false; /* We don't know how to hash an empty key. */
+    }
+
+    i = d->bin_quiet_num;
+    q = &d->bin_quiet[i];
+    q->opaque = req->request.opaque;
+    q->opcode = req->request.opcode;
+    q->dup    = -1;
+
+    if (q->opcode == PROTOCOL_BINARY_CMD_GETQ ||
+        q->opcode == PROTOCOL_BINARY_CMD_GETKQ) {
+        d->ptd->stats.stats.tot_multiget_keys++;
+
+        if (b2b_front_cache_get(d->ptd, uc, it)) {
+            return true;
+        }
+
+        /* The response's key is needed to front cache its value. */
+
+        if (q->opcode == PROTOCOL_BINARY_CMD_GETQ &&
+            cproxy_front_cache_key(d->ptd, key, keylen) == true) {
+            req->request.opcode = PROTOCOL_BINARY_CMD_GETKQ;
+        }
+
+        h = 2166136261U;
+        for (k = 0; k < keylen; k++) {
+            h = (h ^ (uint8_t) key[k]) * 16777619U;
+        }
+
+        for (s = h & (nslots - 1); slots[s] > 0; s = (s + 1) & (nslots - 1)) {
+            int j = slots[s] - 1;
+            protocol_binary_request_header *prev =
+                (protocol_binary_request_header *) ITEM_data(gets[j]);
+
+            if (ntohs(prev->request.keylen) == keylen &&
+                memcmp(((char *) prev) + sizeof(*prev) + prev->request.extlen,
+                       key, keylen) == 0) {
+                /* The earlier request is still queued, see below, */
+                /* so it can still be changed to return the key. */
+
+                if (q->opcode == PROTOCOL_BINARY_CMD_GETKQ) {
+                    prev->request.opcode = PROTOCOL_BINARY_CMD_GETKQ;
+                }
+
+                q->dup = d->bin_quiet[j].dup;
+                d->bin_quiet[j].dup = i;
+                d->bin_quiet_num++;
+
+                d->ptd->stats.stats.tot_multiget_keys_dedupe++;
+
+                return true;
+            }
+        }
+    } else {
+        /* Another quiet command, like a SETQ, might change a key, */
+        /* so later GET's aren't answered by earlier ones, nor by */
+        /* the front_cache. */
+
+        memset(slots, 0, nslots * sizeof(int));
+
+        b2b_front_cache_forget(d->ptd, it);
+    }
+
+    d->bin_quiet_num++;
+
+    req->request.opaque = htonl(i + 1);
+
+    c = b2b_queue_item(uc, d, it);
+    if (c == NULL) {
+        /* The failed downstream conn was closed, along with the */
+        /* earlier requests that it was holding. */
+
+        memset(slots, 0, nslots * sizeof(int));
+        return false;
+    }
+
+    /* Only a request that's still queued, until b2b_flush_queued(), */
+    /* can answer later GET's of its key.  A shared downstream conn */
+    /* already took its own copy of the header, and might have */
+    /* written it, so its later GET's of the key go out on their own. */
+
+    if (s >= 0 && c->mux == NULL) {
+        slots[s] = i + 1;
+        gets[i] = it; /* The downstream conn holds a refcount. */
+    }
+
+    return true;
+}
+
+/* Forwards the saved-up quiet binary commands, with one write per */
+/* downstream conn, and with quiet GET's de-duplicated like an ascii */
+/* multiget.  The responses get their upstream opaques back in */
+/* cproxy_process_b2b_downstream_nread(), via d->bin_quiet. */
+
 void cproxy_binary_uncork_cmds(downstream *d, conn *uc) {
     cb_assert(d != NULL);
     cb_assert(uc != NULL);
@@ -254,14 +379,51 @@ void cproxy_binary_uncork_cmds(downstream *d, conn *uc) {
     }
 
     int n = 0;
+    int nslots = 16;
+    int *slots = NULL;
+    item **gets = NULL;
+
+    if (uc->corked == NULL) {
+        return;
+    }
+
+    while (nslots < uc->corked_num * 2) {
+        nslots = nslots * 2;
+    }
+
+    cb_assert(d->bin_quiet == NULL);
+
+    d->bin_quiet = calloc(uc->corked_num, sizeof(bin_quiet));
+    d->bin_quiet_num = 0;
+
+    slots = calloc(nslots, sizeof(int));
+    gets = calloc(uc->corked_num, sizeof(item *));
+
+    if (d->bin_quiet == NULL || slots == NULL || gets == NULL) {
+        /* Just forward the quiet commands as-is. */
+
+        d->ptd->stats.stats.err_oom++;
+
+        free(d->bin_quiet);
+        d->bin_quiet = NULL;
+    }
 
     while (uc->corked != NULL) {
         bin_cmd *next = uc->corked->next;
 
         item *it = uc->corked->request_item;
-        if (it != NULL) {
-            b2b_forward_item(uc, d, it);
-            n++;
+        if (it != NULL && d->upstream_conn == uc) {
+            if (d->bin_quiet != NULL) {
+                if (uncork_quiet_cmd(d, uc, it, slots, nslots, gets)) {
+                    n++;
+                }
+            } else {
+                b2b_front_cache_forget(d->ptd, it);
+
+                if (b2b_queue_item(uc, d, it) != NULL) {
+                    n++;
+                }
+            }
         }
 
         if (uc->corked->request_item != NULL) {
@@ -276,6 +438,18 @@ void cproxy_binary_uncork_cmds(downstream *d, conn *uc) {
         uc->corked = next;
     }
 
+    uc->corked_tail = NULL;
+    uc->corked_num = 0;
+
+    /* A failed downstream conn close might have released d. */
+
+    if (d->upstream_conn == uc) {
+        b2b_flush_queued(d);
+    }
+
+    free(slots);
+    free(gets);
+
     if (settings.verbose > 2) {
         moxi_log_write("%d: cproxy_binary_uncork_cmds, uncorked %d\n",
                 uc->sfd, n);
@@ -283,7 +457,17 @@ void cproxy_binary_uncork_cmds(downstream *d, conn *uc) {
 }
 
 void cproxy_process_downstream_binary(conn *c) {
-    downstream *d = c->extra;
+    downstream *d;
+
+    if (c->mux != NULL) {
+        /* Shared downstream conns only carry b2b requests. */
+
+        cproxy_mux_route(c);
+        cproxy_process_b2b_downstream(c);
+        return;
+    }
+
+    d = c->extra;
     cb_assert(d != NULL);
     cb_assert(d->upstream_conn != NULL);
 
@@ -295,7 +479,14 @@ void cproxy_process_downstream_binary(conn *c) {
 }
 
 void cproxy_process_downstream_binary_nread(conn *c) {
-    downstream *d = c->extra;
+    downstream *d;
+
+    if (c->mux != NULL) {
+        cproxy_process_b2b_downstream_nread(c);
+        return;
+    }
+
+    d = c->extra;
     cb_assert(d != NULL);
     cb_assert(d->upstream_conn != NULL);
 
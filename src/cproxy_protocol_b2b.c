@@ -17,6 +17,13 @@ static protocol_binary_request_noop req_noop = {
     .bytes = {0}
 };
 
+static void b2b_hedge_watch(downstream *d, conn *uc,
+                            int server_index, int vbucket);
+static void b2b_hedge_timeout(evutil_socket_t fd,
+                              const short which,
+                              void *arg);
+static void b2b_front_cache_quiet_response(proxy_td *ptd, item *res_it);
+
 void cproxy_init_b2b() {
     memset(&req_noop, 0, sizeof(req_noop));
 
@@ -31,6 +38,7 @@ void cproxy_init_b2b() {
 bool cproxy_forward_b2b_downstream(downstream *d) {
     int nc;
     int server_index;
+    int vbucket;
     conn *uc;
 
     cb_assert(d != NULL);
@@ -60,6 +68,7 @@ bool cproxy_forward_b2b_downstream(downstream *d) {
     cb_assert(IS_PROXY(uc->protocol));
 
     server_index = -1;
+    vbucket = -1;
 
     if (cproxy_is_broadcast_cmd(uc->cmd) == false && uc->corked == NULL) {
         item *it = uc->item;
@@ -74,7 +83,7 @@ bool cproxy_forward_b2b_downstream(downstream *d) {
         key_len = ntohs(req->request.keylen);
 
         if (key_len > 0) {
-            server_index = cproxy_server_index(d, key, key_len, NULL);
+            server_index = cproxy_server_index(d, key, key_len, &vbucket);
             if (server_index < 0) {
                 return false;
             }
@@ -101,7 +110,8 @@ bool cproxy_forward_b2b_downstream(downstream *d) {
         for (i = 0; i < nconns; i++) {
             conn *c = d->downstream_conns[i];
             if (c != NULL &&
-                c != NULL_CONN) {
+                c != NULL_CONN &&
+                c->mux == NULL) {
                 cb_assert(c->state == conn_pause);
                 cb_assert(c->item == NULL);
 
@@ -124,7 +134,15 @@ bool cproxy_forward_b2b_downstream(downstream *d) {
             return cproxy_broadcast_b2b_downstream(d, uc);
         }
 
-        return cproxy_forward_b2b_simple_downstream(d, uc);
+        if (cproxy_forward_b2b_simple_downstream(d, uc) == false) {
+            return false;
+        }
+
+        if (server_index >= 0) {
+            b2b_hedge_watch(d, uc, server_index, vbucket);
+        }
+
+        return true;
     }
 
     if (settings.verbose > 2) {
@@ -221,6 +239,16 @@ bool b2b_forward_item_vbucket(conn *uc, downstream *d, item *it,
         req->request.reserved = htons(vbucket);
     }
 
+    if (c->mux != NULL) {
+        if (cproxy_mux_send(c, d, it) == true) {
+            return true;
+        }
+
+        d->ptd->stats.stats.err_oom++;
+
+        return false;
+    }
+
     if (add_conn_item(c, it) == true) {
         /* The caller keeps its refcount, and we need our own. */
 
@@ -247,6 +275,92 @@ bool b2b_forward_item_vbucket(conn *uc, downstream *d, item *it,
     return false;
 }
 
+/* Like b2b_forward_item(), but only queues the item onto its */
+/* downstream conn, so that many quiet commands can go out in one */
+/* write, via b2b_flush_queued().  Returns the downstream conn. */
+
+conn *b2b_queue_item(conn *uc, downstream *d, item *it) {
+    int  vbucket = -1;
+    bool local;
+    conn *c;
+    protocol_binary_request_header *req;
+    char *key;
+    int keylen;
+
+    cb_assert(uc != NULL);
+    cb_assert(d != NULL);
+    cb_assert(d->ptd != NULL);
+    cb_assert(it != NULL);
+
+    req = (protocol_binary_request_header *) ITEM_data(it);
+    key = ((char *) req) + sizeof(*req) + req->request.extlen;
+    keylen = ntohs(req->request.keylen);
+
+    if (keylen <= 0) {
+        return NULL; /* We don't know how to hash an empty key. */
+    }
+
+    c = cproxy_find_downstream_conn_ex(d, key, keylen, &local, &vbucket);
+    if (c == NULL) {
+        return NULL;
+    }
+
+    if (local) {
+        uc->hit_local = true;
+    }
+
+    if (c->mux != NULL) {
+        return b2b_forward_item_vbucket(uc, d, it, c, vbucket) ? c : NULL;
+    }
+
+    if (vbucket >= 0) {
+        req->request.reserved = htons(vbucket);
+    }
+
+    if (add_conn_item(c, it) == true) {
+        it->refcount++;
+
+        if (add_iov(c, ITEM_data(it), it->nbytes) == 0) {
+            return c;
+        }
+    }
+
+    d->ptd->stats.stats.err_oom++;
+    cproxy_close_conn(c);
+
+    return NULL;
+}
+
+/* Starts the writes of the downstream conns that have queued items. */
+
+void b2b_flush_queued(downstream *d) {
+    int nconns;
+    int i;
+
+    cb_assert(d != NULL);
+    cb_assert(d->ptd != NULL);
+    cb_assert(d->downstream_conns != NULL);
+
+    nconns = mcs_server_count(&d->mst);
+
+    for (i = 0; i < nconns; i++) {
+        conn *c = d->downstream_conns[i];
+        if (c != NULL &&
+            c != NULL_CONN &&
+            c->mux == NULL &&
+            c->state == conn_pause &&
+            c->iovused > 0) {
+            conn_set_state(c, conn_mwrite);
+            c->write_and_go = conn_new_cmd;
+
+            if (update_event(c, EV_WRITE | EV_PERSIST) == false) {
+                d->ptd->stats.stats.err_oom++;
+                cproxy_close_conn(c);
+            }
+        }
+    }
+}
+
 /* Used for broadcast commands, like no-op, flush_all or stats.
  */
 bool cproxy_broadcast_b2b_downstream(downstream *d, conn *uc) {
@@ -347,7 +461,7 @@ void cproxy_process_b2b_downstream(conn *c) {
     cb_assert(c->substate == bin_no_state);
 
     d = c->extra;
-    cb_assert(d);
+    cb_assert(d != NULL || c->mux != NULL);
 
     c->cmd_curr       = -1;
     c->cmd_start      = NULL;
@@ -401,7 +515,9 @@ void cproxy_process_b2b_downstream(conn *c) {
             cproxy_process_b2b_downstream_nread(c);
         }
     } else {
-        d->ptd->stats.stats.err_oom++;
+        if (d != NULL) {
+            d->ptd->stats.stats.err_oom++;
+        }
         cproxy_close_conn(c);
     }
 }
@@ -439,6 +555,19 @@ void cproxy_process_b2b_downstream_nread(conn *c) {
     }
 
     d = c->extra;
+
+    if (d == NULL && c->mux != NULL) {
+        /* The response is for a downstream that already went away */
+        /* from this shared downstream conn, so just drop it. */
+
+        item_remove(c->item);
+        c->item = NULL;
+
+        conn_set_state(c, conn_pause);
+
+        return;
+    }
+
     cb_assert(d != NULL);
     cb_assert(d->ptd != NULL);
     cb_assert(d->ptd->proxy != NULL);
@@ -467,8 +596,23 @@ void cproxy_process_b2b_downstream_nread(conn *c) {
     } else {
         conn_set_state(c, conn_pause);
 
-        if (opcode == PROTOCOL_BINARY_CMD_NOOP ||
-            opcode == PROTOCOL_BINARY_CMD_FLUSH) {
+        if (d->hedge_state != HEDGE_NONE &&
+            b2b_hedge_reply(d, c, status, &it) == false) {
+            goto done;
+        }
+
+        if (opcode == PROTOCOL_BINARY_CMD_NOOP) {
+            goto done;
+        }
+
+        if (opcode == PROTOCOL_BINARY_CMD_FLUSH) {
+            /* TODO: Handle flush_all's expiration parameter against */
+            /* the front_cache. */
+
+            if (uc != NULL) {
+                mcache_flush_all(&d->ptd->proxy->front_cache, 0);
+            }
+
             goto done;
         }
 
@@ -547,6 +691,24 @@ void cproxy_process_b2b_downstream_nread(conn *c) {
         }
     }
 
+    /* A response to an uncorked quiet command needs its upstream */
+    /* opaque back, and might also answer de-duplicated GET's. */
+
+    if (uc != NULL &&
+        c->noreply &&
+        d->bin_quiet != NULL) {
+        b2b_quiet_response(d, uc, it);
+        goto done;
+    }
+
+    /* Keep the front_cache in sync, as the ascii paths do. */
+
+    if (uc != NULL &&
+        uc->item != NULL &&
+        c->noreply == false) {
+        b2b_front_cache_update(d->ptd, uc->item, it, d->front_cache_gen);
+    }
+
     /* Write the response to the upstream connection. */
 
     if (uc != NULL) {
@@ -587,3 +749,687 @@ void cproxy_process_b2b_downstream_nread(conn *c) {
     }
 }
 
+/* A binary GET or GETK is hedged when the vbucket master hasn't */
+/* answered within the ptd's hedge_delay, by sending a GET_REPLICA */
+/* to the first replica of the vbucket, with the first good reply */
+/* winning.  Until the hedge_delay is known, GET's are only timed. */
+
+static void b2b_hedge_watch(downstream *d, conn *uc,
+                            int server_index, int vbucket) {
+    proxy_td *ptd = d->ptd;
+
+    cb_assert(d->hedge_state == HEDGE_NONE);
+    cb_assert(d->hedge_timer == false);
+
+    if (ptd->behavior_pool.base.hedge_get_percentile == 0 ||
+        vbucket < 0 ||
+        (uc->cmd != PROTOCOL_BINARY_CMD_GET &&
+         uc->cmd != PROTOCOL_BINARY_CMD_GETK) ||
+        mcs_server_replica(&d->mst, vbucket, 0) < 0) {
+        return;
+    }
+
+    d->hedge_state   = HEDGE_WATCH;
+    d->hedge_master  = server_index;
+    d->hedge_replica = -1;
+    d->hedge_vbucket = vbucket;
+    d->hedge_start   = usec_now();
+
+    if (ptd->hedge_delay > 0) {
+        struct timeval tv;
+
+        tv.tv_sec  = ptd->hedge_delay / 1000000;
+        tv.tv_usec = ptd->hedge_delay % 1000000;
+
+        evtimer_set(&d->hedge_event, b2b_hedge_timeout, d);
+
+        event_base_set(uc->thread->base, &d->hedge_event);
+
+        d->hedge_timer = evtimer_add(&d->hedge_event, &tv) == 0;
+    }
+}
+
+static void b2b_hedge_timeout(evutil_socket_t fd,
+                              const short which,
+                              void *arg) {
+    downstream *d = arg;
+    protocol_binary_request_header *req;
+    item *it;
+    conn *uc;
+    conn *rc;
+    int replica;
+    (void)fd;
+    (void)which;
+
+    cb_assert(d != NULL);
+
+    d->hedge_timer = false;
+
+    uc = d->upstream_conn;
+    if (d->hedge_state != HEDGE_WATCH ||
+        d->downstream_used != 1 ||
+        d->upstream_retry > 0 ||
+        uc == NULL ||
+        uc->item == NULL) {
+        return;
+    }
+
+    replica = mcs_server_replica(&d->mst, d->hedge_vbucket, 0);
+    if (replica < 0 ||
+        replica == d->hedge_master) {
+        return;
+    }
+
+    rc = cproxy_hedge_acquire_downstream_conn(d, uc->thread, replica);
+    if (rc == NULL) {
+        d->ptd->stats.stats.tot_hedge_get_skipped++;
+        return;
+    }
+
+    if (rc->mux == NULL &&
+        cproxy_prep_conn_for_write(rc) == false) {
+        d->ptd->stats.stats.err_downstream_write_prep++;
+        d->ptd->stats.stats.tot_hedge_get_skipped++;
+
+        d->downstream_used++;
+        cproxy_hedge_detach_downstream_conn(d, rc);
+        return;
+    }
+
+    it = item_alloc("q", 1, 0, 0, ((item *) uc->item)->nbytes);
+    if (it == NULL) {
+        d->ptd->stats.stats.err_oom++;
+        d->ptd->stats.stats.tot_hedge_get_skipped++;
+
+        d->downstream_used++;
+        cproxy_hedge_detach_downstream_conn(d, rc);
+        return;
+    }
+
+    memcpy(ITEM_data(it), ITEM_data((item *) uc->item), it->nbytes);
+
+    req = (protocol_binary_request_header *) ITEM_data(it);
+    req->request.opcode = PROTOCOL_BINARY_CMD_GET_REPLICA;
+
+    /* Count the replica before forwarding, so that a failed forward, */
+    /* which closes the replica conn, doesn't error the upstream. */
+
+    d->downstream_used++;
+
+    if (b2b_forward_item_vbucket(uc, d, it, rc, d->hedge_vbucket)) {
+        d->hedge_state   = HEDGE_SENT;
+        d->hedge_replica = replica;
+
+        d->ptd->stats.stats.tot_hedge_get++;
+    } else {
+        d->ptd->stats.stats.tot_hedge_get_skipped++;
+
+        if (rc->mux != NULL) {
+            cproxy_hedge_detach_downstream_conn(d, rc);
+        }
+    }
+
+    item_remove(it);
+}
+
+/* Returns a copy of a response with a different opcode and opaque, */
+/* optionally without its key, or NULL when out of memory. */
+
+item *b2b_response_copy(item *it, uint8_t opcode, uint32_t opaque,
+                        bool strip_key) {
+    protocol_binary_response_header *res;
+    uint32_t bodylen;
+    int extlen;
+    int keylen;
+    item *copy;
+    char *src;
+    char *dst;
+
+    res = (protocol_binary_response_header *) ITEM_data(it);
+
+    extlen  = res->response.extlen;
+    keylen  = strip_key ? ntohs(res->response.keylen) : 0;
+    bodylen = ntohl(res->response.bodylen);
+
+    copy = item_alloc("q", 1, 0, 0, it->nbytes - keylen);
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    src = ITEM_data(it);
+    dst = ITEM_data(copy);
+
+    memcpy(dst, src, sizeof(*res) + extlen);
+    memcpy(dst + sizeof(*res) + extlen,
+           src + sizeof(*res) + extlen + keylen,
+           it->nbytes - sizeof(*res) - extlen - keylen);
+
+    res = (protocol_binary_response_header *) dst;
+    res->response.opcode = opcode;
+    res->response.opaque = opaque;
+
+    if (keylen > 0) {
+        res->response.keylen  = 0;
+        res->response.bodylen = htonl(bodylen - keylen);
+    }
+
+    return copy;
+}
+
+/* Rewrites a GET_REPLICA reply to look like a reply to the */
+/* upstream's GET or GETK, where a GET reply has no key. */
+
+item *b2b_hedge_reply_item(item *it, uint8_t opcode) {
+    protocol_binary_response_header *res;
+    item *copy;
+
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    res->response.opcode = opcode;
+
+    if (opcode != PROTOCOL_BINARY_CMD_GET ||
+        res->response.keylen == 0) {
+        return it;
+    }
+
+    copy = b2b_response_copy(it, opcode, res->response.opaque, true);
+    if (copy == NULL) {
+        return it; /* Still a well-formed reply, just with the key. */
+    }
+
+    item_remove(it);
+
+    return copy;
+}
+
+/* Decides between the master's and the replica's replies to a */
+/* hedged GET.  Returns false when the reply should be dropped. */
+
+bool b2b_hedge_reply(downstream *d, conn *c, int status, item **itp) {
+    conn *uc = d->upstream_conn;
+    conn *other;
+    int k;
+
+    if (d->hedge_state == HEDGE_WATCH) {
+        /* The master answered, without any hedge. */
+
+        cproxy_hedge_sample(d->ptd, usec_now() - d->hedge_start);
+        cproxy_clear_hedge(d);
+
+        return true;
+    }
+
+    cb_assert(d->hedge_state == HEDGE_SENT);
+
+    k = downstream_conn_index(d, c);
+    if (k != d->hedge_replica) {
+        /* The master answered first, unless it's a not-my-vbucket, */
+        /* where the replica might still win against the retry. */
+
+        if (status == PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET) {
+            return true;
+        }
+
+        cproxy_hedge_sample(d->ptd, usec_now() - d->hedge_start);
+        cproxy_clear_hedge(d);
+
+        d->ptd->stats.stats.tot_hedge_get_wasted++;
+
+        other = d->downstream_conns[d->hedge_replica];
+        if (other != NULL &&
+            other != NULL_CONN &&
+            other != c) {
+            cproxy_hedge_detach_downstream_conn(d, other);
+        }
+
+        return true;
+    }
+
+    if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS &&
+        (d->downstream_used > 1 || d->upstream_retry > 0)) {
+        /* Leave it to the master, or to the master's retry. */
+
+        d->ptd->stats.stats.tot_hedge_get_wasted++;
+        d->hedge_state = HEDGE_WATCH;
+
+        return false;
+    }
+
+    if (d->downstream_used > 1) {
+        other = d->downstream_conns[d->hedge_master];
+        if (other != NULL &&
+            other != NULL_CONN) {
+            cproxy_hedge_detach_downstream_conn(d, other);
+        }
+    }
+
+    /* Otherwise, the master went away without an answer, */
+    /* so even a replica error goes to the upstream. */
+
+    if (status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        d->ptd->stats.stats.tot_hedge_get_win++;
+    }
+
+    cproxy_hedge_sample(d->ptd, usec_now() - d->hedge_start);
+    cproxy_clear_hedge(d);
+
+    d->upstream_retry = 0;
+
+    if (uc != NULL) {
+        *itp = b2b_hedge_reply_item(*itp, (uint8_t) uc->cmd);
+    }
+
+    return true;
+}
+
+/* Writes a response to an uncorked quiet command to the upstream, */
+/* once for each of the upstream's requests that it answers. */
+
+void b2b_quiet_response(downstream *d, conn *uc, item *it) {
+    protocol_binary_response_header *res;
+    uint32_t idx;
+    uint64_t nbytes = 0;
+    int i;
+
+    res = (protocol_binary_response_header *) ITEM_data(it);
+    idx = ntohl(res->response.opaque);
+
+    if (idx == 0 || idx > (uint32_t) d->bin_quiet_num) {
+        /* Not one of ours, so just pass it along. */
+
+        if (add_conn_item(uc, it) == true) {
+            it->refcount++;
+
+            if (add_iov(uc, ITEM_data(it), it->nbytes) == 0) {
+                return;
+            }
+        }
+
+        d->ptd->stats.stats.err_oom++;
+        cproxy_close_conn(uc);
+        return;
+    }
+
+    b2b_front_cache_quiet_response(d->ptd, it);
+
+    for (i = idx - 1; i >= 0; i = d->bin_quiet[i].dup) {
+        bin_quiet *q = &d->bin_quiet[i];
+        bool strip_key = (res->response.keylen != 0 &&
+                          q->opcode == PROTOCOL_BINARY_CMD_GETQ);
+        item *out;
+
+        if (i == (int) idx - 1 && strip_key == false) {
+            res->response.opaque = q->opaque;
+            res->response.opcode = q->opcode;
+
+            out = it;
+            out->refcount++;
+        } else {
+            out = b2b_response_copy(it, q->opcode, q->opaque, strip_key);
+            if (out == NULL) {
+                break;
+            }
+        }
+
+        if (i != (int) idx - 1) {
+            nbytes += out->nbytes;
+        }
+
+        if (add_conn_item(uc, out) == false) {
+            item_remove(out);
+            break;
+        }
+
+        if (add_iov(uc, ITEM_data(out), out->nbytes) != 0) {
+            break;
+        }
+    }
+
+    if (i >= 0) {
+        d->ptd->stats.stats.err_oom++;
+        cproxy_close_conn(uc);
+        return;
+    }
+
+    d->ptd->stats.stats.tot_multiget_bytes_dedupe += nbytes;
+}
+
+/* The front_cache keeps items in the same form for binary upstreams */
+/* as for ascii upstreams, with the flags in the ITEM_suffix and a */
+/* "\r\n" terminated value, so that either protocol can hit on what */
+/* the other cached.  Only items with a known CAS are served to a */
+/* binary upstream, as an ascii get doesn't learn the CAS. */
+
+/* Copies a binary request's key, which isn't space or null */
+/* terminated, as the front_cache needs.  Returns the key length, */
+/* or 0 when the key isn't front cachable. */
+
+static int b2b_front_cache_key(proxy_td *ptd, item *req_it,
+                               char *key_buf, bool misses) {
+    protocol_binary_request_header *req;
+    int keylen;
+
+    if (ptd->behavior_pool.base.front_cache_lifespan == 0 ||
+        mcache_started(&ptd->proxy->front_cache) == false) {
+        return 0;
+    }
+
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+    keylen = ntohs(req->request.keylen);
+
+    if (keylen <= 0 ||
+        keylen > KEY_MAX_LENGTH) {
+        return 0;
+    }
+
+    memcpy(key_buf, ((char *) req) + sizeof(*req) + req->request.extlen,
+           keylen);
+    key_buf[keylen] = '\0';
+
+    if (cproxy_front_cache_key(ptd, key_buf, keylen) == true ||
+        (misses &&
+         cproxy_front_cache_miss_key(ptd, key_buf, keylen) == true)) {
+        return keylen;
+    }
+
+    return 0;
+}
+
+/* Returns a response to a binary GET, GETK, GETQ or GETKQ request */
+/* from a front_cache item, or NULL when out of memory. */
+
+item *b2b_front_cache_response(item *it,
+                               protocol_binary_request_header *req) {
+    protocol_binary_response_get *rsp;
+    uint8_t opcode = req->request.opcode;
+    bool miss = (it->it_flags & ITEM_MISS) != 0;
+    int keylen = 0;
+    int extlen = 0;
+    int vlen = 0;
+    char *body;
+    item *out;
+
+    if (opcode == PROTOCOL_BINARY_CMD_GETK ||
+        opcode == PROTOCOL_BINARY_CMD_GETKQ) {
+        keylen = it->nkey;
+    }
+
+    /* Like memcached, a GET miss says why, while a GETK miss */
+    /* just has the key. */
+
+    if (miss) {
+        vlen = (keylen > 0) ? 0 : 9;
+    } else {
+        extlen = sizeof(rsp->message.body);
+        vlen = it->nbytes - 2;
+    }
+
+    out = item_alloc("q", 1, 0, 0,
+                     sizeof(rsp->message.header) + extlen + keylen + vlen);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    rsp = (protocol_binary_response_get *) ITEM_data(out);
+    memset(rsp, 0, sizeof(rsp->message.header) + extlen);
+
+    rsp->message.header.response.magic    = (uint8_t) PROTOCOL_BINARY_RES;
+    rsp->message.header.response.opcode   = opcode;
+    rsp->message.header.response.keylen   = htons((uint16_t) keylen);
+    rsp->message.header.response.extlen   = (uint8_t) extlen;
+    rsp->message.header.response.datatype = (uint8_t) PROTOCOL_BINARY_RAW_BYTES;
+    rsp->message.header.response.bodylen  = htonl(extlen + keylen + vlen);
+    rsp->message.header.response.opaque   = req->request.opaque;
+
+    body = ITEM_data(out) + sizeof(rsp->message.header) + extlen;
+
+    memcpy(body, ITEM_key(it), keylen);
+
+    if (miss) {
+        rsp->message.header.response.status =
+            htons(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+
+        memcpy(body + keylen, "Not found", vlen);
+    } else {
+        rsp->message.header.response.cas = mc_swap64(ITEM_get_cas(it));
+        rsp->message.body.flags = htonl(strtoul(ITEM_suffix(it), NULL, 10));
+
+        memcpy(body + keylen, ITEM_data(it), vlen);
+    }
+
+    return out;
+}
+
+/* Answers a binary GET, GETK, GETQ or GETKQ from the front_cache, */
+/* by queuing a response onto the upstream conn, where a remembered */
+/* miss of a quiet GET is answered by nothing at all.  Returns false */
+/* when the request still needs to go to a downstream server. */
+
+bool b2b_front_cache_get(proxy_td *ptd, conn *uc, item *req_it) {
+    protocol_binary_request_header *req;
+    char key_buf[KEY_MAX_LENGTH + 1];
+    int keylen;
+    bool quiet;
+    item *it;
+    item *out;
+
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETK:
+        quiet = false;
+        break;
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+        quiet = true;
+        break;
+    default:
+        return false;
+    }
+
+    keylen = b2b_front_cache_key(ptd, req_it, key_buf, true);
+    if (keylen <= 0) {
+        return false;
+    }
+
+    it = mcache_get(&ptd->proxy->front_cache, key_buf, keylen,
+                    msec_current_time);
+    if (it == NULL) {
+        return false;
+    }
+
+    if ((it->it_flags & ITEM_MISS) != 0) {
+        ptd->stats.stats.tot_front_cache_miss_hits++;
+
+        if (quiet) {
+            item_remove(it);
+            return true;
+        }
+    } else if (ITEM_get_cas(it) == CPROXY_NOT_CAS) {
+        item_remove(it);
+        return false;
+    }
+
+    out = b2b_front_cache_response(it, req);
+
+    item_remove(it); /* The refcount was inc'ed by mcache_get(). */
+
+    if (out == NULL) {
+        ptd->stats.stats.err_oom++;
+        return false;
+    }
+
+    if (settings.verbose > 2) {
+        moxi_log_write("%d: b2b_front_cache_get hit %s\n",
+                       uc->sfd, key_buf);
+    }
+
+    /* A single add_iov() either queues the whole response or */
+    /* nothing, so a failure can still be sent downstream. */
+
+    if (add_conn_item(uc, out) == false) {
+        item_remove(out);
+        ptd->stats.stats.err_oom++;
+        return false;
+    }
+
+    if (add_iov(uc, ITEM_data(out), out->nbytes) != 0) {
+        ptd->stats.stats.err_oom++;
+        return false;
+    }
+
+    return true;
+}
+
+/* Caches a successful binary GET response, where the key comes */
+/* from the response when it has one. */
+
+static void b2b_front_cache_set(proxy_td *ptd, item *res_it,
+                                char *key, int keylen) {
+    protocol_binary_response_get *rsp;
+    int extlen;
+    int rkeylen;
+    int vlen;
+    item *it;
+
+    rsp = (protocol_binary_response_get *) ITEM_data(res_it);
+
+    extlen  = rsp->message.header.response.extlen;
+    rkeylen = ntohs(rsp->message.header.response.keylen);
+
+    if (ntohs(rsp->message.header.response.status) !=
+        PROTOCOL_BINARY_RESPONSE_SUCCESS ||
+        extlen != sizeof(rsp->message.body)) {
+        return;
+    }
+
+    if (rkeylen > 0) {
+        key    = ITEM_data(res_it) + sizeof(rsp->message.header) + extlen;
+        keylen = rkeylen;
+    }
+
+    if (keylen <= 0 ||
+        keylen > KEY_MAX_LENGTH ||
+        cproxy_front_cache_key(ptd, key, keylen) == false) {
+        return;
+    }
+
+    vlen = ntohl(rsp->message.header.response.bodylen) - extlen - rkeylen;
+    if (vlen < 0) {
+        return;
+    }
+
+    it = item_alloc(key, keylen, ntohl(rsp->message.body.flags), 0, vlen + 2);
+    if (it != NULL) {
+        memcpy(ITEM_data(it),
+               ITEM_data(res_it) + sizeof(rsp->message.header) +
+               extlen + rkeylen, vlen);
+        memcpy(ITEM_data(it) + vlen, "\r\n", 2);
+
+        ITEM_set_cas(it, mc_swap64(rsp->message.header.response.cas));
+
+        /* Replace rather than add, so that an item cached by an */
+        /* ascii get, without a CAS, or a remembered miss, is */
+        /* upgraded. */
+
+        mcache_set(&ptd->proxy->front_cache, it,
+                   ptd->behavior_pool.base.front_cache_lifespan +
+                   msec_current_time,
+                   false, false);
+
+        item_remove(it);
+    }
+}
+
+/* Keeps the front_cache in sync with a response to a non-quiet */
+/* binary request, whether by caching a GET's value or miss, or by */
+/* forgetting a key that was changed.  The gen is the request's */
+/* cproxy_front_cache_gen(), from before it was sent. */
+
+void b2b_front_cache_update(proxy_td *ptd, item *req_it, item *res_it,
+                            uint64_t gen) {
+    protocol_binary_request_header *req;
+    protocol_binary_response_header *res;
+    char key_buf[KEY_MAX_LENGTH + 1];
+    int keylen;
+
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+    res = (protocol_binary_response_header *) ITEM_data(res_it);
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETK:
+        keylen = b2b_front_cache_key(ptd, req_it, key_buf, true);
+        if (keylen <= 0) {
+            return;
+        }
+
+        switch (ntohs(res->response.status)) {
+        case PROTOCOL_BINARY_RESPONSE_SUCCESS:
+            b2b_front_cache_set(ptd, res_it, key_buf, keylen);
+            break;
+        case PROTOCOL_BINARY_RESPONSE_KEY_ENOENT:
+            if (cproxy_front_cache_miss_key(ptd, key_buf, keylen) == true) {
+                cproxy_front_cache_miss(ptd, key_buf, keylen, gen);
+            }
+            break;
+        }
+        break;
+
+    default:
+        b2b_front_cache_forget(ptd, req_it);
+        break;
+    }
+}
+
+/* Caches the value of a quiet GET's response, see uncork_quiet_cmd(), */
+/* which asks for the key of a front cachable GETQ. */
+
+static void b2b_front_cache_quiet_response(proxy_td *ptd, item *res_it) {
+    protocol_binary_response_header *res =
+        (protocol_binary_response_header *) ITEM_data(res_it);
+
+    if (res->response.opcode == PROTOCOL_BINARY_CMD_GETKQ &&
+        ptd->behavior_pool.base.front_cache_lifespan > 0 &&
+        mcache_started(&ptd->proxy->front_cache)) {
+        b2b_front_cache_set(ptd, res_it, NULL, 0);
+    }
+}
+
+/* Forgets the key of a binary request that changes it, which is */
+/* done when a quiet request is sent, or on a non-quiet's response. */
+
+void b2b_front_cache_forget(proxy_td *ptd, item *req_it) {
+    protocol_binary_request_header *req;
+    char key_buf[KEY_MAX_LENGTH + 1];
+    int keylen;
+
+    req = (protocol_binary_request_header *) ITEM_data(req_it);
+
+    switch (req->request.opcode) {
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+        break;
+    default:
+        return;
+    }
+
+    keylen = b2b_front_cache_key(ptd, req_it, key_buf, true);
+    if (keylen > 0) {
+        cproxy_front_cache_delete(ptd, key_buf, keylen);
+    }
+}
@@ -423,6 +423,7 @@ void cproxy_reset_stats(proxy_stats *ps) {
     ps->tot_downstream_connect_timeout = 0;
     ps->tot_downstream_connect_interval = 0;
     ps->tot_downstream_connect_max_reached = 0;
+    ps->tot_downstream_connect_unresolved = 0;
     ps->tot_downstream_waiting_errors = 0;
     ps->tot_downstream_auth = 0;
     ps->tot_downstream_auth_failed = 0;
@@ -433,6 +434,25 @@ void cproxy_reset_stats(proxy_stats *ps) {
     ps->tot_downstream_conn_queue_timeout = 0;
     ps->tot_downstream_conn_queue_add = 0;
     ps->tot_downstream_conn_queue_remove = 0;
+    ps->tot_downstream_mux_conn = 0;
+    ps->tot_downstream_mux_request = 0;
+    ps->tot_downstream_mux_orphan = 0;
+    ps->tot_downstream_mux_batch = 0;
+    ps->tot_downstream_mux_batch_requests = 0;
+    ps->tot_downstream_conn_prewarm = 0;
+    ps->tot_downstream_conn_prewarm_failed = 0;
+    ps->tot_downstream_conn_probe = 0;
+    ps->tot_downstream_conn_probe_failed = 0;
+    ps->tot_downstream_conn_idle_closed = 0;
+    ps->tot_hedge_get = 0;
+    ps->tot_hedge_get_win = 0;
+    ps->tot_hedge_get_wasted = 0;
+    ps->tot_hedge_get_skipped = 0;
+    ps->tot_get_coalesced = 0;
+    ps->tot_stream_values = 0;
+    ps->tot_stream_bytes = 0;
+    ps->tot_stream_splice_bytes = 0;
+    ps->tot_pipelined_gets = 0;
     ps->tot_downstream_timeout = 0;
     ps->tot_wait_queue_timeout = 0;
     ps->tot_assign_downstream = 0;
@@ -448,6 +468,8 @@ void cproxy_reset_stats(proxy_stats *ps) {
     ps->tot_multiget_keys = 0;
     ps->tot_multiget_keys_dedupe = 0;
     ps->tot_multiget_bytes_dedupe = 0;
+    ps->tot_front_cache_miss_hits = 0;
+    ps->tot_front_cache_miss_adds = 0;
     ps->tot_optimize_sets = 0;
     ps->err_oom = 0;
     ps->err_upstream_write_prep = 0;
@@ -463,6 +485,164 @@ void cproxy_reset_stats_cmd(proxy_stats_cmd *sc) {
 
 /* ------------------------------------------------- */
 
+static void snapshot_key_stats_copy(const void *it, void *userdata) {
+    const key_stats *ks = it;
+    genhash_t *map = userdata;
+    key_stats *copy;
+    char *key;
+
+    copy = malloc(sizeof(key_stats));
+    if (copy == NULL) {
+        return;
+    }
+
+    key = strdup(ks->key);
+    if (key == NULL) {
+        free(copy);
+        return;
+    }
+
+    *copy = *ks;
+    copy->next = NULL;
+    copy->prev = NULL;
+
+    genhash_update(map, key, copy);
+}
+
+static void snapshot_key_stats_free(const void *key,
+                                    const void *value,
+                                    void *user_data) {
+    (void)user_data;
+    free((void *) key);
+    free((void *) value);
+}
+
+static void snapshot_htgram_copy(HTGRAM_HANDLE *dst, HTGRAM_HANDLE src) {
+    if (src == NULL) {
+        return;
+    }
+
+    if (*dst == NULL) {
+        *dst = cproxy_create_timing_histogram();
+        if (*dst == NULL) {
+            return;
+        }
+    }
+
+    htgram_reset(*dst);
+    htgram_add(*dst, src);
+}
+
+/* Called on the worker thread to copy its ptd's stats into the */
+/* ptd's snapshot.  Returns false, to try again next interval, */
+/* rather than wait while a stats request is reading the snapshot. */
+
+bool cproxy_stats_publish(proxy_td *ptd) {
+    proxy_stats_snapshot *snap;
+    genhash_t *key_stats = NULL;
+    genhash_t *old;
+    bool published = false;
+
+    cb_assert(ptd);
+
+    snap = &ptd->snapshot;
+
+    /* The key stats copy is built before taking the lock, as it */
+    /* might have up to key_stats_max entries. */
+
+    if (ptd->behavior_pool.base.key_stats_max > 0) {
+        key_stats = genhash_init(16, strhash_ops);
+        if (key_stats != NULL) {
+            mcache_foreach(&ptd->key_stats, snapshot_key_stats_copy,
+                           key_stats);
+        }
+    }
+
+    if (cb_mutex_try_enter(&ptd->snapshot_lock) != 0) {
+        old = key_stats;
+    } else {
+        snap->stats.stats = ptd->stats.stats;
+        memcpy(snap->stats.stats_cmd, ptd->stats.stats_cmd,
+               sizeof(snap->stats.stats_cmd));
+
+        snapshot_htgram_copy(&snap->stats.downstream_reserved_time_htgram,
+                             ptd->stats.downstream_reserved_time_htgram);
+        snapshot_htgram_copy(&snap->stats.downstream_connect_time_htgram,
+                             ptd->stats.downstream_connect_time_htgram);
+
+        old = snap->key_stats;
+        snap->key_stats = key_stats;
+
+        snap->version++;
+        snap->published = msec_current_time;
+
+        cb_mutex_exit(&ptd->snapshot_lock);
+
+        published = true;
+    }
+
+    if (old != NULL) {
+        genhash_iter(old, snapshot_key_stats_free, NULL);
+        genhash_free(old);
+    }
+
+    return published;
+}
+
+static void cproxy_stats_snapshot_timeout(evutil_socket_t fd, short which,
+                                          void *arg) {
+    proxy_td *ptd = arg;
+    struct timeval tv;
+    uint32_t interval;
+
+    (void)fd;
+    (void)which;
+
+    cb_assert(ptd);
+
+    ptd->snapshot_armed = false;
+
+    cproxy_stats_publish(ptd);
+
+    /* Picks up any stats_snapshot_interval change from a reconfig. */
+
+    interval = ptd->behavior_pool.base.stats_snapshot_interval;
+    if (interval > 0) {
+        tv.tv_sec  = interval / 1000;
+        tv.tv_usec = (interval % 1000) * 1000;
+
+        ptd->snapshot_armed = evtimer_add(&ptd->snapshot_event, &tv) == 0;
+    }
+}
+
+/* Called on the worker thread, when the ptd sees activity, to start */
+/* the periodic publishing of its stats.  Once started, it keeps */
+/* going, so that stats changes after the last request, like */
+/* closed conns, still get published. */
+
+void cproxy_stats_snapshot_arm(proxy_td *ptd, struct event_base *base) {
+    struct timeval tv;
+    uint32_t interval;
+
+    cb_assert(ptd);
+    cb_assert(base);
+
+    interval = ptd->behavior_pool.base.stats_snapshot_interval;
+    if (ptd->snapshot_armed || interval == 0) {
+        return;
+    }
+
+    tv.tv_sec  = interval / 1000;
+    tv.tv_usec = (interval % 1000) * 1000;
+
+    evtimer_set(&ptd->snapshot_event, cproxy_stats_snapshot_timeout, ptd);
+    event_base_set(base, &ptd->snapshot_event);
+
+    ptd->snapshot_armed = evtimer_add(&ptd->snapshot_event, &tv) == 0;
+}
+
+/* ------------------------------------------------- */
+
 key_stats *find_key_stats(proxy_td *ptd, char *key, int key_len,
                           uint64_t msec_time) {
     key_stats *ks;
@@ -55,6 +55,7 @@ uint32_t lvb_key_hash(mcs_st *ptr, const char *key, size_t key_length,
                       int *vbucket);
 void     lvb_server_invalid_vbucket(mcs_st *ptr, int server_index,
                                     int vbucket);
+int      lvb_server_replica(mcs_st *ptr, int vbucket, int n);
 
 /* The lmc stands for libmemcached. */
 
@@ -72,22 +73,32 @@ mcs_st *mcs_create(mcs_st *ptr, const char *config,
                    const char *default_usr,
                    const char *default_pwd,
                    const char *opts) {
+    mcs_st *rv;
+    int i;
+
     if (config[0] == '{') {
         if (settings.verbose > 2) {
             moxi_log_write("mcs_create using libvbucket\n");
         }
-        return lvb_create(ptr, config, default_usr, default_pwd, opts);
-    }
-    if (config[0] != '{') {
+        rv = lvb_create(ptr, config, default_usr, default_pwd, opts);
+    } else {
         if (settings.verbose > 2) {
             moxi_log_write("mcs_create using libmemcached\n");
         }
-        return lmc_create(ptr, config, default_usr, default_pwd, opts);
+        rv = lmc_create(ptr, config, default_usr, default_pwd, opts);
     }
-    moxi_log_write("ERROR: unconfigured hash library\n");
-    exit(1);
 
-    return NULL;
+    /* Resolve server hostnames in the background, ahead of the */
+    /* first downstream connects. */
+
+    if (rv != NULL) {
+        for (i = 0; i < rv->nservers; i++) {
+            mcs_resolve_prefetch(rv->servers[i].hostname,
+                                 rv->servers[i].port);
+        }
+    }
+
+    return rv;
 }
 
 void mcs_free(mcs_st *ptr) {
@@ -151,6 +162,16 @@ void mcs_server_invalid_vbucket(mcs_st *ptr, int server_index,
     }
 }
 
+/* Returns the server index of the n'th replica of a vbucket, */
+/* or -1 when there's no such replica. */
+
+int mcs_server_replica(mcs_st *ptr, int vbucket, int n) {
+    if (ptr->kind == MCS_KIND_LIBVBUCKET) {
+        return lvb_server_replica(ptr, vbucket, n);
+    }
+    return -1;
+}
+
 /* ---------------------------------------------------------------------- */
 
 mcs_st *lvb_create(mcs_st *ptr, const char *config,
@@ -312,6 +333,29 @@ void lvb_server_invalid_vbucket(mcs_st *ptr, int server_index,
     vbucket_found_incorrect_master(vch, vbucket, server_index);
 }
 
+int lvb_server_replica(mcs_st *ptr, int vbucket, int n) {
+    VBUCKET_CONFIG_HANDLE vch;
+    int i;
+
+    cb_assert(ptr->kind == MCS_KIND_LIBVBUCKET);
+    cb_assert(ptr->data != NULL);
+
+    vch = (VBUCKET_CONFIG_HANDLE) ptr->data;
+
+    if (vbucket < 0 ||
+        vbucket >= vbucket_config_get_num_vbuckets(vch) ||
+        n >= vbucket_config_get_num_replicas(vch)) {
+        return -1;
+    }
+
+    i = vbucket_get_replica(vch, vbucket, n);
+    if (i < 0 || i >= ptr->nservers) {
+        return -1;
+    }
+
+    return i;
+}
+
 
 /* ---------------------------------------------------------------------- */
 
@@ -456,42 +500,378 @@ mcs_return mcs_server_st_connect(mcs_server_st *ptr, int *errno_out, bool blocki
     return MCS_FAILURE;
 }
 
-SOCKET mcs_connect(const char *hostname, int portnum,
-                int *errno_out, bool blocking) {
-    SOCKET ret = INVALID_SOCKET;
+/* Resolved entries are refreshed in the background after this ttl, */
+/* while the previous addresses keep being used. */
+
+#define MCS_RESOLVE_TTL_MSECS   60000
+#define MCS_RESOLVE_RETRY_MSECS 1000
+#define MCS_RESOLVE_MAX_ADDRS   8
+
+typedef struct {
+    int family;
+    int socktype;
+    int protocol;
+    socklen_t addrlen;
+    struct sockaddr_storage addr;
+} mcs_addr;
+
+typedef struct mcs_resolve_entry mcs_resolve_entry;
+
+struct mcs_resolve_entry {
+    char     key[MCS_HOSTNAME_SIZE + 20]; /* Looks like "hostname:port". */
+    char     hostname[MCS_HOSTNAME_SIZE];
+    int      port;
+    int      naddrs;        /* 0 until the first successful resolve. */
+    mcs_addr addrs[MCS_RESOLVE_MAX_ADDRS];
+    uint64_t resolve_time;  /* msec_current_time of the last attempt. */
+    bool     queued;
+
+    mcs_resolve_entry *next_queued;
+};
+
+static bool               mcs_resolve_initted = false;
+static cb_mutex_t         mcs_resolve_lock;
+static cb_cond_t          mcs_resolve_cond;
+static cb_thread_t        mcs_resolve_tid;
+static genhash_t         *mcs_resolve_map; /* Entries are never removed. */
+static mcs_resolve_entry *mcs_resolve_queue_head;
+static mcs_resolve_entry *mcs_resolve_queue_tail;
+static mcs_resolve_stats  mcs_resolve_stats_g;
+
+static void mcs_resolve_thread(void *arg);
+
+/* Calls getaddrinfo(), and copies out up to max addresses. */
+
+static int mcs_resolve_now(const char *hostname, int portnum,
+                           mcs_addr *addrs, int max, bool numeric_only) {
     struct addrinfo *ai   = NULL;
     struct addrinfo *next = NULL;
     struct addrinfo hints;
     char port[50];
-    int error;
-
-    if (errno_out != NULL) {
-        *errno_out = -1;
-    }
+    int n = 0;
 
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_flags = AI_PASSIVE;
+    if (numeric_only) {
+        hints.ai_flags |= AI_NUMERICHOST;
+    }
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_family = AF_UNSPEC;
 
     snprintf(port, sizeof(port), "%d", portnum);
 
-    error = getaddrinfo(hostname, port, &hints, &ai);
-    if (error != 0) {
-#if 0
-        if (error != EAI_SYSTEM) {
-            /* settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL, */
-            /*                                 "getaddrinfo(): %s\n", gai_strerror(error)); */
-        } else {
-            /* settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL, */
-            /*                                 "getaddrinfo(): %s\n", strerror(error)); */
+    if (getaddrinfo(hostname, port, &hints, &ai) != 0) {
+        return 0;
+    }
+
+    for (next = ai; next != NULL && n < max; next = next->ai_next) {
+        if (next->ai_addrlen > sizeof(addrs[n].addr)) {
+            continue;
         }
-#endif
+
+        addrs[n].family   = next->ai_family;
+        addrs[n].socktype = next->ai_socktype;
+        addrs[n].protocol = next->ai_protocol;
+        addrs[n].addrlen  = (socklen_t) next->ai_addrlen;
+        memcpy(&addrs[n].addr, next->ai_addr, next->ai_addrlen);
+        n++;
+    }
+
+    freeaddrinfo(ai);
+
+    return n;
+}
+
+/* Same as mcs_resolve_now(), but tracking latency stats. */
+
+static int mcs_resolve_timed(const char *hostname, int portnum,
+                             mcs_addr *addrs, int max) {
+    uint64_t start = usec_now();
+    uint64_t usecs;
+    int n = mcs_resolve_now(hostname, portnum, addrs, max, false);
+
+    usecs = usec_now() - start;
+
+    cb_mutex_enter(&mcs_resolve_lock);
+    mcs_resolve_stats_g.resolves++;
+    if (n <= 0) {
+        mcs_resolve_stats_g.resolve_errors++;
+    }
+    mcs_resolve_stats_g.resolve_usec_tot += usecs;
+    if (mcs_resolve_stats_g.resolve_usec_max < usecs) {
+        mcs_resolve_stats_g.resolve_usec_max = usecs;
+    }
+    cb_mutex_exit(&mcs_resolve_lock);
+
+    return n;
+}
+
+/* Must be called while holding the mcs_resolve_lock. */
+
+static mcs_resolve_entry *mcs_resolve_entry_get(const char *hostname,
+                                                int portnum) {
+    char key[MCS_HOSTNAME_SIZE + 20];
+    mcs_resolve_entry *entry;
+
+    snprintf(key, sizeof(key), "%s:%d", hostname, portnum);
+
+    entry = genhash_find(mcs_resolve_map, key);
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(mcs_resolve_entry));
+        if (entry != NULL) {
+            strncpy(entry->key, key, sizeof(entry->key) - 1);
+            strncpy(entry->hostname, hostname, sizeof(entry->hostname) - 1);
+            entry->port = portnum;
+
+            /* Numeric addresses resolve without any lookup, */
+            /* so they're never a miss. */
+
+            entry->naddrs = mcs_resolve_now(hostname, portnum,
+                                            entry->addrs,
+                                            MCS_RESOLVE_MAX_ADDRS,
+                                            true);
+            if (entry->naddrs > 0) {
+                entry->resolve_time = UINT64_MAX; /* Never refresh. */
+            }
+
+            genhash_store(mcs_resolve_map, entry->key, entry);
+        }
+    }
+
+    return entry;
+}
+
+/* Must be called while holding the mcs_resolve_lock. */
+
+static void mcs_resolve_enqueue(mcs_resolve_entry *entry) {
+    if (entry->queued) {
+        return;
+    }
+
+    entry->queued = true;
+    entry->next_queued = NULL;
+
+    if (mcs_resolve_queue_tail != NULL) {
+        mcs_resolve_queue_tail->next_queued = entry;
+    } else {
+        mcs_resolve_queue_head = entry;
+    }
+    mcs_resolve_queue_tail = entry;
+
+    cb_cond_signal(&mcs_resolve_cond);
+}
+
+/* Copies out the cached addresses for a server, returning 0 on */
+/* a miss.  A non-blocking caller does not wait for a lookup, but */
+/* instead queues one up for the resolver thread, and gets -1 when */
+/* the server has never been looked up yet. */
+
+static int mcs_resolve(const char *hostname, int portnum,
+                       mcs_addr *addrs, int max, bool blocking) {
+    mcs_resolve_entry *entry;
+    int n = 0;
+
+    if (!mcs_resolve_initted) {
+        return mcs_resolve_now(hostname, portnum, addrs, max, false);
+    }
+
+    cb_mutex_enter(&mcs_resolve_lock);
+
+    entry = mcs_resolve_entry_get(hostname, portnum);
+    if (entry == NULL) {
+        cb_mutex_exit(&mcs_resolve_lock);
+        return mcs_resolve_now(hostname, portnum, addrs, max, false);
+    }
+
+    if (entry->naddrs > 0) {
+        n = entry->naddrs < max ? entry->naddrs : max;
+        memcpy(addrs, entry->addrs, n * sizeof(mcs_addr));
+
+        mcs_resolve_stats_g.hits++;
+
+        if (entry->resolve_time != UINT64_MAX &&
+            msec_current_time - entry->resolve_time > MCS_RESOLVE_TTL_MSECS) {
+            mcs_resolve_stats_g.hits_stale++;
+            mcs_resolve_enqueue(entry);
+        }
+
+        cb_mutex_exit(&mcs_resolve_lock);
+
+        return n;
+    }
+
+    mcs_resolve_stats_g.misses++;
+
+    if (!blocking) {
+        if (entry->resolve_time == 0 ||
+            msec_current_time - entry->resolve_time > MCS_RESOLVE_RETRY_MSECS) {
+            mcs_resolve_enqueue(entry);
+        }
+
+        /* Only a lookup that has already failed is a miss. */
+
+        n = (entry->resolve_time == 0) ? -1 : 0;
+
+        cb_mutex_exit(&mcs_resolve_lock);
+
+        return n;
+    }
+
+    cb_mutex_exit(&mcs_resolve_lock);
+
+    n = mcs_resolve_timed(hostname, portnum, addrs, max);
+    if (n > 0) {
+        cb_mutex_enter(&mcs_resolve_lock);
+        memcpy(entry->addrs, addrs, n * sizeof(mcs_addr));
+        entry->naddrs = n;
+        entry->resolve_time = msec_current_time;
+        cb_mutex_exit(&mcs_resolve_lock);
+    }
+
+    return n;
+}
+
+static void mcs_resolve_thread(void *arg) {
+    (void) arg;
+
+    cb_mutex_enter(&mcs_resolve_lock);
+
+    while (true) {
+        mcs_resolve_entry *entry;
+        mcs_addr addrs[MCS_RESOLVE_MAX_ADDRS];
+        char hostname[MCS_HOSTNAME_SIZE];
+        int port;
+        int n;
+
+        while (mcs_resolve_queue_head == NULL) {
+            cb_cond_wait(&mcs_resolve_cond, &mcs_resolve_lock);
+        }
+
+        entry = mcs_resolve_queue_head;
+        mcs_resolve_queue_head = entry->next_queued;
+        if (mcs_resolve_queue_head == NULL) {
+            mcs_resolve_queue_tail = NULL;
+        }
+        entry->next_queued = NULL;
+
+        memcpy(hostname, entry->hostname, sizeof(hostname));
+        port = entry->port;
+
+        cb_mutex_exit(&mcs_resolve_lock);
+
+        n = mcs_resolve_timed(hostname, port, addrs, MCS_RESOLVE_MAX_ADDRS);
+
+        if (settings.verbose > 2) {
+            moxi_log_write("mcs_resolve %s:%d, naddrs %d\n",
+                           hostname, port, n);
+        }
+
+        cb_mutex_enter(&mcs_resolve_lock);
+
+        /* On a failed refresh, keep using the previous addresses. */
+
+        if (n > 0) {
+            memcpy(entry->addrs, addrs, n * sizeof(mcs_addr));
+            entry->naddrs = n;
+        }
+        entry->resolve_time = msec_current_time;
+        entry->queued = false;
+    }
+}
+
+void mcs_resolve_init(void) {
+    int ret;
+
+    if (mcs_resolve_initted) {
+        return;
+    }
+
+    cb_mutex_initialize(&mcs_resolve_lock);
+    cb_cond_initialize(&mcs_resolve_cond);
+
+    mcs_resolve_map = genhash_init(64, strhash_ops);
+    if (mcs_resolve_map == NULL) {
+        return;
+    }
+
+    if ((ret = cb_create_thread(&mcs_resolve_tid,
+                                mcs_resolve_thread, NULL, 1)) != 0) {
+        moxi_log_write("Can't create resolver thread: %s\n", strerror(ret));
+        return;
+    }
+
+    mcs_resolve_initted = true;
+}
+
+/* Warms the cache for a server, such as when a config arrives, */
+/* before the first downstream connect needs it. */
+
+void mcs_resolve_prefetch(const char *hostname, int portnum) {
+    mcs_resolve_entry *entry;
+
+    if (!mcs_resolve_initted ||
+        hostname == NULL ||
+        hostname[0] == '\0') {
+        return;
+    }
+
+    cb_mutex_enter(&mcs_resolve_lock);
+
+    entry = mcs_resolve_entry_get(hostname, portnum);
+    if (entry != NULL &&
+        entry->naddrs <= 0 &&
+        entry->resolve_time == 0) {
+        mcs_resolve_enqueue(entry);
+    }
+
+    cb_mutex_exit(&mcs_resolve_lock);
+}
+
+void mcs_resolve_stats_get(mcs_resolve_stats *out) {
+    if (!mcs_resolve_initted) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    cb_mutex_enter(&mcs_resolve_lock);
+    *out = mcs_resolve_stats_g;
+    cb_mutex_exit(&mcs_resolve_lock);
+}
+
+void mcs_resolve_stats_reset(void) {
+    if (!mcs_resolve_initted) {
+        return;
+    }
+
+    cb_mutex_enter(&mcs_resolve_lock);
+    memset(&mcs_resolve_stats_g, 0, sizeof(mcs_resolve_stats_g));
+    cb_mutex_exit(&mcs_resolve_lock);
+}
+
+SOCKET mcs_connect(const char *hostname, int portnum,
+                int *errno_out, bool blocking) {
+    SOCKET ret = INVALID_SOCKET;
+    mcs_addr addrs[MCS_RESOLVE_MAX_ADDRS];
+    int naddrs;
+    int i;
+
+    if (errno_out != NULL) {
+        *errno_out = -1;
+    }
+
+    naddrs = mcs_resolve(hostname, portnum, addrs,
+                         MCS_RESOLVE_MAX_ADDRS, blocking);
+    if (naddrs < 0) {
+        if (errno_out != NULL) {
+            *errno_out = MCS_UNRESOLVED;
+        }
+
         return INVALID_SOCKET;
     }
 
-    for (next = ai; next; next = next->ai_next) {
-        SOCKET sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    for (i = 0; i < naddrs; i++) {
+        mcs_addr *a = &addrs[i];
+        SOCKET sock = socket(a->family, a->socktype, a->protocol);
         if (sock == INVALID_SOCKET) {
             /* settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL, */
             /*                                 "Failed to create socket: %s\n", */
@@ -507,7 +887,7 @@ SOCKET mcs_connect(const char *hostname, int portnum,
             continue;
         }
 
-        if (connect(sock, ai->ai_addr, (socklen_t)ai->ai_addrlen) == SOCKET_ERROR) {
+        if (connect(sock, (struct sockaddr *) &a->addr, a->addrlen) == SOCKET_ERROR) {
 #ifdef WIN32
             DWORD errno_last = WSAGetLastError();
 #else
@@ -538,8 +918,6 @@ SOCKET mcs_connect(const char *hostname, int portnum,
         closesocket(sock);
     }
 
-    freeaddrinfo(ai);
-
     return ret;
 }
 
@@ -58,6 +58,8 @@ uint32_t mcs_key_hash(mcs_st *ptr, const char *key, size_t key_length, int *vbuc
 
 void mcs_server_invalid_vbucket(mcs_st *ptr, int server_index, int vbucket);
 
+int mcs_server_replica(mcs_st *ptr, int vbucket, int n);
+
 void mcs_server_st_quit(mcs_server_st *ptr, uint8_t io_death);
 
 mcs_return mcs_server_st_connect(mcs_server_st *ptr,
@@ -80,6 +82,31 @@ mcs_return mcs_set_sock_opt(SOCKET sock);
 SOCKET mcs_connect(const char *hostname, int portnum,
                    int *errno_out, bool blocking);
 
+/* The *errno_out of a non-blocking mcs_connect() that failed only */
+/* because the server's address isn't resolved yet, which the caller */
+/* should retry later rather than treat as a connect error. */
+
+#define MCS_UNRESOLVED -2
+
+/* A process-wide cache of resolved server addresses, filled and */
+/* refreshed by a background resolver thread, so that non-blocking */
+/* mcs_connect() callers never wait on getaddrinfo(). */
+
+typedef struct {
+    uint64_t hits;           /* Found resolved addresses in the cache. */
+    uint64_t hits_stale;     /* Hits past the ttl, while refreshing. */
+    uint64_t misses;         /* Had no resolved addresses. */
+    uint64_t resolves;       /* Number of getaddrinfo() calls. */
+    uint64_t resolve_errors;
+    uint64_t resolve_usec_tot;
+    uint64_t resolve_usec_max;
+} mcs_resolve_stats;
+
+void mcs_resolve_init(void);
+void mcs_resolve_prefetch(const char *hostname, int portnum);
+void mcs_resolve_stats_get(mcs_resolve_stats *out);
+void mcs_resolve_stats_reset(void);
+
 /* ---------------------------------------- */
 
 #define MOXI_DEFAULT_LISTEN_PORT      0
@@ -129,6 +129,7 @@ conn_funcs conn_funcs_default = {
     .conn_init                   = NULL,
     .conn_close                  = NULL,
     .conn_connect                = NULL,
+    .conn_auth                   = NULL,
     .conn_process_ascii_command  = process_command,
     .conn_process_binary_command = dispatch_bin_command,
     .conn_complete_nread_ascii   = complete_nread_ascii,
@@ -440,6 +441,7 @@ conn *conn_new(const SOCKET sfd, enum conn_states init_state,
     c->rbytes = c->wbytes = 0;
     c->wcurr = c->wbuf;
     c->rcurr = c->rbuf;
+    c->rcont = c->rbuf;
     c->ritem = 0;
     c->icurr = c->ilist;
     c->suffixcurr = c->suffixlist;
@@ -467,7 +469,24 @@ conn *conn_new(const SOCKET sfd, enum conn_states init_state,
     c->cmd_start_time = 0;
     c->cmd_retries = 0;
     c->corked = NULL;
+    c->corked_tail = NULL;
+    c->corked_num = 0;
+    c->stream = NULL;
+    c->rbuf_capped = false;
+#ifdef HAVE_IO_URING
+    c->uring_reading = false;
+    c->uring_writing = false;
+    c->uring_read_done = false;
+    c->uring_write_done = false;
+    c->uring_closed = false;
+    c->uring_read_res = 0;
+    c->uring_write_res = 0;
+#endif
+    c->pipeline = NULL;
     c->host_ident = NULL;
+    c->mux = NULL;
+    c->idle_time = 0;
+    c->probing = false;
     c->peer_host = NULL;
     c->peer_protocol = 0;
     c->peer_port = 0;
@@ -549,6 +568,10 @@ void conn_free(conn *c) {
             free(c->suffixlist);
         if (c->iov)
             free(c->iov);
+#ifdef HAVE_IO_URING
+        if (c->uring_iov)
+            free(c->uring_iov);
+#endif
         if (c->host_ident)
             free(c->host_ident);
 
@@ -667,7 +690,8 @@ const char *state_text(enum conn_states state) {
                                        "conn_closing",
                                        "conn_mwrite",
                                        "conn_pause",
-                                       "conn_connecting" };
+                                       "conn_connecting",
+                                       "conn_authing" };
     return statenames[state];
 }
 
@@ -870,9 +894,9 @@ void complete_nread_ascii(conn *c) {
     int comm = c->cmd;
     enum store_item_type ret;
 
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 
     if (strncmp(ITEM_data(it) + it->nbytes - 2, "\r\n", 2) != 0) {
         out_string(c, "CLIENT_ERROR bad data chunk");
@@ -1181,13 +1205,13 @@ static void complete_incr_bin(conn *c) {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS, 0);
     } else {
 
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         if (c->cmd == PROTOCOL_BINARY_CMD_INCREMENT) {
             c->thread->stats.incr_misses++;
         } else {
             c->thread->stats.decr_misses++;
         }
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0);
     }
@@ -1200,9 +1224,9 @@ static void complete_update_bin(conn *c) {
 
     item *it = c->item;
 
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     c->thread->stats.slab_stats[it->slabs_clsid].set_cmds++;
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 
     /* We don't actually receive the trailing two characters in the bin
      * protocol, so we're going to just set them here */
@@ -1285,10 +1309,10 @@ static void process_bin_get(conn *c) {
         uint16_t keylen = 0;
         uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
 
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.get_cmds++;
         c->thread->stats.slab_stats[it->slabs_clsid].get_hits++;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
                               it->nbytes, ITEM_get_cas(it));
@@ -1316,10 +1340,10 @@ static void process_bin_get(conn *c) {
         /* Remember this command so we can garbage collect it later */
         c->item = it;
     } else {
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.get_cmds++;
         c->thread->stats.get_misses++;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
 
@@ -1921,9 +1945,9 @@ static void process_bin_flush(conn *c) {
     }
     item_flush_expired();
 
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     c->thread->stats.flush_cmds++;
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 
     write_bin_response(c, NULL, 0, 0, 0);
 }
@@ -2049,24 +2073,24 @@ enum store_item_type do_store_item(item *it, int comm, conn *c) {
         if(old_it == NULL) {
             /* LRU expired */
             stored = NOT_FOUND;
-            cb_mutex_enter(&c->thread->stats.mutex);
+            THREAD_STATS_BEGIN(&c->thread->stats);
             c->thread->stats.cas_misses++;
-            cb_mutex_exit(&c->thread->stats.mutex);
+            THREAD_STATS_END(&c->thread->stats);
         }
         else if (ITEM_get_cas(it) == ITEM_get_cas(old_it)) {
             /* cas validates */
             /* it and old_it may belong to different classes. */
             /* I'm updating the stats for the one that's getting pushed out */
-            cb_mutex_enter(&c->thread->stats.mutex);
+            THREAD_STATS_BEGIN(&c->thread->stats);
             c->thread->stats.slab_stats[old_it->slabs_clsid].cas_hits++;
-            cb_mutex_exit(&c->thread->stats.mutex);
+            THREAD_STATS_END(&c->thread->stats);
 
             item_replace(old_it, it);
             stored = STORED;
         } else {
-            cb_mutex_enter(&c->thread->stats.mutex);
+            THREAD_STATS_BEGIN(&c->thread->stats);
             c->thread->stats.slab_stats[old_it->slabs_clsid].cas_badval++;
-            cb_mutex_exit(&c->thread->stats.mutex);
+            THREAD_STATS_END(&c->thread->stats);
 
             if(settings.verbose > 1) {
                 moxi_log_write("CAS:  failure: expected %llu, got %llu\n",
@@ -2505,13 +2529,13 @@ static void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool r
             nkey = key_token->length;
 
             if(nkey > KEY_MAX_LENGTH) {
-                cb_mutex_enter(&c->thread->stats.mutex);
+                THREAD_STATS_BEGIN(&c->thread->stats);
                 c->thread->stats.get_cmds   += stats_get_cmds;
                 c->thread->stats.get_misses += stats_get_misses;
                 for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
                     c->thread->stats.slab_stats[sid].get_hits += stats_get_hits[sid];
                 }
-                cb_mutex_exit(&c->thread->stats.mutex);
+                THREAD_STATS_END(&c->thread->stats);
                 out_string(c, "CLIENT_ERROR bad command line format");
                 return;
             }
@@ -2560,13 +2584,13 @@ static void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool r
 
                   suffix = cache_alloc(c->thread->suffix_cache);
                   if (suffix == NULL) {
-                    cb_mutex_enter(&c->thread->stats.mutex);
+                    THREAD_STATS_BEGIN(&c->thread->stats);
                     c->thread->stats.get_cmds   += stats_get_cmds;
                     c->thread->stats.get_misses += stats_get_misses;
                     for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
                         c->thread->stats.slab_stats[sid].get_hits += stats_get_hits[sid];
                     }
-                    cb_mutex_exit(&c->thread->stats.mutex);
+                    THREAD_STATS_END(&c->thread->stats);
                     out_string(c, "SERVER_ERROR out of memory making CAS suffix");
                     item_remove(it);
                     return;
@@ -2652,13 +2676,13 @@ static void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool r
         c->msgcurr = 0;
     }
 
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     c->thread->stats.get_cmds   += stats_get_cmds;
     c->thread->stats.get_misses += stats_get_misses;
     for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
         c->thread->stats.slab_stats[sid].get_hits += stats_get_hits[sid];
     }
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 
     return;
 }
@@ -2771,13 +2795,13 @@ static void process_arithmetic_command(conn *c, token_t *tokens, const size_t nt
 
     it = item_get(key, nkey);
     if (!it) {
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         if (incr) {
             c->thread->stats.incr_misses++;
         } else {
             c->thread->stats.decr_misses++;
         }
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         out_string(c, "NOT_FOUND");
         return;
@@ -2832,13 +2856,13 @@ enum delta_result_type do_add_delta(conn *c, item *it, const bool incr,
         MEMCACHED_COMMAND_DECR(c->sfd, ITEM_key(it), it->nkey, value);
     }
 
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     if (incr) {
         c->thread->stats.slab_stats[it->slabs_clsid].incr_hits++;
     } else {
         c->thread->stats.slab_stats[it->slabs_clsid].decr_hits++;
     }
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 
     snprintf(buf, INCR_MAX_STORAGE_LEN, "%llu", (unsigned long long)value);
     res = (int)strlen(buf);
@@ -2889,17 +2913,17 @@ static void process_delete_command(conn *c, token_t *tokens, const size_t ntoken
     if (it) {
         MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
 
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.slab_stats[it->slabs_clsid].delete_hits++;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         item_unlink(it);
         item_remove(it);      /* release our reference */
         out_string(c, "DELETED");
     } else {
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.delete_misses++;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         out_string(c, "NOT_FOUND");
     }
@@ -2998,9 +3022,9 @@ void process_command(conn *c, char *command) {
 
         set_noreply_maybe(c, tokens, ntokens);
 
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.flush_cmds++;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         if(ntokens == (c->noreply ? 3 : 2)) {
             settings.oldest_live = current_time - 1;
@@ -3250,10 +3274,17 @@ int try_read_command(conn *c) {
 
         cb_assert(cont <= (c->rcurr + c->rbytes));
 
+        /* The command might also consume the lines after it. */
+
+        c->rcont = cont;
+
         c->funcs->conn_process_ascii_command(c, c->rcurr);
 
-        c->rbytes -= (int)(cont - c->rcurr);
-        c->rcurr = cont;
+        cb_assert(c->rcont >= cont);
+        cb_assert(c->rcont <= (c->rcurr + c->rbytes));
+
+        c->rbytes -= (int)(c->rcont - c->rcurr);
+        c->rcurr = c->rcont;
 
         cb_assert(c->rcurr <= (c->rbuf + c->rsize));
     }
@@ -3275,9 +3306,9 @@ static enum try_read_result try_read_udp(conn *c) {
     if (res > 8) {
         unsigned char *buf = (unsigned char *)c->rbuf;
 
-        cb_mutex_enter(&c->thread->stats.mutex);
+        THREAD_STATS_BEGIN(&c->thread->stats);
         c->thread->stats.bytes_read += res;
-        cb_mutex_exit(&c->thread->stats.mutex);
+        THREAD_STATS_END(&c->thread->stats);
 
         add_bytes_read(c, res);
 
@@ -3314,6 +3345,22 @@ static enum try_read_result try_read_network(conn *c) {
 
     cb_assert(c != NULL);
 
+#ifdef HAVE_IO_URING
+    if (c->uring_read_done) {
+        /* The result of the recv that went through io_uring, whose */
+        /* bytes are already in rbytes, see conn_uring_complete(). */
+        c->uring_read_done = false;
+        res = c->uring_read_res;
+        if (res > 0) {
+            return READ_DATA_RECEIVED;
+        }
+        if (res < 0 && is_blocking(-res)) {
+            return READ_NO_DATA_RECEIVED;
+        }
+        return READ_ERROR;
+    }
+#endif
+
     if (c->rcurr != c->rbuf) {
         if (c->rbytes != 0) /* otherwise there's nothing to copy */
             memmove(c->rbuf, c->rcurr, c->rbytes);
@@ -3339,15 +3386,15 @@ static enum try_read_result try_read_network(conn *c) {
         cb_assert(avail > 0);
         res = recv(c->sfd, c->rbuf + c->rbytes, avail, 0);
         if (res > 0) {
-            cb_mutex_enter(&c->thread->stats.mutex);
+            THREAD_STATS_BEGIN(&c->thread->stats);
             c->thread->stats.bytes_read += res;
-            cb_mutex_exit(&c->thread->stats.mutex);
+            THREAD_STATS_END(&c->thread->stats);
 
             add_bytes_read(c, res);
 
             gotdata = READ_DATA_RECEIVED;
             c->rbytes += res;
-            if (res == avail) {
+            if (res == avail && c->rbuf_capped == false) {
                 continue;
             } else {
                 break;
@@ -3433,6 +3480,140 @@ void do_accept_new_conns(const bool do_accept) {
  *   TRANSMIT_SOFT_ERROR Can't write any more right now.
  *   TRANSMIT_HARD_ERROR Can't write (c->state is set to conn_closing)
  */
+#ifdef HAVE_IO_URING
+/*
+ * Queues a recv into the conn's rbuf on its thread's io_uring, instead
+ * of waiting for the socket to be readable.  Downstream conns are left
+ * to libevent, as other conns' events drive them while they wait for
+ * replies.  Returns false when the conn should just wait.
+ */
+static bool conn_uring_recv(conn *c) {
+    if (c->thread == NULL ||
+        c->thread->uring == NULL ||
+        IS_UDP(c->transport) ||
+        IS_DOWNSTREAM(c->protocol)) {
+        return false;
+    }
+
+    /* Like try_read_network(), with the same rbuf handling. */
+
+    if (c->rcurr != c->rbuf) {
+        if (c->rbytes != 0) /* otherwise there's nothing to copy */
+            memmove(c->rbuf, c->rcurr, c->rbytes);
+        c->rcurr = c->rbuf;
+    }
+
+    if (c->rbytes >= c->rsize) {
+        char *new_rbuf = realloc(c->rbuf, c->rsize * 2);
+        if (!new_rbuf) {
+            return false;
+        }
+        c->rcurr = c->rbuf = new_rbuf;
+        c->rsize *= 2;
+    }
+
+    if (!update_event(c, 0) ||
+        !thread_uring_recv(c->thread, c, c->rbuf + c->rbytes,
+                           c->rsize - c->rbytes)) {
+        return false;
+    }
+
+    c->uring_reading = true;
+    return true;
+}
+
+/*
+ * Queues the sendmsg of transmit() on the conn's thread's io_uring.
+ * The msghdr and iovecs are copied, as the conn might grow its lists
+ * before the sendmsg gets submitted, but the data they point at stays
+ * put until the write is done.
+ */
+static bool conn_uring_sendmsg(conn *c, struct msghdr *m, int flags) {
+    if (c->thread == NULL ||
+        c->thread->uring == NULL) {
+        return false;
+    }
+
+    if ((int) m->msg_iovlen > c->uring_iovsize) {
+        int n = c->uring_iovsize > 0 ? c->uring_iovsize : IOV_LIST_INITIAL;
+        struct iovec *new_iov;
+
+        while (n < (int) m->msg_iovlen) {
+            n *= 2;
+        }
+
+        new_iov = realloc(c->uring_iov, sizeof(struct iovec) * n);
+        if (new_iov == NULL) {
+            return false;
+        }
+        c->uring_iov = new_iov;
+        c->uring_iovsize = n;
+    }
+
+    memcpy(c->uring_iov, m->msg_iov, sizeof(struct iovec) * m->msg_iovlen);
+    c->uring_msg = *m;
+    c->uring_msg.msg_iov = c->uring_iov;
+
+    if (!update_event(c, 0) ||
+        !thread_uring_sendmsg(c->thread, c, &c->uring_msg, flags)) {
+        return false;
+    }
+
+    c->uring_writing = true;
+    return true;
+}
+
+/*
+ * Called by the conn's thread when one of its io_uring ops completes,
+ * with the op's result or -errno.
+ */
+void conn_uring_complete(conn *c, int op, int res) {
+    cb_assert(c != NULL);
+
+    if (op == CONN_URING_READ) {
+        cb_assert(c->uring_reading);
+        c->uring_reading = false;
+
+        /* The bytes are in the rbuf already, so count them now, */
+        /* even if the conn was moved on from conn_read meanwhile. */
+
+        if (res > 0) {
+            THREAD_STATS_BEGIN(&c->thread->stats);
+            c->thread->stats.bytes_read += res;
+            THREAD_STATS_END(&c->thread->stats);
+
+            add_bytes_read(c, res);
+
+            c->rbytes += res;
+        }
+
+        c->uring_read_res  = res;
+        c->uring_read_done = c->state == conn_read;
+    } else {
+        cb_assert(c->uring_writing);
+        c->uring_writing = false;
+
+        /* Only a conn that's still writing wants the result. */
+
+        c->uring_write_res  = res;
+        c->uring_write_done = c->state == conn_mwrite ||
+                              c->state == conn_write;
+    }
+
+    if (c->uring_reading || c->uring_writing) {
+        return;
+    }
+
+    if (c->uring_closed) {
+        c->uring_closed = false;
+        conn_close(c);
+        return;
+    }
+
+    drive_machine(c);
+}
+#endif
+
 static enum transmit_result transmit(conn *c) {
     cb_assert(c != NULL);
 
@@ -3444,22 +3625,46 @@ static enum transmit_result transmit(conn *c) {
     if (c->msgcurr < c->msgused) {
         ssize_t res;
         struct msghdr *m = &c->msglist[c->msgcurr];
+        int flags = 0;
 #ifdef WIN32
         DWORD error;
 #else
         int error;
 #endif
 
-        res = sendmsg(c->sfd, m, 0);
+#ifdef MSG_MORE
+        /* When a write spans several msghdr's, such as a batch of */
+        /* coalesced requests, let the kernel fill whole packets */
+        /* until the last msghdr. */
+        if (c->msgcurr + 1 < c->msgused && !IS_UDP(c->transport)) {
+            flags = MSG_MORE;
+        }
+#endif
+
+#ifdef HAVE_IO_URING
+        if (c->uring_write_done) {
+            /* The result of the sendmsg that went through io_uring. */
+            c->uring_write_done = false;
+            res = c->uring_write_res < 0 ? -1 : c->uring_write_res;
+            error = c->uring_write_res < 0 ? -c->uring_write_res : 0;
+        } else if (!IS_UDP(c->transport) &&
+                   conn_uring_sendmsg(c, m, flags)) {
+            /* The completion drives the conn again. */
+            return TRANSMIT_SOFT_ERROR;
+        } else
+#endif
+        {
+            res = sendmsg(c->sfd, m, flags);
 #ifdef WIN32
-        error = WSAGetLastError();
+            error = WSAGetLastError();
 #else
-        error = errno;
+            error = errno;
 #endif
+        }
         if (res > 0) {
-            cb_mutex_enter(&c->thread->stats.mutex);
+            THREAD_STATS_BEGIN(&c->thread->stats);
             c->thread->stats.bytes_written += res;
-            cb_mutex_exit(&c->thread->stats.mutex);
+            THREAD_STATS_END(&c->thread->stats);
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -3519,6 +3724,26 @@ void drive_machine(conn *c) {
 
     cb_assert(c != NULL);
 
+#ifdef HAVE_IO_URING
+    if (c->uring_reading || c->uring_writing) {
+        /* The kernel still points at the conn's buffers, so wait for */
+        /* the in-flight ops, whose completions drive the conn again. */
+        /* A close does its cleanup now, and shuts down the socket so */
+        /* that the ops finish, but keeps the conn until then. */
+        update_event(c, 0);
+
+        if (c->state == conn_closing && !c->uring_closed) {
+            c->uring_closed = true;
+
+            if (c->funcs->conn_close != NULL)
+                c->funcs->conn_close(c);
+
+            shutdown(c->sfd, SHUT_RDWR);
+        }
+        return;
+    }
+#endif
+
     while (!stop) {
         if (settings.verbose > 2) {
             moxi_log_write("%d: drive_machine %s\n",
@@ -3527,6 +3752,14 @@ void drive_machine(conn *c) {
 
         switch(c->state) {
         case conn_listening:
+            if (c->ev_flags == 0 &&
+                !update_event(c, EV_READ | EV_PERSIST)) {
+                /* A worker's listener that was backing off, below. */
+                moxi_log_write("Couldn't update listener event\n");
+                stop = true;
+                break;
+            }
+
             addrlen = sizeof(addr);
             if ((sfd = accept(c->sfd, (struct sockaddr *)&addr, &addrlen)) == INVALID_SOCKET) {
 #ifdef WIN32
@@ -3540,7 +3773,15 @@ void drive_machine(conn *c) {
                 } else if (is_emfile(error)) {
                     if (settings.verbose > 0)
                         moxi_log_write("Too many open connections\n");
-                    accept_new_conns(false);
+                    if (is_listen_thread()) {
+                        accept_new_conns(false);
+                    } else {
+                        /* accept_new_conns() only covers the main */
+                        /* thread's listeners, so a worker's own */
+                        /* listener just backs off for a while. */
+                        struct timeval tv = { 0, 100000 };
+                        update_event_timed(c, 0, &tv);
+                    }
                     stop = true;
                 } else {
                     perror("accept()");
@@ -3554,11 +3795,31 @@ void drive_machine(conn *c) {
                 break;
             }
 
-            dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
-                              DATA_BUFFER_SIZE,
-                              c->protocol,
-                              tcp_transport,
-                              c->funcs, c->extra);
+            if (is_listen_thread()) {
+                dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                                  DATA_BUFFER_SIZE,
+                                  c->protocol,
+                                  tcp_transport,
+                                  c->funcs, c->extra);
+            } else {
+                /* A worker's SO_REUSEPORT listener keeps the new */
+                /* conn on its own thread, with no hand-off. */
+                conn *nc = conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
+                                    DATA_BUFFER_SIZE,
+                                    tcp_transport,
+                                    c->thread->base,
+                                    c->funcs, c->extra);
+                if (nc != NULL) {
+                    nc->protocol = c->protocol;
+                    nc->thread = c->thread;
+                } else {
+                    if (settings.verbose > 0) {
+                        moxi_log_write("Can't listen for events on fd %d\n",
+                                       sfd);
+                    }
+                    closesocket(sfd);
+                }
+            }
             stop = true;
             break;
 
@@ -3573,7 +3834,26 @@ void drive_machine(conn *c) {
             }
             break;
 
+        case conn_authing:
+            if (c->funcs->conn_auth != NULL) {
+                if (c->funcs->conn_auth(c) == true) {
+                    stop = true;
+                }
+            } else {
+                conn_set_state(c, conn_closing);
+                update_event(c, 0);
+            }
+            break;
+
         case conn_waiting:
+#ifdef HAVE_IO_URING
+            if (conn_uring_recv(c)) {
+                /* The recv's completion drives the conn again. */
+                conn_set_state(c, conn_read);
+                stop = true;
+                break;
+            }
+#endif
             if (!update_event(c, EV_READ | EV_PERSIST)) {
                 if (settings.verbose > 0)
                     moxi_log_write("Couldn't update event\n");
@@ -3620,9 +3900,9 @@ void drive_machine(conn *c) {
             if (IS_DOWNSTREAM(c->protocol) || nreqs >= 0) {
                 reset_cmd_handler(c);
             } else {
-                cb_mutex_enter(&c->thread->stats.mutex);
+                THREAD_STATS_BEGIN(&c->thread->stats);
                 c->thread->stats.conn_yields++;
-                cb_mutex_exit(&c->thread->stats.mutex);
+                THREAD_STATS_END(&c->thread->stats);
                 if (c->rbytes > 0) {
                     /* We have already read in data into the input buffer,
                        so libevent will most likely not signal read events
@@ -3732,9 +4012,9 @@ void drive_machine(conn *c) {
 #endif
 
             if (res > 0) {
-                cb_mutex_enter(&c->thread->stats.mutex);
+                THREAD_STATS_BEGIN(&c->thread->stats);
                 c->thread->stats.bytes_read += res;
-                cb_mutex_exit(&c->thread->stats.mutex);
+                THREAD_STATS_END(&c->thread->stats);
                 add_bytes_read(c, res);
                 c->sbytes -= res;
                 break;
@@ -3862,9 +4142,9 @@ void drive_machine(conn *c) {
 
 void add_bytes_read(conn *c, int bytes_read) {
     cb_assert(c != NULL);
-    cb_mutex_enter(&c->thread->stats.mutex);
+    THREAD_STATS_BEGIN(&c->thread->stats);
     c->thread->stats.bytes_read += bytes_read;
-    cb_mutex_exit(&c->thread->stats.mutex);
+    THREAD_STATS_END(&c->thread->stats);
 }
 
 static void event_handler(evutil_socket_t fd, short which, void *arg) {
@@ -4100,6 +4380,183 @@ int server_socket(int port, enum network_transport transport,
     return success == 0;
 }
 
+#ifdef SO_REUSEPORT
+/*
+ * Opens and binds a SO_REUSEPORT listener.  Returns INVALID_SOCKET on
+ * failure, with *addrinuse set when the address was already taken.
+ */
+static SOCKET new_socket_reuseport(struct addrinfo *ai, bool *addrinuse) {
+    SOCKET sfd;
+    struct linger ling = {0, 0};
+    int flags = 1;
+
+    *addrinuse = false;
+
+    if ((sfd = new_socket(ai)) == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+#ifdef IPV6_V6ONLY
+    if (ai->ai_family == AF_INET6 &&
+        setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY,
+                   (char *) &flags, sizeof(flags)) != 0) {
+        perror("setsockopt");
+        closesocket(sfd);
+        return INVALID_SOCKET;
+    }
+#endif
+
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT,
+                   (void *)&flags, sizeof(flags)) != 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        closesocket(sfd);
+        return INVALID_SOCKET;
+    }
+
+    setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    setsockopt(sfd, SOL_SOCKET, SO_LINGER, (void *)&ling, sizeof(ling));
+    setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, (void *)&flags, sizeof(flags));
+
+    if (bind(sfd, ai->ai_addr, ai->ai_addrlen) == SOCKET_ERROR ||
+        listen(sfd, settings.backlog) == SOCKET_ERROR) {
+#ifdef WIN32
+        DWORD error = WSAGetLastError();
+#else
+        int error = errno;
+#endif
+        if (is_addrinuse(error)) {
+            *addrinuse = true;
+        } else {
+            perror("bind() or listen()");
+        }
+        closesocket(sfd);
+        return INVALID_SOCKET;
+    }
+
+    return sfd;
+}
+#endif
+
+/*
+ * Opens a SO_REUSEPORT listener on the TCP port for each worker thread,
+ * for each bindable host address, and hands each listener to its worker
+ * thread, which then accepts on it directly.  Like server_socket(), an
+ * address that's already in use is skipped.  Listeners are only handed
+ * out once every worker has one for every other address, so that no
+ * worker is left without one.
+ *
+ * Returns the number of listeners, which is 0 when SO_REUSEPORT isn't
+ * available or the port can't be bound, after closing any listeners
+ * already opened, so the caller can fall back to server_socket().
+ */
+int server_socket_reuseport(int port, enum protocol prot,
+                            conn_funcs *funcs, void *extra) {
+#ifdef SO_REUSEPORT
+    SOCKET *sfds;
+    struct addrinfo *ai;
+    struct addrinfo *next;
+    struct addrinfo hints = { .ai_flags = AI_PASSIVE,
+                              .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    char port_buf[NI_MAXSERV];
+    int error;
+    int listening = 0;
+    int naddrs = 0;
+    int i;
+
+    if (settings.num_threads <= 1) {
+        return 0;
+    }
+
+    snprintf(port_buf, sizeof(port_buf), "%d", port);
+    error = getaddrinfo(settings.inter, port_buf, &hints, &ai);
+    if (error != 0) {
+        if (error != EAI_SYSTEM)
+            moxi_log_write("getaddrinfo(): %s\n", gai_strerror(error));
+        else
+            perror("getaddrinfo()");
+        return 0;
+    }
+
+    for (next = ai; next; next = next->ai_next) {
+        naddrs++;
+    }
+
+    /* The listeners of each address, one per worker thread, */
+    /* in tid order. */
+
+    sfds = calloc(naddrs * (settings.num_threads - 1), sizeof(SOCKET));
+    if (sfds == NULL) {
+        freeaddrinfo(ai);
+        return 0;
+    }
+
+    for (next = ai; next; next = next->ai_next) {
+        int opened = 0;
+        int tid;
+
+        for (tid = 1; tid < settings.num_threads; tid++) {
+            char host[NI_MAXHOST];
+            bool addrinuse;
+            SOCKET sfd = new_socket_reuseport(next, &addrinuse);
+
+            if (sfd == INVALID_SOCKET) {
+                if (addrinuse && opened == 0) {
+                    break; /* Skipped, as with server_socket(). */
+                }
+
+                if (getnameinfo(next->ai_addr, next->ai_addrlen,
+                                host, sizeof(host), NULL, 0,
+                                NI_NUMERICHOST) != 0) {
+                    strcpy(host, "?");
+                }
+
+                moxi_log_write("could not open SO_REUSEPORT listener"
+                               " %d of %d on %s port %d\n",
+                               tid, settings.num_threads - 1, host, port);
+
+                for (i = 0; i < listening + opened; i++) {
+                    closesocket(sfds[i]);
+                }
+
+                free(sfds);
+                freeaddrinfo(ai);
+
+                return 0;
+            }
+
+            sfds[listening + opened] = sfd;
+            opened++;
+        }
+
+        listening += opened;
+    }
+
+    freeaddrinfo(ai);
+
+    for (i = 0; i < listening; i++) {
+        dispatch_conn_new_to_thread(1 + i % (settings.num_threads - 1),
+                                    sfds[i], conn_listening,
+                                    EV_READ | EV_PERSIST, 1,
+                                    prot, tcp_transport,
+                                    funcs, extra);
+    }
+
+    free(sfds);
+
+    return listening;
+#else
+    (void)port;
+    (void)prot;
+    (void)funcs;
+    (void)extra;
+
+    return 0;
+#endif
+}
+
 static SOCKET new_socket_unix(void) {
     SOCKET sfd;
 
@@ -4352,18 +4809,111 @@ static void usage(char **argv) {
     printf("      Millisecs before moxi will timeout a SASL auth attempt.\n"
            "      0 means no timeout.\n");
     printf("  connect_max_errors=%d\n", b->connect_max_errors);
-    printf("      Max number of errors per host:port:bucket per worker thread\n"
-           "      before moxi blacklists an unresponsive host:port:bucket.\n"
-           "      0 means blacklisting is disabled.\n");
+    printf("      Max number of consecutive errors per host:port:bucket, across\n"
+           "      all worker threads, before moxi blacklists an unresponsive\n"
+           "      host:port:bucket.  0 means blacklisting is disabled.\n");
     printf("  connect_retry_interval=%d\n", b->connect_retry_interval);
     printf("      Millisecs that a host:port:bucket will be blacklisted\n"
            "      before moxi tries again to contact the host:port:bucket.\n"
            "      0 means blacklisting is disabled.\n");
+    printf("  connect_retry_interval_max=%d\n", b->connect_retry_interval_max);
+    printf("      Max millisecs that a host:port:bucket will be blacklisted,\n"
+           "      as each failed retry doubles the blacklist time, starting\n"
+           "      from connect_retry_interval.  When not above\n"
+           "      connect_retry_interval, which is the default, the blacklist\n"
+           "      time stays at connect_retry_interval.\n");
     printf("  downstream_conn_max=%d\n", b->downstream_conn_max);
     printf("      Max number of downstream conns moxi will open per worker thread\n"
            "      to a host:port:bucket.  If downstream_conn_max is reached,\n"
            "      requests go onto the tail of a downstream conn queue.\n"
            "      0 means no limit.\n");
+    printf("  downstream_conn_multiplex=%d\n", b->downstream_conn_multiplex);
+    printf("      Max number of in-flight requests that moxi will pipeline\n"
+           "      onto one shared binary downstream conn, tagging each request\n"
+           "      with its own opaque.  Only applies to binary clients talking\n"
+           "      to binary downstreams.  0 means downstream conns are used\n"
+           "      exclusively by one request at a time.\n");
+    printf("  downstream_conn_coalesce=%d\n", b->downstream_conn_coalesce);
+    printf("      When 1, the requests that are queued onto a shared (multiplexed)\n"
+           "      downstream conn during one event loop iteration are written out\n"
+           "      together, so that many small requests bound for the same server\n"
+           "      cost one writev instead of one each.  Needs downstream_conn_multiplex.\n");
+    printf("  downstream_conn_prewarm=%d\n", b->downstream_conn_prewarm);
+    printf("      Number of downstream conns per server per worker thread\n"
+           "      that moxi opens and authenticates in the background when\n"
+           "      a config arrives, ahead of traffic.  0 means downstream\n"
+           "      conns are only opened on demand.\n");
+    printf("  downstream_conn_probe_interval=%d\n", b->downstream_conn_probe_interval);
+    printf("      Millisecs that a pooled downstream conn may sit idle before\n"
+           "      moxi health checks it with a NOOP (or version, for ascii),\n"
+           "      closing it if the server does not answer within the same\n"
+           "      interval.  0 means idle downstream conns are not probed.\n");
+    printf("  downstream_conn_idle_max=%d\n", b->downstream_conn_idle_max);
+    printf("      Max millisecs that a downstream conn may sit idle in the\n"
+           "      conn pool before moxi closes it.  0 means unlimited.\n");
+    printf("  hedge_get_percentile=%d\n", b->hedge_get_percentile);
+    printf("      Percentile (1 to 99) of recent binary GET latencies after which\n"
+           "      a binary GET that the vbucket master has not yet answered is\n"
+           "      also sent to the first vbucket replica, with whichever answers\n"
+           "      first going to the client.  0 means GETs are never hedged.\n");
+    printf("  coalesce_get=%d\n", b->coalesce_get);
+    printf("      When 1, an ascii get of a single key that another client\n"
+           "      on the same worker thread is already fetching waits for, and\n"
+           "      shares, that in-flight response instead of being sent again.\n"
+           "      0 means every get is sent downstream.\n");
+    printf("  stream_min_bytes=%d\n", b->stream_min_bytes);
+    printf("      Ascii get values of at least this many bytes are relayed\n"
+           "      upstream in chunks as they arrive, instead of being read\n"
+           "      in whole first.  Use 0 to disable.\n");
+    printf("  stream_splice=%d\n", b->stream_splice);
+    printf("      When 1, and built with splice() support, streamed values\n"
+           "      move from the downstream socket to the upstream socket\n"
+           "      through a pipe, without being copied into moxi.\n");
+    printf("  pipeline_max=%d\n", b->pipeline_max);
+    printf("      Max number of get's, pipelined by an ascii client, that\n"
+           "      are parsed ahead and forwarded together, with their\n"
+           "      responses still written in order.  Use 1 to disable.\n");
+    printf("  listen_reuseport=%d\n", b->listen_reuseport);
+    printf("      When 1, each worker thread opens its own SO_REUSEPORT listener\n"
+           "      on the proxy port and accepts directly, with the kernel spreading\n"
+           "      new conns across the threads, instead of the main thread accepting\n"
+           "      and handing each conn to a worker.  Where SO_REUSEPORT is not\n"
+           "      available, the main thread listens as usual.\n");
+    printf("  stats_snapshot_interval=%d\n", b->stats_snapshot_interval);
+    printf("      Millisecs between each worker thread publishing a snapshot of its\n"
+           "      proxy stats, key stats and timing histograms, which stats requests\n"
+           "      then merge without waiting on the workers.  Those stats can be up to\n"
+           "      an interval old, and stay empty until a worker first sees a request.\n"
+           "      The default of 0 asks every worker for its current stats instead.\n");
+    printf("  front_cache_shards=%d\n", b->front_cache_shards);
+    printf("      Number of segments, each with its own lock and LRU list, that\n"
+           "      the front cache of a proxy is split into by key hash, so that\n"
+           "      worker threads do not all contend on one front cache lock.\n"
+           "      front_cache_max is divided across the segments.\n");
+    printf("  front_cache_grace=%d\n", b->front_cache_grace);
+    printf("      Millisecs past front_cache_lifespan that a front cached item\n"
+           "      is still served, while the first request to see it stale\n"
+           "      fetches a fresh copy from the downstream servers.  0 means\n"
+           "      items are dropped at the end of their lifespan.\n");
+    printf("  front_cache_max_bytes=%"PRIu64"\n", b->front_cache_max_bytes);
+    printf("      Max bytes of values that the front cache of a proxy keeps,\n"
+           "      in addition to the front_cache_max limit on the number of\n"
+           "      items, evicting the least recently used items to make room.\n"
+           "      0 means no byte limit.\n");
+    printf("  front_cache_max_item_bytes=%d\n", b->front_cache_max_item_bytes);
+    printf("      Values larger than this many bytes are not front cached.\n"
+           "      0 means no limit.\n");
+    printf("  front_cache_admission=%d\n", b->front_cache_admission);
+    printf("      When 1, a full front cache only admits a new item if a sketch of\n"
+           "      recent key accesses estimates that it is more frequently read\n"
+           "      than the least recently used item it would evict, so that a\n"
+           "      burst of one-off keys does not flush out the hot keys.\n");
+    printf("  front_cache_miss_lifespan=%d\n", b->front_cache_miss_lifespan);
+    printf("      Millisecs that a get miss on a key matching front_cache_miss_spec\n"
+           "      is remembered in the front cache, so that repeated gets of a\n"
+           "      missing key are answered without asking the downstream servers.\n"
+           "      A set, add or delete of the key through moxi forgets the miss.\n"
+           "      0 means misses are not remembered.\n");
     printf("  downstream_conn_queue_timeout=%ld\n",
            b->downstream_conn_queue_timeout.tv_sec * 1000 +
            b->downstream_conn_queue_timeout.tv_usec / 1000);
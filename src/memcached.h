@@ -16,6 +16,7 @@
 
 #include "work.h"
 #include "genhash.h"
+#include "uring.h"
 
 #include "protocol_binary.h"
 #include "cache.h"
@@ -155,6 +156,7 @@ enum conn_states {
     conn_mwrite,     /**< writing out many items sequentially */
     conn_pause,      /**< waiting for asynchronous event */
     conn_connecting, /**< the socket is in connecting state*/
+    conn_authing,    /**< the socket is doing a sasl auth/bucket handshake */
     conn_max_state   /**< Max state value (used for assertion) */
 };
 
@@ -234,10 +236,12 @@ struct slab_stats {
 };
 
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread.  Only the owning thread writes them, without
+ * a lock, bracketed by THREAD_STATS_BEGIN/END.  Other threads read them
+ * like a seqlock, retrying their copy if seq was odd or changed.
  */
 struct thread_stats {
-    cb_mutex_t        mutex;
+    volatile unsigned int seq;
     uint64_t          get_cmds;
     uint64_t          get_misses;
     uint64_t          delete_misses;
@@ -251,6 +255,18 @@ struct thread_stats {
     struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
 };
 
+#ifdef WIN32
+#define THREAD_STATS_BARRIER() MemoryBarrier()
+#else
+#define THREAD_STATS_BARRIER() __atomic_thread_fence(__ATOMIC_ACQ_REL)
+#endif
+
+#define THREAD_STATS_BEGIN(ts) \
+    do { (ts)->seq++; THREAD_STATS_BARRIER(); } while (0)
+
+#define THREAD_STATS_END(ts) \
+    do { THREAD_STATS_BARRIER(); (ts)->seq++; } while (0)
+
 /**
  * Global stats.
  */
@@ -322,6 +338,12 @@ extern struct settings settings;
 /* temp */
 #define ITEM_SLABBED 4
 
+/* A stale front cache item, which one request is refreshing. */
+#define ITEM_REFRESHING 8
+
+/* A front cache item that remembers a miss, instead of a value. */
+#define ITEM_MISS 16
+
 /**
  * Structure for storing items within memcached.
  */
@@ -352,17 +374,39 @@ struct bin_cmd {
     bin_cmd *next;
 };
 
+typedef struct pipeline_cmd pipeline_cmd;
+typedef struct pipeline pipeline;
+
+/* A get, pipelined by an ascii client, along with the responses */
+/* that are held back until the get's before it are answered. */
+
+struct pipeline_cmd {
+    char  *command;   /* Points into the conn's rbuf. */
+    item **items;     /* Each has 1 refcount. */
+    int   *cas_emits;
+    int    items_num;
+    int    items_max;
+};
+
+struct pipeline {
+    int          num; /* Including cmds[0], the conn's cmd_start. */
+    int          max;
+    pipeline_cmd cmds[];
+};
+
 typedef struct {
     cb_thread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
-    struct event notify_event;  /* listen event for notify pipe */
-    SOCKET notify_receive_fd;      /* receiving end of notify pipe */
-    SOCKET notify_send_fd;         /* sending end of notify pipe */
     struct thread_stats stats;  /* Stats generated by this thread */
-    struct conn_queue *new_conn_queue; /* queue of new connections to handle */
+    struct thread_stats stats_base; /* stats as of the last reset */
     cache_t *suffix_cache;      /* suffix cache */
-    work_queue *work_queue;
+    work_queue *work_queue;     /* new connections and other work to handle */
     genhash_t *conn_hash;       /* per thread connection hash, keyed by host_ident */
+#ifdef HAVE_IO_URING
+    uring *uring;               /* NULL when the thread doesn't use io_uring */
+    SOCKET uring_efd;           /* eventfd signaled on io_uring completions */
+    struct event uring_event;   /* listen event for uring_efd */
+#endif
 } LIBEVENT_THREAD;
 
 /**
@@ -376,6 +420,7 @@ struct conn_funcs {
     bool (*conn_init)(conn *c);
     void (*conn_close)(conn *c);
     bool (*conn_connect)(conn *c);
+    bool (*conn_auth)(conn *c);
     void (*conn_process_ascii_command)(conn *c, char *command);
     void (*conn_process_binary_command)(conn *c);
     void (*conn_complete_nread_ascii)(conn *c);
@@ -398,6 +443,7 @@ struct conn {
 
     char   *rbuf;   /** buffer to read commands into */
     char   *rcurr;  /** but if we parsed some already, this is where we stopped */
+    char   *rcont;  /** where the next command starts, once the current one is processed */
     int    rsize;   /** total allocated size of rbuf */
     int    rbytes;  /** how much data, starting from rcur, do we have unparsed */
 
@@ -488,13 +534,42 @@ struct conn {
     uint64_t  cmd_arrive_time;
 
     bin_cmd *corked;
+    bin_cmd *corked_tail;
+    int      corked_num;
+
+    void *stream; /* The downstream that's relaying a value to this */
+                  /* upstream conn, while it drains a chunk. */
+    bool rbuf_capped; /* When true, a read stops once the rbuf is full, */
+                      /* instead of growing it, so the rest of a value */
+                      /* can be spliced, see the stream_splice behavior. */
+
+    pipeline *pipeline; /* The get's parsed ahead of the current one. */
 
     char *host_ident; /* Uniquely identifies a memcached server, including */
                       /* address:port and possibly optional bucket/usr/pwd info. */
+    void *mux;        /* Non-NULL when this downstream conn is shared by */
+                      /* many downstreams, see downstream_conn_multiplex. */
+    uint64_t idle_time; /* msec_current_time of when this downstream conn */
+                        /* was last parked in its thread's conn pool. */
+    bool probing;       /* True while this pooled downstream conn waits, in */
+                        /* conn_authing, for a health check reply. */
     char *peer_host;    /* this and the following two paramters are used for mcmux */
     unsigned int peer_protocol;  /* compatiblity mode */
     int peer_port;
 
+#ifdef HAVE_IO_URING
+    bool uring_reading;    /* A recv into the rbuf is in flight. */
+    bool uring_writing;    /* A sendmsg is in flight. */
+    bool uring_read_done;  /* The recv completed with uring_read_res. */
+    bool uring_write_done; /* The sendmsg completed with uring_write_res. */
+    bool uring_closed;     /* The conn closed while ops were in flight. */
+    int  uring_read_res;
+    int  uring_write_res;
+    struct msghdr  uring_msg;  /* Copy of the in-flight sendmsg's msghdr */
+    struct iovec  *uring_iov;  /* and its iovecs, which the conn might */
+    int            uring_iovsize; /* realloc while the sendmsg waits. */
+#endif
+
     const char *update_diag;
 };
 
@@ -568,12 +643,25 @@ int server_socket(int port,
                   enum network_transport transport,
                   FILE *portnum_file);
 
+int server_socket_reuseport(int port, enum protocol prot,
+                            conn_funcs *funcs, void *extra);
+
 #ifdef HAVE_SYS_UN_H
 int server_socket_unix(const char *path, int access_mask);
 #endif
 
 void drive_machine(conn *c);
 
+#ifdef HAVE_IO_URING
+/* Which of a conn's io_uring ops completed, see conn_uring_complete(). */
+
+#define CONN_URING_READ  1
+#define CONN_URING_WRITE 2
+#define CONN_URING_OPS   3
+
+void conn_uring_complete(conn *c, int op, int res);
+#endif
+
 void write_bin_response(conn *c, void *d, int hlen, int keylen, int dlen);
 void write_bin_error(conn *c, protocol_binary_response_status err, int swallow);
 
@@ -596,6 +684,12 @@ void thread_init(int nthreads, struct event_base *main_base);
 int  thread_index(cb_thread_t thread_id);
 LIBEVENT_THREAD *thread_by_index(int i);
 
+#ifdef HAVE_IO_URING
+bool thread_uring_recv(LIBEVENT_THREAD *me, conn *c, void *buf, size_t len);
+bool thread_uring_sendmsg(LIBEVENT_THREAD *me, conn *c,
+                          struct msghdr *m, int flags);
+#endif
+
 int  dispatch_event_add(int thread, conn *c);
 
 void dispatch_conn_new(SOCKET sfd, enum conn_states init_state,
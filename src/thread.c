@@ -10,8 +10,19 @@
 #include <string.h>
 #include "log.h"
 
+#ifdef HAVE_IO_URING
+#include <sys/eventfd.h>
+#endif
+
 #define ITEMS_PER_ALLOC 64
 
+/* Submission queue size of each worker thread's io_uring. */
+#define URING_ENTRIES 256
+
+/* Most rounds of submitting and reaping per event loop iteration, */
+/* so that the io_uring conns don't starve the libevent ones. */
+#define URING_FLUSH_MAX 16
+
 extern struct hash_ops strhash_ops;
 extern struct hash_ops skeyhash_ops;
 
@@ -29,15 +40,6 @@ struct conn_queue_item {
     CQ_ITEM          *next;
 };
 
-/* A connection queue. */
-typedef struct conn_queue CQ;
-struct conn_queue {
-    CQ_ITEM *head;
-    CQ_ITEM *tail;
-    cb_mutex_t lock;
-    cb_cond_t  cond;
-};
-
 /* Lock for cache operations (item_*, assoc_*) */
 cb_mutex_t cache_lock;
 
@@ -47,13 +49,17 @@ cb_mutex_t conn_lock;
 /* Lock for global stats */
 static cb_mutex_t stats_lock;
 
+/* Serializes the readers of the threads' thread_stats, and guards */
+/* their stats_base.  The owning threads never take it. */
+static cb_mutex_t thread_stats_lock;
+
 /* Free list of CQ_ITEM structs */
 static CQ_ITEM *cqi_freelist;
 static cb_mutex_t cqi_freelist_lock;
 
 /*
- * Each libevent instance has a wakeup pipe, which other threads
- * can use to signal that they've put a new connection on its queue.
+ * Each libevent instance has a work queue, which other threads
+ * use to hand it new connections and other work.
  */
 static LIBEVENT_THREAD *threads;
 
@@ -65,54 +71,6 @@ static cb_mutex_t init_lock;
 static cb_cond_t init_cond;
 
 
-static void thread_libevent_process(evutil_socket_t fd, short which, void *arg);
-
-/*
- * Initializes a connection queue.
- */
-static void cq_init(CQ *cq) {
-    cb_mutex_initialize(&cq->lock);
-    cb_cond_initialize(&cq->cond);
-    cq->head = NULL;
-    cq->tail = NULL;
-}
-
-/*
- * Looks for an item on a connection queue, but doesn't block if there isn't
- * one.
- * Returns the item, or NULL if no item is available
- */
-static CQ_ITEM *cq_pop(CQ *cq) {
-    CQ_ITEM *cq_item;
-
-    cb_mutex_enter(&cq->lock);
-    cq_item = cq->head;
-    if (NULL != cq_item) {
-        cq->head = cq_item->next;
-        if (NULL == cq->head)
-            cq->tail = NULL;
-    }
-    cb_mutex_exit(&cq->lock);
-
-    return cq_item;
-}
-
-/*
- * Adds an item to a connection queue.
- */
-static void cq_push(CQ *cq, CQ_ITEM *cq_item) {
-    cq_item->next = NULL;
-
-    cb_mutex_enter(&cq->lock);
-    if (NULL == cq->tail)
-        cq->head = cq_item;
-    else
-        cq->tail->next = cq_item;
-    cq->tail = cq_item;
-    cb_cond_signal(&cq->cond);
-    cb_mutex_exit(&cq->lock);
-}
-
 /*
  * Returns a fresh connection queue item.
  */
@@ -203,33 +161,18 @@ static void setup_thread(LIBEVENT_THREAD *me) {
         }
     }
 
-    /* Listen for notifications from other threads */
-    event_set(&me->notify_event, me->notify_receive_fd,
-              EV_READ | EV_PERSIST, thread_libevent_process, me);
-    event_base_set(me->base, &me->notify_event);
-
-    if (event_add(&me->notify_event, 0) == -1) {
-        moxi_log_write("Can't monitor libevent notify pipe\n");
-        exit(1);
-    }
-
-    me->new_conn_queue = malloc(sizeof(struct conn_queue));
-    if (me->new_conn_queue == NULL) {
-        perror("Failed to allocate memory for connection queue");
-        exit(EXIT_FAILURE);
-    }
-    cq_init(me->new_conn_queue);
-
-    /* TODO: Merge new_conn_queue with work_queue. */
+    /* Other threads send new connections and other work here. */
 
     me->work_queue = calloc(1, sizeof(work_queue));
     if (me->work_queue == NULL) {
         perror("Failed to allocate memory for work queue");
         exit(EXIT_FAILURE);
     }
-    work_queue_init(me->work_queue, me->base);
+    if (!work_queue_init(me->work_queue, me->base)) {
+        moxi_log_write("Failed to create work queue\n");
+        exit(EXIT_FAILURE);
+    }
 
-    cb_mutex_initialize(&me->stats.mutex);
     me->suffix_cache = cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
                                     NULL, NULL);
     if (me->suffix_cache == NULL) {
@@ -245,6 +188,186 @@ static void setup_thread(LIBEVENT_THREAD *me) {
 }
 
 
+#ifdef HAVE_IO_URING
+static void thread_uring_wakeup(evutil_socket_t fd, short which, void *arg);
+
+/*
+ * Sets up a worker thread's io_uring, which carries the recv()s of
+ * the thread's upstream TCP conns and the sendmsg()s of its conns.
+ * Downstream reads stay on libevent, and no buffers are registered
+ * with the ring.  Completions are signaled on an eventfd, so the
+ * thread's libevent loop and drive_machine() stay in charge.  When the
+ * kernel doesn't support io_uring, the thread just uses recv() and
+ * sendmsg().
+ */
+static void thread_uring_init(LIBEVENT_THREAD *me) {
+    uring *r;
+
+    me->uring = NULL;
+    me->uring_efd = INVALID_SOCKET;
+
+    r = calloc(1, sizeof(uring));
+    if (r == NULL) {
+        return;
+    }
+
+    if (!uring_init(r, URING_ENTRIES)) {
+        if (settings.verbose > 0) {
+            moxi_log_write("io_uring not available, using recv/sendmsg\n");
+        }
+        free(r);
+        return;
+    }
+
+    me->uring_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (me->uring_efd != INVALID_SOCKET &&
+        uring_register_eventfd(r, me->uring_efd)) {
+        event_set(&me->uring_event, me->uring_efd,
+                  EV_READ | EV_PERSIST, thread_uring_wakeup, me);
+        event_base_set(me->base, &me->uring_event);
+
+        if (event_add(&me->uring_event, 0) == 0) {
+            me->uring = r;
+            return;
+        }
+    }
+
+    moxi_log_write("Can't monitor io_uring completions, using recv/sendmsg\n");
+
+    if (me->uring_efd != INVALID_SOCKET) {
+        close(me->uring_efd);
+        me->uring_efd = INVALID_SOCKET;
+    }
+    uring_exit(r);
+    free(r);
+}
+
+static struct io_uring_sqe *thread_uring_sqe(LIBEVENT_THREAD *me) {
+    struct io_uring_sqe *sqe;
+
+    if (me == NULL || me->uring == NULL) {
+        return NULL;
+    }
+
+    sqe = uring_get_sqe(me->uring);
+    if (sqe == NULL) {
+        /* The submission queue is full, so submit it early. */
+        uring_submit(me->uring);
+        sqe = uring_get_sqe(me->uring);
+    }
+
+    return sqe;
+}
+
+/*
+ * Queues a recv into buf for the conn.  Everything queued during one
+ * event loop iteration goes to the kernel together, see
+ * thread_uring_flush().  Returns false when the caller should just
+ * wait for the socket to be readable instead.
+ */
+bool thread_uring_recv(LIBEVENT_THREAD *me, conn *c, void *buf, size_t len) {
+    struct io_uring_sqe *sqe = thread_uring_sqe(me);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sfd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->user_data = (uint64_t) (uintptr_t) c | CONN_URING_READ;
+
+    return true;
+}
+
+/*
+ * Queues a sendmsg for the conn, like thread_uring_recv().  The msghdr
+ * must stay put until the sendmsg completes.
+ */
+bool thread_uring_sendmsg(LIBEVENT_THREAD *me, conn *c,
+                          struct msghdr *m, int flags) {
+    struct io_uring_sqe *sqe = thread_uring_sqe(me);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = c->sfd;
+    sqe->addr = (uint64_t) (uintptr_t) m;
+    sqe->len = 1;
+    sqe->msg_flags = flags | MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t) (uintptr_t) c | CONN_URING_WRITE;
+
+    return true;
+}
+
+static void thread_uring_wakeup(evutil_socket_t fd, short which, void *arg) {
+    eventfd_t count;
+
+    (void)which;
+    (void)arg;
+
+    /* The completions get reaped once the loop iteration is done. */
+
+    if (eventfd_read(fd, &count) != 0 && settings.verbose > 1) {
+        moxi_log_write("Can't read io_uring eventfd\n");
+    }
+}
+
+/*
+ * Submits the thread's queued ops with a single io_uring_enter(), and
+ * hands each completion back to its conn's drive_machine(), which might
+ * queue more ops.  Most sends, and recvs on sockets that already have
+ * data, complete during the submit, so those are reaped in rounds.
+ * Returns true when there's still work left for another round.
+ */
+static bool thread_uring_flush(LIBEVENT_THREAD *me) {
+    uring *r = me->uring;
+    struct io_uring_cqe *cqe;
+    bool reaped = false;
+    int i;
+    int rv;
+
+    for (i = 0; i < URING_FLUSH_MAX; i++) {
+        rv = uring_submit(r);
+        if (rv < 0 && rv != -EAGAIN && rv != -EBUSY &&
+            settings.verbose > 0) {
+            moxi_log_write("io_uring submit failed: %s\n", strerror(-rv));
+        }
+
+        cqe = uring_peek_cqe(r);
+        if (cqe == NULL) {
+            break;
+        }
+
+        while (cqe != NULL) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+
+            uring_cqe_seen(r);
+
+            conn_uring_complete((conn *) (uintptr_t) (data & ~(uint64_t) CONN_URING_OPS),
+                                (int) (data & CONN_URING_OPS), res);
+
+            cqe = uring_peek_cqe(r);
+        }
+
+        reaped = true;
+    }
+
+    if (reaped) {
+        eventfd_t count;
+
+        /* These completions were also signaled on the eventfd, */
+        /* which doesn't need another loop iteration to notice. */
+
+        eventfd_read(me->uring_efd, &count);
+    }
+
+    return r->sq_queued > 0 || uring_peek_cqe(r) != NULL;
+}
+#endif
+
 /*
  * Worker thread: main event loop
  */
@@ -260,40 +383,54 @@ static void worker_libevent(void *arg) {
         moxi_log_write("worker_libevent thread_id %ld\n", (long)me->thread_id);
 #endif
 
+#ifdef HAVE_IO_URING
+    thread_uring_init(me);
+#endif
+
     cb_mutex_enter(&init_lock);
     init_count++;
     cb_cond_signal(&init_cond);
     cb_mutex_exit(&init_lock);
 
+#ifdef HAVE_IO_URING
+    if (me->uring != NULL) {
+        int flags = EVLOOP_ONCE;
+
+        /* The ops queued during each loop iteration go to the kernel */
+        /* at its end, before the loop waits for events again. */
+
+        while (event_base_loop(me->base, flags) == 0) {
+            flags = EVLOOP_ONCE;
+            if (thread_uring_flush(me)) {
+                flags |= EVLOOP_NONBLOCK;
+            }
+        }
+        return;
+    }
+#endif
+
     event_base_loop(me->base, 0);
 }
 
 
 /*
- * Processes an incoming "handle a new connection" item. This is called when
- * input arrives on the libevent wakeup pipe.
+ * Processes an incoming "handle a new connection" item. This is called
+ * through the thread's work queue.
  */
-static void thread_libevent_process(evutil_socket_t fd, short which, void *arg) {
-    LIBEVENT_THREAD *me = arg;
-    CQ_ITEM *cq_item;
-    char buf[1];
-
-    (void)which;
-
-    if (recv(fd, buf, 1, 0) != 1) {
-        if (settings.verbose > 0) {
-            moxi_log_write("Can't read from libevent pipe\n");
-        }
-    }
-
-    cq_item = cq_pop(me->new_conn_queue);
+static void thread_conn_new(void *data0, void *data1) {
+    CQ_ITEM *cq_item = data0;
+    LIBEVENT_THREAD *me = data1;
 
     if (NULL != cq_item) {
+        /* Like in server_socket(), a listener doesn't conn_init(), */
+        /* so its funcs are only assigned afterwards. */
+        bool listener = cq_item->init_state == conn_listening;
         conn *c = conn_new(cq_item->sfd, cq_item->init_state, cq_item->event_flags,
                            cq_item->read_buffer_size,
                            cq_item->transport,
                            me->base,
-                           cq_item->funcs, cq_item->extra);
+                           listener ? NULL : cq_item->funcs,
+                           cq_item->extra);
         if (c == NULL) {
             if (IS_UDP(cq_item->transport)) {
                 moxi_log_write("Can't listen for events on UDP socket\n");
@@ -308,6 +445,9 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
         } else {
             c->protocol = cq_item->protocol;
             c->thread = me;
+            if (listener) {
+                c->funcs = cq_item->funcs;
+            }
         }
         cqi_free(cq_item);
     }
@@ -353,6 +493,11 @@ void dispatch_conn_new_to_thread(int tid, SOCKET sfd, enum conn_states init_stat
 
     thread = threads + tid;
     cq_item = cqi_new();
+    if (cq_item == NULL) {
+        moxi_log_write("Failed to allocate memory for connection queue item\n");
+        closesocket(sfd);
+        return;
+    }
 
     cq_item->sfd = sfd;
     cq_item->init_state = init_state;
@@ -363,11 +508,11 @@ void dispatch_conn_new_to_thread(int tid, SOCKET sfd, enum conn_states init_stat
     cq_item->funcs = funcs;
     cq_item->extra = extra;
 
-    cq_push(thread->new_conn_queue, cq_item);
-
     MEMCACHED_CONN_DISPATCH(sfd, thread->thread_id);
-    if (send(thread->notify_send_fd, "", 1, 0) != 1) {
-        perror("Writing to thread notify pipe");
+    if (!work_send(thread->work_queue, thread_conn_new, cq_item, thread)) {
+        moxi_log_write("Failed to dispatch new connection\n");
+        closesocket(sfd);
+        cqi_free(cq_item);
     }
 }
 
@@ -550,86 +695,98 @@ void STATS_UNLOCK() {
     cb_mutex_exit(&stats_lock);
 }
 
+/* Copies a thread's stats while its owning thread may be updating */
+/* them.  The owner only holds an odd seq for a few increments, but */
+/* the retries are bounded anyway, as slightly torn stats beat */
+/* spinning forever on a stuck seq. */
+
+static void threadlocal_stats_snapshot(LIBEVENT_THREAD *t,
+                                       struct thread_stats *out) {
+    unsigned int seq;
+    int tries = 0;
+
+    do {
+        seq = t->stats.seq;
+        THREAD_STATS_BARRIER();
+        memcpy(out, &t->stats, sizeof(struct thread_stats));
+        THREAD_STATS_BARRIER();
+    } while (((seq & 1) || seq != t->stats.seq) && ++tries < 1000);
+}
+
 void threadlocal_stats_reset(void) {
-    int ii, sid;
-    for (ii = 0; ii < settings.num_threads; ++ii) {
-        cb_mutex_enter(&threads[ii].stats.mutex);
-
-        threads[ii].stats.get_cmds = 0;
-        threads[ii].stats.get_misses = 0;
-        threads[ii].stats.delete_misses = 0;
-        threads[ii].stats.incr_misses = 0;
-        threads[ii].stats.decr_misses = 0;
-        threads[ii].stats.cas_misses = 0;
-        threads[ii].stats.bytes_read = 0;
-        threads[ii].stats.bytes_written = 0;
-        threads[ii].stats.flush_cmds = 0;
-        threads[ii].stats.conn_yields = 0;
-
-        for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            threads[ii].stats.slab_stats[sid].set_cmds = 0;
-            threads[ii].stats.slab_stats[sid].get_hits = 0;
-            threads[ii].stats.slab_stats[sid].delete_hits = 0;
-            threads[ii].stats.slab_stats[sid].incr_hits = 0;
-            threads[ii].stats.slab_stats[sid].decr_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_badval = 0;
-        }
+    int ii;
 
-        cb_mutex_exit(&threads[ii].stats.mutex);
+    /* Rather than zeroing counters that only their owning thread */
+    /* may write, remember where they were, for subtracting later. */
+
+    cb_mutex_enter(&thread_stats_lock);
+
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        threadlocal_stats_snapshot(&threads[ii], &threads[ii].stats_base);
     }
+
+    cb_mutex_exit(&thread_stats_lock);
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *thread_stats) {
+    struct thread_stats *cur;
+    struct thread_stats *base;
     int ii, sid;
-    /* The struct contains a mutex, so I should probably not memset it.. */
-    thread_stats->get_cmds = 0;
-    thread_stats->get_misses = 0;
-    thread_stats->delete_misses = 0;
-    thread_stats->incr_misses = 0;
-    thread_stats->decr_misses = 0;
-    thread_stats->cas_misses = 0;
-    thread_stats->bytes_written = 0;
-    thread_stats->bytes_read = 0;
-    thread_stats->flush_cmds = 0;
-    thread_stats->conn_yields = 0;
-
-    memset(thread_stats->slab_stats, 0,
-           sizeof(struct slab_stats) * MAX_NUMBER_OF_SLAB_CLASSES);
+
+    memset(thread_stats, 0, sizeof(struct thread_stats));
+
+    cur = malloc(sizeof(struct thread_stats));
+    if (cur == NULL) {
+        return;
+    }
+
+    cb_mutex_enter(&thread_stats_lock);
 
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        cb_mutex_enter(&threads[ii].stats.mutex);
-
-        thread_stats->get_cmds += threads[ii].stats.get_cmds;
-        thread_stats->get_misses += threads[ii].stats.get_misses;
-        thread_stats->delete_misses += threads[ii].stats.delete_misses;
-        thread_stats->decr_misses += threads[ii].stats.decr_misses;
-        thread_stats->incr_misses += threads[ii].stats.incr_misses;
-        thread_stats->cas_misses += threads[ii].stats.cas_misses;
-        thread_stats->bytes_read += threads[ii].stats.bytes_read;
-        thread_stats->bytes_written += threads[ii].stats.bytes_written;
-        thread_stats->flush_cmds += threads[ii].stats.flush_cmds;
-        thread_stats->conn_yields += threads[ii].stats.conn_yields;
+        threadlocal_stats_snapshot(&threads[ii], cur);
+        base = &threads[ii].stats_base;
+
+        thread_stats->get_cmds += cur->get_cmds - base->get_cmds;
+        thread_stats->get_misses += cur->get_misses - base->get_misses;
+        thread_stats->delete_misses +=
+            cur->delete_misses - base->delete_misses;
+        thread_stats->decr_misses += cur->decr_misses - base->decr_misses;
+        thread_stats->incr_misses += cur->incr_misses - base->incr_misses;
+        thread_stats->cas_misses += cur->cas_misses - base->cas_misses;
+        thread_stats->bytes_read += cur->bytes_read - base->bytes_read;
+        thread_stats->bytes_written +=
+            cur->bytes_written - base->bytes_written;
+        thread_stats->flush_cmds += cur->flush_cmds - base->flush_cmds;
+        thread_stats->conn_yields += cur->conn_yields - base->conn_yields;
 
         for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             thread_stats->slab_stats[sid].set_cmds +=
-                threads[ii].stats.slab_stats[sid].set_cmds;
+                cur->slab_stats[sid].set_cmds -
+                base->slab_stats[sid].set_cmds;
             thread_stats->slab_stats[sid].get_hits +=
-                threads[ii].stats.slab_stats[sid].get_hits;
+                cur->slab_stats[sid].get_hits -
+                base->slab_stats[sid].get_hits;
             thread_stats->slab_stats[sid].delete_hits +=
-                threads[ii].stats.slab_stats[sid].delete_hits;
+                cur->slab_stats[sid].delete_hits -
+                base->slab_stats[sid].delete_hits;
             thread_stats->slab_stats[sid].decr_hits +=
-                threads[ii].stats.slab_stats[sid].decr_hits;
+                cur->slab_stats[sid].decr_hits -
+                base->slab_stats[sid].decr_hits;
             thread_stats->slab_stats[sid].incr_hits +=
-                threads[ii].stats.slab_stats[sid].incr_hits;
+                cur->slab_stats[sid].incr_hits -
+                base->slab_stats[sid].incr_hits;
             thread_stats->slab_stats[sid].cas_hits +=
-                threads[ii].stats.slab_stats[sid].cas_hits;
+                cur->slab_stats[sid].cas_hits -
+                base->slab_stats[sid].cas_hits;
             thread_stats->slab_stats[sid].cas_badval +=
-                threads[ii].stats.slab_stats[sid].cas_badval;
+                cur->slab_stats[sid].cas_badval -
+                base->slab_stats[sid].cas_badval;
         }
-
-        cb_mutex_exit(&threads[ii].stats.mutex);
     }
+
+    cb_mutex_exit(&thread_stats_lock);
+
+    free(cur);
 }
 
 void slab_stats_aggregate(struct thread_stats *thread_stats, struct slab_stats *out) {
@@ -654,34 +811,6 @@ void slab_stats_aggregate(struct thread_stats *thread_stats, struct slab_stats *
     }
 }
 
-static bool create_notification_pipe(LIBEVENT_THREAD *me) {
-    int j;
-    SOCKET notify[2];
-    if (evutil_socketpair(SOCKETPAIR_AF, SOCK_STREAM, 0,
-        (void*)notify) == SOCKET_ERROR) {
-        moxi_log_write("Failed to create notification pipe");
-        return false;
-    }
-
-    for (j = 0; j < 2; ++j) {
-        int flags = 1;
-        setsockopt(notify[j], IPPROTO_TCP,
-                   TCP_NODELAY, (void *)&flags, sizeof(flags));
-        setsockopt(notify[j], SOL_SOCKET,
-                   SO_REUSEADDR, (void *)&flags, sizeof(flags));
-
-        if (evutil_make_socket_nonblocking(notify[j]) == -1) {
-            moxi_log_write("Failed to enable non-blocking");
-            return false;
-        }
-    }
-
-    me->notify_receive_fd = notify[0];
-    me->notify_send_fd = notify[1];
-
-    return true;
-}
-
 /*
  * Initializes the thread subsystem, creating various worker threads.
  *
@@ -693,6 +822,7 @@ void thread_init(int nthreads, struct event_base *main_base) {
 
     cb_mutex_initialize(&cache_lock);
     cb_mutex_initialize(&stats_lock);
+    cb_mutex_initialize(&thread_stats_lock);
 
     cb_mutex_initialize(&init_lock);
     cb_cond_initialize(&init_cond);
@@ -710,10 +840,6 @@ void thread_init(int nthreads, struct event_base *main_base) {
     threads[0].thread_id = cb_thread_self();
 
     for (i = 0; i < nthreads; i++) {
-        if (!create_notification_pipe(&threads[i])) {
-            exit(1);
-        }
-
         setup_thread(&threads[i]);
     }
 
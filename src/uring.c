@@ -0,0 +1,189 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "src/config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit,
+                       unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit,
+                         min_complete, flags, NULL, 0);
+}
+
+static unsigned uring_load(unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void uring_store(unsigned *p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+bool uring_init(uring *r, unsigned entries) {
+    struct io_uring_params p;
+    char *sq;
+    char *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+
+    r->fd = uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        r->sq_ring = NULL;
+        uring_exit(r);
+        return false;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd,
+                          IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            r->cq_ring = NULL;
+            uring_exit(r);
+            return false;
+        }
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        uring_exit(r);
+        return false;
+    }
+
+    sq = r->sq_ring;
+    r->sq_head    = (unsigned *) (sq + p.sq_off.head);
+    r->sq_tail    = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask    = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array   = (unsigned *) (sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+
+    cq = r->cq_ring;
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return true;
+}
+
+void uring_exit(uring *r) {
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring != NULL) {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *r) {
+    unsigned tail = *r->sq_tail + r->sq_queued;
+    unsigned index;
+    struct io_uring_sqe *sqe;
+
+    if (tail - uring_load(r->sq_head) >= r->sq_entries) {
+        return NULL;
+    }
+
+    index = tail & *r->sq_mask;
+
+    sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    r->sq_array[index] = index;
+    r->sq_queued++;
+
+    return sqe;
+}
+
+int uring_submit(uring *r) {
+    unsigned n;
+    int rv;
+
+    /* Only the owning thread moves the tail, so a plain read of it */
+    /* is fine, but the kernel must see the sqe's before the tail. */
+
+    if (r->sq_queued > 0) {
+        uring_store(r->sq_tail, *r->sq_tail + r->sq_queued);
+        r->sq_queued = 0;
+    }
+
+    /* Includes any sqe's left over from an earlier failed submit. */
+
+    n = *r->sq_tail - uring_load(r->sq_head);
+    if (n == 0) {
+        return 0;
+    }
+
+    do {
+        rv = uring_enter(r->fd, n, 0, 0);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv < 0) {
+        return -errno;
+    }
+
+    return rv;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == uring_load(r->cq_tail)) {
+        return NULL;
+    }
+
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(uring *r) {
+    uring_store(r->cq_head, *r->cq_head + 1);
+}
+
+bool uring_register_eventfd(uring *r, int efd) {
+    return syscall(__NR_io_uring_register, r->fd,
+                   IORING_REGISTER_EVENTFD, &efd, 1) == 0;
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#ifndef URING_H
+#define URING_H
+
+#include "src/config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+/* Just enough of an io_uring, over the raw syscalls, for the worker */
+/* threads to batch their upstream reads and their socket writes, */
+/* without needing liburing.  A uring is only used by the thread */
+/* that owns it. */
+
+typedef struct uring uring;
+
+struct uring {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned  sq_entries;
+    unsigned  sq_queued; /* Number of sqe's not yet submitted. */
+
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+
+    struct io_uring_cqe *cqes;
+
+    void   *sq_ring;
+    size_t  sq_ring_size;
+    void   *cq_ring;
+    size_t  cq_ring_size;
+    size_t  sqes_size;
+};
+
+bool uring_init(uring *r, unsigned entries);
+void uring_exit(uring *r);
+
+/* Returns NULL when the submission queue is full.  The sqe comes */
+/* back zeroed, and is queued until the next uring_submit(). */
+
+struct io_uring_sqe *uring_get_sqe(uring *r);
+
+/* Returns the number of sqe's submitted, or -errno. */
+
+int uring_submit(uring *r);
+
+/* Returns NULL when there are no completions to reap.  Each */
+/* returned cqe must be followed by a uring_cqe_seen(). */
+
+struct io_uring_cqe *uring_peek_cqe(uring *r);
+void uring_cqe_seen(uring *r);
+
+/* The eventfd gets signaled on every completion. */
+
+bool uring_register_eventfd(uring *r, int efd);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* URING_H */
@@ -7,15 +7,84 @@
 #include <platform/cbassert.h>
 #include <unistd.h>
 #include <event.h>
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #include "work.h"
 #include "log.h"
 
 #undef WORK_DEBUG
 
 
+/* Atomics for the lock-free ring, which other modules use, too. */
+
+#if defined(__GNUC__)
+uint64_t work_atomic_load(uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void work_atomic_store(uint64_t *p, uint64_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+uint64_t work_atomic_add(uint64_t *p, int64_t v) {
+    return __atomic_fetch_add(p, v, __ATOMIC_RELAXED);
+}
+
+uint64_t work_atomic_exchange(uint64_t *p, uint64_t v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+bool work_atomic_cas(uint64_t *p, uint64_t *expected, uint64_t v) {
+    return __atomic_compare_exchange_n(p, expected, v, true,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#elif defined(WIN32)
+uint64_t work_atomic_load(uint64_t *p) {
+    return (uint64_t) InterlockedCompareExchange64((LONG64 volatile *) p,
+                                                   0, 0);
+}
+
+void work_atomic_store(uint64_t *p, uint64_t v) {
+    InterlockedExchange64((LONG64 volatile *) p, (LONG64) v);
+}
+
+uint64_t work_atomic_add(uint64_t *p, int64_t v) {
+    return (uint64_t) InterlockedExchangeAdd64((LONG64 volatile *) p, v);
+}
+
+uint64_t work_atomic_exchange(uint64_t *p, uint64_t v) {
+    return (uint64_t) InterlockedExchange64((LONG64 volatile *) p,
+                                            (LONG64) v);
+}
+
+bool work_atomic_cas(uint64_t *p, uint64_t *expected, uint64_t v) {
+    uint64_t prev = (uint64_t)
+        InterlockedCompareExchange64((LONG64 volatile *) p,
+                                     (LONG64) v, (LONG64) *expected);
+    if (prev == *expected) {
+        return true;
+    }
+    *expected = prev;
+    return false;
+}
+#else
+#error "work.c needs atomic operations for this compiler"
+#endif
+
 static bool create_notification_pipe(work_queue *me) {
     int j;
     SOCKET notify[2];
+
+#ifdef HAVE_EVENTFD
+    /* An eventfd is a counter, so a single one does for both ends. */
+
+    me->recv_fd = me->send_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (me->recv_fd != INVALID_SOCKET) {
+        return true;
+    }
+#endif
+
     if (evutil_socketpair(SOCKETPAIR_AF, SOCK_STREAM, 0,
         (void*)notify) == SOCKET_ERROR) {
         moxi_log_write("Failed to create notification pipe");
@@ -48,24 +117,46 @@ static bool create_notification_pipe(work_queue *me) {
  *  should be libevent-based, with a processing loop handled by
  *  libevent.
  *
+ *  Work is passed through a bounded ring of preallocated cells,
+ *  which many sending threads can fill without a lock.  The
+ *  receiving thread is woken up once for however many sends
+ *  happened since it last looked.
+ *
  *  Use work_queue_init() to initialize a work_queue structure,
  *  where the work_queue structure memory is owned by the caller.
  *
  *  Returns true on success.
  */
 bool work_queue_init(work_queue *m, struct event_base *event_base) {
+    uint64_t i;
+
     cb_assert(m != NULL);
 
     memset(m, 0, sizeof(work_queue));
 
     cb_mutex_initialize(&m->work_lock);
 
+    m->cells = calloc(WORK_QUEUE_CELLS, sizeof(work_cell));
+    if (m->cells == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < WORK_QUEUE_CELLS; i++) {
+        m->cells[i].seq = i;
+    }
+
+    m->enqueue_pos = 0;
+    m->dequeue_pos = 0;
+    m->notified = 0;
+
     m->work_head = NULL;
     m->work_tail = NULL;
+    m->work_overflow = 0;
 
     m->num_items = 0;
     m->tot_sends = 0;
     m->tot_recvs = 0;
+    m->tot_wakeups = 0;
 
     m->event_base = event_base;
     cb_assert(m->event_base != NULL);
@@ -80,13 +171,12 @@ bool work_queue_init(work_queue *m, struct event_base *event_base) {
 
     if (event_add(&m->event, 0) == 0) {
 #ifdef WORK_DEBUG
-            moxi_log_write("work_queue_init %x %x %x %d %d %u %llu\n",
+            moxi_log_write("work_queue_init %x %x %x %d %d %llu\n",
                     (int) pthread_self(),
                     (int) m,
                     (int) m->event_base,
                     m->send_fd,
                     m->recv_fd,
-                    m->work_head != NULL,
                     m->tot_sends);
 #endif
 
@@ -100,131 +190,240 @@ bool work_queue_init(work_queue *m, struct event_base *event_base) {
     return false;
 }
 
+/* Claims the next cell of the ring, returning false when the */
+/* ring is full.  This is Dmitry Vyukov's bounded queue, where */
+/* each cell's seq says whether it's free for the current lap. */
+
+static bool work_ring_push(work_queue *m, work_item *w) {
+    work_cell *cell;
+    uint64_t pos = work_atomic_load(&m->enqueue_pos);
+
+    for (;;) {
+        int64_t diff;
+
+        cell = &m->cells[pos & (WORK_QUEUE_CELLS - 1)];
+        diff = (int64_t) work_atomic_load(&cell->seq) - (int64_t) pos;
+        if (diff == 0) {
+            if (work_atomic_cas(&m->enqueue_pos, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; /* The ring is full. */
+        } else {
+            pos = work_atomic_load(&m->enqueue_pos);
+        }
+    }
+
+    cell->item = *w;
+
+    work_atomic_store(&cell->seq, pos + 1);
+
+    return true;
+}
+
+/* Only called by the receiving thread. */
+
+static bool work_ring_pop(work_queue *m, work_item *w) {
+    uint64_t pos = m->dequeue_pos;
+    work_cell *cell = &m->cells[pos & (WORK_QUEUE_CELLS - 1)];
+
+    if ((int64_t) work_atomic_load(&cell->seq) - (int64_t) (pos + 1) < 0) {
+        return false; /* The ring is empty, or the cell is still */
+                      /* being filled by its sender. */
+    }
+
+    *w = cell->item;
+
+    m->dequeue_pos = pos + 1;
+
+    work_atomic_store(&cell->seq, pos + WORK_QUEUE_CELLS);
+
+    return true;
+}
+
+/* Only the first send after the receiving thread has started */
+/* draining the queue actually signals the receiving thread.  A */
+/* failed signal re-allows signaling, so that the next send tries */
+/* again instead of the queue never being woken up. */
+
+static void work_wakeup(work_queue *m) {
+    bool ok;
+#ifdef HAVE_EVENTFD
+    uint64_t one = 1;
+#endif
+
+    if (work_atomic_exchange(&m->notified, 1) != 0) {
+        return;
+    }
+
+    work_atomic_add(&m->tot_wakeups, 1);
+
+#ifdef HAVE_EVENTFD
+    if (m->send_fd == m->recv_fd) {
+        ok = write(m->send_fd, &one, sizeof(one)) == sizeof(one);
+    } else
+#endif
+    {
+        ok = send(m->send_fd, "", 1, 0) == 1;
+    }
+
+    /* A full eventfd counter or socket buffer means that the */
+    /* receiving thread already has a wakeup to read. */
+
+    if (!ok && errno != EAGAIN && errno != EWOULDBLOCK) {
+        work_atomic_exchange(&m->notified, 0);
+
+        moxi_log_write("work_wakeup failed, errno %d\n", errno);
+    }
+}
+
 /** Use work_send() to place work on another thread's work queue.
  *  The receiving thread will invoke the given function with
  *  the given callback data.
  *
- *  Returns true on success.
+ *  Returns true once the work is queued, even if the wakeup failed,
+ *  as the receiving thread will still run it.  Returns false only
+ *  when the work was not queued, so the caller still owns the data.
  */
 bool work_send(work_queue *m,
                void (*func)(void *data0, void *data1),
                void *data0, void *data1) {
+    work_item w;
+    bool queued = false;
+
     cb_assert(m != NULL);
     cb_assert(m->recv_fd >= 0);
     cb_assert(m->send_fd >= 0);
     cb_assert(m->event_base != NULL);
     cb_assert(func != NULL);
 
-    bool rv = false;
+    w.func  = func;
+    w.data0 = data0;
+    w.data1 = data1;
+    w.next  = NULL;
 
-    /* TODO: Add a free-list of work_items. */
+    /* Once work has overflowed the ring, later work follows it */
+    /* onto the overflow list, to keep the send order. */
 
-    work_item *w = calloc(1, sizeof(work_item));
-    if (w != NULL) {
-        w->func  = func;
-        w->data0 = data0;
-        w->data1 = data1;
-        w->next  = NULL;
+    if (work_atomic_load(&m->work_overflow) == 0) {
+        queued = work_ring_push(m, &w);
+    }
+
+    if (!queued) {
+        work_item *o = calloc(1, sizeof(work_item));
+        if (o == NULL) {
+            return false;
+        }
+
+        *o = w;
 
         cb_mutex_enter(&m->work_lock);
 
         if (m->work_tail != NULL)
-            m->work_tail->next = w;
-        m->work_tail = w;
+            m->work_tail->next = o;
+        m->work_tail = o;
         if (m->work_head == NULL)
-            m->work_head = w;
+            m->work_head = o;
+
+        work_atomic_add(&m->work_overflow, 1);
 
-        if (send(m->send_fd, "", 1, 0) == 1) {
-            m->num_items++;
-            m->tot_sends++;
+        cb_mutex_exit(&m->work_lock);
+    }
+
+    work_atomic_add(&m->num_items, 1);
+    work_atomic_add(&m->tot_sends, 1);
 
 #ifdef WORK_DEBUG
-            moxi_log_write("work_send %x %x %x %d %d %d %llu %llu\n",
-                    (int) cb_thread_self(),
-                    (int) m,
-                    (int) m->event_base,
-                    m->send_fd, m->recv_fd,
-                    m->work_head != NULL,
-                    m->num_items,
-                    m->tot_sends);
+    moxi_log_write("work_send %x %x %x %d %d %d %llu\n",
+            (int) cb_thread_self(),
+            (int) m,
+            (int) m->event_base,
+            m->send_fd, m->recv_fd,
+            queued,
+            m->tot_sends);
 #endif
 
-            rv = true;
-        }
-
-        cb_mutex_exit(&m->work_lock);
-    }
+    work_wakeup(m);
 
-    return rv;
+    return true;
 }
 
 /** Called by libevent, on the receiving thread, when
  *  there is work for the receiving thread to handle.
  */
 void work_recv(evutil_socket_t fd, short which, void *arg) {
-    cb_assert(which & EV_READ);
-
     work_queue *m = arg;
+    work_item *curr = NULL;
+    work_item *next = NULL;
+    work_item w;
+    uint64_t num_items = 0;
+    char buf[64];
+
+    cb_assert(which & EV_READ);
     cb_assert(m != NULL);
     cb_assert(m->recv_fd == fd);
     cb_assert(m->send_fd >= 0);
     cb_assert(m->event_base != NULL);
 
-    work_item *curr = NULL;
-    work_item *next = NULL;
+    /* Drain the wakeups, then re-allow them before looking at the */
+    /* queue, so that a send that we miss below signals us again. */
 
-    char buf[1];
+#ifdef HAVE_EVENTFD
+    if (m->send_fd == m->recv_fd) {
+        if (read(fd, buf, sizeof(uint64_t)) < 0 && errno != EAGAIN) {
+#ifdef WORK_DEBUG
+            moxi_log_write("unexpected work_recv read error\n");
+#endif
+        }
+    } else
+#endif
+    {
+        while (recv(fd, buf, sizeof(buf), 0) > 0) {
+        }
+    }
 
-    /* The lock area includes the read() for safety, */
-    /* as the pipe acts like a cond variable. */
+    work_atomic_exchange(&m->notified, 0);
 
-    cb_mutex_enter(&m->work_lock);
+    while (work_ring_pop(m, &w)) {
+        num_items++;
+        w.func(w.data0, w.data1);
+    }
 
-    int readrv = recv(fd, buf, 1, 0);
-    cb_assert(readrv == 1);
-    if (readrv != 1) {
-#ifdef WORK_DEBUG
-        /* Perhaps libevent called us in incorrect way. */
+    if (work_atomic_load(&m->work_overflow) > 0) {
+        cb_mutex_enter(&m->work_lock);
 
-        moxi_log_write("unexpected work_recv read value\n");
-#endif
-    }
+        curr = m->work_head;
+        m->work_head = NULL;
+        m->work_tail = NULL;
 
-    curr = m->work_head;
-    m->work_head = NULL;
-    m->work_tail = NULL;
+        cb_mutex_exit(&m->work_lock);
+
+        /* The ring was drained first, as that's older work. */
+
+        while (curr != NULL) {
+            next = curr->next;
+            num_items++;
+            work_atomic_add(&m->work_overflow, -1);
+            curr->func(curr->data0, curr->data1);
+            free(curr);
+            curr = next;
+        }
+    }
 
 #ifdef WORK_DEBUG
-    moxi_log_write("work_recv %x %x %x %d %d %d %llu %llu %d\n",
+    moxi_log_write("work_recv %x %x %x %d %d %llu %llu %d\n",
             (int) pthread_self(),
             (int) m,
             (int) m->event_base,
             m->send_fd, m->recv_fd,
-            curr != NULL,
-            m->num_items,
+            num_items,
             m->tot_sends,
             fd);
 #endif
 
-    cb_mutex_exit(&m->work_lock);
-
-    uint64_t num_items = 0;
-
-    while (curr != NULL) {
-        next = curr->next;
-        num_items++;
-        curr->func(curr->data0, curr->data1);
-        free(curr);
-        curr = next;
-    }
-
     if (num_items > 0) {
-        cb_mutex_enter(&m->work_lock);
-
-        m->tot_recvs += num_items;
-        m->num_items -= num_items;
-
-        cb_mutex_exit(&m->work_lock);
+        work_atomic_add(&m->tot_recvs, num_items);
+        work_atomic_add(&m->num_items, -(int64_t) num_items);
     }
 }
 
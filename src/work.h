@@ -11,7 +11,12 @@
 #include <event.h>
 #include <platform/platform.h>
 
+/* Number of preallocated work_cell's per work_queue, a power of 2. */
+
+#define WORK_QUEUE_CELLS 1024
+
 typedef struct work_item   work_item;
+typedef struct work_cell   work_cell;
 typedef struct work_queue  work_queue;
 typedef struct work_collect work_collect;
 
@@ -22,16 +27,33 @@ struct work_item {
     work_item  *next;
 };
 
+struct work_cell {
+    uint64_t  seq; /* Which lap of the ring the cell is ready for. */
+    work_item item;
+};
+
 struct work_queue {
-    SOCKET send_fd; /* Pipe to notify thread. */
-    SOCKET recv_fd;
+    SOCKET send_fd; /* Wakes up the receiving thread.  When they're */
+    SOCKET recv_fd; /* the same, it's an eventfd. */
+
+    /* A bounded, lock-free, multi-producer/single-consumer ring. */
+
+    work_cell *cells;       /* Array, size is WORK_QUEUE_CELLS. */
+    uint64_t   enqueue_pos; /* Claimed by the senders. */
+    uint64_t   dequeue_pos; /* Only used by the receiving thread. */
+    uint64_t   notified;    /* 1 when a wakeup is already pending. */
+
+    /* Work that didn't fit in the ring, in send order.  While there */
+    /* is any, the senders keep appending here, under the work_lock. */
 
     work_item *work_head;
     work_item *work_tail;
+    uint64_t   work_overflow; /* Number of items in the overflow list. */
 
     uint64_t num_items; /* Current number of items in queue. */
     uint64_t tot_sends;
     uint64_t tot_recvs;
+    uint64_t tot_wakeups;
 
     struct event_base *event_base;
     struct event       event;
@@ -61,4 +83,15 @@ int work_collect_wait(work_collect *c);
 int work_collect_count(work_collect *c, int count);
 int work_collect_one(work_collect *c);
 
+/* Atomics on 64-bit values, with acquire loads and release stores. */
+/* The add is relaxed and returns the value before the add.  The cas */
+/* may fail spuriously, and on failure updates *expected to the */
+/* current value, so it's meant for a retry loop. */
+
+uint64_t work_atomic_load(uint64_t *p);
+void     work_atomic_store(uint64_t *p, uint64_t v);
+uint64_t work_atomic_add(uint64_t *p, int64_t v);
+uint64_t work_atomic_exchange(uint64_t *p, uint64_t v);
+bool     work_atomic_cas(uint64_t *p, uint64_t *expected, uint64_t v);
+
 #endif /* WORK_H */
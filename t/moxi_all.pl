@@ -44,6 +44,59 @@ if ($res != 0) {
   exit($res);
 }
 
+print "------------------------------------ stream\n";
+
+my $cmd = "./t/moxi_mock.pl moxi_mock_stream ascii \"\" \"\"" .
+                 " stream_min_bytes=1024,";
+print($cmd . "\n");
+my $res = system($cmd);
+if ($res != 0) {
+  print "exit: $res\n";
+  exit($res);
+}
+
+sleep(1);
+
+print "------------------------------------ stream splice\n";
+
+my $cmd = "./t/moxi_mock.pl moxi_mock_stream ascii \"\" \"\"" .
+                 " stream_min_bytes=1024,stream_splice=1,";
+print($cmd . "\n");
+my $res = system($cmd);
+if ($res != 0) {
+  print "exit: $res\n";
+  exit($res);
+}
+
+sleep(1);
+
+print "------------------------------------ pipeline\n";
+
+my $cmd = "./t/moxi_mock.pl moxi_mock_pipeline ascii \"\" \"\"" .
+                 " pipeline_max=4,downstream_timeout=4000,";
+print($cmd . "\n");
+my $res = system($cmd);
+if ($res != 0) {
+  print "exit: $res\n";
+  exit($res);
+}
+
+sleep(1);
+
+print "------------------------------------ mux\n";
+
+my $cmd = "./t/moxi_mock.pl moxi_mock_mux binary \"\" \"\"" .
+                 " downstream_max=4,downstream_conn_max=1," .
+                   "downstream_conn_multiplex=2,downstream_timeout=3000";
+print($cmd . "\n");
+my $res = system($cmd);
+if ($res != 0) {
+  print "exit: $res\n";
+  exit($res);
+}
+
+sleep(1);
+
 print "------------------------------------ auth\n";
 
 my $cmd = "./t/moxi_mock.pl moxi_mock_auth binary \"\"" .
@@ -53,12 +53,19 @@ if ($restargs ne '...NONE...') {
 
 # Fork moxi for moxi-specific testing.
 #
+# The moxi-Z-param comes last, so a test can override the defaults.
+#
+my $Z = "downstream_max=1,downstream_conn_max=0," .
+        "downstream_protocol=" . $downstream_protocol;
+if ($big_Z ne '') {
+  $Z .= "," . $big_Z;
+  $Z =~ s/,+$//;
+}
+
 my $childargs =
       " -z " . $little_z .
       " -p 0 -U 0 -v -t 1" .
-      " -Z \"" . $big_Z .
-            "downstream_max=1,downstream_conn_max=0," .
-            "downstream_protocol=" . $downstream_protocol . "\"";
+      " -Z \"" . $Z . "\"";
 if ($< == 0) {
    $childargs .= " -u root";
 }
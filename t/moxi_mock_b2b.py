@@ -36,6 +36,13 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
     def __init__(self, x):
         moxi_mock_server.ProxyClientBase.__init__(self, x)
 
+    def quietReqs(self):
+        """The someVal0 and someVal1 multiget as moxi forwards it, with
+           each quiet command's opaque being its index + 1"""
+        return (self.packReq(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=1) +
+                self.packReq(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=2) +
+                self.packReq(memcacheConstants.CMD_NOOP))
+
     def SOON_testBasicVersion(self):
         """Test version command does not reach mock server"""
         self.client_connect()
@@ -193,7 +200,7 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
              self.packReq(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13) +
              self.packReq(memcacheConstants.CMD_NOOP))
         self.client_send(r)
-        self.mock_recv(r)
+        self.mock_recv(self.quietReqs())
         self.mock_send(self.packRes(memcacheConstants.CMD_NOOP))
         self.client_recv(self.packRes(memcacheConstants.CMD_NOOP))
 
@@ -203,8 +210,8 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
              self.packReq(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13) +
              self.packReq(memcacheConstants.CMD_NOOP))
         self.client_send(r)
-        self.mock_recv(r)
-        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=4,
+        self.mock_recv(self.quietReqs())
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=1,
                                     extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 567),
                                     val='0123456789'))
         self.mock_send(self.packRes(memcacheConstants.CMD_NOOP))
@@ -219,11 +226,11 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
              self.packReq(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13) +
              self.packReq(memcacheConstants.CMD_NOOP))
         self.client_send(r)
-        self.mock_recv(r)
-        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=4,
+        self.mock_recv(self.quietReqs())
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=1,
                                     extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
                                     val='0123456789'))
-        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13,
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=2,
                                     extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
                                     val='0123456789'))
         self.mock_send(self.packRes(memcacheConstants.CMD_NOOP))
@@ -242,11 +249,11 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
              self.packReq(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13) +
              self.packReq(memcacheConstants.CMD_NOOP))
         self.client_send(r)
-        self.mock_recv(r)
-        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=13,
+        self.mock_recv(self.quietReqs())
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal1', opaque=2,
                                     extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
                                     val='0123456789'))
-        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=4,
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='someVal0', opaque=1,
                                     extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
                                     val='0123456789'))
         self.mock_send(self.packRes(memcacheConstants.CMD_NOOP))
@@ -259,6 +266,29 @@ class TestProxyBinary(moxi_mock_server.ProxyClientBase):
                                     val='0123456789') +
             self.packRes(memcacheConstants.CMD_NOOP))
 
+    def testMultiGetDuplicateKey(self):
+        """Test quiet gets of one key are sent once, and all answered"""
+        self.client_connect()
+        self.client_send(self.packReq(memcacheConstants.CMD_GETKQ, key='dupVal', opaque=4) +
+                         self.packReq(memcacheConstants.CMD_GETQ, key='dupVal', opaque=5) +
+                         self.packReq(memcacheConstants.CMD_GETKQ, key='otherVal', opaque=6) +
+                         self.packReq(memcacheConstants.CMD_NOOP, opaque=7))
+        self.mock_recv(self.packReq(memcacheConstants.CMD_GETKQ, key='dupVal', opaque=1) +
+                       self.packReq(memcacheConstants.CMD_GETKQ, key='otherVal', opaque=3) +
+                       self.packReq(memcacheConstants.CMD_NOOP, opaque=7))
+        self.mock_send(self.packRes(memcacheConstants.CMD_GETKQ, key='dupVal', opaque=1,
+                                    extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
+                                    val='0123456789'))
+        self.mock_send(self.packRes(memcacheConstants.CMD_NOOP, opaque=7))
+        self.client_recv(
+            self.packRes(memcacheConstants.CMD_GETKQ, key='dupVal', opaque=4,
+                                    extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
+                                    val='0123456789') +
+            self.packRes(memcacheConstants.CMD_GETQ, opaque=5,
+                                    extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0),
+                                    val='0123456789') +
+            self.packRes(memcacheConstants.CMD_NOOP, opaque=7))
+
     def testGetEmptyValue(self):
         """Test the proxy handles empty VALUE response"""
         self.client_connect()
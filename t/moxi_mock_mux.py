@@ -0,0 +1,142 @@
+import sys
+import string
+import socket
+import select
+import unittest
+import threading
+import time
+import re
+import struct
+
+from memcacheConstants import REQ_MAGIC_BYTE, RES_MAGIC_BYTE
+from memcacheConstants import REQ_PKT_FMT, RES_PKT_FMT, MIN_RECV_PACKET
+
+import memcacheConstants
+
+import moxi_mock_server
+
+# Tests of binary downstream conns that are shared by several
+# upstream requests, per the downstream_conn_multiplex behavior.
+#
+# Before you run moxi_mock_mux.py, start a moxi like...
+#
+#   ./moxi -z 11333=localhost:11311 -p 0 -U 0 -vvv -t 1 -O stderr
+#          -Z downstream_protocol=binary,downstream_max=4,
+#             downstream_conn_max=1,downstream_conn_multiplex=2,
+#             downstream_timeout=3000
+#
+# Then...
+#
+#   python ./t/moxi_mock_mux.py
+#
+# ----------------------------------
+
+class TestProxyMux(moxi_mock_server.ProxyClientBase):
+    def __init__(self, x):
+        moxi_mock_server.ProxyClientBase.__init__(self, x)
+
+    def setUp(self):
+        # Give moxi time to see that the previous test's mock
+        # sessions were closed.
+        #
+        self.wait(20)
+
+    def mock_recv_req(self, cmd, key, session_idx=0):
+        """Receives a request, returning the opaque that moxi used"""
+        message = self.mock_recv_message(session_idx)
+        self.assertTrue(len(message) >= MIN_RECV_PACKET)
+        magic, c, keylen, extlen, dtype, vbucket, bodylen, opaque, cas = \
+            struct.unpack(REQ_PKT_FMT, message[:MIN_RECV_PACKET])
+        self.assertEqual(REQ_MAGIC_BYTE, magic)
+        self.assertEqual(cmd, c)
+        self.assertEqual(key, message[MIN_RECV_PACKET + extlen:
+                                      MIN_RECV_PACKET + extlen + keylen])
+        return opaque
+
+    def client_recv_status(self, idx=0):
+        """Receives a response header, returning its status"""
+        s = self.clients[idx].recv(1024)
+        self.assertTrue(len(s) >= MIN_RECV_PACKET)
+        magic, c, keylen, extlen, dtype, status, bodylen, opaque, cas = \
+            struct.unpack(RES_PKT_FMT, s[:MIN_RECV_PACKET])
+        self.assertEqual(RES_MAGIC_BYTE, magic)
+        return status
+
+    def getkRes(self, key, val, opaque):
+        return self.packRes(memcacheConstants.CMD_GETK, key=key, val=val,
+                            opaque=opaque,
+                            extraHeader=struct.pack(memcacheConstants.GET_RES_FMT, 0))
+
+    def testMuxShare(self):
+        """Test two upstreams share a downstream conn, replies out of order"""
+        self.client_connect(0)
+        self.client_connect(1)
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='a',
+                                      opaque=11), 0)
+        oa = self.mock_recv_req(memcacheConstants.CMD_GETK, 'a')
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='b',
+                                      opaque=22), 1)
+        ob = self.mock_recv_req(memcacheConstants.CMD_GETK, 'b')
+
+        self.assertNotEqual(oa, ob)
+        self.assertEqual(1, len(self.mock_server().sessions))
+
+        self.mock_send(self.getkRes('b', 'B', ob))
+        self.client_recv(self.getkRes('b', 'B', 22), 1)
+
+        self.mock_send(self.getkRes('a', 'A', oa))
+        self.client_recv(self.getkRes('a', 'A', 11), 0)
+
+    def testMuxOrphanReply(self):
+        """Test a reply for a closed upstream is dropped"""
+        self.client_connect(0)
+        self.client_connect(1)
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='a',
+                                      opaque=11), 0)
+        oa = self.mock_recv_req(memcacheConstants.CMD_GETK, 'a')
+        self.client_close(0)
+        self.wait(10)
+
+        self.mock_send(self.getkRes('a', 'A', oa))
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='b',
+                                      opaque=22), 1)
+        ob = self.mock_recv_req(memcacheConstants.CMD_GETK, 'b')
+        self.assertEqual(1, len(self.mock_server().sessions))
+
+        self.mock_send(self.getkRes('b', 'B', ob))
+        self.client_recv(self.getkRes('b', 'B', 22), 1)
+
+    def testMuxTimeoutCloses(self):
+        """Test a downstream timeout closes the shared conn"""
+        self.client_connect()
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='slow',
+                                      opaque=33))
+        self.mock_recv_req(memcacheConstants.CMD_GETK, 'slow')
+
+        # The mock server never answers, so the request times out.
+        #
+        self.assertEqual(memcacheConstants.ERR_EBUSY, self.client_recv_status())
+
+        # The shared conn was closed, since its server might be
+        # hung, and the next request gets a new conn.
+        #
+        session = self.mock_session(0)
+        i = 0
+        while session.client is not None and i < 30:
+            self.wait(10)
+            i = i + 1
+        self.assertTrue(session.client is None)
+
+        self.client_send(self.packReq(memcacheConstants.CMD_GETK, key='next',
+                                      opaque=44))
+        o = self.mock_recv_req(memcacheConstants.CMD_GETK, 'next', 1)
+        self.mock_send(self.getkRes('next', 'N', o), 1)
+        self.client_recv(self.getkRes('next', 'N', 44))
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,84 @@
+import sys
+import string
+import socket
+import select
+import unittest
+import threading
+import time
+import re
+
+import moxi_mock_server
+
+# Tests of pipelined ascii gets, which moxi forwards together, as
+# one multiget, per the pipeline_max behavior.
+#
+# Before you run moxi_mock_pipeline.py, start a moxi like...
+#
+#   ./moxi -z 11333=localhost:11311 -p 0 -U 0 -vvv -t 1
+#          -Z pipeline_max=4,downstream_timeout=4000,
+#             downstream_max=1,downstream_conn_max=0,downstream_protocol=ascii
+#
+# Then...
+#
+#   python ./t/moxi_mock_pipeline.py
+#
+# ----------------------------------
+
+class TestProxyPipeline(moxi_mock_server.ProxyClientBase):
+    def __init__(self, x):
+        moxi_mock_server.ProxyClientBase.__init__(self, x)
+
+    def testPipelineInOrder(self):
+        """Test replies are in command order, when a later get's key answers first"""
+        self.client_connect()
+        self.client_send('get a\r\nget b\r\n')
+        self.mock_recv('get a b\r\n')
+        self.mock_send('VALUE b 0 1\r\nB\r\n')
+        self.mock_send('VALUE a 0 1\r\nA\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('VALUE a 0 1\r\nA\r\nEND\r\n' +
+                         'VALUE b 0 1\r\nB\r\nEND\r\n')
+
+        # The conn goes back to reading commands one at a time.
+        #
+        self.client_send('get c\r\n')
+        self.mock_recv('get c\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('END\r\n')
+
+    def testPipelineMiss(self):
+        """Test a pipelined get of a missing key still gets its END"""
+        self.client_connect()
+        self.client_send('get a\r\nget b\r\nget c\r\n')
+        self.mock_recv('get a b c\r\n')
+        self.mock_send('VALUE c 0 1\r\nC\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('END\r\n' +
+                         'END\r\n' +
+                         'VALUE c 0 1\r\nC\r\nEND\r\n')
+
+    def testPipelineRepeatedKey(self):
+        """Test a key asked for by several pipelined gets is sent once"""
+        self.client_connect()
+        self.client_send('get a b\r\nget b\r\nget a\r\n')
+        self.mock_recv('get a b\r\n')
+        self.mock_send('VALUE b 0 1\r\nB\r\n')
+        self.mock_send('VALUE a 0 1\r\nA\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('VALUE b 0 1\r\nB\r\nVALUE a 0 1\r\nA\r\nEND\r\n' +
+                         'VALUE b 0 1\r\nB\r\nEND\r\n' +
+                         'VALUE a 0 1\r\nA\r\nEND\r\n')
+
+    def testPipelineError(self):
+        """Test a downstream timeout repeats the error for every pipelined get"""
+        self.client_connect()
+        self.client_send('get a\r\nget b\r\n')
+        self.mock_recv('get a b\r\n')
+
+        # The mock server never answers, so the gets time out, and
+        # moxi repeats the error once per pipelined get.
+        #
+        self.client_recv('END\r\nEND\r\n')
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,111 @@
+import sys
+import string
+import socket
+import select
+import unittest
+import threading
+import time
+import re
+
+import moxi_mock_server
+
+# Tests of streamed (cut-through) ascii get values.
+#
+# Before you run moxi_mock_stream.py, start a moxi like...
+#
+#   ./moxi -z 11333=localhost:11311 -p 0 -U 0 -vvv -t 1
+#          -Z stream_min_bytes=1024,
+#             downstream_max=1,downstream_conn_max=0,downstream_protocol=ascii
+#
+# Then...
+#
+#   python ./t/moxi_mock_stream.py
+#
+# The same tests also cover the splice() relay, with a moxi that
+# additionally has stream_splice=1.
+#
+# ----------------------------------
+
+# Larger than the 64KB chunks that moxi relays a value in.
+#
+BIG_VALUE_LEN = 200000
+
+class TestProxyStream(moxi_mock_server.ProxyClientBase):
+    def __init__(self, x):
+        moxi_mock_server.ProxyClientBase.__init__(self, x)
+
+    def client_recv_all(self, what, idx=0):
+        """Receives exactly len(what) bytes and compares them"""
+        s = ''
+        while len(s) < len(what):
+            x = self.clients[idx].recv(len(what) - len(s))
+            if not x:
+                break
+            s = s + x
+        self.assertEqual(len(what), len(s))
+        self.assertTrue(what == s)
+
+    def testStreamSmallValue(self):
+        """Test a value under stream_min_bytes is not streamed"""
+        self.client_connect()
+        self.client_send('get small\r\n')
+        self.mock_recv('get small\r\n')
+        self.mock_send('VALUE small 0 5\r\nhello\r\nEND\r\n')
+        self.client_recv('VALUE small 0 5\r\nhello\r\nEND\r\n')
+
+    def testStreamBigValue(self):
+        """Test a value of several chunks, then a next command"""
+        v = ''.join([chr(ord('a') + (i % 26)) for i in range(BIG_VALUE_LEN)])
+        self.client_connect()
+        self.client_send('get big\r\n')
+        self.mock_recv('get big\r\n')
+        self.mock_send('VALUE big 1 %d\r\n' % (BIG_VALUE_LEN))
+        self.mock_send(v)
+        self.mock_send('\r\nEND\r\n')
+        self.client_recv_all('VALUE big 1 %d\r\n' % (BIG_VALUE_LEN) +
+                             v + '\r\nEND\r\n')
+
+        # The upstream conn must read commands again after a
+        # streamed value.
+        #
+        self.client_send('get after\r\n')
+        self.mock_recv('get after\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('END\r\n')
+
+    def testStreamBigValueTwice(self):
+        """Test two streamed values in a row on one conn"""
+        v = 'x' * BIG_VALUE_LEN
+        self.client_connect()
+        for i in range(2):
+            self.client_send('get big%d\r\n' % (i))
+            self.mock_recv('get big%d\r\n' % (i))
+            self.mock_send('VALUE big%d 0 %d\r\n%s\r\nEND\r\n' %
+                           (i, BIG_VALUE_LEN, v))
+            self.client_recv_all('VALUE big%d 0 %d\r\n%s\r\nEND\r\n' %
+                                 (i, BIG_VALUE_LEN, v))
+
+    def testStreamUpstreamClose(self):
+        """Test the upstream closing mid-value, then another get"""
+        v = 'y' * BIG_VALUE_LEN
+        self.client_connect(0)
+        self.client_send('get big\r\n', 0)
+        self.mock_recv('get big\r\n')
+        self.mock_send('VALUE big 0 %d\r\n%s' % (BIG_VALUE_LEN, v[:100000]))
+        self.client_close(0)
+        self.wait(10)
+
+        # The rest of the value gets dropped, and the downstream
+        # goes on to serve the next get.
+        #
+        self.mock_send('%s\r\nEND\r\n' % (v[100000:]))
+        self.wait(10)
+
+        self.client_connect(1)
+        self.client_send('get after\r\n', 1)
+        self.mock_recv('get after\r\n')
+        self.mock_send('END\r\n')
+        self.client_recv('END\r\n', 1)
+
+if __name__ == '__main__':
+    unittest.main()
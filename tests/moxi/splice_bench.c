@@ -0,0 +1,255 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* splice() is a GNU extension, as is RUSAGE_THREAD. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include "src/config.h"
+#include <platform/cbassert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/* Compares the relaying thread's CPU time per value byte of the */
+/* stream_splice behavior, which splice()'s a value from the */
+/* downstream socket through a pipe to the upstream socket, against */
+/* copying it through a STREAM_CHUNK_SIZE buffer, like the chunked */
+/* streaming path.  Values go over loopback TCP, from a writer thread */
+/* to a reader thread that checks every byte.  The relay uses */
+/* blocking sockets, instead of moxi's event loop, so that only the */
+/* cost of moving the bytes is measured. */
+/* */
+/* It's only built where splice() is available. */
+/* */
+/* Usage: moxi_splice_bench [megabytes_per_value_size] */
+
+#define STREAM_CHUNK_SIZE 65536
+
+typedef struct {
+    SOCKET   fd;
+    size_t   value_size;
+    uint64_t values;
+    uint64_t checked;
+} bench_end;
+
+static unsigned char pattern(uint64_t i) {
+    return (unsigned char) ((i * 31 + 7) & 0xff);
+}
+
+static void writer(void *arg) {
+    bench_end *e = arg;
+    unsigned char *buf;
+    uint64_t pos = 0;
+    uint64_t i;
+    size_t j;
+
+    buf = malloc(e->value_size);
+    cb_assert(buf != NULL);
+
+    for (i = 0; i < e->values; i++) {
+        size_t off = 0;
+
+        for (j = 0; j < e->value_size; j++) {
+            buf[j] = pattern(pos + j);
+        }
+        pos += e->value_size;
+
+        while (off < e->value_size) {
+            ssize_t n = send(e->fd, buf + off, e->value_size - off, 0);
+            cb_assert(n > 0 || errno == EINTR);
+            if (n > 0) {
+                off += n;
+            }
+        }
+    }
+
+    free(buf);
+    shutdown(e->fd, SHUT_WR);
+}
+
+static void reader(void *arg) {
+    bench_end *e = arg;
+    unsigned char buf[STREAM_CHUNK_SIZE];
+    ssize_t n;
+    ssize_t j;
+
+    while ((n = recv(e->fd, buf, sizeof(buf), 0)) != 0) {
+        cb_assert(n > 0 || errno == EINTR);
+        for (j = 0; j < n; j++) {
+            cb_assert(buf[j] == pattern(e->checked + j));
+        }
+        e->checked += n;
+    }
+}
+
+/* Returns a connected pair of loopback TCP sockets. */
+
+static void tcp_pair(SOCKET fds[2]) {
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    SOCKET l;
+
+    l = socket(AF_INET, SOCK_STREAM, 0);
+    cb_assert(l != INVALID_SOCKET);
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    cb_assert(bind(l, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+    cb_assert(listen(l, 1) == 0);
+    cb_assert(getsockname(l, (struct sockaddr *) &sin, &len) == 0);
+
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    cb_assert(fds[0] != INVALID_SOCKET);
+    cb_assert(connect(fds[0], (struct sockaddr *) &sin, sizeof(sin)) == 0);
+
+    fds[1] = accept(l, NULL, NULL);
+    cb_assert(fds[1] != INVALID_SOCKET);
+
+    closesocket(l);
+}
+
+static uint64_t thread_cpu_nsecs(void) {
+    struct rusage ru;
+    int rv;
+
+    rv = getrusage(RUSAGE_THREAD, &ru);
+    cb_assert(rv == 0);
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static void relay_copy(SOCKET in, SOCKET out, size_t left) {
+    static char buf[STREAM_CHUNK_SIZE];
+
+    while (left > 0) {
+        ssize_t n = recv(in, buf, left < sizeof(buf) ? left : sizeof(buf), 0);
+        ssize_t m = 0;
+
+        cb_assert(n > 0);
+
+        while (m < n) {
+            ssize_t k = send(out, buf + m, n - m, 0);
+            cb_assert(k > 0);
+            m += k;
+        }
+
+        left -= n;
+    }
+}
+
+static void relay_splice(SOCKET in, SOCKET out, int *fds, size_t left) {
+    while (left > 0) {
+        ssize_t n = splice(in, NULL, fds[1], NULL,
+                           left < STREAM_CHUNK_SIZE ?
+                           left : STREAM_CHUNK_SIZE,
+                           SPLICE_F_MOVE);
+        ssize_t m = 0;
+
+        cb_assert(n > 0);
+
+        while (m < n) {
+            ssize_t k = splice(fds[0], NULL, out, NULL, n - m,
+                               SPLICE_F_MOVE);
+            cb_assert(k > 0);
+            m += k;
+        }
+
+        left -= n;
+    }
+}
+
+static void run(const char *name, bool use_splice,
+                size_t value_size, uint64_t values) {
+    bench_end w;
+    bench_end r;
+    cb_thread_t wtid;
+    cb_thread_t rtid;
+    SOCKET src[2];
+    SOCKET dst[2];
+    int fds[2] = { -1, -1 };
+    uint64_t cpu;
+    hrtime_t start;
+    double secs;
+    uint64_t i;
+
+    tcp_pair(src);
+    tcp_pair(dst);
+
+    if (use_splice) {
+        cb_assert(pipe(fds) == 0);
+    }
+
+    memset(&w, 0, sizeof(w));
+    w.fd = src[0];
+    w.value_size = value_size;
+    w.values = values;
+
+    memset(&r, 0, sizeof(r));
+    r.fd = dst[1];
+
+    cb_assert(cb_create_thread(&wtid, writer, &w, 0) == 0);
+    cb_assert(cb_create_thread(&rtid, reader, &r, 0) == 0);
+
+    start = gethrtime();
+    cpu = thread_cpu_nsecs();
+
+    for (i = 0; i < values; i++) {
+        if (use_splice) {
+            relay_splice(src[1], dst[0], fds, value_size);
+        } else {
+            relay_copy(src[1], dst[0], value_size);
+        }
+    }
+
+    cpu = thread_cpu_nsecs() - cpu;
+    secs = (gethrtime() - start) / 1000000000.0;
+
+    shutdown(dst[0], SHUT_WR);
+
+    cb_join_thread(wtid);
+    cb_join_thread(rtid);
+
+    cb_assert(r.checked == value_size * values);
+
+    printf("%-6s value bytes %7lu, values %7"PRIu64", secs %.3f"
+           ", relay cpu ns/byte %.3f\n",
+           name, (unsigned long) value_size, values, secs,
+           (double) cpu / (value_size * values));
+
+    if (use_splice) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    closesocket(src[0]);
+    closesocket(src[1]);
+    closesocket(dst[0]);
+    closesocket(dst[1]);
+}
+
+int main(int argc, char **argv) {
+    size_t sizes[] = { 1024, 16 * 1024, 256 * 1024 };
+    uint64_t megabytes = 64;
+    size_t i;
+
+    if (argc > 1) {
+        megabytes = strtoull(argv[1], NULL, 10);
+    }
+
+    cb_assert(megabytes > 0);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint64_t values = (megabytes << 20) / sizes[i];
+
+        run("copy", false, sizes[i], values);
+        run("splice", true, sizes[i], values);
+    }
+
+    return 0;
+}
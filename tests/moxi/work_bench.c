@@ -0,0 +1,241 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+#include "src/config.h"
+#include <platform/cbassert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <event.h>
+
+#include <src/work.h>
+#include <src/log.h>
+
+/* Compares the messages/sec and wakeups/sec of the work_queue against */
+/* the mutex protected list with a byte per message on a socketpair, */
+/* which is how new connections used to be handed to worker threads. */
+/* */
+/* Usage: moxi_work_bench [producers [messages_per_producer]] */
+
+moxi_log *ml;
+volatile uint64_t msec_current_time;
+
+static struct moxi_log bench_log;
+
+/* ---------------------------------------------------------- */
+
+typedef struct pipe_item pipe_item;
+
+struct pipe_item {
+    pipe_item *next;
+};
+
+typedef struct {
+    pipe_item  *head;
+    pipe_item  *tail;
+    cb_mutex_t  lock;
+    SOCKET      recv_fd;
+    SOCKET      send_fd;
+    struct event event;
+} pipe_queue;
+
+static void pipe_queue_push(pipe_queue *q, pipe_item *item) {
+    item->next = NULL;
+
+    cb_mutex_enter(&q->lock);
+    if (q->tail == NULL) {
+        q->head = item;
+    } else {
+        q->tail->next = item;
+    }
+    q->tail = item;
+    cb_mutex_exit(&q->lock);
+
+    while (send(q->send_fd, "", 1, 0) != 1) {
+        cb_assert(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+}
+
+static pipe_item *pipe_queue_pop(pipe_queue *q) {
+    pipe_item *item;
+
+    cb_mutex_enter(&q->lock);
+    item = q->head;
+    if (item != NULL) {
+        q->head = item->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+    }
+    cb_mutex_exit(&q->lock);
+
+    return item;
+}
+
+/* ---------------------------------------------------------- */
+
+typedef struct {
+    struct event_base *base;
+    pipe_queue         pq;
+    work_queue         wq;
+    bool               use_work_queue;
+
+    int      producers;
+    uint64_t per_producer;
+    uint64_t received;
+    uint64_t wakeups;
+} bench;
+
+static void bench_done(bench *b) {
+    if (b->received == b->per_producer * b->producers) {
+        event_base_loopbreak(b->base);
+    }
+}
+
+static void pipe_queue_recv(evutil_socket_t fd, short which, void *arg) {
+    bench *b = arg;
+    pipe_item *item;
+    char buf[1];
+
+    (void)which;
+
+    b->wakeups++;
+
+    if (recv(fd, buf, 1, 0) != 1) {
+        return;
+    }
+
+    item = pipe_queue_pop(&b->pq);
+    if (item != NULL) {
+        free(item);
+        b->received++;
+        bench_done(b);
+    }
+}
+
+static void work_bench_func(void *data0, void *data1) {
+    bench *b = data0;
+
+    (void)data1;
+
+    b->received++;
+    bench_done(b);
+}
+
+static void producer(void *arg) {
+    bench *b = arg;
+    uint64_t i;
+    bool ok;
+
+    for (i = 0; i < b->per_producer; i++) {
+        if (b->use_work_queue) {
+            ok = work_send(&b->wq, work_bench_func, b, NULL);
+            cb_assert(ok);
+        } else {
+            pipe_item *item = malloc(sizeof(pipe_item));
+            cb_assert(item != NULL);
+            pipe_queue_push(&b->pq, item);
+        }
+    }
+}
+
+static void run(const char *name, bool use_work_queue,
+                int producers, uint64_t per_producer) {
+    bench b;
+    cb_thread_t *tids;
+    SOCKET fds[2];
+    hrtime_t start;
+    double secs;
+    int i;
+
+    memset(&b, 0, sizeof(b));
+
+    b.base = event_base_new();
+    cb_assert(b.base != NULL);
+
+    b.use_work_queue = use_work_queue;
+    b.producers = producers;
+    b.per_producer = per_producer;
+
+    if (use_work_queue) {
+        bool ok = work_queue_init(&b.wq, b.base);
+        cb_assert(ok);
+    } else {
+        cb_mutex_initialize(&b.pq.lock);
+        cb_assert(evutil_socketpair(SOCKETPAIR_AF, SOCK_STREAM, 0,
+                                    (void *) fds) != SOCKET_ERROR);
+        cb_assert(evutil_make_socket_nonblocking(fds[0]) != -1);
+        b.pq.recv_fd = fds[0];
+        b.pq.send_fd = fds[1];
+
+        event_set(&b.pq.event, b.pq.recv_fd,
+                  EV_READ | EV_PERSIST, pipe_queue_recv, &b);
+        event_base_set(b.base, &b.pq.event);
+        cb_assert(event_add(&b.pq.event, 0) == 0);
+    }
+
+    tids = calloc(producers, sizeof(cb_thread_t));
+    cb_assert(tids != NULL);
+
+    start = gethrtime();
+
+    for (i = 0; i < producers; i++) {
+        cb_assert(cb_create_thread(&tids[i], producer, &b, 0) == 0);
+    }
+
+    event_base_loop(b.base, 0);
+
+    secs = (gethrtime() - start) / 1000000000.0;
+
+    for (i = 0; i < producers; i++) {
+        cb_join_thread(tids[i]);
+    }
+
+    if (use_work_queue) {
+        b.wakeups = b.wq.tot_wakeups;
+        event_del(&b.wq.event);
+        closesocket(b.wq.recv_fd);
+        if (b.wq.send_fd != b.wq.recv_fd) {
+            closesocket(b.wq.send_fd);
+        }
+        free(b.wq.cells);
+    } else {
+        event_del(&b.pq.event);
+        closesocket(b.pq.recv_fd);
+        closesocket(b.pq.send_fd);
+    }
+
+    cb_assert(b.received == per_producer * producers);
+
+    printf("%-10s producers %d, messages %"PRIu64", wakeups %"PRIu64
+           ", secs %.3f, messages/sec %.0f, wakeups/sec %.0f\n",
+           name, producers, b.received, b.wakeups, secs,
+           b.received / secs, b.wakeups / secs);
+
+    free(tids);
+    event_base_free(b.base);
+}
+
+int main(int argc, char **argv) {
+    int producers = 4;
+    uint64_t per_producer = 100000;
+
+    bench_log.fd = 2;
+    bench_log.log_level = 5;
+    bench_log.log_mode = ERRORLOG_STDERR;
+    ml = &bench_log;
+
+    if (argc > 1) {
+        producers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        per_producer = strtoull(argv[2], NULL, 10);
+    }
+
+    cb_assert(producers > 0);
+
+    run("pipe", false, producers, per_producer);
+    run("work", true, producers, per_producer);
+
+    return 0;
+}